@@ -5,6 +5,7 @@
 #  - libelf          : required
 #  - pthreads        : required
 #  - libpcap/winpcap : optional
+#  - zlib            : optional
 # accumulators:
 #  - DYNAMIPS_FLAGS
 #  - DYNAMIPS_DEFINITIONS
@@ -217,6 +218,12 @@ if ( HAVE_PCAP AND CYGWIN )
 endif ()
 print_variables ( HAVE_PCAP )
 
+# zlib (optional)
+set_cmake_required ()
+find_package ( ZLIB )
+print_variables ( ZLIB_FOUND ZLIB_INCLUDE_DIRS ZLIB_LIBRARIES )
+set ( HAVE_ZLIB ${ZLIB_FOUND} )
+
 # headers
 # TODO minimize headers in the source
 set ( _missing )
@@ -41,6 +41,9 @@
 /* Maximum packet size */
 #define AM79C971_MAX_PKT_SIZE  2048
 
+/* Maximum number of host segments for a TX packet */
+#define AM79C971_TX_MAX_IOV    32
+
 /* Send up to 16 packets in a TX ring scan pass */
 #define AM79C971_TXRING_PASS_COUNT  16
 
@@ -173,6 +176,7 @@ struct am79c971_data {
 
    /* TX ring scanner task id */
    ptask_id_t tx_tid;
+   ptask_t *tx_task;
 };
 
 /* Log an am79c971 message */
@@ -406,6 +410,10 @@ static void am79c971_rdp_access(cpu_gen_t *cpu,struct am79c971_data *d,
                am79c971_update_rx_tx_on_bits(d);
             }
 
+            /* Transmit Demand: scan the TX ring now */
+            if (*data & AM79C971_CSR0_TDMD)
+               ptask_kick_task(d->tx_task,d->tx_tid);
+
             /* Update IRQ status */
             am79c971_update_irq_status(d);
          }
@@ -824,10 +832,12 @@ static inline m_uint32_t txdesc_get_current(struct am79c971_data *d)
 /* Handle the TX ring (single packet) */
 static int am79c971_handle_txring_single(struct am79c971_data *d)
 {
-   u_char pkt[AM79C971_MAX_PKT_SIZE],*pkt_ptr;
+   u_char pkt[AM79C971_MAX_PKT_SIZE];
+   struct iovec iov[AM79C971_TX_MAX_IOV];
    struct tx_desc txd0,ctxd,ntxd,*ptxd;
    m_uint32_t tx_start,tx_current;
    m_uint32_t clen,tot_len;
+   int iov_cnt = 0;
    
    if ((d->tx_start == 0) || !(d->csr[0] & AM79C971_CSR0_TXON))
       return(FALSE);
@@ -852,7 +862,6 @@ static int am79c971_handle_txring_single(struct am79c971_data *d)
 #endif
 
    /* Empty packet for now */
-   pkt_ptr = pkt;
    tot_len = 0;
 
    for(;;) {
@@ -865,9 +874,13 @@ static int am79c971_handle_txring_single(struct am79c971_data *d)
       clen = ~((ptxd->tmd[1] & AM79C971_TMD1_LEN) - 1);
       clen &= AM79C971_TMD1_LEN;
 
-      physmem_copy_from_vm(d->vm,pkt_ptr,ptxd->tmd[0],clen);
+      /* Truncate the packet if it is too big */
+      clen = m_min(clen,AM79C971_MAX_PKT_SIZE - tot_len);
 
-      pkt_ptr += clen;
+      /* Map the buffer directly, without copying the data */
+      iov_cnt = physmem_map_iov_bounce(d->vm,ptxd->tmd[0],clen,
+                                       iov,iov_cnt,AM79C971_TX_MAX_IOV,
+                                       pkt,tot_len);
       tot_len += clen;
 
       /* Clear the OWN bit if this is not the first descriptor */
@@ -898,14 +911,14 @@ static int am79c971_handle_txring_single(struct am79c971_data *d)
 
    if (tot_len != 0) {
 #if DEBUG_TRANSMIT
-      AM79C971_LOG(d,"sending packet of %u bytes\n",tot_len);
-      mem_dump(log_file,pkt,tot_len);
+      AM79C971_LOG(d,"sending packet of %u bytes (%d segments)\n",
+                   tot_len,iov_cnt);
 #endif
       /* rewrite ISL header if required */
-      cisco_isl_rewrite(pkt,tot_len);
+      iov_cnt = cisco_isl_rewrite_iov(pkt,iov,iov_cnt,tot_len);
 
       /* send it on wire */
-      netio_send(d->nio,pkt,tot_len);
+      netio_send_queuedv(d->nio,iov,iov_cnt);
    }
 
    /* Clear the OWN flag of the first descriptor */
@@ -925,10 +938,20 @@ static int am79c971_handle_txring(struct am79c971_data *d)
 
    AM79C971_LOCK(d);
 
+   /* Packet segments are mapped directly in VM memory */
+   physmem_dma_begin(d->vm);
+
    for(i=0;i<AM79C971_TXRING_PASS_COUNT;i++)
       if (!am79c971_handle_txring_single(d))
          break;
 
+   physmem_dma_end(d->vm);
+
+   /* Pass limit reached, there are probably more packets to send */
+   if (i == AM79C971_TXRING_PASS_COUNT)
+      ptask_kick_task(d->tx_task,d->tx_tid);
+
+   netio_send_flush(d->nio);
    netio_clear_bw_stat(d->nio);
    AM79C971_UNLOCK(d);
    return(TRUE);
@@ -1010,6 +1033,18 @@ static void pci_am79c971_write(cpu_gen_t *cpu,struct pci_device *dev,
    }
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t am79c971_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct am79c971_data,rx_tx_clear_count),
+   VM_CKPT_FIELD(struct am79c971_data,rap),
+   VM_CKPT_FIELD(struct am79c971_data,csr),
+   VM_CKPT_FIELD(struct am79c971_data,bcr),
+   VM_CKPT_RANGE(struct am79c971_data,rx_start,rx_pos),
+   VM_CKPT_FIELD(struct am79c971_data,mii_regs),
+   VM_CKPT_FIELD(struct am79c971_data,mac_addr),
+   VM_CKPT_FIELD_END,
+};
+
 /* 
  * dev_am79c971_init()
  *
@@ -1060,6 +1095,9 @@ dev_am79c971_init(vm_instance_t *vm,char *name,int interface_type,
    dev->phys_len  = 0x4000;
    dev->handler   = dev_am79c971_access;
    dev->priv_data = d;
+
+   /* State saved in VM checkpoints */
+   pci_dev->ckpt_fields = am79c971_ckpt_fields;
    return(d);
 
  err_dev:
@@ -1089,7 +1127,9 @@ int dev_am79c971_set_nio(struct am79c971_data *d,netio_desc_t *nio)
       return(-1);
 
    d->nio = nio;
-   d->tx_tid = ptask_add((ptask_callback)am79c971_handle_txring,d,NULL);
+   d->tx_tid = ptask_add_group(d->vm,0,(ptask_callback)am79c971_handle_txring,
+                               d,NULL);
+   d->tx_task = ptask_get(d->tx_tid);
    netio_rxl_add(nio,(netio_rx_handler_t)am79c971_handle_rxring,d,NULL);
    return(0);
 }
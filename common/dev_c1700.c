@@ -403,7 +403,6 @@ static void c1700_init_defaults(c1700_t *router)
 static void c1700_set_irq(vm_instance_t *vm,u_int irq)
 {
    c1700_t *router = VM_C1700(vm);
-   cpu_ppc_t *cpu = CPU_PPC32(vm->boot_cpu);
    u_int slot,port;
 
    switch(irq) {
@@ -430,9 +429,6 @@ static void c1700_set_irq(vm_instance_t *vm,u_int irq)
          mpc860_set_pending_irq(router->mpc_data,24);
          break;
    }
-
-   if (vm->irq_idle_preempt[irq])
-      cpu_idle_break_wait(cpu->gen);
 }
 
 /* Clear an IRQ */
@@ -499,10 +495,6 @@ static int c1700_init_platform(c1700_t *router)
    /* Set processor ID */
    ppc32_set_pvr(cpu,PPC32_PVR_MPC860);
    
-   /* Mark the Network IO interrupt as high priority */
-   vm->irq_idle_preempt[C1700_NETIO_IRQ] = TRUE;
-   vm->irq_idle_preempt[C1700_DUART_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU (idle PC, ...) */
    cpu->idle_pc = vm->idle_pc;
 
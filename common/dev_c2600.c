@@ -466,7 +466,6 @@ static void c2600_init_defaults(c2600_t *router)
 static void c2600_set_irq(vm_instance_t *vm,u_int irq)
 {
    c2600_t *router = VM_C2600(vm);
-   cpu_ppc_t *cpu = CPU_PPC32(vm->boot_cpu);
    u_int slot,port;
 
    switch(irq) {
@@ -493,9 +492,6 @@ static void c2600_set_irq(vm_instance_t *vm,u_int irq)
          mpc860_set_pending_irq(router->mpc_data,24);
          break;
    }
-
-   if (vm->irq_idle_preempt[irq])
-      cpu_idle_break_wait(cpu->gen);
 }
 
 /* Clear an IRQ */
@@ -562,10 +558,6 @@ static int c2600_init_platform(c2600_t *router)
    /* Set processor ID */
    ppc32_set_pvr(cpu,PPC32_PVR_MPC860);
    
-   /* Mark the Network IO interrupt as high priority */
-   vm->irq_idle_preempt[C2600_NETIO_IRQ] = TRUE;
-   vm->irq_idle_preempt[C2600_DUART_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU (idle PC, ...) */
    cpu->idle_pc = vm->idle_pc;
 
@@ -432,6 +432,17 @@ void c2691_init_eeprom_groups(c2691_t *router)
    router->nm_eeprom_group.eeprom[0] = NULL;
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t c2691_iofpga_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct c2691_iofpga_data,net_irq_status),
+   VM_CKPT_FIELD(struct c2691_iofpga_data,intr_mask),
+   VM_CKPT_FIELD(struct c2691_iofpga_data,wic_select),
+   VM_CKPT_FIELD(struct c2691_iofpga_data,wic_cmd_pos),
+   VM_CKPT_FIELD(struct c2691_iofpga_data,wic_cmd_valid),
+   VM_CKPT_FIELD(struct c2691_iofpga_data,wic_cmd),
+   VM_CKPT_FIELD_END,
+};
+
 /* Shutdown the IO FPGA device */
 static void 
 dev_c2691_iofpga_shutdown(vm_instance_t *vm,struct c2691_iofpga_data *d)
@@ -468,6 +479,7 @@ int dev_c2691_iofpga_init(c2691_t *router,m_uint64_t paddr,m_uint32_t len)
    d->vm_obj.name = "io_fpga";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_c2691_iofpga_shutdown;
+   d->vm_obj.ckpt_fields = c2691_iofpga_ckpt_fields;
 
    /* Set device properties */
    dev_init(&d->dev);
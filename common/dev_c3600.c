@@ -591,11 +591,6 @@ static int c3600_init_platform(c3600_t *router)
    vm->set_irq = mips64_vm_set_irq;
    vm->clear_irq = mips64_vm_clear_irq;
 
-   /* Mark the Network IO interrupt as high priority */
-   cpu->irq_idle_preempt[C3600_NETIO_IRQ] = TRUE;
-   cpu->irq_idle_preempt[C3600_GT64K_IRQ] = TRUE;
-   cpu->irq_idle_preempt[C3600_DUART_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU (idle PC, ...) */
    cpu->idle_pc = vm->idle_pc;
 
@@ -733,9 +728,6 @@ static void c3600_set_irq(vm_instance_t *vm,u_int irq)
    switch(irq) {
       case 0 ... 7:
          mips64_set_irq(cpu0,irq);
-
-         if (cpu0->irq_idle_preempt[irq])
-            cpu_idle_break_wait(cpu0->gen);
          break;
 
       case C3600_NETIO_IRQ_BASE ... C3600_NETIO_IRQ_END:
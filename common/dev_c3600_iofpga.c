@@ -754,6 +754,15 @@ void c3600_init_eeprom_groups(c3600_t *router)
    }
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t c3600_iofpga_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct c3600_iofpga_data,net_irq_status),
+   VM_CKPT_FIELD(struct c3600_iofpga_data,eeprom_slot),
+   VM_CKPT_FIELD(struct c3600_iofpga_data,io_mask),
+   VM_CKPT_FIELD(struct c3600_iofpga_data,sel),
+   VM_CKPT_FIELD_END,
+};
+
 /* Shutdown the IO FPGA device */
 static void 
 dev_c3600_iofpga_shutdown(vm_instance_t *vm,struct c3600_iofpga_data *d)
@@ -788,6 +797,7 @@ int dev_c3600_iofpga_init(c3600_t *router,m_uint64_t paddr,m_uint32_t len)
    d->vm_obj.name = "io_fpga";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_c3600_iofpga_shutdown;
+   d->vm_obj.ckpt_fields = c3600_iofpga_ckpt_fields;
 
    /* Set device properties */
    dev_init(&d->dev);
@@ -434,11 +434,6 @@ static int c3725_init_platform(c3725_t *router)
    vm->set_irq = mips64_vm_set_irq;
    vm->clear_irq = mips64_vm_clear_irq;
 
-   /* Mark the Network IO interrupt as high priority */
-   cpu->irq_idle_preempt[C3725_NETIO_IRQ] = TRUE;
-   cpu->irq_idle_preempt[C3725_GT96K_IRQ] = TRUE;
-   cpu->irq_idle_preempt[C3725_DUART_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU (idle PC, ...) */
    cpu->idle_pc = vm->idle_pc;
 
@@ -488,12 +483,10 @@ static int c3725_init_platform(c3725_t *router)
                     vm->vtty_con,vm->vtty_aux);
 
    /* PCMCIA Slot 0 */
-   dev_pcmcia_disk_init(vm,"slot0",C3725_SLOT0_ADDR,0x200000,
-                        vm->pcmcia_disk_size[0],1);
+   dev_pcmcia_disk_init(vm,"slot0",C3725_SLOT0_ADDR,0x200000,0,1);
 
    /* PCMCIA Slot 1 */
-   dev_pcmcia_disk_init(vm,"slot1",C3725_SLOT1_ADDR,0x200000,
-                        vm->pcmcia_disk_size[1],1);
+   dev_pcmcia_disk_init(vm,"slot1",C3725_SLOT1_ADDR,0x200000,1,1);
 
    /* Initialize Network Modules */
    if (vm_slot_init_all(vm) == -1)
@@ -568,9 +561,6 @@ static void c3725_set_irq(vm_instance_t *vm,u_int irq)
    switch(irq) {
       case 0 ... 7:
          mips64_set_irq(cpu0,irq);
-
-         if (cpu0->irq_idle_preempt[irq])
-            cpu_idle_break_wait(cpu0->gen);
          break;
 
       case C3725_NETIO_IRQ_BASE ... C3725_NETIO_IRQ_END:
@@ -506,6 +506,19 @@ void c3745_init_eeprom_groups(c3745_t *router)
    }
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t c3745_iofpga_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct c3745_iofpga_data,net_irq_status),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,intr_mask),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,io_mask2),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,eeprom_select),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,wic_select),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,wic_cmd_pos),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,wic_cmd_valid),
+   VM_CKPT_FIELD(struct c3745_iofpga_data,wic_cmd),
+   VM_CKPT_FIELD_END,
+};
+
 /* Shutdown the IO FPGA device */
 static void 
 dev_c3745_iofpga_shutdown(vm_instance_t *vm,struct c3745_iofpga_data *d)
@@ -542,6 +555,7 @@ int dev_c3745_iofpga_init(c3745_t *router,m_uint64_t paddr,m_uint32_t len)
    d->vm_obj.name = "io_fpga";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_c3745_iofpga_shutdown;
+   d->vm_obj.ckpt_fields = c3745_iofpga_ckpt_fields;
 
    /* Set device properties */
    dev_init(&d->dev);
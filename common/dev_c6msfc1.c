@@ -481,10 +481,6 @@ static int c6msfc1_init_platform(c6msfc1_t *router)
    vm->set_irq = mips64_vm_set_irq;
    vm->clear_irq = mips64_vm_clear_irq;
 
-   /* Mark the Network IO interrupt as high priority */
-   cpu0->irq_idle_preempt[C6MSFC1_NETIO_IRQ] = TRUE;
-   cpu0->irq_idle_preempt[C6MSFC1_GT64K_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU0 (idle PC, ...) */
    cpu0->idle_pc = vm->idle_pc;
 
@@ -631,8 +627,6 @@ static void c6msfc1_set_irq(vm_instance_t *vm,u_int irq)
       case 0 ... 7:
          mips64_set_irq(cpu0,irq);
          
-         if (cpu0->irq_idle_preempt[irq])
-            cpu_idle_break_wait(cpu0->gen);
          break;
          
       case C6MSFC1_NETIO_IRQ_BASE ... C6MSFC1_NETIO_IRQ_END:
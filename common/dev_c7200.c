@@ -1488,10 +1488,6 @@ static int c7200m_init_platform(c7200_t *router)
    vm->set_irq = mips64_vm_set_irq;
    vm->clear_irq = mips64_vm_clear_irq;
 
-   /* Mark the Network IO interrupt as high priority */
-   cpu0->irq_idle_preempt[C7200_NETIO_IRQ] = TRUE;
-   cpu0->irq_idle_preempt[C7200_GT64K_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU0 (idle PC, ...) */
    cpu0->idle_pc = vm->idle_pc;
 
@@ -1610,9 +1606,6 @@ static int c7200p_init_platform(c7200_t *router)
    cpu_group_add(vm->cpu_group,gen0);
    vm->boot_cpu = gen0;
 
-   /* Mark the Network IO interrupt as high priority */
-   vm->irq_idle_preempt[C7200_NETIO_IRQ] = TRUE;
-
    /* Copy some parameters from VM to CPU0 (idle PC, ...) */
    cpu0->idle_pc = vm->idle_pc;
 
@@ -1814,9 +1807,6 @@ static void c7200m_set_irq(vm_instance_t *vm,u_int irq)
    switch(irq) {
       case 0 ... 7:
          mips64_set_irq(cpu0,irq);
-
-         if (cpu0->irq_idle_preempt[irq])
-            cpu_idle_break_wait(cpu0->gen);
          break;
 
       case C7200_NETIO_IRQ_BASE ... C7200_NETIO_IRQ_END:
@@ -1917,9 +1907,6 @@ static void c7200p_set_irq(vm_instance_t *vm,u_int irq)
          dev_c7200_net_set_irq(router,slot,port);
          break;
    }
-
-   if (vm->irq_idle_preempt[irq])
-      cpu_idle_break_wait(cpu0->gen);
 }
 
 /* Clear an IRQ */
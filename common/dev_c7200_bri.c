@@ -882,8 +882,9 @@ int dev_c7200_pa_bri_set_nio(vm_instance_t *vm,struct cisco_card *card,
    d->nio = nio;
 
    /* TEST */
-   d->m32_data.tx_tid = ptask_add((ptask_callback)m32_tx_scan_all_channels,
-                                  &d->m32_data,NULL);
+   d->m32_data.tx_tid =
+      ptask_add_group(d->vm,0,(ptask_callback)m32_tx_scan_all_channels,
+                      &d->m32_data,NULL);
 
    //netio_rxl_add(nio,(netio_rx_handler_t)dev_pa_4b_handle_rxring,d,NULL);
    return(0);
@@ -660,6 +660,12 @@ void c7200_init_sys_eeprom_groups(c7200_t *router)
    router->sys_eeprom_g2.eeprom[0] = &router->pem_eeprom;
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t c7200_iofpga_ckpt_fields[] = {
+   VM_CKPT_RANGE(struct iofpga_data,duart_isr,envm_r2),
+   VM_CKPT_FIELD_END,
+};
+
 /* Shutdown the IO FPGA device */
 void dev_c7200_iofpga_shutdown(vm_instance_t *vm,struct iofpga_data *d)
 {
@@ -707,6 +713,7 @@ int dev_c7200_iofpga_init(c7200_t *router,m_uint64_t paddr,m_uint32_t len)
    d->vm_obj.name = "io_fpga";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_c7200_iofpga_shutdown;
+   d->vm_obj.ckpt_fields = c7200_iofpga_ckpt_fields;
 
    /* Set device properties */
    dev_init(&d->dev);
@@ -727,8 +734,9 @@ int dev_c7200_iofpga_init(c7200_t *router,m_uint64_t paddr,m_uint32_t len)
       vm->vtty_aux->read_notifier = tty_aux_input;
 
       /* Trigger periodically a dummy IRQ to flush buffers */
-      d->duart_irq_tid = ptask_add((ptask_callback)tty_trigger_dummy_irq,
-                                   d,NULL);
+      d->duart_irq_tid = ptask_add_group(d->router->vm,0,
+                                         (ptask_callback)tty_trigger_dummy_irq,
+                                         d,NULL);
    }
 
    /* Map this device to the VM */
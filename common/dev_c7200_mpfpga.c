@@ -427,6 +427,20 @@ void c7200_init_mp_eeprom_groups(c7200_t *router)
    router->pa_eeprom_g3.eeprom[0] = NULL;
 }
 
+/* Registers saved in VM checkpoints (in the router structure) */
+static vm_ckpt_field_t c7200_mpfpga_ckpt_fields[] = {
+   VM_CKPT_FIELD(c7200_t,net_irq_status),
+   VM_CKPT_FIELD(c7200_t,net_irq_mask),
+   VM_CKPT_FIELD_END,
+};
+
+/* Update the network IRQ status after a checkpoint restore */
+static void 
+dev_c7200_mpfpga_ckpt_restore(vm_instance_t *vm,struct c7200_mpfpga_data *d)
+{
+   dev_c7200_net_update_irq(d->router);
+}
+
 /* Shutdown the MP FPGA device */
 static void 
 dev_c7200_mpfpga_shutdown(vm_instance_t *vm,struct c7200_mpfpga_data *d)
@@ -459,6 +473,9 @@ int dev_c7200_mpfpga_init(c7200_t *router,m_uint64_t paddr,m_uint32_t len)
    d->vm_obj.name = "mp_fpga";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_c7200_mpfpga_shutdown;
+   d->vm_obj.ckpt_fields = c7200_mpfpga_ckpt_fields;
+   d->vm_obj.ckpt_data = router;
+   d->vm_obj.ckpt_restore = (vm_ckpt_restore_t)dev_c7200_mpfpga_ckpt_restore;
 
    /* Set device properties */
    dev_init(&d->dev);
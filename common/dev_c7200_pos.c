@@ -810,7 +810,9 @@ int dev_c7200_pa_pos_set_nio(vm_instance_t *vm,struct cisco_card *card,
       return(-1);
 
    d->nio = nio;
-   d->tx_tid = ptask_add((ptask_callback)dev_pos_oc3_handle_txring,d,NULL);
+   d->tx_tid = ptask_add_group(d->vm,0,
+                               (ptask_callback)dev_pos_oc3_handle_txring,
+                               d,NULL);
    netio_rxl_add(nio,(netio_rx_handler_t)dev_pos_oc3_handle_rxring,d,NULL);
    return(0);
 }
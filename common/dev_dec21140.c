@@ -107,6 +107,9 @@
 /* Maximum packet size */
 #define DEC21140_MAX_PKT_SIZE     2048
 
+/* Maximum number of host segments for a TX packet */
+#define DEC21140_TX_MAX_IOV       32
+
 /* Send up to 32 packets in a TX ring scan pass */
 #define DEC21140_TXRING_PASS_COUNT  32
 
@@ -182,6 +185,7 @@ struct dec21140_data {
 
    /* TX ring scanner task id */
    ptask_id_t tx_tid;
+   ptask_t *tx_task;
 };
 
 /* Log a dec21140 message */
@@ -461,6 +465,11 @@ void *dev_dec21140_access(cpu_gen_t *cpu,struct vdevice *dev,
       cpu_log(cpu,d->name,"write CSR%u value 0x%x\n",reg,(m_uint32_t)*data);
 #endif
       switch(reg) {
+         case 1:
+            /* CSR1: TX poll demand, scan the TX ring now */
+            d->csr[reg] = *data;
+            ptask_kick_task(d->tx_task,d->tx_tid);
+            break;
          case 3:
             d->csr[reg] = *data;
             d->rx_current = d->csr[reg];
@@ -735,11 +744,12 @@ static void txdesc_set_next(struct dec21140_data *d,struct tx_desc *txd)
 /* Handle the TX ring (single packet) */
 static int dev_dec21140_handle_txring_single(struct dec21140_data *d)
 {   
-   u_char pkt[DEC21140_MAX_PKT_SIZE],*pkt_ptr;
+   u_char pkt[DEC21140_MAX_PKT_SIZE];
    u_char setup_frame[DEC21140_SETUP_FRAME_SIZE];
-   m_uint32_t tx_start,len1,len2,clen,tot_len;
+   struct iovec iov[DEC21140_TX_MAX_IOV];
+   m_uint32_t tx_start,len1,len2,tot_len;
    struct tx_desc txd0,ctxd,*ptxd;
-   int done = FALSE;
+   int iov_cnt = 0,done = FALSE;
 
    /* 
     * Don't start transmit if the txring address has not been set
@@ -788,7 +798,6 @@ static int dev_dec21140_handle_txring_single(struct dec21140_data *d)
 #endif
 
    /* Empty packet for now */
-   pkt_ptr = pkt;
    tot_len = 0;
 
    do {
@@ -805,20 +814,24 @@ static int dev_dec21140_handle_txring_single(struct dec21140_data *d)
 
       len1 = ptxd->tdes[1] & DEC21140_TXDESC_LEN_MASK;
       len2 = (ptxd->tdes[1] >> 11) & DEC21140_TXDESC_LEN_MASK;
-      clen = len1 + len2;
 
-      /* Be sure that we have either len1 or len2 not null */
-      if (clen != 0)
-      {
-         if (len1 != 0)
-            physmem_copy_from_vm(d->vm,pkt_ptr,ptxd->tdes[2],len1);
-         
-         if ((len2 != 0) && !(ptxd->tdes[1] & DEC21140_TXDESC_TCH))
-            physmem_copy_from_vm(d->vm,pkt_ptr+len1,ptxd->tdes[3],len2);
-      }
+      if (ptxd->tdes[1] & DEC21140_TXDESC_TCH)
+         len2 = 0;
+
+      /* Truncate the packet if it is too big */
+      len1 = m_min(len1,DEC21140_MAX_PKT_SIZE - tot_len);
+      len2 = m_min(len2,DEC21140_MAX_PKT_SIZE - tot_len - len1);
+
+      /* Map the buffers directly, without copying the data */
+      iov_cnt = physmem_map_iov_bounce(d->vm,ptxd->tdes[2],len1,
+                                       iov,iov_cnt,DEC21140_TX_MAX_IOV,
+                                       pkt,tot_len);
+      tot_len += len1;
 
-      pkt_ptr += clen;
-      tot_len += clen;
+      iov_cnt = physmem_map_iov_bounce(d->vm,ptxd->tdes[3],len2,
+                                       iov,iov_cnt,DEC21140_TX_MAX_IOV,
+                                       pkt,tot_len);
+      tot_len += len2;
 
       /* Clear the OWN bit if this is not the first descriptor */
       if (!(ptxd->tdes[1] & DEC21140_TXDESC_FS))
@@ -840,14 +853,14 @@ static int dev_dec21140_handle_txring_single(struct dec21140_data *d)
 
    if (tot_len != 0) {
 #if DEBUG_TRANSMIT
-      DEC21140_LOG(d,"sending packet of %u bytes\n",tot_len);
-      mem_dump(log_file,pkt,tot_len);
+      DEC21140_LOG(d,"sending packet of %u bytes (%d segments)\n",
+                   tot_len,iov_cnt);
 #endif
       /* rewrite ISL header if required */
-      cisco_isl_rewrite(pkt,tot_len);
+      iov_cnt = cisco_isl_rewrite_iov(pkt,iov,iov_cnt,tot_len);
 
       /* send it on wire */
-      netio_send(d->nio,pkt,tot_len);
+      netio_send_queuedv(d->nio,iov,iov_cnt);
    }
 
  clear_txd0_own_bit:
@@ -868,10 +881,20 @@ static int dev_dec21140_handle_txring(struct dec21140_data *d)
 {  
    int i;
 
+   /* Packet segments are mapped directly in VM memory */
+   physmem_dma_begin(d->vm);
+
    for(i=0;i<DEC21140_TXRING_PASS_COUNT;i++)
       if (!dev_dec21140_handle_txring_single(d))
          break;
 
+   physmem_dma_end(d->vm);
+
+   /* Pass limit reached, there are probably more packets to send */
+   if (i == DEC21140_TXRING_PASS_COUNT)
+      ptask_kick_task(d->tx_task,d->tx_tid);
+
+   netio_send_flush(d->nio);
    netio_clear_bw_stat(d->nio);
    return(TRUE);
 }
@@ -924,6 +947,17 @@ static void pci_dec21140_write(cpu_gen_t *cpu,struct pci_device *dev,
    }
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t dec21140_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct dec21140_data,rx_current),
+   VM_CKPT_FIELD(struct dec21140_data,tx_current),
+   VM_CKPT_FIELD(struct dec21140_data,csr),
+   VM_CKPT_RANGE(struct dec21140_data,mii_state,mii_regs),
+   VM_CKPT_FIELD(struct dec21140_data,mac_addr),
+   VM_CKPT_FIELD(struct dec21140_data,mac_addr_count),
+   VM_CKPT_FIELD_END,
+};
+
 /* 
  * dev_dec21140_init()
  *
@@ -976,6 +1010,9 @@ struct dec21140_data *dev_dec21140_init(vm_instance_t *vm,char *name,
    dev->phys_len  = 0x20000;
    dev->handler   = dev_dec21140_access;
    dev->priv_data = d;
+
+   /* State saved in VM checkpoints */
+   pci_dev->ckpt_fields = dec21140_ckpt_fields;
    return(d);
 
  err_dev:
@@ -1005,7 +1042,10 @@ int dev_dec21140_set_nio(struct dec21140_data *d,netio_desc_t *nio)
       return(-1);
 
    d->nio = nio;
-   d->tx_tid = ptask_add((ptask_callback)dev_dec21140_handle_txring,d,NULL);
+   d->tx_tid = ptask_add_group(d->vm,0,
+                               (ptask_callback)dev_dec21140_handle_txring,
+                               d,NULL);
+   d->tx_task = ptask_get(d->tx_tid);
    netio_rxl_add(nio,(netio_rx_handler_t)dev_dec21140_handle_rxring,d,NULL);
    return(0);
 }
@@ -2608,6 +2608,44 @@ static int gt_eth_handle_rx_pkt(netio_desc_t *nio,
    return(TRUE);
 }
 
+/* Registers saved in VM checkpoints */
+#define GT_CKPT_MPSC(i) \
+   VM_CKPT_RANGE(struct gt_data,mpsc[i].mmcrl,mpsc[i].chr)
+#define GT_CKPT_ETH(i) \
+   VM_CKPT_RANGE(struct gt_data,eth_ports[i].rx_start,eth_ports[i].tx_frames)
+
+static vm_ckpt_field_t gt_ckpt_fields[] = {
+   VM_CKPT_FIELD(struct gt_data,dma),
+   VM_CKPT_FIELD(struct gt_data,int_cause_reg),
+   VM_CKPT_FIELD(struct gt_data,int_high_cause_reg),
+   VM_CKPT_FIELD(struct gt_data,int_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,int0_main_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,int0_high_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,int1_main_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,int1_high_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,ser_cause_reg),
+   VM_CKPT_FIELD(struct gt_data,serint0_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,serint1_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,sgcr),
+   VM_CKPT_FIELD(struct gt_data,sdma_cause_reg),
+   VM_CKPT_FIELD(struct gt_data,sdma_mask_reg),
+   VM_CKPT_FIELD(struct gt_data,sdma),
+   GT_CKPT_MPSC(0), GT_CKPT_MPSC(1), GT_CKPT_MPSC(2), GT_CKPT_MPSC(3),
+   GT_CKPT_MPSC(4), GT_CKPT_MPSC(5), GT_CKPT_MPSC(6), GT_CKPT_MPSC(7),
+   GT_CKPT_ETH(0), GT_CKPT_ETH(1),
+   VM_CKPT_FIELD(struct gt_data,smi_reg),
+   VM_CKPT_FIELD(struct gt_data,mii_regs),
+   VM_CKPT_FIELD_END,
+};
+
+/* Update the IRQ status after a checkpoint restore */
+static void dev_gt_ckpt_restore(vm_instance_t *vm,struct gt_data *d)
+{
+   GT_LOCK(d);
+   d->gt_update_irq_status(d);
+   GT_UNLOCK(d);
+}
+
 /* Shutdown a GT system controller */
 void dev_gt_shutdown(vm_instance_t *vm,struct gt_data *d)
 {
@@ -2647,6 +2685,8 @@ int dev_gt64010_init(vm_instance_t *vm,char *name,
    d->vm_obj.name = name;
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_gt_shutdown;
+   d->vm_obj.ckpt_fields = gt_ckpt_fields;
+   d->vm_obj.ckpt_restore = (vm_ckpt_restore_t)dev_gt_ckpt_restore;
 
    dev_init(&d->dev);
    d->dev.name      = name;
@@ -2712,6 +2752,8 @@ int dev_gt64120_init(vm_instance_t *vm,char *name,
    d->vm_obj.name = name;
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_gt_shutdown;
+   d->vm_obj.ckpt_fields = gt_ckpt_fields;
+   d->vm_obj.ckpt_restore = (vm_ckpt_restore_t)dev_gt_ckpt_restore;
 
    dev_init(&d->dev);
    d->dev.name      = name;
@@ -2792,6 +2834,8 @@ int dev_gt96100_init(vm_instance_t *vm,char *name,
    d->vm_obj.name = name;
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_gt_shutdown;
+   d->vm_obj.ckpt_fields = gt_ckpt_fields;
+   d->vm_obj.ckpt_restore = (vm_ckpt_restore_t)dev_gt_ckpt_restore;
 
    dev_init(&d->dev);
    d->dev.name      = name;
@@ -2813,7 +2857,9 @@ int dev_gt96100_init(vm_instance_t *vm,char *name,
    }
 
    /* Start the Ethernet TX ring scanner */
-   d->eth_tx_tid = ptask_add((ptask_callback)gt_eth_handle_txqueues,d,NULL);
+   d->eth_tx_tid = ptask_add_group(d->vm,0,
+                                   (ptask_callback)gt_eth_handle_txqueues,
+                                   d,NULL);
 
    /* Map this device to the VM */
    vm_bind_device(vm,&d->dev);
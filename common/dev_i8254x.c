@@ -274,6 +274,7 @@ struct i8254x_data {
 
    /* TX ring scanner task id */
    ptask_id_t tx_tid;
+   ptask_t *tx_task;
 
    /* Interrupt registers */
    m_uint32_t icr,imr;
@@ -757,9 +758,11 @@ void *dev_i8254x_access(cpu_gen_t *cpu,struct vdevice *dev,
       /* TX Descriptor Tail */
       case I82542_REG_TDT:
       case I8254X_REG_TDT:
-         if (op_type == MTS_WRITE)
+         if (op_type == MTS_WRITE) {
+            /* New descriptors to transmit, scan the TX ring now */
             d->tdt = *data & 0xFFFF;
-         else
+            ptask_kick_task(d->tx_task,d->tx_tid);
+         } else
             *data = d->tdt;
          break;
 
@@ -887,7 +890,7 @@ static int dev_i8254x_handle_txring_single(struct i8254x_data *d)
          LVG_LOG(d,"sending packet of %u bytes\n",tot_len);
          mem_dump(log_file,d->tx_buffer,tot_len);
 #endif
-         netio_send(d->nio,d->tx_buffer,tot_len);
+         netio_send_queued(d->nio,d->tx_buffer,tot_len);
          break;
       }
    }
@@ -921,6 +924,11 @@ static int dev_i8254x_handle_txring(struct i8254x_data *d)
          break;
    }
 
+   /* Pass limit reached, there are probably more packets to send */
+   if (i == I8254X_TXRING_PASS_COUNT)
+      ptask_kick_task(d->tx_task,d->tx_tid);
+
+   netio_send_flush(d->nio);
    netio_clear_bw_stat(d->nio);
    return(TRUE);
 }
@@ -1158,7 +1166,10 @@ int dev_i8254x_set_nio(struct i8254x_data *d,netio_desc_t *nio)
       return(-1);
 
    d->nio = nio;
-   d->tx_tid = ptask_add((ptask_callback)dev_i8254x_handle_txring,d,NULL);
+   d->tx_tid = ptask_add_group(d->vm,0,
+                               (ptask_callback)dev_i8254x_handle_txring,
+                               d,NULL);
+   d->tx_task = ptask_get(d->tx_tid);
    netio_rxl_add(nio,(netio_rx_handler_t)dev_i8254x_handle_rxring,d,NULL);
    return(0);
 }
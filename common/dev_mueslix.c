@@ -1044,8 +1044,9 @@ int dev_mueslix_set_nio(struct mueslix_data *d,u_int channel_id,
 
    /* define the new NIO */
    channel->nio = nio;
-   channel->tx_tid = ptask_add((ptask_callback)dev_mueslix_handle_txring,
-                               channel,NULL);
+   channel->tx_tid = ptask_add_group(d->vm,0,
+                                     (ptask_callback)dev_mueslix_handle_txring,
+                                     channel,NULL);
    netio_rxl_add(nio,(netio_rx_handler_t)dev_mueslix_handle_rxring,
                  channel,NULL);
    return(0);
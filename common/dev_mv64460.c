@@ -2673,8 +2673,9 @@ int dev_mv64460_init(vm_instance_t *vm,char *name,
                0,0,-1,d,NULL,pci_mv64460_read,NULL);
 
    /* Start the Ethernet TX ring scanner */
-   d->eth_tx_tid = ptask_add((ptask_callback)mv64460_eth_handle_txqueues,
-                             d,NULL);
+   d->eth_tx_tid = ptask_add_group(d->vm,0,
+                                   (ptask_callback)mv64460_eth_handle_txqueues,
+                                   d,NULL);
 
    /* Map this device to the VM */
    vm_bind_device(vm,&d->dev);
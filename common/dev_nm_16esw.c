@@ -2545,8 +2545,9 @@ dev_nm_16esw_init(vm_instance_t *vm,char *name,u_int nm_bay,
    data->dev = dev;
 
    /* Create the TX ring scanner */
-   data->tx_tid = ptask_add((ptask_callback)dev_bcm5600_handle_txring,
-                            data,NULL);
+   data->tx_tid = ptask_add_group(data->vm,0,
+                                  (ptask_callback)dev_bcm5600_handle_txring,
+                                  data,NULL);
 
    /* Start the MAC address ager */
    data->ager_tid = timer_create_entry(15000,FALSE,10,
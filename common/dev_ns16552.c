@@ -338,6 +338,17 @@ void *dev_ns16552_access(cpu_gen_t *cpu,struct vdevice *dev,m_uint32_t offset,
    return NULL;
 }
 
+/* Registers saved in VM checkpoints */
+static vm_ckpt_field_t ns16552_ckpt_fields[] = {
+   VM_CKPT_RANGE(struct ns16552_data,channel[0].ier,channel[0].output),
+   VM_CKPT_RANGE(struct ns16552_data,channel[1].ier,channel[1].output),
+   VM_CKPT_FIELD(struct ns16552_data,duart_irq_seq),
+   VM_CKPT_FIELD(struct ns16552_data,line_control_reg),
+   VM_CKPT_FIELD(struct ns16552_data,div_latch),
+   VM_CKPT_FIELD(struct ns16552_data,baud_divisor),
+   VM_CKPT_FIELD_END,
+};
+
 /* Shutdown a NS16552 device */
 void dev_ns16552_shutdown(vm_instance_t *vm,struct ns16552_data *d)
 {
@@ -382,6 +393,7 @@ int dev_ns16552_init(vm_instance_t *vm,m_uint64_t paddr,m_uint32_t len,
    d->vm_obj.name = "ns16552";
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_ns16552_shutdown;
+   d->vm_obj.ckpt_fields = ns16552_ckpt_fields;
 
    /* Set device properties */
    dev_init(&d->dev);
@@ -397,7 +409,8 @@ int dev_ns16552_init(vm_instance_t *vm,m_uint64_t paddr,m_uint32_t len,
    vtty_B->read_notifier = tty_aux_input;
 
    /* Trigger periodically a dummy IRQ to flush buffers */
-   d->tid = ptask_add((ptask_callback)tty_trigger_dummy_irq,d,NULL);
+   d->tid = ptask_add_group(d->vm,0,(ptask_callback)tty_trigger_dummy_irq,
+                            d,NULL);
 
    /* Map this device to the VM */
    vm_bind_device(vm,&d->dev);   
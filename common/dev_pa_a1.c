@@ -1681,7 +1681,9 @@ int dev_c7200_pa_a1_set_nio(vm_instance_t *vm,struct cisco_card *card,
       return(-1);
 
    d->nio = nio;
-   d->tx_tid = ptask_add((ptask_callback)ti1570_scan_tx_sched_table,d,NULL);
+   d->tx_tid = ptask_add_group(d->vm,0,
+                               (ptask_callback)ti1570_scan_tx_sched_table,
+                               d,NULL);
    netio_rxl_add(nio,(netio_rx_handler_t)ti1570_handle_rx_cell,d,NULL);
    return(0);
 }
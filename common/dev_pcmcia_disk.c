@@ -13,13 +13,16 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "cpu.h"
 #include "vm.h"
 #include "dynamips.h"
 #include "memory.h"
 #include "device.h"
+#include "ptask.h"
 #include "fs_mbr.h"
 #include "fs_fat.h"
 
@@ -35,6 +38,30 @@
 /* Size (in bytes) of a sector */
 #define SECTOR_SIZE  512
 
+/* Size (in sectors) of the sector cache used for multi-sector transfers */
+#define DISK_CACHE_SECTORS  1024
+
+/* Number of sectors read ahead */
+#define DISK_READ_AHEAD  64
+
+/* Write-back: period of the flush task (in msec), max number of periods */
+#define DISK_FLUSH_PERIOD  1000
+#define DISK_FLUSH_MAX     5
+
+/* Copy-on-write overlay file */
+#define DISK_COW_MAGIC    0x44594e41434f5744ULL  /* "DYNACOWD" */
+#define DISK_COW_VERSION  1
+#define DISK_COW_ALIGN    4096
+
+/* Copy-on-write overlay header */
+struct disk_cow_header {
+   m_uint64_t magic;
+   m_uint32_t version;
+   m_uint32_t sect_count;
+   m_uint64_t bitmap_offset;
+   m_uint64_t data_offset;
+};
+
 /* ATA commands */
 #define ATA_CMD_NOP           0x00
 #define ATA_CMD_READ_SECTOR   0x20
@@ -203,10 +230,40 @@ struct pcmcia_disk_data {
    char *filename;
    int fd;
 
+   /* Disk file mapped in memory (NULL if file I/O is used) */
+   u_char *map;
+   size_t map_size;
+
+   /* Shared base image (copy-on-write mode) */
+   char *base_filename;
+   int base_fd;
+   u_char *base_map;
+   size_t base_map_size;
+
+   /* Copy-on-write: bitmap of sectors present in the disk file */
+   m_uint8_t *cow_bitmap;
+   off_t cow_bitmap_offset;
+   size_t cow_bitmap_size;
+   int cow_bitmap_dirty;
+
+   /* Offset of the first sector in the disk file */
+   off_t sect_offset;
+
    /* Disk parameters (C/H/S) */
    u_int nr_heads;
    u_int nr_cylinders;
    u_int sects_per_track;
+   m_uint32_t tot_sect;
+
+   /* Sector cache (write-back), dirty sectors are contiguous */
+   pthread_mutex_t cache_lock;
+   m_uint8_t *cache;
+   m_uint32_t cache_start;
+   u_int cache_count;
+   m_uint32_t dirty_start,dirty_end;
+   u_int flush_count;
+   int cache_activity;
+   ptask_id_t flush_tid;
 
    /* Current ATA command and CHS info */
    m_uint8_t ata_cmd,ata_cmd_in_progress;
@@ -225,10 +282,11 @@ struct pcmcia_disk_data {
    /* Callback function when data buffer is validated */
    void (*ata_cmd_callback)(struct pcmcia_disk_data *);
 
-   /* Data buffer */
+   /* Data buffer (points to the sector cache for read commands) */
    m_uint32_t data_offset;
    u_int data_pos;
-   m_uint8_t data_buffer[SECTOR_SIZE];
+   m_uint8_t *data_buffer;
+   m_uint8_t sect_buffer[SECTOR_SIZE];
 };
 
 /* Convert a CHS reference to an LBA reference */
@@ -280,8 +338,292 @@ static int disk_format(struct pcmcia_disk_data *d)
    return(0);
 }
 
-/* Create the virtual disk */
-static int disk_create(struct pcmcia_disk_data *d)
+/* Read data from a disk file (or from its mapping) */
+static int disk_file_read(int fd,u_char *map,off_t offset,
+                          m_uint8_t *buffer,size_t len)
+{
+   if (map != NULL) {
+      memcpy(buffer,map+offset,len);
+      return(0);
+   }
+
+   if (pread(fd,buffer,len,offset) != len) {
+      perror("disk_file_read: pread");
+      return(-1);
+   }
+
+   return(0);
+}
+
+/* Write data to a disk file (or to its mapping) */
+static int disk_file_write(int fd,u_char *map,off_t offset,
+                           m_uint8_t *buffer,size_t len)
+{
+   if (map != NULL) {
+      memcpy(map+offset,buffer,len);
+      return(0);
+   }
+
+   if (pwrite(fd,buffer,len,offset) != len) {
+      perror("disk_file_write: pwrite");
+      return(-1);
+   }
+
+   return(0);
+}
+
+/* Check if a sector is present in the copy-on-write overlay */
+static inline int disk_cow_present(struct pcmcia_disk_data *d,m_uint32_t sect)
+{
+   return(d->cow_bitmap[sect >> 3] & (1 << (sect & 7)));
+}
+
+/* Read sectors from disk file (sectors beyond the end of disk are zeroed) */
+static int disk_read_sectors(struct pcmcia_disk_data *d,m_uint32_t sect,
+                             u_int count,m_uint8_t *buffer)
+{
+   u_int i,n;
+   int present;
+
+#if DEBUG_READ
+   vm_log(d->vm,d->dev.name,"reading sectors 0x%8.8x-0x%8.8x\n",
+          sect,sect+count-1);
+#endif
+
+   if (sect >= d->tot_sect) {
+      memset(buffer,0,count * SECTOR_SIZE);
+      return(-1);
+   }
+
+   if (count > (d->tot_sect - sect)) {
+      n = d->tot_sect - sect;
+      memset(buffer + (n * SECTOR_SIZE),0,(count - n) * SECTOR_SIZE);
+      count = n;
+   }
+
+   if (!d->cow_bitmap)
+      return(disk_file_read(d->fd,d->map,
+                            d->sect_offset + (off_t)sect * SECTOR_SIZE,
+                            buffer,count * SECTOR_SIZE));
+
+   /* Read runs of sectors from the overlay or from the base image */
+   for(i=0;i<count;i+=n) {
+      present = disk_cow_present(d,sect+i);
+
+      for(n=1;(i+n < count) && (disk_cow_present(d,sect+i+n) == present);n++)
+         ;
+
+      if (present) {
+         if (disk_file_read(d->fd,d->map,
+                            d->sect_offset + (off_t)(sect+i) * SECTOR_SIZE,
+                            buffer + (i * SECTOR_SIZE),n * SECTOR_SIZE) == -1)
+            return(-1);
+      } else {
+         if (disk_file_read(d->base_fd,d->base_map,
+                            (off_t)(sect+i) * SECTOR_SIZE,
+                            buffer + (i * SECTOR_SIZE),n * SECTOR_SIZE) == -1)
+            return(-1);
+      }
+   }
+
+   return(0);
+}
+
+/* Write sectors to disk file */
+static int disk_write_sectors(struct pcmcia_disk_data *d,m_uint32_t sect,
+                              u_int count,m_uint8_t *buffer)
+{
+   u_int i;
+
+#if DEBUG_WRITE
+   vm_log(d->vm,d->dev.name,"writing sectors 0x%8.8x-0x%8.8x\n",
+          sect,sect+count-1);
+#endif
+
+   if (sect >= d->tot_sect)
+      return(-1);
+
+   if (count > (d->tot_sect - sect))
+      count = d->tot_sect - sect;
+
+   if (disk_file_write(d->fd,d->map,
+                       d->sect_offset + (off_t)sect * SECTOR_SIZE,
+                       buffer,count * SECTOR_SIZE) == -1)
+      return(-1);
+
+   if (d->cow_bitmap) {
+      for(i=0;i<count;i++)
+         d->cow_bitmap[(sect+i) >> 3] |= 1 << ((sect+i) & 7);
+
+      d->cow_bitmap_dirty = TRUE;
+   }
+
+   return(0);
+}
+
+/* Write the dirty sectors of the cache to disk (cache lock held) */
+static void disk_cache_writeback(struct pcmcia_disk_data *d)
+{
+   if (d->dirty_start == d->dirty_end)
+      return;
+
+   disk_write_sectors(d,d->dirty_start,d->dirty_end - d->dirty_start,
+                      d->cache + (d->dirty_start - d->cache_start)*SECTOR_SIZE);
+
+   d->dirty_start = d->dirty_end = 0;
+   d->flush_count = 0;
+}
+
+/* Flush cached writes to disk file */
+static void disk_flush(struct pcmcia_disk_data *d,int sync)
+{
+   pthread_mutex_lock(&d->cache_lock);
+
+   disk_cache_writeback(d);
+
+   /* Data is written before the overlay bitmap */
+   if (d->cow_bitmap_dirty) {
+      if (!d->map)
+         disk_file_write(d->fd,NULL,d->cow_bitmap_offset,
+                         d->cow_bitmap,d->cow_bitmap_size);
+
+      d->cow_bitmap_dirty = FALSE;
+   }
+
+   if (d->map)
+      msync(d->map,d->map_size,sync ? MS_SYNC : MS_ASYNC);
+
+   pthread_mutex_unlock(&d->cache_lock);
+}
+
+/* Flush task: write back the cache when the disk is idle */
+static int disk_flush_task(struct pcmcia_disk_data *d,void *arg)
+{
+   int activity;
+
+   activity = d->cache_activity;
+   d->cache_activity = FALSE;
+
+   if ((d->dirty_start == d->dirty_end) && !d->cow_bitmap_dirty)
+      return(0);
+
+   if (!activity || (++d->flush_count >= DISK_FLUSH_MAX))
+      disk_flush(d,FALSE);
+
+   return(0);
+}
+
+/* Get cached sectors for a read command (read ahead if not cached) */
+static m_uint8_t *disk_cache_read(struct pcmcia_disk_data *d,
+                                  m_uint32_t sect,u_int count)
+{
+   u_int n;
+
+   pthread_mutex_lock(&d->cache_lock);
+   d->cache_activity = TRUE;
+
+   if ((sect < d->cache_start) ||
+       ((sect + count) > (d->cache_start + d->cache_count)))
+   {
+      disk_cache_writeback(d);
+
+      n = DISK_READ_AHEAD;
+
+      if ((sect < d->tot_sect) && (n > (d->tot_sect - sect)))
+         n = d->tot_sect - sect;
+
+      if (n < count)
+         n = count;
+
+      disk_read_sectors(d,sect,n,d->cache);
+      d->cache_start = sect;
+      d->cache_count = n;
+   }
+
+   pthread_mutex_unlock(&d->cache_lock);
+   return(d->cache + (sect - d->cache_start) * SECTOR_SIZE);
+}
+
+/* Prepare the cache for a write command */
+static void disk_cache_write_start(struct pcmcia_disk_data *d,
+                                   m_uint32_t sect,u_int count)
+{
+   int dirty;
+
+   pthread_mutex_lock(&d->cache_lock);
+   d->cache_activity = TRUE;
+
+   /* 
+    * Written sectors have to extend the cached data without gap, and be
+    * contiguous with the dirty sectors.
+    */
+   dirty = (d->dirty_start != d->dirty_end);
+
+   if ((sect < d->cache_start) ||
+       (sect > (d->cache_start + d->cache_count)) ||
+       ((sect + count) > (d->cache_start + DISK_CACHE_SECTORS)) ||
+       (dirty && ((sect > d->dirty_end) || ((sect + count) < d->dirty_start))))
+   {
+      disk_cache_writeback(d);
+      d->cache_start = sect;
+      d->cache_count = 0;
+   }
+
+   pthread_mutex_unlock(&d->cache_lock);
+}
+
+/* Store a written sector in the cache */
+static void disk_cache_write(struct pcmcia_disk_data *d,m_uint32_t sect,
+                             m_uint8_t *buffer)
+{
+   u_int index;
+
+   pthread_mutex_lock(&d->cache_lock);
+   d->cache_activity = TRUE;
+
+   index = sect - d->cache_start;
+
+   if (index < DISK_CACHE_SECTORS) {
+      memcpy(d->cache + (index * SECTOR_SIZE),buffer,SECTOR_SIZE);
+
+      if (index >= d->cache_count)
+         d->cache_count = index + 1;
+
+      if (d->dirty_start == d->dirty_end) {
+         d->dirty_start = sect;
+         d->dirty_end   = sect + 1;
+      } else {
+         if (sect < d->dirty_start)
+            d->dirty_start = sect;
+
+         if (sect >= d->dirty_end)
+            d->dirty_end = sect + 1;
+      }
+   } else {
+      /* command longer than announced, write through */
+      disk_write_sectors(d,sect,1,buffer);
+   }
+
+   pthread_mutex_unlock(&d->cache_lock);
+}
+
+/* Map a file in memory */
+static u_char *disk_map_file(int fd,size_t len,int prot)
+{
+   u_char *ptr;
+
+   ptr = mmap(NULL,len,prot,MAP_SHARED,fd,0);
+
+   if (ptr == MAP_FAILED) {
+      perror("disk_map_file: mmap");
+      return NULL;
+   }
+
+   return ptr;
+}
+
+/* Create the raw disk file */
+static int disk_create_raw(struct pcmcia_disk_data *d)
 {
    off_t disk_len;
 
@@ -301,57 +643,137 @@ static int disk_create(struct pcmcia_disk_data *d)
       }
    }
 
-   disk_len = (off_t) d->nr_heads * d->nr_cylinders * d->sects_per_track * SECTOR_SIZE;
-   ftruncate(d->fd,disk_len);
+   disk_len = (off_t)d->tot_sect * SECTOR_SIZE;
+
+   if (ftruncate(d->fd,disk_len) == -1) {
+      perror("disk_create: ftruncate");
+      close(d->fd);
+      d->fd = -1;
+      return(-1);
+   }
+
+   d->map_size = disk_len;
+   d->sect_offset = 0;
    return(0);
 }
 
-/* Read a sector from disk file */
-static int disk_read_sector(struct pcmcia_disk_data *d,m_uint32_t sect,
-                            m_uint8_t *buffer)
+/* Create or open the copy-on-write overlay of a base image */
+static int disk_create_cow(struct pcmcia_disk_data *d)
 {
-   off_t disk_offset = (off_t)sect * SECTOR_SIZE;
-
-#if DEBUG_READ
-   vm_log(d->vm,d->dev.name,"reading sector 0x%8.8x\n",sect);
-#endif
+   struct disk_cow_header hdr;
+   ssize_t len;
 
-   if (lseek(d->fd,disk_offset,SEEK_SET) == -1) {
-      perror("read_sector: lseek");
+   if ((d->base_fd = open(d->base_filename,O_RDONLY)) < 0) {
+      perror("disk_create: open base image");
       return(-1);
    }
-   
-   if (read(d->fd,buffer,SECTOR_SIZE) != SECTOR_SIZE) {
-      perror("read_sector: read");
+
+   d->cow_bitmap_offset = DISK_COW_ALIGN;
+   d->cow_bitmap_size = (d->tot_sect + 7) / 8;
+   d->cow_bitmap_size = (d->cow_bitmap_size + DISK_COW_ALIGN - 1) &
+      ~(DISK_COW_ALIGN - 1);
+   d->sect_offset = d->cow_bitmap_offset + d->cow_bitmap_size;
+
+   d->base_map_size = (size_t)d->tot_sect * SECTOR_SIZE;
+   d->map_size = d->sect_offset + d->base_map_size;
+
+   if ((d->fd = open(d->filename,O_CREAT|O_RDWR,0600)) < 0) {
+      perror("disk_create: open");
       return(-1);
    }
 
+   len = pread(d->fd,&hdr,sizeof(hdr),0);
+
+   if (len == 0) {
+      /* new overlay: sectors are read from the base image */
+      memset(&hdr,0,sizeof(hdr));
+      hdr.magic         = DISK_COW_MAGIC;
+      hdr.version       = DISK_COW_VERSION;
+      hdr.sect_count    = d->tot_sect;
+      hdr.bitmap_offset = d->cow_bitmap_offset;
+      hdr.data_offset   = d->sect_offset;
+
+      if ((pwrite(d->fd,&hdr,sizeof(hdr),0) != sizeof(hdr)) ||
+          (ftruncate(d->fd,d->map_size) == -1))
+      {
+         perror("disk_create: overlay creation");
+         return(-1);
+      }
+   } else {
+      if ((len != sizeof(hdr)) || (hdr.magic != DISK_COW_MAGIC) ||
+          (hdr.version != DISK_COW_VERSION) ||
+          (hdr.sect_count != d->tot_sect) ||
+          (hdr.bitmap_offset != d->cow_bitmap_offset) ||
+          (hdr.data_offset != d->sect_offset))
+      {
+         vm_error(d->vm,"%s: file '%s' is not an overlay of '%s'.\n",
+                  d->dev.name,d->filename,d->base_filename);
+         return(-1);
+      }
+   }
+
    return(0);
 }
 
-/* Write a sector to disk file */
-static int disk_write_sector(struct pcmcia_disk_data *d,m_uint32_t sect,
-                             m_uint8_t *buffer)
-{  
-   off_t disk_offset = (off_t)sect * SECTOR_SIZE;
+/* Create the virtual disk */
+static int disk_create(struct pcmcia_disk_data *d)
+{
+   if (d->base_filename) {
+      if (disk_create_cow(d) == -1)
+         return(-1);
+   } else {
+      if (disk_create_raw(d) == -1)
+         return(-1);
+   }
 
-#if DEBUG_WRITE
-   vm_log(d->vm,d->dev.name,"writing sector 0x%8.8x\n",sect);
-#endif
+   /* Map the disk files, fall back to file I/O on failure */
+   if (d->vm->pcmcia_disk_mmap && (d->tot_sect != 0)) {
+      d->map = disk_map_file(d->fd,d->map_size,PROT_READ|PROT_WRITE);
 
-   if (lseek(d->fd,disk_offset,SEEK_SET) == -1) {
-      perror("write_sector: lseek");
-      return(-1);
+      if (d->map && (d->base_fd != -1)) {
+         d->base_map = disk_map_file(d->base_fd,d->base_map_size,PROT_READ);
+
+         if (!d->base_map) {
+            munmap(d->map,d->map_size);
+            d->map = NULL;
+         }
+      }
+
+      if (!d->map)
+         vm_log(d->vm,d->dev.name,"unable to map disk, using file I/O.\n");
    }
-   
-   if (write(d->fd,buffer,SECTOR_SIZE) != SECTOR_SIZE) {
-      perror("write_sector: write");
-      return(-1);
+
+   /* Load the overlay bitmap */
+   if (d->base_filename) {
+      if (d->map) {
+         d->cow_bitmap = d->map + d->cow_bitmap_offset;
+      } else {
+         if (!(d->cow_bitmap = malloc(d->cow_bitmap_size)))
+            return(-1);
+
+         if (disk_file_read(d->fd,NULL,d->cow_bitmap_offset,
+                            d->cow_bitmap,d->cow_bitmap_size) == -1)
+            return(-1);
+      }
    }
 
    return(0);
 }
 
+/* Close the disk files */
+static void disk_close(struct pcmcia_disk_data *d)
+{
+   if (d->map) {
+      munmap(d->map,d->map_size);
+   } else {
+      free(d->cow_bitmap);
+   }
+
+   if (d->base_map) munmap(d->base_map,d->base_map_size);
+   if (d->base_fd != -1) close(d->base_fd);
+   if (d->fd != -1) close(d->fd);
+}
+
 /* Identify PCMCIA device (ATA command 0xEC) */
 static void ata_identify_device(struct pcmcia_disk_data *d)
 {
@@ -461,9 +883,9 @@ static void ata_cmd_read_callback(struct pcmcia_disk_data *d)
       return;
    }
 
-   /* Read the next sector */
+   /* Next sector (the whole command is in the sector cache) */
    d->sect_pos++;
-   disk_read_sector(d,d->sect_pos,d->data_buffer);
+   d->data_buffer += SECTOR_SIZE;
    d->ata_status = ATA_STATUS_RDY|ATA_STATUS_DSC|ATA_STATUS_DRQ;
 }
 
@@ -471,7 +893,7 @@ static void ata_cmd_read_callback(struct pcmcia_disk_data *d)
 static void ata_cmd_write_callback(struct pcmcia_disk_data *d)
 {
    /* Write the sector */
-   disk_write_sector(d,d->sect_pos,d->data_buffer);
+   disk_cache_write(d,d->sect_pos,d->data_buffer);
    d->ata_status = ATA_STATUS_RDY|ATA_STATUS_DSC|ATA_STATUS_DRQ;
    d->sect_pos++;
 
@@ -490,6 +912,7 @@ static void ata_handle_cmd(struct pcmcia_disk_data *d)
 #endif
 
    d->data_pos = 0;
+   d->data_buffer = d->sect_buffer;
 
    switch(d->ata_cmd) {
       case ATA_CMD_IDENT_DEVICE:
@@ -505,7 +928,7 @@ static void ata_handle_cmd(struct pcmcia_disk_data *d)
             d->sect_remaining = 256;
 
          ata_set_sect_pos(d);
-         disk_read_sector(d,d->sect_pos,d->data_buffer);
+         d->data_buffer = disk_cache_read(d,d->sect_pos,d->sect_remaining);
          d->ata_cmd_callback = ata_cmd_read_callback;
          d->ata_status = ATA_STATUS_RDY|ATA_STATUS_DSC|ATA_STATUS_DRQ;
          break;
@@ -517,6 +940,7 @@ static void ata_handle_cmd(struct pcmcia_disk_data *d)
             d->sect_remaining = 256;
 
          ata_set_sect_pos(d);
+         disk_cache_write_start(d,d->sect_pos,d->sect_remaining);
          d->ata_cmd_callback = ata_cmd_write_callback;
          d->ata_status = ATA_STATUS_RDY|ATA_STATUS_DSC|ATA_STATUS_DRQ;
          break;
@@ -708,24 +1132,35 @@ void dev_pcmcia_disk_shutdown(vm_instance_t *vm,struct pcmcia_disk_data *d)
       /* Remove the device */
       dev_remove(vm,&d->dev);
 
-      /* Close disk file */
-      if (d->fd != -1) close(d->fd);
+      /* Write back cached sectors */
+      if (d->flush_tid != 0)
+         ptask_remove(d->flush_tid);
 
-      /* Free filename */
+      if (d->fd != -1)
+         disk_flush(d,TRUE);
+
+      /* Close disk files */
+      disk_close(d);
+
+      /* Free filenames and sector cache */
+      free(d->base_filename);
       free(d->filename);
+      free(d->cache);
+      pthread_mutex_destroy(&d->cache_lock);
       
       /* Free the structure itself */
       free(d);
    }
 }
 
-/* Initialize a PCMCIA disk */
+/* Initialize a PCMCIA disk (disk_id: 0 for disk0, 1 for disk1) */
 vm_obj_t *dev_pcmcia_disk_init(vm_instance_t *vm,char *name,
                                m_uint64_t paddr,m_uint32_t len,
-                               u_int disk_size,int mode)
+                               u_int disk_id,int mode)
 {
    struct pcmcia_disk_data *d;
    m_uint32_t tot_sect;
+   struct stat st;
 
    /* allocate the private data structure */
    if (!(d = malloc(sizeof(*d)))) {
@@ -740,22 +1175,48 @@ vm_obj_t *dev_pcmcia_disk_init(vm_instance_t *vm,char *name,
    d->vm_obj.data = d;
    d->vm_obj.shutdown = (vm_shutdown_t)dev_pcmcia_disk_shutdown;
    d->fd = -1;
+   d->base_fd = -1;
+   pthread_mutex_init(&d->cache_lock,NULL);
 
    if (!(d->filename = vm_build_filename(vm,name))) {
       fprintf(stderr,"PCMCIA: unable to create filename.\n");
       goto err_filename;
    }
 
+   if (!(d->cache = malloc(DISK_CACHE_SECTORS * SECTOR_SIZE))) {
+      fprintf(stderr,"PCMCIA: unable to create sector cache.\n");
+      goto err_cache;
+   }
+
    /* Data buffer offset in mapped memory */
    d->data_offset = 0x80200;
+   d->data_buffer = d->sect_buffer;
    d->ata_status  = ATA_STATUS_RDY|ATA_STATUS_DSC;
 
    /* Compute the number of cylinders given a disk size in Mb */
-   tot_sect = ((m_uint64_t)disk_size * 1048576) / SECTOR_SIZE;
+   tot_sect = ((m_uint64_t)vm->pcmcia_disk_size[disk_id] * 1048576) / 
+      SECTOR_SIZE;
+
+   /* With a base image, the disk size is the size of the image */
+   if (vm->pcmcia_disk_base[disk_id] != NULL) {
+      if (!(d->base_filename = strdup(vm->pcmcia_disk_base[disk_id])))
+         goto err_disk_create;
+
+      if (stat(d->base_filename,&st) == -1) {
+         vm_error(vm,"%s: unable to access base image '%s'.\n",
+                  name,d->base_filename);
+         goto err_disk_create;
+      }
+
+      tot_sect = st.st_size / SECTOR_SIZE;
+      vm_log(vm,name,"copy-on-write overlay of base image '%s'\n",
+             d->base_filename);
+   }
 
    d->nr_heads = DISK_NR_HEADS;
    d->sects_per_track = DISK_SECTS_PER_TRACK;
    d->nr_cylinders = tot_sect / (d->nr_heads * d->sects_per_track);
+   d->tot_sect = d->nr_heads * d->nr_cylinders * d->sects_per_track;
 
    vm_log(vm,name,"C/H/S settings = %u/%u/%u\n",
           d->nr_cylinders,d->nr_heads,d->sects_per_track);
@@ -764,6 +1225,10 @@ vm_obj_t *dev_pcmcia_disk_init(vm_instance_t *vm,char *name,
    if (disk_create(d) == -1)
       goto err_disk_create;
 
+   /* Write back cached sectors when the disk is idle */
+   d->flush_tid = ptask_add_group(vm,DISK_FLUSH_PERIOD,
+                                  (ptask_callback)disk_flush_task,d,NULL);
+
    dev_init(&d->dev);
    d->dev.name      = name;
    d->dev.priv_data = d;
@@ -782,8 +1247,13 @@ vm_obj_t *dev_pcmcia_disk_init(vm_instance_t *vm,char *name,
    return(&d->vm_obj);
 
  err_disk_create:
+   disk_close(d);
+   free(d->base_filename);
+   free(d->cache);
+ err_cache:
    free(d->filename);
  err_filename:
+   pthread_mutex_destroy(&d->cache_lock);
    free(d);
    return NULL;
 }
@@ -1250,6 +1250,10 @@ static void *vtty_thread_main(void *arg)
             if (vtty->read_notifier != NULL)
                vtty->read_notifier(vtty);
 
+            /* Wake up the CPU (for UARTs polling their input) */
+            if (vtty->vm != NULL)
+               cpu_idle_break_wait(vtty->vm->boot_cpu);
+
             vtty->input_pending = FALSE;
          }
 
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <assert.h>
 
@@ -19,6 +20,10 @@
 #include "memory.h"
 #include "device.h"
 
+#ifdef USE_UNSTABLE
+#include "mem_merge.h"
+#endif
+
 #define DEBUG_DEV_ACCESS  0
 
 /* Get device by ID */
@@ -45,14 +50,12 @@ struct vdevice *dev_get_by_name(vm_instance_t *vm,char *name)
    return NULL;
 }
 
-/* Device lookup by physical address */
-struct vdevice *dev_lookup(vm_instance_t *vm,m_uint64_t phys_addr,int cached)
+/* Device lookup by physical address (walk through the device list) */
+static struct vdevice *dev_lookup_list(vm_instance_t *vm,m_uint64_t phys_addr,
+                                       int cached)
 {
    struct vdevice *dev;
    
-   if (!vm)
-      return NULL;
-
    for(dev=vm->dev_list;dev;dev=dev->next) {
       if (cached && !(dev->flags & VDEVICE_FLAG_CACHING))
          continue;
@@ -65,6 +68,35 @@ struct vdevice *dev_lookup(vm_instance_t *vm,m_uint64_t phys_addr,int cached)
    return NULL;
 }
 
+/* Device lookup by physical address */
+struct vdevice *dev_lookup(vm_instance_t *vm,m_uint64_t phys_addr,int cached)
+{
+   struct vdevice *dev;
+   m_uint8_t *chunk,id;
+
+   if (!vm)
+      return NULL;
+
+   /* Use the physical address map if this page is described */
+   if (likely(vm->dev_map && (phys_addr < VM_DEV_MAP_LIMIT)) &&
+       (chunk = vm->dev_map[phys_addr >> VM_DEV_MAP_CHUNK_SHIFT]))
+   {
+      id = chunk[(phys_addr >> VM_PAGE_SHIFT) & (VM_DEV_MAP_PAGES - 1)];
+
+      if (id == VM_DEV_MAP_NONE)
+         return NULL;
+
+      if ((id != VM_DEV_MAP_MULTI) && (dev = vm->dev_array[id])) {
+         if (cached && !(dev->flags & VDEVICE_FLAG_CACHING))
+            return NULL;
+
+         return dev;
+      }
+   }
+
+   return(dev_lookup_list(vm,phys_addr,cached));
+}
+
 /* Find the next device after the specified address */
 struct vdevice *dev_lookup_next(vm_instance_t *vm,m_uint64_t phys_addr,
                                 struct vdevice *dev_start,int cached)
@@ -86,6 +118,131 @@ struct vdevice *dev_lookup_next(vm_instance_t *vm,m_uint64_t phys_addr,
    return NULL;
 }
 
+/* 
+ * Get the physical map entry of a page: a device id if a single device 
+ * covers the whole page.
+ */
+static m_uint8_t dev_map_get_entry(vm_instance_t *vm,m_uint64_t paddr)
+{
+   struct vdevice *dev,*found = NULL;
+   m_uint64_t page_end = paddr + VM_PAGE_SIZE;
+
+   /* devices are ordered by physical addresses */
+   for(dev=vm->dev_list;dev && (dev->phys_addr < page_end);dev=dev->next) {
+      if ((dev->phys_addr + dev->phys_len) <= paddr)
+         continue;
+
+      if (found != NULL)
+         return(VM_DEV_MAP_MULTI);
+
+      found = dev;
+   }
+
+   if (!found)
+      return(VM_DEV_MAP_NONE);
+
+   if ((found->phys_addr > paddr) ||
+       ((found->phys_addr + found->phys_len) < page_end))
+      return(VM_DEV_MAP_MULTI);
+
+   return(found->id);
+}
+
+/* Update the physical address map for the specified range */
+int dev_map_update(vm_instance_t *vm,m_uint64_t paddr,m_uint64_t len)
+{
+   m_uint64_t page,end;
+   m_uint8_t *chunk;
+   u_int i;
+
+   if (!len)
+      return(0);
+
+   if (!vm->dev_map) {
+      vm->dev_map = calloc(VM_DEV_MAP_CHUNKS,sizeof(m_uint8_t *));
+
+      if (!vm->dev_map) {
+         vm_error(vm,"unable to create physical address map.\n");
+         return(-1);
+      }
+   }
+
+   end = m_min(paddr + len,VM_DEV_MAP_LIMIT);
+
+   for(page=paddr&VM_PAGE_MASK;page<end;page+=VM_PAGE_SIZE) {
+      i = page >> VM_DEV_MAP_CHUNK_SHIFT;
+
+      /* missing chunks are handled with the device list */
+      if (!(chunk = vm->dev_map[i])) {
+         if (!(chunk = malloc(VM_DEV_MAP_PAGES)))
+            return(-1);
+
+         memset(chunk,VM_DEV_MAP_NONE,VM_DEV_MAP_PAGES);
+         vm->dev_map[i] = chunk;
+      }
+
+      chunk[(page >> VM_PAGE_SHIFT) & (VM_DEV_MAP_PAGES - 1)] = 
+         dev_map_get_entry(vm,page);
+   }
+
+   return(0);
+}
+
+/* Free the physical address map */
+void dev_map_free(vm_instance_t *vm)
+{
+   u_int i;
+
+   if (vm->dev_map != NULL) {
+      for(i=0;i<VM_DEV_MAP_CHUNKS;i++)
+         free(vm->dev_map[i]);
+
+      free(vm->dev_map);
+      vm->dev_map = NULL;
+   }
+}
+
+/* 
+ * Compare device lookup with the physical map and with the device list,
+ * on addresses spread over all devices (times in usec).
+ */
+int dev_lookup_bench(vm_instance_t *vm,u_int count,
+                     m_tmcnt_t *map_time,m_tmcnt_t *list_time)
+{
+   m_uint64_t addr[256];
+   struct vdevice *dev;
+   volatile u_long sink = 0;
+   m_tmcnt_t start;
+   u_int i,n = 0;
+   int errors = 0;
+
+   for(dev=vm->dev_list;dev && (n < 256);dev=dev->next)
+      if (dev->phys_len != 0) {
+         addr[n++] = dev->phys_addr;
+         addr[n++] = dev->phys_addr + dev->phys_len - 1;
+      }
+
+   if (!n)
+      return(-1);
+
+   /* Check that both methods give the same results */
+   for(i=0;i<n;i++)
+      if (dev_lookup(vm,addr[i],FALSE) != dev_lookup_list(vm,addr[i],FALSE))
+         errors++;
+
+   start = m_gettime_usec();
+   for(i=0;i<count;i++)
+      sink += (u_long)dev_lookup(vm,addr[i % n],FALSE);
+   *map_time = m_gettime_usec() - start;
+
+   start = m_gettime_usec();
+   for(i=0;i<count;i++)
+      sink += (u_long)dev_lookup_list(vm,addr[i % n],FALSE);
+   *list_time = m_gettime_usec() - start;
+
+   return(errors);
+}
+
 /* Initialize a device */
 void dev_init(struct vdevice *dev)
 {
@@ -136,6 +293,19 @@ void dev_remove(vm_instance_t *vm,struct vdevice *dev)
       }
    }
 
+#ifdef USE_UNSTABLE
+   /* RAM backed by huge pages (the file is a ghost image) */
+   if (dev->flags & VDEVICE_FLAG_HUGE) {
+      memzone_unmap_huge((void *)dev->host_addr,dev->phys_len);
+
+      if (dev->fd != -1)
+         close(dev->fd);
+
+      dev_init(dev);
+      return;
+   }
+#endif
+
    if (dev->fd != -1) {
       /* Unmap memory mapped file */
       if (dev->host_addr) {
@@ -184,6 +354,15 @@ void dev_show_list(vm_instance_t *vm)
       dev_show(dev);
 
    printf("\n");
+
+   for(dev=vm->dev_list;dev;dev=dev->next) {
+      if ((dev->flags & VDEVICE_FLAG_SPARSE) && 
+          !(dev->flags & VDEVICE_FLAG_REMAP))
+      {
+         dev_sparse_show_info(dev);
+         printf("\n");
+      }
+   }
 }
 
 /* device access function */
@@ -228,6 +407,38 @@ struct vdevice *dev_remap(char *name,struct vdevice *orig,
    return dev;
 }
 
+#ifdef USE_UNSTABLE
+/* 
+ * Allocate the RAM of a device with huge pages. If a file is specified,
+ * its content is copied into the RAM.
+ */
+static int dev_create_huge_ram(vm_instance_t *vm,struct vdevice *dev,
+                               char *filename)
+{
+   int mode = vm->huge_pages;
+   u_char *ram_ptr;
+   off_t fsize;
+
+   if (filename) {
+      dev->fd = memzone_open_huge_file(filename,dev->phys_len,&ram_ptr,
+                                       &fsize,&mode);
+      if (dev->fd == -1)
+         return(-1);
+   } else {
+      if (!(ram_ptr = memzone_map_huge(dev->phys_len,PROT_READ|PROT_WRITE,
+                                       &mode)))
+         return(-1);
+   }
+
+   dev->host_addr = (m_iptr_t)ram_ptr;
+   dev->flags |= VDEVICE_FLAG_HUGE;
+
+   vm_log(vm,"DEVICE","%s: %u Mb allocated with huge pages (%s).\n",
+          dev->name,dev->phys_len >> 20,memzone_huge_mode_str(mode));
+   return(0);
+}
+#endif
+
 /* Create a RAM device */
 struct vdevice *dev_create_ram(vm_instance_t *vm,char *name,
                                int sparse,char *filename,
@@ -243,6 +454,20 @@ struct vdevice *dev_create_ram(vm_instance_t *vm,char *name,
    dev->phys_len = len;
    dev->flags = VDEVICE_FLAG_CACHING;
 
+#ifdef USE_UNSTABLE
+   /* Huge pages are only used for anonymous memory */
+   if (!sparse && !filename && vm->huge_pages) {
+      if (dev_create_huge_ram(vm,dev,NULL) == -1) {
+         perror("dev_create_ram: huge pages");
+         free(dev);
+         return NULL;
+      }
+
+      vm_bind_device(vm,dev);
+      return dev;
+   }
+#endif
+
    if (!sparse) {
       if (filename) {
          dev->fd = memzone_create_file(filename,dev->phys_len,&ram_ptr);
@@ -277,6 +502,7 @@ dev_create_ghost_ram(vm_instance_t *vm,char *name,int sparse,char *filename,
 {
    struct vdevice *dev;
    u_char *ram_ptr;
+   int res;
 
    if (!(dev = dev_create(name)))
       return NULL;
@@ -285,6 +511,20 @@ dev_create_ghost_ram(vm_instance_t *vm,char *name,int sparse,char *filename,
    dev->phys_len = len;
    dev->flags = VDEVICE_FLAG_CACHING|VDEVICE_FLAG_GHOST;
 
+#ifdef USE_UNSTABLE
+   /* Private copy of the ghost image in huge pages */
+   if (!sparse && vm->huge_pages) {
+      if (dev_create_huge_ram(vm,dev,filename) == -1) {
+         perror("dev_create_ghost_ram: huge pages");
+         free(dev);
+         return NULL;
+      }
+
+      vm_bind_device(vm,dev);
+      return dev;
+   }
+#endif
+
    if (!sparse) {
       dev->fd = memzone_open_cow_file(filename,dev->phys_len,&ram_ptr);
       if (dev->fd == -1) {
@@ -298,7 +538,13 @@ dev_create_ghost_ram(vm_instance_t *vm,char *name,int sparse,char *filename,
          return NULL;
       }
    } else {
-      if (vm_ghost_image_get(filename,&ram_ptr,&dev->fd) == -1) {
+#ifdef USE_UNSTABLE
+      res = vm_ghost_image_get(filename,vm->huge_pages,&ram_ptr,&dev->fd);
+#else
+      res = vm_ghost_image_get(filename,&ram_ptr,&dev->fd);
+#endif
+
+      if (res == -1) {
          free(dev);
          return NULL;
       }
@@ -364,15 +610,30 @@ int dev_sparse_shutdown(struct vdevice *dev)
    if (!(dev->flags & VDEVICE_FLAG_SPARSE))
       return(-1);
 
+#ifdef USE_UNSTABLE
+   /* Release the pages shared with other VMs */
+   if (dev->sparse_map != NULL) {
+      u_int i,nr_pages;
+
+      nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+      for(i=0;i<nr_pages;i++)
+         if (dev->sparse_map[i] & VDEVICE_PTE_SHARED)
+            mem_merge_put_page((void *)(dev->sparse_map[i] & VM_PAGE_MASK));
+   }
+#endif
+
    free(dev->sparse_map);
+   free(dev->sparse_hash);
    dev->sparse_map = NULL;
+   dev->sparse_hash = NULL;
    return(0);
 }
 
 /* Show info about a sparse device */
 int dev_sparse_show_info(struct vdevice *dev)
 {
-   u_int i,nr_pages,dirty_pages;
+   u_int i,nr_pages,dirty_pages,shared_pages,zero_pages;
 
    printf("Sparse information for device '%s':\n",dev->name);
 
@@ -387,13 +648,26 @@ int dev_sparse_show_info(struct vdevice *dev)
    }
 
    nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
-   dirty_pages = 0;
+   dirty_pages = shared_pages = zero_pages = 0;
   
-   for(i=0;i<nr_pages;i++)
+   for(i=0;i<nr_pages;i++) {
       if (dev->sparse_map[i] & VDEVICE_PTE_DIRTY)
          dirty_pages++;
+      else if (dev->sparse_map[i] & VDEVICE_PTE_SHARED) {
+#ifdef USE_UNSTABLE
+         if (mem_merge_is_zero_page((void *)(dev->sparse_map[i] & 
+                                             VM_PAGE_MASK)))
+            zero_pages++;
+         else
+#endif
+            shared_pages++;
+      }
+   }
 
-   printf("%u dirty pages on a total of %u pages.\n",dirty_pages,nr_pages);
+   printf("%u dirty pages, %u pages shared with other VMs "
+          "on a total of %u pages.\n",dirty_pages,shared_pages,nr_pages);
+   printf("%u zero pages reclaimed (%u Kb).\n",
+          zero_pages,zero_pages * (VM_PAGE_SIZE / 1024));
    return(0);
 }
 
@@ -408,40 +682,59 @@ m_iptr_t dev_sparse_get_host_addr(vm_instance_t *vm,struct vdevice *dev,
    ptr = dev->sparse_map[offset];
    *cow = 0;
 
-   /* 
-    * If the device is not in COW mode, allocate a host page if the physical
-    * page is requested for the first time.
-    */
-   if (!dev->host_addr) {
-      if (!(ptr & VDEVICE_PTE_DIRTY)) {
-         ptr = (m_iptr_t)vm_alloc_host_page(vm);
-         assert(ptr);
-
-         dev->sparse_map[offset] = ptr | VDEVICE_PTE_DIRTY;
-         return(ptr);
-      } 
-
+   if (ptr & VDEVICE_PTE_DIRTY)
       return(ptr & VM_PAGE_MASK);
-   }
 
    /* 
-    * We have a "ghost" base. We apply the copy-on-write (COW) mechanism 
-    * ourselves. 
+    * "Ghost" pages and pages shared with other VMs are read-only: we apply
+    * the copy-on-write (COW) mechanism ourselves.
     */
-   if (ptr & VDEVICE_PTE_DIRTY)
+   if ((dev->host_addr || (ptr & VDEVICE_PTE_SHARED)) && (op_type == MTS_READ))
+   {
+      *cow = 1;
       return(ptr & VM_PAGE_MASK);
+   }
 
-   if (op_type == MTS_READ) {
-      *cow = 1;
+   VM_MEM_LOCK(vm);
+
+   /* The page may have been allocated or shared in the meantime */
+   ptr = dev->sparse_map[offset];
+
+   if (ptr & VDEVICE_PTE_DIRTY) {
+      VM_MEM_UNLOCK(vm);
       return(ptr & VM_PAGE_MASK);
    }
 
-   /* Write attempt on a "ghost" page. Duplicate it */
    ptr_new = (m_iptr_t)vm_alloc_host_page(vm);
    assert(ptr_new);
 
+   /* 
+    * If the device is not in COW mode, the host page is simply allocated
+    * when the physical page is requested for the first time.
+    */
+   if (!dev->host_addr && !(ptr & VDEVICE_PTE_SHARED)) {
+      dev->sparse_map[offset] = ptr_new | VDEVICE_PTE_DIRTY;
+      VM_MEM_UNLOCK(vm);
+      return(ptr_new);
+   }
+
+   /* Write attempt on a "ghost" or shared page. Duplicate it */
    memcpy((void *)ptr_new,(void *)(ptr & VM_PAGE_MASK),VM_PAGE_SIZE);
    dev->sparse_map[offset] = ptr_new | VDEVICE_PTE_DIRTY;
+   VM_MEM_UNLOCK(vm);
+
+#ifdef USE_UNSTABLE
+   if (ptr & VDEVICE_PTE_SHARED) {
+      /* Virtual mappings of the shared page must be dropped */
+      if (vm->cpu_group != NULL)
+         cpu_group_mts_invalidate_hpa(vm->cpu_group,ptr & VM_PAGE_MASK);
+
+      mem_merge_put_page((void *)(ptr & VM_PAGE_MASK));
+   }
+#endif
+
+   /* The read-only page may be cached for physmem read accesses */
+   physmem_tlb_invalidate(vm,paddr);
    return(ptr_new);
 }
 
@@ -19,8 +19,24 @@
 #define VDEVICE_FLAG_SYNC         0x08  /* Forced sync */
 #define VDEVICE_FLAG_SPARSE       0x10  /* Sparse device */
 #define VDEVICE_FLAG_GHOST        0x20  /* Ghost device */
+#define VDEVICE_FLAG_HUGE         0x40  /* RAM backed by huge pages */
 
-#define VDEVICE_PTE_DIRTY  0x01
+/* Sparse map entries: host page address and flags */
+#define VDEVICE_PTE_DIRTY   0x01  /* Private page */
+#define VDEVICE_PTE_SHARED  0x02  /* Page shared with other VMs (read-only) */
+
+/* 
+ * Physical address map: device id for each page, in chunks of 4 Mb 
+ * allocated on demand. Addresses above 64 Gb use the device list.
+ */
+#define VM_DEV_MAP_ADDR_BITS    36
+#define VM_DEV_MAP_CHUNK_SHIFT  22
+#define VM_DEV_MAP_CHUNKS   (1 << (VM_DEV_MAP_ADDR_BITS - VM_DEV_MAP_CHUNK_SHIFT))
+#define VM_DEV_MAP_PAGES    (1 << (VM_DEV_MAP_CHUNK_SHIFT - VM_PAGE_SHIFT))
+#define VM_DEV_MAP_LIMIT    (1ULL << VM_DEV_MAP_ADDR_BITS)
+
+#define VM_DEV_MAP_NONE     0xFF  /* No device in this page */
+#define VM_DEV_MAP_MULTI    0xFE  /* Several devices: use the device list */
 
 typedef void *(*dev_handler_t)(cpu_gen_t *cpu,struct vdevice *dev,
                                m_uint32_t offset,u_int op_size,u_int op_type,
@@ -38,6 +54,7 @@ struct vdevice {
    int fd;
    dev_handler_t handler;
    m_iptr_t *sparse_map;
+   m_uint64_t *sparse_hash;
    struct vdevice *next,**pprev;
 };
 
@@ -108,6 +125,16 @@ struct vdevice *dev_lookup(vm_instance_t *vm,m_uint64_t phys_addr,int cached);
 struct vdevice *dev_lookup_next(vm_instance_t *vm,m_uint64_t phys_addr,
                                 struct vdevice *dev_start,int cached);
 
+/* Update the physical address map for the specified range */
+int dev_map_update(vm_instance_t *vm,m_uint64_t paddr,m_uint64_t len);
+
+/* Free the physical address map */
+void dev_map_free(vm_instance_t *vm);
+
+/* Compare device lookup with the physical map and with the device list */
+int dev_lookup_bench(vm_instance_t *vm,u_int count,
+                     m_tmcnt_t *map_time,m_tmcnt_t *list_time);
+
 /* Initialize a device */
 void dev_init(struct vdevice *dev);
 
@@ -154,6 +181,9 @@ int dev_sparse_init(struct vdevice *dev);
 /* Shutdown sparse device structures */
 int dev_sparse_shutdown(struct vdevice *dev);
 
+/* Show info about a sparse device */
+int dev_sparse_show_info(struct vdevice *dev);
+
 /* Get an host address for a sparse device */
 m_iptr_t dev_sparse_get_host_addr(vm_instance_t *vm,struct vdevice *dev,
                                   m_uint64_t paddr,u_int op_type,int *cow);
@@ -249,10 +279,10 @@ int dev_c7200_sram_init(vm_instance_t *vm,char *name,
                         m_uint64_t paddr,m_uint32_t len,
                         struct pci_bus *pci_bus,int pci_device);
 
-/* Initialize a PCMCIA disk */
+/* Initialize a PCMCIA disk (disk_id: 0 for disk0, 1 for disk1) */
 vm_obj_t *dev_pcmcia_disk_init(vm_instance_t *vm,char *name,
                                m_uint64_t paddr,m_uint32_t len,
-                               u_int disk_size,int mode);
+                               u_int disk_id,int mode);
 
 /* Get the device associated with a PCMCIA disk object */
 struct vdevice *dev_pcmcia_disk_get_device(vm_obj_t *obj);
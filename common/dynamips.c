@@ -26,6 +26,9 @@
 
 #ifdef USE_UNSTABLE
 #include "tcb.h"
+#include "tc_cache.h"
+#include "ios_unpack.h"
+#include "mips64_mem.h"
 #endif
 
 #include "mips64_exec.h"
@@ -193,7 +196,8 @@ static void show_usage(vm_instance_t *vm,int argc,char *argv[])
           "(default: 7200)\n\n"
           "  -l <log_file>      : Set logging file (default is %s)\n"
           "  -j                 : Disable the JIT compiler, very slow\n"
-          "  --idle-pc <pc>     : Set the idle PC (default: disabled)\n"
+          "  --idle-pc <pc>     : Set the idle PC (default: disabled, "
+          "\"auto\" to detect it)\n"
           "  --timer-itv <val>  : Timer IRQ interval check (default: %u)\n"
           "\n"
           "  -i <instance>      : Set instance ID\n"
@@ -225,15 +229,45 @@ static void show_usage(vm_instance_t *vm,int argc,char *argv[])
           "(default: %u Mb)\n"
           "  --disk1 <size>     : Set PCMCIA ATA disk1: size "
           "(default: %u Mb)\n"
+          "  --disk0-base <file>: Use disk0 as a copy-on-write overlay "
+          "of <file>\n"
+          "  --disk1-base <file>: Use disk1 as a copy-on-write overlay "
+          "of <file>\n"
+          "  --disk-mmap        : Map PCMCIA ATA disk files in memory\n"
           "\n"
           "  --noctrl           : Disable ctrl+] monitor console\n"
           "  --notelnetmsg      : Disable message when using tcp console/aux\n"
           "  --filepid filename : Store dynamips pid in a file\n"
           "  --console-binding-addr: binding address for tcp console/aux\n"
+          "  --rxl-workers <n>  : Number of NIO RX listener threads "
+          "(default: 1)\n"
+          "  --rxl-affinity <cpu,...> : Bind NIO RX listener threads to CPUs\n"
+          "  --ptask-workers <n> : Number of periodic task threads "
+          "(default: 1)\n"
+          "  --tickless          : Don't send timer ticks to idle CPUs\n"
+#ifdef USE_UNSTABLE
+          "  --jit-cache <dir>   : Keep translated code in a persistent cache\n"
+          "  --jit-workers <n>   : Number of background JIT threads "
+          "(default: 1, 0: disabled)\n"
+          "  --jit-threshold <n> : Executions of a page before compiling it "
+          "(default: 16)\n"
+          "  --mts-cache <n>     : Number of MIPS MTS cache entries "
+          "(default: %u)\n"
+          "  --mts-ways <n>      : Ways of the MIPS MTS cache: 1, 2 or 4 "
+          "(default: %u)\n"
+          "  --unpack-cache <dir> : Keep self-decompressed IOS images in "
+          "a cache\n"
+          "  --huge-pages <mode> : Huge pages for RAM and JIT code "
+          "(0: no, 1: THP, 2: hugetlbfs)\n"
+#endif
           "\n",
           LOGFILE_DEFAULT_NAME,VM_TIMER_IRQ_CHECK_ITV,
           vm->ram_size,vm->rom_size,vm->nvram_size,vm->conf_reg_setup,
-          vm->clock_divisor,vm->pcmcia_disk_size[0],vm->pcmcia_disk_size[1]);
+          vm->clock_divisor,vm->pcmcia_disk_size[0],vm->pcmcia_disk_size[1]
+#ifdef USE_UNSTABLE
+          ,MTS_CACHE_DEF_ENTRIES,MTS_CACHE_DEF_WAYS
+#endif
+          );
 
    if (vm->platform->cli_show_options != NULL)
       vm->platform->cli_show_options(vm);
@@ -346,6 +380,48 @@ static void cli_load_plugins(int argc,char *argv[])
    }
 }
 
+/* Find a long option in the command line ("--opt value" or "--opt=value") */
+static char *cli_find_long_option(int argc,char *argv[],char *opt)
+{
+   size_t len = strlen(opt);
+   int i;
+
+   for(i=1;i<argc;i++) {
+      if (strncmp(argv[i],opt,len))
+         continue;
+
+      if (argv[i][len] == '=')
+         return(&argv[i][len+1]);
+
+      if (argv[i][len] == 0) {
+         if (argv[i+1] != NULL)
+            return(argv[i+1]);
+
+         fprintf(stderr,"Error: option '%s': no argument specified.\n",opt);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   return NULL;
+}
+
+/* 
+ * Setup the NIO RX listener (must be done before parsing the remaining 
+ * options, since they may create NIO).
+ */
+static void cli_setup_rxl(int argc,char *argv[])
+{
+   char *str;
+
+   if ((str = cli_find_long_option(argc,argv,"--rxl-workers")) &&
+       (netio_rxl_set_workers(atoi(str)) == -1))
+      exit(EXIT_FAILURE);
+
+   if ((str = cli_find_long_option(argc,argv,"--rxl-affinity")) &&
+       (netio_rxl_set_affinity(str) == -1))
+      exit(EXIT_FAILURE);
+}
+
 /* Determine the platform (Cisco 3600, 7200). Default is Cisco 7200 */
 static vm_platform_t *cli_get_platform_type(int argc,char *argv[])
 {
@@ -364,6 +440,9 @@ static vm_platform_t *cli_get_platform_type(int argc,char *argv[])
 static struct option cmd_line_lopts[] = {
    { "disk0"      , 1, NULL, OPT_DISK0_SIZE },
    { "disk1"      , 1, NULL, OPT_DISK1_SIZE },
+   { "disk0-base" , 1, NULL, OPT_DISK0_BASE },
+   { "disk1-base" , 1, NULL, OPT_DISK1_BASE },
+   { "disk-mmap"  , 0, NULL, OPT_DISK_MMAP },
    { "idle-pc"    , 1, NULL, OPT_IDLE_PC },
    { "timer-itv"  , 1, NULL, OPT_TIMER_ITV },
    { "vm-debug"   , 1, NULL, OPT_VM_DEBUG },
@@ -375,6 +454,19 @@ static struct option cmd_line_lopts[] = {
    { "startup-config", 1, NULL, OPT_STARTUP_CONFIG_FILE },
    { "private-config", 1, NULL, OPT_PRIVATE_CONFIG_FILE },
    { "console-binding-addr", 1, NULL, OPT_CONSOLE_BINDING_ADDR },
+   { "rxl-workers", 1, NULL, OPT_RXL_WORKERS },
+   { "rxl-affinity", 1, NULL, OPT_RXL_AFFINITY },
+   { "ptask-workers", 1, NULL, OPT_PTASK_WORKERS },
+   { "tickless", 0, NULL, OPT_TIMER_TICKLESS },
+#ifdef USE_UNSTABLE
+   { "jit-cache", 1, NULL, OPT_JIT_CACHE },
+   { "jit-workers", 1, NULL, OPT_JIT_WORKERS },
+   { "jit-threshold", 1, NULL, OPT_JIT_THRESHOLD },
+   { "mts-cache", 1, NULL, OPT_MTS_CACHE },
+   { "mts-ways", 1, NULL, OPT_MTS_WAYS },
+   { "unpack-cache", 1, NULL, OPT_UNPACK_CACHE },
+   { "huge-pages", 1, NULL, OPT_HUGE_PAGES },
+#endif
    { NULL         , 0, NULL, 0 },
 };
 
@@ -480,6 +572,25 @@ static int parse_std_cmd_line(int argc,char *argv[])
                    vm->pcmcia_disk_size[1]);
             break;
 
+         /* PCMCIA disk base images (copy-on-write) */
+         case OPT_DISK0_BASE:
+            if (vm_set_disk_base(vm,0,optarg) == -1)
+               goto exit_failure;
+            printf("PCMCIA ATA disk0 base image set to %s.\n",optarg);
+            break;
+
+         case OPT_DISK1_BASE:
+            if (vm_set_disk_base(vm,1,optarg) == -1)
+               goto exit_failure;
+            printf("PCMCIA ATA disk1 base image set to %s.\n",optarg);
+            break;
+
+         /* Memory-mapped PCMCIA disks */
+         case OPT_DISK_MMAP:
+            vm->pcmcia_disk_mmap = TRUE;
+            printf("PCMCIA ATA disks are memory-mapped.\n");
+            break;
+
          case OPT_NOCTRL:
             vtty_set_ctrlhandler(0); /* Ignore ctrl ] */
             printf("Block ctrl+] access to monitor console.\n");
@@ -557,6 +668,12 @@ static int parse_std_cmd_line(int argc,char *argv[])
 
          /* Idle PC */
          case OPT_IDLE_PC:
+            if (!strcmp(optarg,"auto")) {
+               vm->idle_pc_auto = TRUE;
+               printf("Automatic idle PC detection enabled.\n");
+               break;
+            }
+
             vm->idle_pc = strtoull(optarg,NULL,0);
             printf("Idle PC set to 0x%llx.\n",vm->idle_pc);
             break;
@@ -687,6 +804,65 @@ static int parse_std_cmd_line(int argc,char *argv[])
          case 'L':
             break;
 
+         /* NIO RX listener setup (already handled) */
+         case OPT_RXL_WORKERS:
+         case OPT_RXL_AFFINITY:
+            break;
+
+         /* Number of periodic task workers */
+         case OPT_PTASK_WORKERS:
+            if (ptask_set_workers(atoi(optarg)) == -1)
+               goto exit_failure;
+            break;
+
+         /* Tickless mode for timer IRQ */
+         case OPT_TIMER_TICKLESS:
+            timer_tick_set_tickless(TRUE);
+            break;
+
+#ifdef USE_UNSTABLE
+         /* Persistent cache of translated code */
+         case OPT_JIT_CACHE:
+            if (tc_cache_set_dir(optarg) == -1)
+               goto exit_failure;
+            break;
+
+         /* Background JIT compilation */
+         case OPT_JIT_WORKERS:
+            if (tc_job_set_workers(atoi(optarg)) == -1)
+               goto exit_failure;
+            break;
+
+         case OPT_JIT_THRESHOLD:
+            tc_job_set_threshold(atoi(optarg));
+            break;
+
+         /* Geometry of the MIPS MTS cache */
+         case OPT_MTS_CACHE:
+            if (mips64_mts_set_cache_entries(atoi(optarg)) == -1)
+               goto exit_failure;
+            break;
+
+         case OPT_MTS_WAYS:
+            if (mips64_mts_set_cache_ways(atoi(optarg)) == -1)
+               goto exit_failure;
+            break;
+
+         /* Cache of self-decompressed IOS images */
+         case OPT_UNPACK_CACHE:
+            if (ios_unpack_set_dir(optarg) == -1)
+               goto exit_failure;
+            break;
+
+         /* Huge pages for RAM and exec area */
+         case OPT_HUGE_PAGES:
+            if (vm_set_huge_pages(vm,atoi(optarg)) == -1) {
+               fprintf(stderr,"Invalid huge page mode: %s\n",optarg);
+               goto exit_failure;
+            }
+            break;
+#endif
+
          /* Oops ! */
          case '?':
             show_usage(vm,argc,argv);
@@ -809,6 +985,57 @@ static int run_hypervisor(int argc,char *argv[])
          case 'L':
             break;
 
+         /* NIO RX listener setup (already handled) */
+         case OPT_RXL_WORKERS:
+         case OPT_RXL_AFFINITY:
+            break;
+
+         /* Number of periodic task workers */
+         case OPT_PTASK_WORKERS:
+            if (ptask_set_workers(atoi(optarg)) == -1)
+               exit(EXIT_FAILURE);
+            break;
+
+         /* Tickless mode for timer IRQ */
+         case OPT_TIMER_TICKLESS:
+            timer_tick_set_tickless(TRUE);
+            break;
+
+#ifdef USE_UNSTABLE
+         /* Persistent cache of translated code */
+         case OPT_JIT_CACHE:
+            if (tc_cache_set_dir(optarg) == -1)
+               exit(EXIT_FAILURE);
+            break;
+
+         /* Background JIT compilation */
+         case OPT_JIT_WORKERS:
+            if (tc_job_set_workers(atoi(optarg)) == -1)
+               exit(EXIT_FAILURE);
+            break;
+
+         case OPT_JIT_THRESHOLD:
+            tc_job_set_threshold(atoi(optarg));
+            break;
+
+         /* Geometry of the MIPS MTS cache */
+         case OPT_MTS_CACHE:
+            if (mips64_mts_set_cache_entries(atoi(optarg)) == -1)
+               exit(EXIT_FAILURE);
+            break;
+
+         case OPT_MTS_WAYS:
+            if (mips64_mts_set_cache_ways(atoi(optarg)) == -1)
+               exit(EXIT_FAILURE);
+            break;
+
+         /* Cache of self-decompressed IOS images */
+         case OPT_UNPACK_CACHE:
+            if (ios_unpack_set_dir(optarg) == -1)
+               exit(EXIT_FAILURE);
+            break;
+#endif
+
          case OPT_NOCTRL:
             vtty_set_ctrlhandler(0); /* Ignore ctrl ] */
             printf("Block ctrl+] access to monitor console.\n");
@@ -948,6 +1175,7 @@ int main(int argc,char *argv[])
    crc_init();
 
    /* Initialize NetIO code */
+   cli_setup_rxl(argc,argv);
    netio_rxl_init();
 
    /* Initialize NetIO packet filters */
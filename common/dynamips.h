@@ -71,12 +71,26 @@ extern char *console_binding_addr;
 #define OPT_VM_DEBUG    0x105
 #define OPT_IOMEM_SIZE  0x106
 #define OPT_SPARSE_MEM  0x107
+#define OPT_DISK0_BASE  0x108
+#define OPT_DISK1_BASE  0x109
+#define OPT_DISK_MMAP   0x10a
 #define OPT_NOCTRL      0x120
 #define OPT_NOTELMSG    0x121
 #define OPT_FILEPID     0x122
 #define OPT_STARTUP_CONFIG_FILE  0x140
 #define OPT_PRIVATE_CONFIG_FILE  0x141
 #define OPT_CONSOLE_BINDING_ADDR 0x150
+#define OPT_RXL_WORKERS  0x160
+#define OPT_RXL_AFFINITY 0x161
+#define OPT_PTASK_WORKERS 0x162
+#define OPT_TIMER_TICKLESS 0x163
+#define OPT_JIT_CACHE    0x164
+#define OPT_JIT_WORKERS  0x165
+#define OPT_JIT_THRESHOLD 0x166
+#define OPT_MTS_CACHE    0x167
+#define OPT_MTS_WAYS     0x168
+#define OPT_UNPACK_CACHE 0x169
+#define OPT_HUGE_PAGES   0x16a
 
 /* Delete all objects */
 void dynamips_reset(void);
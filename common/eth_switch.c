@@ -45,28 +45,312 @@ static inline u_int ethsw_hash_index(n_eth_addr_t *addr,u_int vlan_id)
    h_index ^= (addr->eth_addr_byte[2] << 8) | addr->eth_addr_byte[3];
    h_index ^= (addr->eth_addr_byte[4] << 8) | addr->eth_addr_byte[5];
    h_index ^= vlan_id;
-   return(h_index & (ETHSW_HASH_SIZE - 1));
+   h_index ^= h_index >> 10;
+   return(h_index & (ETHSW_MAC_SETS - 1));
+}
+
+/* 
+ * Enter a read-side section (packet forwarding). If the epoch changes
+ * before the reader is counted, the writer may already have waited for
+ * this epoch: the reader has to register again.
+ */
+static inline u_int ethsw_read_lock(ethsw_table_t *t)
+{
+   u_int epoch;
+
+   for(;;) {
+      epoch = __atomic_load_n(&t->rcu_epoch,__ATOMIC_SEQ_CST);
+      __atomic_add_fetch(&t->rcu_readers[epoch & 1],1,__ATOMIC_SEQ_CST);
+
+      if (__atomic_load_n(&t->rcu_epoch,__ATOMIC_SEQ_CST) == epoch)
+         return(epoch & 1);
+
+      __atomic_sub_fetch(&t->rcu_readers[epoch & 1],1,__ATOMIC_RELEASE);
+   }
+}
+
+/* Leave a read-side section */
+static inline void ethsw_read_unlock(ethsw_table_t *t,u_int epoch)
+{
+   __atomic_sub_fetch(&t->rcu_readers[epoch],1,__ATOMIC_RELEASE);
+}
+
+/* 
+ * Wait for the end of the read-side sections started before this call
+ * (switch lock held).
+ */
+static void ethsw_synchronize(ethsw_table_t *t)
+{
+   u_int epoch;
+
+   epoch = __atomic_fetch_add(&t->rcu_epoch,1,__ATOMIC_SEQ_CST) & 1;
+
+   while(__atomic_load_n(&t->rcu_readers[epoch],__ATOMIC_ACQUIRE) != 0)
+      usleep(100);
+}
+
+/* Check if a MAC address table entry has expired */
+static inline int ethsw_entry_expired(ethsw_table_t *t,m_tmcnt_t last_seen,
+                                      m_tmcnt_t now)
+{
+   u_int aging_time = __atomic_load_n(&t->aging_time,__ATOMIC_RELAXED);
+   return((aging_time != 0) && ((now - last_seen) > (aging_time * 1000ULL)));
+}
+
+/* Read an entry of the MAC address table (returns -1 if being updated) */
+static inline int ethsw_entry_read(ethsw_mac_entry_t *entry,
+                                   ethsw_mac_entry_t *copy)
+{
+   m_uint32_t seq;
+
+   seq = __atomic_load_n(&entry->seq,__ATOMIC_ACQUIRE);
+
+   if (seq & 1)
+      return(-1);
+
+   copy->nio       = entry->nio;
+   copy->port      = entry->port;
+   copy->mac_addr  = entry->mac_addr;
+   copy->vlan_id   = entry->vlan_id;
+   copy->last_seen = __atomic_load_n(&entry->last_seen,__ATOMIC_RELAXED);
+
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+   if (__atomic_load_n(&entry->seq,__ATOMIC_RELAXED) != seq)
+      return(-1);
+
+   copy->seq = seq;
+   return(0);
+}
+
+/* 
+ * Lock an entry for update, starting from the specified sequence number.
+ * Returns -1 if the entry has been modified in the meantime.
+ */
+static inline int ethsw_entry_lock(ethsw_mac_entry_t *entry,m_uint32_t seq)
+{
+   if (seq & 1)
+      return(-1);
+
+   if (!__atomic_compare_exchange_n(&entry->seq,&seq,seq+1,FALSE,
+                                    __ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+      return(-1);
+
+   return(0);
+}
+
+/* Unlock an entry after update */
+static inline void ethsw_entry_unlock(ethsw_mac_entry_t *entry)
+{
+   __atomic_store_n(&entry->seq,entry->seq+1,__ATOMIC_RELEASE);
+}
+
+/* Lock an entry for update, waiting for a concurrent update to complete */
+static void ethsw_entry_lock_wait(ethsw_mac_entry_t *entry)
+{
+   m_uint32_t seq;
+
+   for(;;) {
+      seq = __atomic_load_n(&entry->seq,__ATOMIC_RELAXED);
+
+      if (ethsw_entry_lock(entry,seq) == 0)
+         break;
+   }
+}
+
+/* Clear an entry (the entry has to be locked) */
+static inline void ethsw_entry_clear(ethsw_mac_entry_t *entry)
+{
+   entry->nio = NULL;
+   entry->port = 0;
+   entry->vlan_id = 0;
+   memset(&entry->mac_addr,0,sizeof(entry->mac_addr));
+}
+
+/* Look up a MAC address in the specified VLAN (returns NULL if unknown) */
+static ethsw_port_t *ethsw_lookup(ethsw_table_t *t,n_eth_addr_t *addr,
+                                  u_int vlan_id,m_tmcnt_t now)
+{
+   ethsw_mac_entry_t *set,copy;
+   ethsw_port_t *port;
+   u_int i;
+
+   set = t->mac_addr_table[ethsw_hash_index(addr,vlan_id)];
+
+   for(i=0;i<ETHSW_MAC_WAYS;i++) {
+      /* an entry being updated is treated as a miss (packet flooded) */
+      if (ethsw_entry_read(&set[i],&copy) == -1)
+         continue;
+
+      if (copy.nio && (copy.vlan_id == vlan_id) &&
+          !memcmp(&copy.mac_addr,addr,N_ETH_ALEN))
+      {
+         if (ethsw_entry_expired(t,copy.last_seen,now))
+            return NULL;
+
+         /* the port may have been removed since the address was learned */
+         port = __atomic_load_n(&t->port[copy.port],__ATOMIC_ACQUIRE);
+
+         if (!port || (port->nio != copy.nio))
+            return NULL;
+
+         return(port);
+      }
+   }
+
+   return NULL;
+}
+
+/* 
+ * Learn a source MAC address. The update is skipped if the entry is
+ * modified by another thread, the address will be learned with the next
+ * packet.
+ */
+static void ethsw_learn(ethsw_table_t *t,n_eth_addr_t *addr,u_int vlan_id,
+                        ethsw_port_t *port,m_tmcnt_t now)
+{
+   ethsw_mac_entry_t *set,*entry,copy,victim_copy;
+   int victim = -1,rank,victim_rank = 0;
+   u_int i;
+
+   memset(&victim_copy,0,sizeof(victim_copy));
+
+   set = t->mac_addr_table[ethsw_hash_index(addr,vlan_id)];
+
+   for(i=0;i<ETHSW_MAC_WAYS;i++) {
+      entry = &set[i];
+
+      if (ethsw_entry_read(entry,&copy) == -1)
+         continue;
+
+      /* known address: refresh the entry */
+      if (copy.nio && (copy.vlan_id == vlan_id) &&
+          !memcmp(&copy.mac_addr,addr,N_ETH_ALEN))
+      {
+         if ((copy.nio == port->nio) && (copy.port == port->id)) {
+            if ((now - copy.last_seen) >= 1000)
+               __atomic_store_n(&entry->last_seen,now,__ATOMIC_RELAXED);
+            return;
+         }
+
+         /* the station has moved to another port */
+         if (ethsw_entry_lock(entry,copy.seq) == 0) {
+            entry->nio = port->nio;
+            entry->port = port->id;
+            entry->last_seen = now;
+            ethsw_entry_unlock(entry);
+         }
+         return;
+      }
+
+      /* replace a free entry, or else an expired entry, or else the LRU */
+      if (!copy.nio)
+         rank = 0;
+      else if (ethsw_entry_expired(t,copy.last_seen,now))
+         rank = 1;
+      else
+         rank = 2;
+
+      if ((victim == -1) || (rank < victim_rank) ||
+          ((rank == 2) && (victim_rank == 2) &&
+           (copy.last_seen < victim_copy.last_seen)))
+      {
+         victim = i;
+         victim_rank = rank;
+         victim_copy = copy;
+      }
+   }
+
+   if (victim == -1)
+      return;
+
+   entry = &set[victim];
+
+   if (ethsw_entry_lock(entry,victim_copy.seq) == -1)
+      return;
+
+   entry->nio       = port->nio;
+   entry->port      = port->id;
+   entry->vlan_id   = vlan_id;
+   entry->mac_addr  = *addr;
+   entry->last_seen = now;
+   ethsw_entry_unlock(entry);
+
+   if (victim_rank == 1)
+      __atomic_add_fetch(&t->stats.aged,1,__ATOMIC_RELAXED);
+
+   __atomic_add_fetch(&t->stats.learned,1,__ATOMIC_RELAXED);
 }
 
 /* Invalidate the whole MAC address table */
 static void ethsw_invalidate(ethsw_table_t *t)
 {
-   memset(t->mac_addr_table,0,sizeof(t->mac_addr_table));
+   ethsw_mac_entry_t *entry;
+   u_int i,j;
+
+   for(i=0;i<ETHSW_MAC_SETS;i++)
+      for(j=0;j<ETHSW_MAC_WAYS;j++) {
+         entry = &t->mac_addr_table[i][j];
+         ethsw_entry_lock_wait(entry);
+         ethsw_entry_clear(entry);
+         ethsw_entry_unlock(entry);
+      }
 }
 
 /* Invalidate entry of the MAC address table referring to the specified NIO */
 static void ethsw_invalidate_port(ethsw_table_t *t,netio_desc_t *nio)
 {
    ethsw_mac_entry_t *entry;
-   int i;
+   u_int i,j;
+
+   for(i=0;i<ETHSW_MAC_SETS;i++)
+      for(j=0;j<ETHSW_MAC_WAYS;j++) {
+         entry = &t->mac_addr_table[i][j];
+
+         if (__atomic_load_n(&entry->nio,__ATOMIC_RELAXED) != nio)
+            continue;
 
-   for(i=0;i<ETHSW_HASH_SIZE;i++) {
-      entry = &t->mac_addr_table[i];
-      if (entry->nio == nio) {
-         entry->nio = NULL;
-         entry->vlan_id = 0;
+         ethsw_entry_lock_wait(entry);
+
+         if (entry->nio == nio)
+            ethsw_entry_clear(entry);
+
+         ethsw_entry_unlock(entry);
       }
-   }
+}
+
+/* Update the flooding bitmaps for the specified port (switch lock held) */
+static void ethsw_update_port_bitmaps(ethsw_table_t *t,u_int port)
+{
+   m_uint64_t bit = 1ULL << port;
+   ethsw_port_t *p;
+   u_int i;
+
+   for(i=0;i<ETHSW_MAX_VLAN;i++)
+      if (t->vlan_ports[i] & bit)
+         __atomic_and_fetch(&t->vlan_ports[i],~bit,__ATOMIC_RELEASE);
+
+   __atomic_and_fetch(&t->trunk_ports,~bit,__ATOMIC_RELEASE);
+
+   if (!(p = t->port[port]))
+      return;
+
+   if (p->type == ETHSW_PORT_TYPE_ACCESS)
+      __atomic_or_fetch(&t->vlan_ports[p->vlan_id],bit,__ATOMIC_RELEASE);
+   else
+      __atomic_or_fetch(&t->trunk_ports,bit,__ATOMIC_RELEASE);
+}
+
+/* 
+ * Send a packet to an output port. The RX threads of several input ports
+ * may forward packets to the same port at the same time.
+ */
+static void ethsw_send(ethsw_table_t *t,ethsw_port_t *op,
+                       void *pkt,size_t pkt_len)
+{
+   pthread_mutex_lock(&t->send_lock[op->id]);
+   netio_send(op->nio,pkt,pkt_len);
+   pthread_mutex_unlock(&t->send_lock[op->id]);
 }
 
 /* Push a 802.1Q tag */
@@ -97,14 +381,14 @@ static void dot1q_pop_tag(m_uint8_t *pkt,ethsw_packet_t *sp)
 
 /* Input vector for ACCESS ports */
 static void ethsw_iv_access(ethsw_table_t *t,ethsw_packet_t *sp,
-                            netio_desc_t *op)
+                            ethsw_port_t *op)
 {
    m_uint8_t *pkt;
 
-   switch(op->vlan_port_type) {
+   switch(op->type) {
       /* Access -> Access: no special treatment */
       case ETHSW_PORT_TYPE_ACCESS:
-         netio_send(op,sp->pkt,sp->pkt_len);
+         ethsw_send(t,op,sp->pkt,sp->pkt_len);
          break;
 
       /* Access -> 802.1Q: push tag */
@@ -114,7 +398,7 @@ static void ethsw_iv_access(ethsw_table_t *t,ethsw_packet_t *sp,
           * forward the packet without adding the tag.
           */
          if (op->vlan_id == sp->input_vlan) {
-            netio_send(op,sp->pkt,sp->pkt_len);
+            ethsw_send(t,op,sp->pkt,sp->pkt_len);
          } else {
             pkt = malloc(sp->pkt_len+4);
             if (pkt == NULL) {
@@ -123,20 +407,20 @@ static void ethsw_iv_access(ethsw_table_t *t,ethsw_packet_t *sp,
             }
             memset(pkt, 0, sp->pkt_len+4);
             dot1q_push_tag(pkt,sp,op->vlan_id,sp->input_port->ethertype);
-            netio_send(op,pkt,sp->pkt_len+4);
+            ethsw_send(t,op,pkt,sp->pkt_len+4);
             free(pkt);
          }
          break;
 
       default:
          fprintf(stderr,"ethsw_iv_access: unknown port type %u\n",
-                 op->vlan_port_type);
+                 op->type);
    }
 }
 
 /* Input vector for 802.1Q ports */
 static void ethsw_iv_dot1q(ethsw_table_t *t,ethsw_packet_t *sp,
-                           netio_desc_t *op)
+                           ethsw_port_t *op)
 {
    m_uint8_t *pkt;
 
@@ -146,7 +430,7 @@ static void ethsw_iv_dot1q(ethsw_table_t *t,ethsw_packet_t *sp,
       return;
    }
 
-   switch(op->vlan_port_type) {
+   switch(op->type) {
       /* 802.1Q -> Access: pop tag */
       case ETHSW_PORT_TYPE_ACCESS:
          pkt = malloc(sp->pkt_len-4);
@@ -156,7 +440,7 @@ static void ethsw_iv_dot1q(ethsw_table_t *t,ethsw_packet_t *sp,
          }
          memset(pkt, 0, sp->pkt_len-4);
          dot1q_pop_tag(pkt,sp);
-         netio_send(op,pkt,sp->pkt_len-4);
+         ethsw_send(t,op,pkt,sp->pkt_len-4);
          free(pkt);
          break;
 
@@ -170,10 +454,10 @@ static void ethsw_iv_dot1q(ethsw_table_t *t,ethsw_packet_t *sp,
             }
             memset(pkt, 0, sp->pkt_len-4);
             dot1q_pop_tag(pkt,sp);
-            netio_send(op,pkt,sp->pkt_len-4);
+            ethsw_send(t,op,pkt,sp->pkt_len-4);
             free(pkt);
          } else {
-            netio_send(op,sp->pkt,sp->pkt_len);
+            ethsw_send(t,op,sp->pkt,sp->pkt_len);
          }
          break;
 
@@ -190,24 +474,24 @@ static void ethsw_iv_dot1q(ethsw_table_t *t,ethsw_packet_t *sp,
             }
             memset(pkt, 0, sp->pkt_len-4);
             dot1q_pop_tag(pkt,sp);
-            netio_send(op,pkt,sp->pkt_len-4);
+            ethsw_send(t,op,pkt,sp->pkt_len-4);
             free(pkt);
          }
          break;
 
       default:
          fprintf(stderr,"ethsw_iv_dot1q: unknown port type %u\n",
-                 op->vlan_port_type);
+                 op->type);
    }
 }
 
 /* Input vector for QinQ ports */
 static void ethsw_iv_qinq(ethsw_table_t *t,ethsw_packet_t *sp,
-                         netio_desc_t *op)
+                         ethsw_port_t *op)
 {
    m_uint8_t *pkt;
 
-   switch(op->vlan_port_type) {
+   switch(op->type) {
       /* QinQ -> 802.1Q: push outer tag */
       case ETHSW_PORT_TYPE_DOT1Q:
          pkt = malloc(sp->pkt_len+4);
@@ -217,7 +501,7 @@ static void ethsw_iv_qinq(ethsw_table_t *t,ethsw_packet_t *sp,
          }
          memset(pkt, 0, sp->pkt_len+4);
          dot1q_push_tag(pkt,sp,sp->input_port->vlan_id,sp->input_port->ethertype);
-         netio_send(op,pkt,sp->pkt_len+4);
+         ethsw_send(t,op,pkt,sp->pkt_len+4);
          free(pkt);
          break;
 
@@ -234,14 +518,14 @@ static void ethsw_iv_qinq(ethsw_table_t *t,ethsw_packet_t *sp,
             }
             memset(pkt, 0, sp->pkt_len-4);
             dot1q_pop_tag(pkt,sp);
-            netio_send(op,pkt,sp->pkt_len-4);
+            ethsw_send(t,op,pkt,sp->pkt_len-4);
             free(pkt);
          }
          break;
 
       default:
          fprintf(stderr,"ethsw_iv_dot1q: unknown port type %u\n",
-                 op->vlan_port_type);
+                 op->type);
    }
 }
 
@@ -249,20 +533,31 @@ static void ethsw_iv_qinq(ethsw_table_t *t,ethsw_packet_t *sp,
 static void ethsw_flood(ethsw_table_t *t,ethsw_packet_t *sp)
 {
    ethsw_input_vector_t input_vector;
-   netio_desc_t *op;
-   int i;
+   m_uint64_t ports;
+   ethsw_port_t *op;
+   u_int i;
 
-   input_vector = sp->input_port->vlan_input_vector;
+   input_vector = sp->input_port->input_vector;
    assert(input_vector != NULL);
 
-   for(i=0;i<ETHSW_MAX_NIO;i++) {
-      op = t->nio[i];
+   /* trunk ports and access ports in the input vlan */
+   ports = __atomic_load_n(&t->trunk_ports,__ATOMIC_ACQUIRE);
+
+   if (sp->input_vlan < ETHSW_MAX_VLAN)
+      ports |= __atomic_load_n(&t->vlan_ports[sp->input_vlan],
+                               __ATOMIC_ACQUIRE);
+
+   __atomic_add_fetch(&t->stats.flooded,1,__ATOMIC_RELAXED);
 
-      if (!op || (op == sp->input_port))
+   for(;ports;ports&=ports-1) {
+      i = __builtin_ctzll(ports);
+      op = __atomic_load_n(&t->port[i],__ATOMIC_ACQUIRE);
+
+      if (!op || (op->id == sp->input_port->id))
          continue;
 
-      /* skip output port configured in access mode with a different vlan */
-      if ((op->vlan_port_type == ETHSW_PORT_TYPE_ACCESS) &&
+      /* the port may have been reconfigured since the bitmap was read */
+      if ((op->type == ETHSW_PORT_TYPE_ACCESS) &&
           (op->vlan_id != sp->input_vlan))
          continue;
 
@@ -276,16 +571,13 @@ static void ethsw_forward(ethsw_table_t *t,ethsw_packet_t *sp)
 {
    n_eth_hdr_t *hdr = (n_eth_hdr_t *)sp->pkt;
    ethsw_input_vector_t input_vector;
-   ethsw_mac_entry_t *entry;
-   u_int h_index;
+   ethsw_port_t *op;
+   m_tmcnt_t now;
 
-   /* Learn the source MAC address */
-   h_index = ethsw_hash_index(&hdr->saddr,sp->input_vlan);
-   entry = &t->mac_addr_table[h_index];
+   now = m_gettime();
 
-   entry->nio      = sp->input_port;
-   entry->vlan_id  = sp->input_vlan;
-   entry->mac_addr = hdr->saddr;
+   /* Learn the source MAC address */
+   ethsw_learn(t,&hdr->saddr,sp->input_vlan,sp->input_port,now);
 
    /* If we have a broadcast/multicast packet, flood it */
    if (eth_addr_is_mcast(&hdr->daddr)) {
@@ -295,30 +587,29 @@ static void ethsw_forward(ethsw_table_t *t,ethsw_packet_t *sp)
    }
 
    /* Lookup on the destination MAC address (unicast) */
-   h_index = ethsw_hash_index(&hdr->daddr,sp->input_vlan);
-   entry = &t->mac_addr_table[h_index];
+   op = ethsw_lookup(t,&hdr->daddr,sp->input_vlan,now);
 
    /* If the dest MAC is unknown, flood the packet */
-   if (memcmp(&entry->mac_addr,&hdr->daddr,N_ETH_ALEN) ||
-       (entry->vlan_id != sp->input_vlan))
-   {
+   if (!op) {
       ethsw_debug(t,"unknown dest, flooding packet.\n");
       ethsw_flood(t,sp);
       return;
    }
 
    /* Forward the packet to the output port only */
-   if (entry->nio != sp->input_port) {
-      input_vector = sp->input_port->vlan_input_vector;
+   if (op->id != sp->input_port->id) {
+      input_vector = sp->input_port->input_vector;
       assert(input_vector != NULL);
-      input_vector(t,sp,entry->nio);
+      input_vector(t,sp,op);
+      __atomic_add_fetch(&t->stats.forwarded,1,__ATOMIC_RELAXED);
    } else {
       ethsw_debug(t,"source and dest ports identical, dropping.\n");
+      __atomic_add_fetch(&t->stats.dropped,1,__ATOMIC_RELAXED);
    }
 }
 
 /* Receive a packet and prepare its forwarding */
-static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
+static inline int ethsw_receive(ethsw_table_t *t,ethsw_port_t *port,
                                 u_char *pkt,ssize_t pkt_len)
 {
    n_eth_dot1q_hdr_t *dot1q_hdr;
@@ -329,7 +620,7 @@ static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
    ethsw_packet_t sp;
    u_char *ptr;
 
-   sp.input_port = nio;
+   sp.input_port = port;
    sp.input_vlan = 0;
    sp.pkt        = pkt;
    sp.pkt_len    = pkt_len;
@@ -339,9 +630,9 @@ static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
       return(-1);
 
    /* Determine the input VLAN */
-   switch(nio->vlan_port_type) {
+   switch(port->type) {
       case ETHSW_PORT_TYPE_ACCESS:
-         sp.input_vlan = nio->vlan_id;
+         sp.input_vlan = port->vlan_id;
          break;
 
       case ETHSW_PORT_TYPE_DOT1Q:
@@ -353,7 +644,7 @@ static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
              ethertype != N_ETH_PROTO_DOT1Q_2 &&
              ethertype != N_ETH_PROTO_DOT1Q_3 &&
              ethertype != N_ETH_PROTO_DOT1Q_4) {
-            sp.input_vlan = nio->vlan_id;
+            sp.input_vlan = port->vlan_id;
             sp.input_tag  = FALSE;
          } else {
             sp.input_vlan = ntohs(dot1q_hdr->vlan_id) & 0xFFF;
@@ -373,7 +664,7 @@ static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
             return(-1);
 
          /* The MAC address lookup is done on the outer VLAN */
-         sp.input_vlan = nio->vlan_id;
+         sp.input_vlan = port->vlan_id;
          break;
 
       case ETHSW_PORT_TYPE_ISL:
@@ -397,51 +688,105 @@ static inline int ethsw_receive(ethsw_table_t *t,netio_desc_t *nio,
 
       default:
          fprintf(stderr,"ethsw_receive: unknown port type %u\n",
-                 nio->vlan_port_type);
+                 port->type);
          return(-1);
    }
 
-   if (sp.input_vlan != 0)
-      ethsw_forward(t,&sp);
+   if (sp.input_vlan == 0)
+      return(-1);
+
+   ethsw_forward(t,&sp);
    return(0);
 }
 
-/* Receive a packet (handle the locking part) */
+/* 
+ * Receive a packet. Packets are handled concurrently by the RX threads,
+ * the switch lock is only used for configuration changes.
+ */
 static int ethsw_recv_pkt(netio_desc_t *nio,u_char *pkt,ssize_t pkt_len,
-                          ethsw_table_t *t)
+                          ethsw_table_t *t,void *port_id)
 {
-   if (ETHSW_TRYLOCK(t) == 0) {
-      ethsw_receive(t,nio,pkt,pkt_len);
-      ETHSW_UNLOCK(t);
-   }
+   ethsw_port_t *port;
+   u_int epoch;
+
+   epoch = ethsw_read_lock(t);
+   port = __atomic_load_n(&t->port[(u_long)port_id],__ATOMIC_ACQUIRE);
+
+   if (!port || (port->nio != nio) ||
+       (ethsw_receive(t,port,pkt,pkt_len) == -1))
+      __atomic_add_fetch(&t->stats.dropped,1,__ATOMIC_RELAXED);
+
+   ethsw_read_unlock(t,epoch);
    return(0);
 }
 
 /* Set a port as an access port with the specified VLAN */
-static void set_access_port(netio_desc_t *nio,u_int vlan_id)
+static void set_access_port(ethsw_port_t *port,u_int vlan_id)
 {
-   nio->vlan_port_type    = ETHSW_PORT_TYPE_ACCESS;
-   nio->vlan_id           = vlan_id;
-   nio->vlan_input_vector = ethsw_iv_access;
-   nio->ethertype         = N_ETH_PROTO_DOT1Q;
+   port->type         = ETHSW_PORT_TYPE_ACCESS;
+   port->vlan_id      = vlan_id;
+   port->input_vector = ethsw_iv_access;
+   port->ethertype    = N_ETH_PROTO_DOT1Q;
 }
 
 /* Set a port as a 802.1Q trunk port */
-static void set_dot1q_port(netio_desc_t *nio,u_int native_vlan)
+static void set_dot1q_port(ethsw_port_t *port,u_int native_vlan)
 {
-   nio->vlan_port_type    = ETHSW_PORT_TYPE_DOT1Q;
-   nio->vlan_id           = native_vlan;
-   nio->vlan_input_vector = ethsw_iv_dot1q;
-   nio->ethertype         = N_ETH_PROTO_DOT1Q;
+   port->type         = ETHSW_PORT_TYPE_DOT1Q;
+   port->vlan_id      = native_vlan;
+   port->input_vector = ethsw_iv_dot1q;
+   port->ethertype    = N_ETH_PROTO_DOT1Q;
 }
 
 /* Set a port as a Q-in-Q trunk port */
-static void set_qinq_port(netio_desc_t *nio,u_int outer_vlan,m_uint16_t ethertype)
+static void set_qinq_port(ethsw_port_t *port,u_int outer_vlan,m_uint16_t ethertype)
 {
-   nio->vlan_port_type    = ETHSW_PORT_TYPE_QINQ;
-   nio->vlan_id           = outer_vlan;
-   nio->vlan_input_vector = ethsw_iv_qinq;
-   nio->ethertype         = ethertype;
+   port->type         = ETHSW_PORT_TYPE_QINQ;
+   port->vlan_id      = outer_vlan;
+   port->input_vector = ethsw_iv_qinq;
+   port->ethertype    = ethertype;
+}
+
+/* Find a port by NIO name (switch lock held) */
+static int ethsw_find_port(ethsw_table_t *t,char *nio_name)
+{
+   int i;
+
+   for(i=0;i<ETHSW_MAX_NIO;i++)
+      if (t->port[i] && !strcmp(t->port[i]->nio->name,nio_name))
+         return(i);
+
+   return(-1);
+}
+
+/* Get a copy of a port record, to be modified then published */
+static ethsw_port_t *ethsw_dup_port(ethsw_port_t *port)
+{
+   ethsw_port_t *copy;
+
+   if (!(copy = malloc(sizeof(*copy))))
+      return NULL;
+
+   *copy = *port;
+   return copy;
+}
+
+/* 
+ * Publish a port record (NULL to remove the port). The previous record
+ * is freed when the packets using it have been forwarded (switch lock
+ * held).
+ */
+static void ethsw_publish_port(ethsw_table_t *t,u_int id,ethsw_port_t *port)
+{
+   ethsw_port_t *old = t->port[id];
+
+   __atomic_store_n(&t->port[id],port,__ATOMIC_SEQ_CST);
+   ethsw_update_port_bitmaps(t,id);
+
+   if (old) {
+      ethsw_synchronize(t);
+      free(old);
+   }
 }
 
 /* Acquire a reference to an Ethernet switch (increment reference count) */
@@ -460,6 +805,7 @@ int ethsw_release(char *name)
 ethsw_table_t *ethsw_create(char *name)
 {
    ethsw_table_t *t;
+   int i;
 
    /* Allocate a new switch structure */
    if (!(t = malloc(sizeof(*t))))
@@ -468,6 +814,11 @@ ethsw_table_t *ethsw_create(char *name)
    memset(t,0,sizeof(*t));
    pthread_mutex_init(&t->lock,NULL);
 
+   for(i=0;i<ETHSW_MAX_NIO;i++)
+      pthread_mutex_init(&t->send_lock[i],NULL);
+
+   t->aging_time = ETHSW_DEF_AGING_TIME;
+
    if (!(t->name = strdup(name)))
       goto err_name;
 
@@ -489,14 +840,15 @@ ethsw_table_t *ethsw_create(char *name)
 /* Add a NetIO descriptor to a virtual ethernet switch */
 int ethsw_add_netio(ethsw_table_t *t,char *nio_name)
 {
+   ethsw_port_t *port;
    netio_desc_t *nio;
    int i;
 
    ETHSW_LOCK(t);
 
-   /* Try to find a free slot in the NIO array */
+   /* Try to find a free slot in the port array */
    for(i=0;i<ETHSW_MAX_NIO;i++)
-      if (t->nio[i] == NULL)
+      if (t->port[i] == NULL)
          break;
 
    /* No free slot found ... */
@@ -507,11 +859,18 @@ int ethsw_add_netio(ethsw_table_t *t,char *nio_name)
    if (!(nio = netio_acquire(nio_name)))
       goto error;
 
+   if (!(port = malloc(sizeof(*port)))) {
+      netio_release(nio_name);
+      goto error;
+   }
+
    /* By default, the port is an access port in VLAN 1 */
-   set_access_port(nio,1);
+   port->nio = nio;
+   port->id  = i;
+   set_access_port(port,1);
+   ethsw_publish_port(t,i,port);
 
-   t->nio[i] = nio;
-   netio_rxl_add(nio,(netio_rx_handler_t)ethsw_recv_pkt,t,NULL);
+   netio_rxl_add(nio,(netio_rx_handler_t)ethsw_recv_pkt,t,(void *)(u_long)i);
    ETHSW_UNLOCK(t);
    return(0);
 
@@ -538,22 +897,25 @@ int ethsw_remove_netio(ethsw_table_t *t,char *nio_name)
    if (!(nio = registry_exists(nio_name,OBJ_TYPE_NIO)))
       goto error;
 
-   /* Try to find the NIO in the NIO array */
+   /* Try to find the NIO in the port array */
    for(i=0;i<ETHSW_MAX_NIO;i++)
-      if (t->nio[i] == nio)
+      if (t->port[i] && (t->port[i]->nio == nio))
          break;
 
    if (i == ETHSW_MAX_NIO)
       goto error;
 
+   /* Stop receiving on this port, so the port can't be learned again */
+   netio_rxl_remove(nio);
+
+   /* Wait for the packets being forwarded to this port */
+   ethsw_publish_port(t,i,NULL);
+
    /* Invalidate this port in the MAC address table */
    ethsw_invalidate_port(t,nio);
-   t->nio[i] = NULL;
-
    ETHSW_UNLOCK(t);
 
-   /* Remove the NIO from the RX multiplexer */
-   ethsw_free_nio(nio);
+   netio_release(nio->name);
    return(0);
 
  error:
@@ -574,37 +936,76 @@ int ethsw_clear_mac_addr_table(ethsw_table_t *t)
 int ethsw_iterate_mac_addr_table(ethsw_table_t *t,ethsw_foreach_entry_t cb,
                                  void *opt_arg)
 {
-   ethsw_mac_entry_t *entry;
-   int i;
+   ethsw_mac_entry_t *entry,copy;
+   m_tmcnt_t now;
+   u_int i,j;
 
    ETHSW_LOCK(t);
+   now = m_gettime();
 
-   for(i=0;i<ETHSW_HASH_SIZE;i++) {
-      entry = &t->mac_addr_table[i];
+   for(i=0;i<ETHSW_MAC_SETS;i++)
+      for(j=0;j<ETHSW_MAC_WAYS;j++) {
+         entry = &t->mac_addr_table[i][j];
 
-      if (!entry->nio)
-         continue;
+         if (!__atomic_load_n(&entry->nio,__ATOMIC_RELAXED))
+            continue;
 
-      cb(t,entry,opt_arg);
-   }
+         ethsw_entry_lock_wait(entry);
+         copy = *entry;
+
+         /* remove expired entries */
+         if (entry->nio && ethsw_entry_expired(t,entry->last_seen,now)) {
+            ethsw_entry_clear(entry);
+            __atomic_add_fetch(&t->stats.aged,1,__ATOMIC_RELAXED);
+            copy.nio = NULL;
+         }
+
+         ethsw_entry_unlock(entry);
+
+         /* NIO of the entry can't be released while we hold the lock */
+         if (copy.nio)
+            cb(t,&copy,opt_arg);
+      }
 
    ETHSW_UNLOCK(t);
    return(0);
 }
 
+/* Set the aging time of learned MAC addresses (0: no aging) */
+int ethsw_set_aging_time(ethsw_table_t *t,u_int aging_time)
+{
+   __atomic_store_n(&t->aging_time,aging_time,__ATOMIC_RELAXED);
+   return(0);
+}
+
+/* Get the switch statistics */
+void ethsw_get_stats(ethsw_table_t *t,ethsw_stats_t *stats)
+{
+   stats->forwarded = __atomic_load_n(&t->stats.forwarded,__ATOMIC_RELAXED);
+   stats->flooded   = __atomic_load_n(&t->stats.flooded,__ATOMIC_RELAXED);
+   stats->dropped   = __atomic_load_n(&t->stats.dropped,__ATOMIC_RELAXED);
+   stats->learned   = __atomic_load_n(&t->stats.learned,__ATOMIC_RELAXED);
+   stats->aged      = __atomic_load_n(&t->stats.aged,__ATOMIC_RELAXED);
+}
+
 /* Set port as an access port */
 int ethsw_set_access_port(ethsw_table_t *t,char *nio_name,u_int vlan_id)
 {
+   ethsw_port_t *port;
    int i,res = -1;
 
+   if (vlan_id >= ETHSW_MAX_VLAN)
+      return(-1);
+
    ETHSW_LOCK(t);
 
-   for(i=0;i<ETHSW_MAX_NIO;i++)
-      if (t->nio[i] && !strcmp(t->nio[i]->name,nio_name)) {
-         set_access_port(t->nio[i],vlan_id);
-         res = 0;
-         break;
-      }
+   if (((i = ethsw_find_port(t,nio_name)) != -1) &&
+       (port = ethsw_dup_port(t->port[i])))
+   {
+      set_access_port(port,vlan_id);
+      ethsw_publish_port(t,i,port);
+      res = 0;
+   }
 
    ETHSW_UNLOCK(t);
    return(res);
@@ -613,16 +1014,18 @@ int ethsw_set_access_port(ethsw_table_t *t,char *nio_name,u_int vlan_id)
 /* Set port as a 802.1q trunk port */
 int ethsw_set_dot1q_port(ethsw_table_t *t,char *nio_name,u_int native_vlan)
 {
+   ethsw_port_t *port;
    int i,res = -1;
 
    ETHSW_LOCK(t);
 
-   for(i=0;i<ETHSW_MAX_NIO;i++)
-      if (t->nio[i] && !strcmp(t->nio[i]->name,nio_name)) {
-         set_dot1q_port(t->nio[i],native_vlan);
-         res = 0;
-         break;
-      }
+   if (((i = ethsw_find_port(t,nio_name)) != -1) &&
+       (port = ethsw_dup_port(t->port[i])))
+   {
+      set_dot1q_port(port,native_vlan);
+      ethsw_publish_port(t,i,port);
+      res = 0;
+   }
 
    ETHSW_UNLOCK(t);
    return(res);
@@ -631,6 +1034,7 @@ int ethsw_set_dot1q_port(ethsw_table_t *t,char *nio_name,u_int native_vlan)
 /* Set port as a Q-in-Q port */
 int ethsw_set_qinq_port(ethsw_table_t *t,char *nio_name,u_int outer_vlan,m_uint16_t ethertype)
 {
+   ethsw_port_t *port;
    int i,res = -1;
 
    if(ethertype != N_ETH_PROTO_DOT1Q &&
@@ -642,12 +1046,13 @@ int ethsw_set_qinq_port(ethsw_table_t *t,char *nio_name,u_int outer_vlan,m_uint1
 
    ETHSW_LOCK(t);
 
-   for(i=0;i<ETHSW_MAX_NIO;i++)
-      if (t->nio[i] && !strcmp(t->nio[i]->name,nio_name)) {
-         set_qinq_port(t->nio[i],outer_vlan,ethertype);
-         res = 0;
-         break;
-      }
+   if (((i = ethsw_find_port(t,nio_name)) != -1) &&
+       (port = ethsw_dup_port(t->port[i])))
+   {
+      set_qinq_port(port,outer_vlan,ethertype);
+      ethsw_publish_port(t,i,port);
+      res = 0;
+   }
 
    ETHSW_UNLOCK(t);
    return(res);
@@ -656,7 +1061,7 @@ int ethsw_set_qinq_port(ethsw_table_t *t,char *nio_name,u_int outer_vlan,m_uint1
 /* Save the configuration of a switch */
 void ethsw_save_config(ethsw_table_t *t,FILE *fd)
 {
-   netio_desc_t *nio;
+   ethsw_port_t *port;
    int i;
 
    fprintf(fd,"ethsw create %s\n",t->name);
@@ -665,29 +1070,30 @@ void ethsw_save_config(ethsw_table_t *t,FILE *fd)
 
    for(i=0;i<ETHSW_MAX_NIO;i++)
    {
-      nio = t->nio[i];
+      if (!(port = t->port[i]))
+         continue;
 
-      fprintf(fd,"ethsw add_nio %s %s\n",t->name,nio->name);
+      fprintf(fd,"ethsw add_nio %s %s\n",t->name,port->nio->name);
 
-      switch(nio->vlan_port_type) {
+      switch(port->type) {
          case ETHSW_PORT_TYPE_ACCESS:
             fprintf(fd,"ethsw set_access_port %s %s %u\n",
-                    t->name,nio->name,nio->vlan_id);
+                    t->name,port->nio->name,port->vlan_id);
             break;
 
          case ETHSW_PORT_TYPE_DOT1Q:
             fprintf(fd,"ethsw set_dot1q_port %s %s %u\n",
-                    t->name,nio->name,nio->vlan_id);
+                    t->name,port->nio->name,port->vlan_id);
             break;
 
          case ETHSW_PORT_TYPE_QINQ:
             fprintf(fd,"ethsw set_qinq_port %s %s %u 0x%x\n",
-                    t->name,nio->name,nio->vlan_id,nio->ethertype);
+                    t->name,port->nio->name,port->vlan_id,port->ethertype);
             break;
 
          default:
             fprintf(stderr,"ethsw_save_config: unknown port type %u\n",
-                    nio->vlan_port_type);
+                    port->type);
       }
    }
 
@@ -714,12 +1120,16 @@ static int ethsw_free(void *data,void *arg)
    int i;
 
    for(i=0;i<ETHSW_MAX_NIO;i++) {
-      if (!t->nio[i])
+      if (!t->port[i])
          continue;
 
-      ethsw_free_nio(t->nio[i]);
+      ethsw_free_nio(t->port[i]->nio);
+      free(t->port[i]);
    }
 
+   for(i=0;i<ETHSW_MAX_NIO;i++)
+      pthread_mutex_destroy(&t->send_lock[i]);
+
    free(t->name);
    free(t);
    return(TRUE);
@@ -14,8 +14,15 @@
 #include "net.h"
 #include "net_io.h"
 
-/* Hash entries for the MAC address table */
-#define ETHSW_HASH_SIZE  4096
+/* MAC address table geometry (sets of ETHSW_MAC_WAYS entries) */
+#define ETHSW_MAC_SETS   1024
+#define ETHSW_MAC_WAYS   4
+
+/* Default aging time of learned MAC addresses (in seconds) */
+#define ETHSW_DEF_AGING_TIME  300
+
+/* Number of VLANs for the flooding port bitmaps */
+#define ETHSW_MAX_VLAN   4096
 
 /* Maximum port number */
 #define ETHSW_MAX_NIO    64
@@ -31,41 +38,89 @@ enum {
    ETHSW_PORT_TYPE_ISL,
 };
 
-/* Received packet */
+typedef struct ethsw_table ethsw_table_t;
+typedef struct ethsw_port ethsw_port_t;
 typedef struct ethsw_packet ethsw_packet_t;
+
+/* Packet input vector */
+typedef void (*ethsw_input_vector_t)(ethsw_table_t *t,ethsw_packet_t *sp,
+                                     ethsw_port_t *output_port);
+
+/* 
+ * Switch port. A port record is never modified once published: a new
+ * record replaces it when the port is reconfigured.
+ */
+struct ethsw_port {
+   netio_desc_t *nio;
+   u_int id;
+   u_int type;
+   m_uint16_t vlan_id;
+   m_uint16_t ethertype;
+   ethsw_input_vector_t input_vector;
+};
+
+/* Received packet */
 struct ethsw_packet {
    u_char *pkt;
    ssize_t pkt_len;
-   netio_desc_t *input_port;
+   ethsw_port_t *input_port;
    u_int input_vlan;
    int input_tag;
 };
 
-/* MAC address table entry */
+/* 
+ * MAC address table entry. Entries are read without lock: the sequence
+ * number is odd while the entry is being updated.
+ */
 typedef struct ethsw_mac_entry ethsw_mac_entry_t;
 struct ethsw_mac_entry {
-   netio_desc_t *nio;
-   n_eth_addr_t mac_addr;
+   m_uint32_t seq;
    m_uint16_t vlan_id;
+   n_eth_addr_t mac_addr;
+   netio_desc_t *nio;
+   u_int port;
+   m_tmcnt_t last_seen;
+};
+
+/* Switch statistics */
+typedef struct ethsw_stats ethsw_stats_t;
+struct ethsw_stats {
+   m_uint64_t forwarded;
+   m_uint64_t flooded;
+   m_uint64_t dropped;
+   m_uint64_t learned;
+   m_uint64_t aged;
 };
 
 /* Virtual Ethernet switch */
-typedef struct ethsw_table ethsw_table_t;
 struct ethsw_table {
    char *name;
    pthread_mutex_t lock;
    int debug;
 
-   /* Virtual Ports */
-   netio_desc_t *nio[ETHSW_MAX_NIO];
+   /* Virtual Ports (packets sent to a port are serialized) */
+   ethsw_port_t *port[ETHSW_MAX_NIO];
+   pthread_mutex_t send_lock[ETHSW_MAX_NIO];
+
+   /* 
+    * Packets are forwarded without holding the lock. A removed or
+    * replaced port record is freed only when the receivers active at
+    * that time are done.
+    */
+   u_int rcu_epoch;
+   u_int rcu_readers[2];
+
+   /* Flooding bitmaps: access ports per VLAN and trunk ports */
+   m_uint64_t vlan_ports[ETHSW_MAX_VLAN];
+   m_uint64_t trunk_ports;
 
    /* MAC address table */
-   ethsw_mac_entry_t mac_addr_table[ETHSW_HASH_SIZE];
-};
+   ethsw_mac_entry_t mac_addr_table[ETHSW_MAC_SETS][ETHSW_MAC_WAYS];
+   u_int aging_time;
 
-/* Packet input vector */
-typedef void (*ethsw_input_vector_t)(ethsw_table_t *t,ethsw_packet_t *sp,
-                                     netio_desc_t *output_port);
+   /* Statistics (updated atomically) */
+   ethsw_stats_t stats;
+};
 
 /* "foreach" vector */
 typedef void (*ethsw_foreach_entry_t)(ethsw_table_t *t,
@@ -74,7 +129,6 @@ typedef void (*ethsw_foreach_entry_t)(ethsw_table_t *t,
 
 #define ETHSW_LOCK(t)   pthread_mutex_lock(&(t)->lock)
 #define ETHSW_UNLOCK(t) pthread_mutex_unlock(&(t)->lock)
-#define ETHSW_TRYLOCK(t) pthread_mutex_trylock(&(t)->lock)
 
 /* Acquire a reference to an Ethernet switch (increment reference count) */
 ethsw_table_t *ethsw_acquire(char *name);
@@ -98,6 +152,12 @@ int ethsw_clear_mac_addr_table(ethsw_table_t *t);
 int ethsw_iterate_mac_addr_table(ethsw_table_t *t,ethsw_foreach_entry_t cb,
                                  void *opt_arg);
 
+/* Set the aging time of learned MAC addresses (0: no aging) */
+int ethsw_set_aging_time(ethsw_table_t *t,u_int aging_time);
+
+/* Get the switch statistics */
+void ethsw_get_stats(ethsw_table_t *t,ethsw_stats_t *stats);
+
 /* Set port as an access port */
 int ethsw_set_access_port(ethsw_table_t *t,char *nio_name,u_int vlan_id);
 
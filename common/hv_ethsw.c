@@ -280,6 +280,51 @@ static int cmd_show_mac_addr_table(hypervisor_conn_t *conn,
    return(0);
 }
 
+/*
+ * Set the aging time of learned MAC addresses (0: no aging).
+ *
+ * Parameters: <ethsw_name> <aging_time>
+ */
+static int cmd_set_aging_time(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   ethsw_table_t *t;
+
+   if (!(t = hypervisor_find_object(conn,argv[0],OBJ_TYPE_ETHSW)))
+      return(-1);
+
+   ethsw_set_aging_time(t,atoi(argv[1]));
+   ethsw_release(argv[0]);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show the switch statistics */
+static int cmd_show_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   ethsw_stats_t stats;
+   ethsw_table_t *t;
+
+   if (!(t = hypervisor_find_object(conn,argv[0],OBJ_TYPE_ETHSW)))
+      return(-1);
+
+   ethsw_get_stats(t,&stats);
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"forwarded: %llu",
+                         (unsigned long long)stats.forwarded);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"flooded: %llu",
+                         (unsigned long long)stats.flooded);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"dropped: %llu",
+                         (unsigned long long)stats.dropped);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"learned: %llu",
+                         (unsigned long long)stats.learned);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"aged: %llu",
+                         (unsigned long long)stats.aged);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"aging time: %u",t->aging_time);
+
+   ethsw_release(argv[0]);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
 
 /* Show info about a ETHSW object */
 static void cmd_show_list(registry_entry_t *entry,void *opt,int *err)
@@ -309,6 +354,8 @@ static hypervisor_cmd_t ethsw_cmd_array[] = {
    { "set_qinq_port", 3, 4, cmd_set_qinq_port, NULL },
    { "clear_mac_addr_table", 1, 1, cmd_clear_mac_addr_table, NULL },
    { "show_mac_addr_table", 1, 1, cmd_show_mac_addr_table, NULL },
+   { "set_aging_time", 2, 2, cmd_set_aging_time, NULL },
+   { "show_stats", 1, 1, cmd_show_stats, NULL },
    { "list", 0, 0, cmd_list, NULL },
    { NULL, -1, -1, NULL, NULL },
 };
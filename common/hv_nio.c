@@ -481,6 +481,30 @@ static int cmd_set_bandwidth(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Show statistics of the RX listener shards */
+static int cmd_rxl_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   netio_rxl_stats_t stats;
+   u_int i,count;
+
+   count = netio_rxl_get_shard_count();
+
+   for(i=0;i<count;i++) {
+      if (netio_rxl_get_shard_stats(i,&stats) == -1)
+         continue;
+
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                            "shard %u: cpu=%d nio=%u fd=%u wakeups=%llu "
+                            "batches=%llu pkts=%llu bytes=%llu",
+                            i,stats.cpu,stats.nio_count,stats.fd_count,
+                            stats.wakeups,stats.batches,stats.pkts,
+                            stats.bytes);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Show info about a NIO object */
 static void cmd_show_nio_list(registry_entry_t *entry,void *opt,int *err)
 {
@@ -524,6 +548,7 @@ static hypervisor_cmd_t nio_cmd_array[] = {
    { "reset_stats", 1, 1, cmd_reset_stats },
    { "set_bandwidth", 2, 2, cmd_set_bandwidth },
    { "list", 0, 0, cmd_nio_list, NULL },
+   { "rxl_stats", 0, 0, cmd_rxl_stats, NULL },
    { NULL, -1, -1, NULL, NULL },
 };
 
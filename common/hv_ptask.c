@@ -0,0 +1,96 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2005,2006 Christophe Fillot (cf@utc.fr)
+ *
+ * Hypervisor routines for periodic tasks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "vm.h"
+#include "ptask.h"
+#include "registry.h"
+#include "hypervisor.h"
+
+/* Get the name of a task group (a VM instance) */
+static void cmd_get_group_name(void *group,char *name,size_t len)
+{
+   vm_instance_t *vm = group;
+
+   snprintf(name,len,"%s",vm->name);
+}
+
+/* Show statistics of a task */
+static void cmd_show_task_stats(ptask_stats_t *stats,void *opt)
+{
+   hypervisor_conn_t *conn = opt;
+   m_uint64_t avg;
+
+   avg = stats->run_count ? stats->run_time / stats->run_count : 0;
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                         "task %lld: worker=%u vm=%s period=%u doorbell=%d "
+                         "runs=%llu late=%llu kicks=%llu total_us=%llu "
+                         "avg_us=%llu max_us=%llu",
+                         stats->id,stats->worker,stats->group_name,
+                         stats->period,stats->doorbell,stats->run_count,
+                         stats->late_count,stats->kick_count,stats->run_time,
+                         avg,stats->run_time_max);
+}
+
+/* Show statistics of workers and tasks */
+static int cmd_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   m_uint64_t wakeups,run_count,run_time;
+   u_int i,task_count;
+
+   for(i=0;i<ptask_get_workers();i++) {
+      if (ptask_get_worker_stats(i,&task_count,&wakeups,
+                                 &run_count,&run_time) == -1)
+         continue;
+
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                            "worker %u: tasks=%u wakeups=%llu runs=%llu "
+                            "run_time_us=%llu",
+                            i,task_count,wakeups,run_count,run_time);
+   }
+
+   ptask_get_stats(cmd_get_group_name,cmd_show_task_stats,conn);
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* ptask commands */
+static hypervisor_cmd_t ptask_cmd_array[] = {
+   { "stats", 0, 0, cmd_stats, NULL },
+   { NULL, -1, -1, NULL, NULL },
+};
+
+/* Hypervisor periodic tasks initialization */
+int hypervisor_ptask_init(void)
+{
+   hypervisor_module_t *module;
+
+   module = hypervisor_register_module("ptask",NULL);
+   assert(module != NULL);
+
+   hypervisor_register_cmd_array(module,ptask_cmd_array);
+   return(0);
+}
@@ -268,6 +268,87 @@ static int cmd_pmem_cfind(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Compare device lookup with the physical map and with the device list */
+static int cmd_dev_lookup_bench(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   m_tmcnt_t map_time,list_time;
+   vm_instance_t *vm;
+   u_int count = 1000000;
+   int errors;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (argc > 1)
+      count = strtoul(argv[1],NULL,0);
+
+   errors = dev_lookup_bench(vm,count,&map_time,&list_time);
+   vm_release(vm);
+
+   if (errors == -1) {
+      hypervisor_send_reply(conn,HSC_ERR_UNSPECIFIED,1,"No device");
+      return(-1);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"lookups: %u",count);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"physical map: %llu us",
+                         map_time);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"device list: %llu us",
+                         list_time);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"mismatches: %d",errors);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show statistics of the physical memory translation cache */
+static int cmd_pmem_tlb_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   m_uint64_t hits,misses,total;
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   /* "reset" clears the counters */
+   physmem_tlb_get_stats(vm,&hits,&misses,
+                         (argc > 1) && !strcmp(argv[1],"reset"));
+
+   total = hits + misses;
+
+   vm_release(vm);
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"hits: %llu",hits);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"misses: %llu",misses);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"hit ratio: %.2f%%",
+                         total ? (100.0 * hits) / total : 0.0);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Check if the code at the specified address looks like an idle loop */
+static int cmd_idle_pc_check(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+   int res;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (!(cpu = cpu_group_find_id(vm->cpu_group,atoi(argv[1])))) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_BAD_OBJ,1,"Bad CPU specified");
+      return(-1);
+   }
+
+   res = cpu_idle_pc_check(cpu,strtoull(argv[2],NULL,0));
+   vm_release(vm);
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"%s",
+                         res ? "idle loop" : "not an idle loop");
+   return(0);
+}
+
 /* VM debug commands */
 static hypervisor_cmd_t vm_cmd_array[] = {
    { "show_cpu_regs", 2, 2, cmd_show_cpu_regs, NULL },
@@ -280,6 +361,9 @@ static hypervisor_cmd_t vm_cmd_array[] = {
    { "pmem_w16", 4, 4, cmd_pmem_w16, NULL },
    { "pmem_r16", 3, 3, cmd_pmem_r16, NULL },
    { "pmem_cfind", 3, 5, cmd_pmem_cfind, NULL },
+   { "dev_lookup_bench", 1, 2, cmd_dev_lookup_bench, NULL },
+   { "pmem_tlb_stats", 1, 2, cmd_pmem_tlb_stats, NULL },
+   { "idle_pc_check", 3, 3, cmd_idle_pc_check, NULL },
    { NULL, -1, -1, NULL, NULL },
 };
 
@@ -99,6 +99,9 @@ extern int hypervisor_vm_debug_init(void);
 /* Hypervisor store initialization */
 extern int hypervisor_store_init(void);
 
+/* Hypervisor periodic tasks initialization */
+extern int hypervisor_ptask_init(void);
+
 /* Send a reply */
 int hypervisor_send_reply(hypervisor_conn_t *conn,int code,int done,
                           char *format,...);
@@ -92,6 +92,254 @@ void memlog_update_read(cpu_gen_t *cpu,m_iptr_t raddr)
 }
 
 
+/* === Physical memory translation cache ================================= */
+
+/*
+ * The cache is shared by all threads using the physmem_* helpers (CPU,
+ * device tasks, RX listeners). Each entry is protected by a sequence
+ * number: readers never block, and a writer that finds an entry being
+ * updated simply does not cache its translation.
+ */
+
+/* Get the cache entry of a physical address */
+static forced_inline vm_pmem_tlb_entry_t *
+physmem_tlb_get_entry(vm_instance_t *vm,m_uint64_t paddr)
+{
+   return(&vm->pmem_tlb[(paddr >> VM_PAGE_SHIFT) & (VM_PMEM_TLB_SIZE - 1)]);
+}
+
+/* Lookup for the host page of a physical address */
+static forced_inline u_char *
+physmem_tlb_lookup(vm_instance_t *vm,m_uint64_t paddr,u_int op_type)
+{
+   vm_pmem_tlb_entry_t *entry;
+   u_char *hptr = NULL;
+   m_uint32_t seq;
+
+   entry = physmem_tlb_get_entry(vm,paddr);
+   seq = __atomic_load_n(&entry->seq,__ATOMIC_ACQUIRE);
+
+   if (!(seq & 1) && (entry->ppage == (paddr & VM_PAGE_MASK)) &&
+       ((op_type == MTS_READ) || (entry->flags & VM_PMEM_TLB_WRITE)))
+      hptr = entry->hptr;
+
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+   if (__atomic_load_n(&entry->seq,__ATOMIC_RELAXED) != seq)
+      return NULL;
+
+   return hptr;
+}
+
+/* Set a cache entry (skipped if the entry is being updated) */
+static void physmem_tlb_set(vm_instance_t *vm,m_uint64_t paddr,
+                            m_uint64_t ppage,u_char *hptr,m_uint32_t flags)
+{
+   vm_pmem_tlb_entry_t *entry;
+   m_uint32_t seq;
+
+   entry = physmem_tlb_get_entry(vm,paddr);
+   seq = __atomic_load_n(&entry->seq,__ATOMIC_RELAXED);
+
+   if ((seq & 1) ||
+       !__atomic_compare_exchange_n(&entry->seq,&seq,seq+1,FALSE,
+                                    __ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+      return;
+
+   entry->ppage = ppage;
+   entry->hptr  = hptr;
+   entry->flags = flags;
+
+   __atomic_store_n(&entry->seq,seq+2,__ATOMIC_RELEASE);
+}
+
+/* 
+ * Clear a cache entry if it matches the specified page (any page if
+ * ppage is -1). Wait for a concurrent update: the entry must not survive.
+ */
+static void physmem_tlb_clear(vm_pmem_tlb_entry_t *entry,m_uint64_t ppage)
+{
+   m_uint32_t seq;
+
+   for(;;) {
+      seq = __atomic_load_n(&entry->seq,__ATOMIC_RELAXED);
+
+      if (!(seq & 1) &&
+          __atomic_compare_exchange_n(&entry->seq,&seq,seq+1,FALSE,
+                                      __ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+         break;
+   }
+
+   if ((ppage == (m_uint64_t)-1) || (entry->ppage == ppage)) {
+      entry->hptr  = NULL;
+      entry->flags = 0;
+   }
+
+   __atomic_store_n(&entry->seq,seq+2,__ATOMIC_RELEASE);
+}
+
+/* Invalidate a page in the physical memory translation cache */
+void physmem_tlb_invalidate(vm_instance_t *vm,m_uint64_t paddr)
+{
+   physmem_tlb_clear(physmem_tlb_get_entry(vm,paddr),paddr & VM_PAGE_MASK);
+}
+
+/* Flush the physical memory translation cache */
+void physmem_tlb_flush(vm_instance_t *vm)
+{
+   u_int i;
+
+   for(i=0;i<VM_PMEM_TLB_SIZE;i++)
+      physmem_tlb_clear(&vm->pmem_tlb[i],(m_uint64_t)-1);
+}
+
+/* Get the slot index of the calling thread (statistics, DMA accesses) */
+static forced_inline u_int physmem_thread_slot(void)
+{
+   u_long h = (u_long)pthread_self();
+
+   return((h >> 12) ^ (h >> 20));
+}
+
+/* Get the statistics slot of the calling thread */
+static forced_inline vm_pmem_tlb_stats_t *physmem_tlb_stats(vm_instance_t *vm)
+{
+   u_int i = physmem_thread_slot();
+   return(&vm->pmem_tlb_stats[i & (VM_PMEM_TLB_STATS_SLOTS - 1)]);
+}
+
+/* 
+ * Increment a counter. Slots are not shared by threads most of the time,
+ * losing a count on a collision is acceptable for statistics.
+ */
+static forced_inline void physmem_tlb_stats_inc(m_uint64_t *counter)
+{
+   __atomic_store_n(counter,__atomic_load_n(counter,__ATOMIC_RELAXED)+1,
+                    __ATOMIC_RELAXED);
+}
+
+/* Get the translation cache statistics of a VM, and optionally reset them */
+void physmem_tlb_get_stats(vm_instance_t *vm,m_uint64_t *hits,
+                           m_uint64_t *misses,int reset)
+{
+   vm_pmem_tlb_stats_t *s;
+   u_int i;
+
+   *hits = *misses = 0;
+
+   for(i=0;i<VM_PMEM_TLB_STATS_SLOTS;i++) {
+      s = &vm->pmem_tlb_stats[i];
+      *hits   += __atomic_load_n(&s->hits,__ATOMIC_RELAXED);
+      *misses += __atomic_load_n(&s->misses,__ATOMIC_RELAXED);
+
+      if (reset) {
+         __atomic_store_n(&s->hits,0,__ATOMIC_RELAXED);
+         __atomic_store_n(&s->misses,0,__ATOMIC_RELAXED);
+      }
+   }
+}
+
+/* === Device accesses to memory ========================================= */
+
+#ifdef USE_UNSTABLE
+/* 
+ * DMA section of the calling thread. Sections can be nested, a thread
+ * accesses the memory of a single VM at a time.
+ */
+static __thread vm_dma_slot_t *physmem_dma_slot = NULL;
+static __thread u_int physmem_dma_depth = 0;
+
+/* Returns TRUE if device threads are accessing the memory of a VM */
+static int physmem_dma_active(vm_instance_t *vm)
+{
+   u_int i;
+
+   for(i=0;i<VM_DMA_SLOTS;i++)
+      if (__atomic_load_n(&vm->dma_slots[i].count,__ATOMIC_SEQ_CST))
+         return(TRUE);
+
+   return(FALSE);
+}
+
+/* 
+ * Start an access to the memory of a VM from a device. Host pointers to
+ * VM memory are valid until the end of the section.
+ */
+void physmem_dma_begin(vm_instance_t *vm)
+{
+   vm_dma_slot_t *slot;
+
+   if (physmem_dma_depth++ != 0)
+      return;
+
+   slot = &vm->dma_slots[physmem_thread_slot() & (VM_DMA_SLOTS - 1)];
+
+   for(;;) {
+      __atomic_add_fetch(&slot->count,1,__ATOMIC_SEQ_CST);
+
+      if (likely(!__atomic_load_n(&vm->dma_closed,__ATOMIC_SEQ_CST)))
+         break;
+
+      /* Pages are being remapped, wait until the end of the operation */
+      pthread_mutex_lock(&vm->dma_lock);
+      __atomic_sub_fetch(&slot->count,1,__ATOMIC_SEQ_CST);
+      pthread_cond_broadcast(&vm->dma_cond);
+
+      while(vm->dma_closed)
+         pthread_cond_wait(&vm->dma_cond,&vm->dma_lock);
+
+      pthread_mutex_unlock(&vm->dma_lock);
+   }
+
+   physmem_dma_slot = slot;
+}
+
+/* End an access to the memory of a VM from a device */
+void physmem_dma_end(vm_instance_t *vm)
+{
+   if (--physmem_dma_depth != 0)
+      return;
+
+   __atomic_sub_fetch(&physmem_dma_slot->count,1,__ATOMIC_SEQ_CST);
+
+   if (unlikely(__atomic_load_n(&vm->dma_closed,__ATOMIC_SEQ_CST))) {
+      pthread_mutex_lock(&vm->dma_lock);
+      pthread_cond_broadcast(&vm->dma_cond);
+      pthread_mutex_unlock(&vm->dma_lock);
+   }
+}
+
+/* Stop the device accesses to the memory of a VM, and wait for them */
+void physmem_dma_suspend(vm_instance_t *vm)
+{
+   pthread_mutex_lock(&vm->dma_lock);
+   __atomic_store_n(&vm->dma_closed,TRUE,__ATOMIC_SEQ_CST);
+
+   while(physmem_dma_active(vm))
+      pthread_cond_wait(&vm->dma_cond,&vm->dma_lock);
+
+   pthread_mutex_unlock(&vm->dma_lock);
+}
+
+/* Allow device accesses to the memory of a VM again */
+void physmem_dma_resume(vm_instance_t *vm)
+{
+   pthread_mutex_lock(&vm->dma_lock);
+   __atomic_store_n(&vm->dma_closed,FALSE,__ATOMIC_SEQ_CST);
+   pthread_cond_broadcast(&vm->dma_cond);
+   pthread_mutex_unlock(&vm->dma_lock);
+}
+#else
+/* Memory pages are never remapped */
+void physmem_dma_begin(vm_instance_t *vm)
+{
+}
+
+void physmem_dma_end(vm_instance_t *vm)
+{
+}
+#endif
+
 /* === Operations on physical memory ====================================== */
 
 /* Get host pointer for the physical address */
@@ -99,23 +347,42 @@ static inline void *physmem_get_hptr(vm_instance_t *vm,m_uint64_t paddr,
                                      u_int op_size,u_int op_type,
                                      m_uint64_t *data)
 {
+   m_uint64_t ppage = paddr & VM_PAGE_MASK;
    struct vdevice *dev;
    m_uint32_t offset;
-   void *ptr;
+   u_char *ptr;
    int cow;
 
+   if (likely((ptr = physmem_tlb_lookup(vm,paddr,op_type)) != NULL)) {
+      physmem_tlb_stats_inc(&physmem_tlb_stats(vm)->hits);
+      return(ptr + (paddr & VM_PAGE_IMASK));
+   }
+
+   physmem_tlb_stats_inc(&physmem_tlb_stats(vm)->misses);
+
    if (!(dev = dev_lookup(vm,paddr,FALSE)))
       return NULL;
 
    if (dev->flags & VDEVICE_FLAG_SPARSE) {
-      ptr = (void *)dev_sparse_get_host_addr(vm,dev,paddr,op_type,&cow);
+      ptr = (u_char *)dev_sparse_get_host_addr(vm,dev,paddr,op_type,&cow);
       if (!ptr) return NULL;
 
+      /* ghost pages are read-only until copied (COW) */
+      physmem_tlb_set(vm,paddr,ppage,ptr,cow ? 0 : VM_PMEM_TLB_WRITE);
       return(ptr + (paddr & VM_PAGE_IMASK));
    }
 
-   if ((dev->host_addr != 0) && !(dev->flags & VDEVICE_FLAG_NO_MTS_MMAP))
-      return((void *)dev->host_addr + (paddr - dev->phys_addr));
+   if ((dev->host_addr != 0) && !(dev->flags & VDEVICE_FLAG_NO_MTS_MMAP)) {
+      ptr = (u_char *)dev->host_addr + (paddr - dev->phys_addr);
+
+      /* cache only pages completely covered by the device */
+      if ((ppage >= dev->phys_addr) && 
+          ((ppage + VM_PAGE_SIZE) <= (dev->phys_addr + dev->phys_len)))
+         physmem_tlb_set(vm,paddr,ppage,ptr - (paddr & VM_PAGE_IMASK),
+                         VM_PMEM_TLB_WRITE);
+
+      return(ptr);
+   }
 
    if (op_size == 0)
       return NULL;
@@ -128,74 +395,227 @@ static inline void *physmem_get_hptr(vm_instance_t *vm,m_uint64_t paddr,
 void physmem_copy_from_vm(vm_instance_t *vm,void *real_buffer,
                           m_uint64_t paddr,size_t len)
 {
+   struct iovec iov[PHYSMEM_COPY_MAX_IOV];
    m_uint64_t dummy;
    m_uint32_t r;
+   u_char *buf = real_buffer;
    u_char *ptr;
+   int i,count;
+
+   physmem_dma_begin(vm);
+
+   /* Fast path: the whole range is in host memory */
+   count = physmem_map_iov(vm,paddr,len,MTS_READ,iov,PHYSMEM_COPY_MAX_IOV);
+
+   if (likely(count != -1)) {
+      for(i=0;i<count;i++) {
+         memcpy(buf,iov[i].iov_base,iov[i].iov_len);
+         buf += iov[i].iov_len;
+      }
+
+      physmem_dma_end(vm);
+      return;
+   }
 
    while(len > 0) {
       r = m_min(VM_PAGE_SIZE - (paddr & VM_PAGE_IMASK), len);
       ptr = physmem_get_hptr(vm,paddr,0,MTS_READ,&dummy);
       
       if (likely(ptr != NULL)) {
-         memcpy(real_buffer,ptr,r);
+         memcpy(buf,ptr,r);
       } else {
          r = m_min(len,4);
          switch(r) {
             case 4:
-               *(m_uint32_t *)real_buffer = 
+               *(m_uint32_t *)buf = 
                   htovm32(physmem_copy_u32_from_vm(vm,paddr));
                break;
             case 2:
-               *(m_uint16_t *)real_buffer =
+               *(m_uint16_t *)buf =
                   htovm16(physmem_copy_u16_from_vm(vm,paddr));
                break;
             case 1:
-               *(m_uint8_t *)real_buffer = physmem_copy_u8_from_vm(vm,paddr);
+               *(m_uint8_t *)buf = physmem_copy_u8_from_vm(vm,paddr);
                break;
          }
       }
 
-      real_buffer += r;
+      buf += r;
       paddr += r;
       len -= r;
    }
+
+   physmem_dma_end(vm);
 }
 
 /* Copy a memory block to VM physical RAM from real host */
 void physmem_copy_to_vm(vm_instance_t *vm,void *real_buffer,
                         m_uint64_t paddr,size_t len)
 {
+   struct iovec iov[PHYSMEM_COPY_MAX_IOV];
    m_uint64_t dummy;
    m_uint32_t r;
+   u_char *buf = real_buffer;
    u_char *ptr;
+   int i,count;
+
+   physmem_dma_begin(vm);
+
+   /* Fast path: the whole range is in host memory */
+   count = physmem_map_iov(vm,paddr,len,MTS_WRITE,iov,PHYSMEM_COPY_MAX_IOV);
+
+   if (likely(count != -1)) {
+      for(i=0;i<count;i++) {
+         memcpy(iov[i].iov_base,buf,iov[i].iov_len);
+         buf += iov[i].iov_len;
+      }
+
+      physmem_dma_end(vm);
+      return;
+   }
 
    while(len > 0) {
       r = m_min(VM_PAGE_SIZE - (paddr & VM_PAGE_IMASK), len);
       ptr = physmem_get_hptr(vm,paddr,0,MTS_WRITE,&dummy);
       
       if (likely(ptr != NULL)) {
-         memcpy(ptr,real_buffer,r);
+         memcpy(ptr,buf,r);
       } else {
          r = m_min(len,4);
          switch(r) {
             case 4:
                physmem_copy_u32_to_vm(vm,paddr,
-                                      htovm32(*(m_uint32_t *)real_buffer));
+                                      htovm32(*(m_uint32_t *)buf));
                break;
             case 2:
                physmem_copy_u16_to_vm(vm,paddr,
-                                      htovm16(*(m_uint16_t *)real_buffer));
+                                      htovm16(*(m_uint16_t *)buf));
                break;
             case 1:
-               physmem_copy_u8_to_vm(vm,paddr,*(m_uint8_t *)real_buffer);
+               physmem_copy_u8_to_vm(vm,paddr,*(m_uint8_t *)buf);
                break;
          }
       }
 
-      real_buffer += r;
+      buf += r;
       paddr += r;
       len -= r;
    }
+
+   physmem_dma_end(vm);
+}
+
+/*
+ * Map a VM physical memory range to host memory segments, for
+ * scatter-gather I/O directly from/to VM memory.
+ *
+ * Write mappings allocate sparse pages and break "ghost" sharing (COW),
+ * so the segments can be written. With sparse memory, the segments are
+ * valid until the end of the DMA section of the caller.
+ *
+ * Returns the number of segments, or -1 if a part of the range is not
+ * directly mapped in host memory (device registers) or if more than
+ * max_iov segments would be required.
+ */
+int physmem_map_iov(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                    u_int op_type,struct iovec *iov,u_int max_iov)
+{
+   struct vdevice *dev;
+   m_uint64_t dev_end;
+   u_char *ptr;
+   size_t r;
+   int cow,count = 0;
+
+   physmem_dma_begin(vm);
+
+   while(len > 0) {
+      if (!(dev = dev_lookup(vm,paddr,FALSE)))
+         goto unmapped;
+
+      if (dev->flags & VDEVICE_FLAG_SPARSE) {
+         /* Sparse memory: each page has its own host page */
+         ptr = (u_char *)dev_sparse_get_host_addr(vm,dev,paddr,op_type,&cow);
+         if (!ptr) goto unmapped;
+
+         ptr += paddr & VM_PAGE_IMASK;
+         r = m_min(VM_PAGE_SIZE - (paddr & VM_PAGE_IMASK), len);
+      } else {
+         /* Linear host mapping: the whole device in a single segment */
+         if (!dev->host_addr || (dev->flags & VDEVICE_FLAG_NO_MTS_MMAP))
+            goto unmapped;
+
+         ptr = (u_char *)dev->host_addr + (paddr - dev->phys_addr);
+         dev_end = dev->phys_addr + dev->phys_len;
+         r = m_min(dev_end - paddr, len);
+      }
+
+      /* Merge with the previous segment if contiguous in host memory */
+      if (count && ((u_char *)iov[count-1].iov_base +
+                    iov[count-1].iov_len == ptr))
+      {
+         iov[count-1].iov_len += r;
+      } else {
+         if (count == max_iov)
+            goto unmapped;
+
+         iov[count].iov_base = ptr;
+         iov[count].iov_len  = r;
+         count++;
+      }
+
+      paddr += r;
+      len -= r;
+   }
+
+   physmem_dma_end(vm);
+   return(count);
+
+ unmapped:
+   physmem_dma_end(vm);
+   return(-1);
+}
+
+/*
+ * Add a VM physical memory range, located at offset "pos" of a packet, to
+ * the segments describing this packet (read access).
+ *
+ * The bounce buffer mirrors the whole packet: ranges that cannot be mapped
+ * are copied there, and if the segment list is full the packet is
+ * linearized in it. Returns the new number of segments.
+ */
+int physmem_map_iov_bounce(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                           struct iovec *iov,int count,u_int max_iov,
+                           u_char *bounce,size_t pos)
+{
+   size_t offset;
+   int i,res;
+
+   if (!len)
+      return(count);
+
+   /* The caller keeps the segments until the end of its DMA section */
+   res = physmem_map_iov(vm,paddr,len,MTS_READ,&iov[count],max_iov-count);
+
+   if (res != -1)
+      return(count+res);
+
+   physmem_copy_from_vm(vm,bounce+pos,paddr,len);
+
+   if (count < max_iov) {
+      iov[count].iov_base = bounce + pos;
+      iov[count].iov_len  = len;
+      return(count+1);
+   }
+
+   /* No segment left: linearize the packet */
+   for(i=0,offset=0;i<count;i++) {
+      memmove(bounce+offset,iov[i].iov_base,iov[i].iov_len);
+      offset += iov[i].iov_len;
+   }
+
+   iov[0].iov_base = bounce;
+   iov[0].iov_len  = pos + len;
+   return(1);
 }
 
 /* Copy a 32-bit word from the VM physical RAM to real host */
@@ -204,9 +624,12 @@ m_uint32_t physmem_copy_u32_from_vm(vm_instance_t *vm,m_uint64_t paddr)
    m_uint64_t tmp = 0;
    m_uint32_t *ptr;
 
+   physmem_dma_begin(vm);
+
    if ((ptr = physmem_get_hptr(vm,paddr,4,MTS_READ,&tmp)) != NULL)
-      return(vmtoh32(*ptr));
+      tmp = vmtoh32(*ptr);
 
+   physmem_dma_end(vm);
    return(tmp);
 }
 
@@ -216,8 +639,12 @@ void physmem_copy_u32_to_vm(vm_instance_t *vm,m_uint64_t paddr,m_uint32_t val)
    m_uint64_t tmp = val;
    m_uint32_t *ptr;
 
+   physmem_dma_begin(vm);
+
    if ((ptr = physmem_get_hptr(vm,paddr,4,MTS_WRITE,&tmp)) != NULL)
       *ptr = htovm32(val);
+
+   physmem_dma_end(vm);
 }
 
 /* Copy a 16-bit word from the VM physical RAM to real host */
@@ -226,9 +653,12 @@ m_uint16_t physmem_copy_u16_from_vm(vm_instance_t *vm,m_uint64_t paddr)
    m_uint64_t tmp = 0;
    m_uint16_t *ptr;
 
+   physmem_dma_begin(vm);
+
    if ((ptr = physmem_get_hptr(vm,paddr,2,MTS_READ,&tmp)) != NULL)
-      return(vmtoh16(*ptr));
+      tmp = vmtoh16(*ptr);
 
+   physmem_dma_end(vm);
    return(tmp);
 }
 
@@ -238,8 +668,12 @@ void physmem_copy_u16_to_vm(vm_instance_t *vm,m_uint64_t paddr,m_uint16_t val)
    m_uint64_t tmp = val;
    m_uint16_t *ptr;
 
-   if ((ptr = physmem_get_hptr(vm,paddr,2,MTS_WRITE,&tmp)) != NULL)   
+   physmem_dma_begin(vm);
+
+   if ((ptr = physmem_get_hptr(vm,paddr,2,MTS_WRITE,&tmp)) != NULL)
       *ptr = htovm16(val);
+
+   physmem_dma_end(vm);
 }
 
 /* Copy a byte from the VM physical RAM to real host */
@@ -248,9 +682,12 @@ m_uint8_t physmem_copy_u8_from_vm(vm_instance_t *vm,m_uint64_t paddr)
    m_uint64_t tmp = 0;
    m_uint8_t *ptr;
 
+   physmem_dma_begin(vm);
+
    if ((ptr = physmem_get_hptr(vm,paddr,1,MTS_READ,&tmp)) != NULL)
-      return(*ptr);
+      tmp = *ptr;
 
+   physmem_dma_end(vm);
    return(tmp);
 }
 
@@ -260,8 +697,12 @@ void physmem_copy_u8_to_vm(vm_instance_t *vm,m_uint64_t paddr,m_uint8_t val)
    m_uint64_t tmp = val;
    m_uint8_t *ptr;
 
-   if ((ptr = physmem_get_hptr(vm,paddr,1,MTS_WRITE,&tmp)) != NULL)   
+   physmem_dma_begin(vm);
+
+   if ((ptr = physmem_get_hptr(vm,paddr,1,MTS_WRITE,&tmp)) != NULL)
       *ptr = val;
+
+   physmem_dma_end(vm);
 }
 
 /* DMA transfer operation */
@@ -272,13 +713,15 @@ void physmem_dma_transfer(vm_instance_t *vm,m_uint64_t src,m_uint64_t dst,
    u_char *sptr,*dptr;
    size_t clen,sl,dl;
 
+   physmem_dma_begin(vm);
+
    while(len > 0) {
       sptr = physmem_get_hptr(vm,src,0,MTS_READ,&dummy);
       dptr = physmem_get_hptr(vm,dst,0,MTS_WRITE,&dummy);
 
       if (!sptr || !dptr) {
          vm_log(vm,"DMA","unable to transfer from 0x%llx to 0x%llx\n",src,dst);
-         return;
+         break;
       }
 
       sl = VM_PAGE_SIZE - (src & VM_PAGE_IMASK);
@@ -292,6 +735,8 @@ void physmem_dma_transfer(vm_instance_t *vm,m_uint64_t src,m_uint64_t dst,
       dst += clen;
       len -= clen;
    }
+
+   physmem_dma_end(vm);
 }
 
 /* strnlen in VM physical memory */
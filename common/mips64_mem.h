@@ -12,4 +12,10 @@ void mips64_mem_shutdown(cpu_mips_t *cpu);
 /* Set the address mode */
 int mips64_set_addr_mode(cpu_mips_t *cpu,u_int addr_mode);
 
+/* Set the number of entries of the MTS cache */
+int mips64_mts_set_cache_entries(u_int entries);
+
+/* Set the number of ways of the MTS cache */
+int mips64_mts_set_cache_ways(u_int ways);
+
 #endif
@@ -760,6 +760,37 @@ void cisco_isl_rewrite(m_uint8_t *pkt,m_uint32_t tot_len)
    }
 }
 
+/*
+ * Rewrite ISL header of a packet described by a list of segments. ISL
+ * frames are linearized in the specified buffer before being rewritten.
+ * Returns the new number of segments.
+ */
+int cisco_isl_rewrite_iov(m_uint8_t *buf,struct iovec *iov,int iovcnt,
+                          m_uint32_t tot_len)
+{
+   static m_uint8_t isl_xaddr[N_ETH_ALEN] = { 0x01,0x00,0x0c,0x00,0x10,0x00 };
+   size_t offset;
+   int i;
+
+   if (!iovcnt)
+      return(0);
+
+   if ((iov[0].iov_len >= N_ETH_ALEN) && 
+       memcmp(iov[0].iov_base,isl_xaddr,N_ETH_ALEN))
+      return(iovcnt);
+
+   for(i=0,offset=0;i<iovcnt;i++) {
+      memmove(buf+offset,iov[i].iov_base,iov[i].iov_len);
+      offset += iov[i].iov_len;
+   }
+
+   cisco_isl_rewrite(buf,tot_len);
+
+   iov[0].iov_base = buf;
+   iov[0].iov_len  = tot_len;
+   return(1);
+}
+
 /* Verify checksum of an IP header */
 int ip_verify_cksum(n_ip_hdr_t *hdr)
 {
@@ -14,6 +14,7 @@
 #include <netdb.h>
 /* TODO missing in MinGW */
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #define N_IP_ADDR_LEN   4
@@ -364,6 +365,10 @@ int ip_connect_fd(int fd,char *remote_host,int remote_port);
 /* ISL rewrite */
 void cisco_isl_rewrite(m_uint8_t *pkt,m_uint32_t tot_len);
 
+/* Rewrite ISL header of a packet described by a list of segments */
+int cisco_isl_rewrite_iov(m_uint8_t *buf,struct iovec *iov,int iovcnt,
+                          m_uint32_t tot_len);
+
 /* Verify checksum of an IP header */
 int ip_verify_cksum(n_ip_hdr_t *hdr);
 
@@ -32,6 +32,10 @@
 #ifdef __linux__
 #include <net/if.h>
 #include <linux/if_tun.h>
+#include <sys/epoll.h>
+#include <sched.h>
+#define NETIO_RXL_EPOLL  1
+#define NETIO_UDP_MMSG   1
 #endif
 
 #include "registry.h"
@@ -43,20 +47,11 @@
 /* Free a NetIO descriptor */
 static int netio_free(void *data,void *arg);
 
-/* NIO RX listener */
-static pthread_mutex_t netio_rxl_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t netio_rxq_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct netio_rx_listener *netio_rxl_list = NULL;
-static struct netio_rx_listener *netio_rxl_add_list = NULL;
-static netio_desc_t *netio_rxl_remove_list = NULL;
-static pthread_t netio_rxl_thread;
-static pthread_cond_t netio_rxl_cond;
-
-#define NETIO_RXL_LOCK()   pthread_mutex_lock(&netio_rxl_mutex);
-#define NETIO_RXL_UNLOCK() pthread_mutex_unlock(&netio_rxl_mutex);
-
-#define NETIO_RXQ_LOCK()   pthread_mutex_lock(&netio_rxq_mutex);
-#define NETIO_RXQ_UNLOCK() pthread_mutex_unlock(&netio_rxq_mutex);
+/* NIO RX listener shards */
+static netio_rxl_shard_t *netio_rxl_shards = NULL;
+static u_int netio_rxl_shard_count = 1;
+static int netio_rxl_cpus[NETIO_RXL_MAX_WORKERS];
+static u_int netio_rxl_cpu_count = 0;
 
 /* NetIO type */
 typedef struct {
@@ -143,6 +138,7 @@ static netio_desc_t *netio_create(char *name)
    /* setup as a NULL descriptor */
    memset(nio,0,sizeof(*nio));
    nio->type = NETIO_TYPE_NULL;
+   pthread_mutex_init(&nio->tx_batch_lock,NULL);
 
    /* save name for registry */
    if (!(nio->name = strdup(name))) {
@@ -184,13 +180,19 @@ void netio_save_config_all(FILE *fd)
    fprintf(fd,"\n");
 }
 
-/* Send a packet through a NetIO descriptor */
-ssize_t netio_send(netio_desc_t *nio,void *pkt,size_t len)
+/* Update output statistics */
+static inline void netio_update_out_stats(netio_desc_t *nio,size_t len)
 {
-   int res;
+   nio->stats_pkts_out++;
+   nio->stats_bytes_out += len;
 
-   if (!nio)
-      return(-1);
+   netio_update_bw_stat(nio,len);
+}
+
+/* Apply TX filters and update statistics before sending a packet */
+static int netio_send_prepare(netio_desc_t *nio,void *pkt,size_t len)
+{
+   int res;
 
    if (nio->debug) {
       printf("NIO %s: sending a packet of %lu bytes:\n",nio->name,(u_long)len);
@@ -213,29 +215,172 @@ ssize_t netio_send(netio_desc_t *nio,void *pkt,size_t len)
          return(-1);
    }
 
-   /* Update output statistics */
-   nio->stats_pkts_out++;
-   nio->stats_bytes_out += len;
+   netio_update_out_stats(nio,len);
+   return(0);
+}
 
-   netio_update_bw_stat(nio,len);
+/* Get the total length of a list of segments */
+static size_t netio_iov_len(struct iovec *iov,int iovcnt)
+{
+   size_t len = 0;
+   int i;
+
+   for(i=0;i<iovcnt;i++)
+      len += iov[i].iov_len;
+
+   return(len);
+}
+
+/* Gather a list of segments into a linear buffer */
+static size_t netio_iov_gather(u_char *buf,size_t max_len,
+                               struct iovec *iov,int iovcnt)
+{
+   size_t len = 0,clen;
+   int i;
+
+   for(i=0;(i<iovcnt) && (len<max_len);i++) {
+      clen = m_min(iov[i].iov_len,max_len - len);
+      memcpy(buf+len,iov[i].iov_base,clen);
+      len += clen;
+   }
+
+   return(len);
+}
+
+/* Send a packet through a NetIO descriptor */
+ssize_t netio_send(netio_desc_t *nio,void *pkt,size_t len)
+{
+   if (!nio)
+      return(-1);
+
+   if (netio_send_prepare(nio,pkt,len) == -1)
+      return(-1);
 
    return(nio->send(nio->dptr,pkt,len));
 }
 
-/* Receive a packet through a NetIO descriptor */
-ssize_t netio_recv(netio_desc_t *nio,void *pkt,size_t max_len)
+/* 
+ * Send a packet described by a list of segments (scatter-gather).
+ * The segments are sent directly when the NIO supports it, otherwise
+ * (or if filters or debugging need a linear packet) they are gathered.
+ */
+ssize_t netio_sendv(netio_desc_t *nio,struct iovec *iov,int iovcnt)
 {
-   ssize_t len;
-   int res;
+   u_char pkt[NETIO_MAX_PKT_SIZE];
+   size_t len;
 
    if (!nio)
       return(-1);
 
-   /* Receive the packet */
-   memset(pkt, 0, max_len);
-   if ((len = nio->recv(nio->dptr,pkt,max_len)) <= 0)
+   if (iovcnt == 1)
+      return(netio_send(nio,iov[0].iov_base,iov[0].iov_len));
+
+   if (!nio->sendv || nio->debug || nio->tx_filter || nio->both_filter) {
+      len = netio_iov_gather(pkt,sizeof(pkt),iov,iovcnt);
+      return(netio_send(nio,pkt,len));
+   }
+
+   netio_update_out_stats(nio,netio_iov_len(iov,iovcnt));
+   return(nio->sendv(nio->dptr,iov,iovcnt));
+}
+
+/* Send the packets of the TX batch (TX batch lock held) */
+static void netio_send_flush_internal(netio_desc_t *nio)
+{
+   netio_batch_t *batch = nio->tx_batch;
+
+   if (!batch || !batch->count)
+      return;
+
+   nio->send_batch(nio->dptr,batch);
+   batch->count = 0;
+   batch->buf_used = 0;
+}
+
+/* 
+ * Queue a packet described by a list of segments for transmission
+ * (sent by netio_send_flush). The segments are gathered directly in
+ * the TX batch buffer.
+ */
+ssize_t netio_send_queuedv(netio_desc_t *nio,struct iovec *iov,int iovcnt)
+{
+   netio_batch_t *batch;
+   u_char *pkt;
+   size_t len;
+
+   if (!nio)
       return(-1);
 
+   /* No batch support for this NIO type, send immediately */
+   if (!nio->send_batch)
+      return(netio_sendv(nio,iov,iovcnt));
+
+   len = netio_iov_len(iov,iovcnt);
+
+   pthread_mutex_lock(&nio->tx_batch_lock);
+
+   if (!nio->tx_batch && !(nio->tx_batch = netio_batch_create(NETIO_TX_BATCH_SIZE)))
+   {
+      pthread_mutex_unlock(&nio->tx_batch_lock);
+      return(netio_sendv(nio,iov,iovcnt));
+   }
+
+   batch = nio->tx_batch;
+
+   /* Make room for this packet */
+   if ((batch->count == NETIO_BATCH_MAX) ||
+       ((batch->buf_used + len) > batch->buf_size))
+      netio_send_flush_internal(nio);
+
+   /* Too large for the batch buffer */
+   if (len > batch->buf_size) {
+      pthread_mutex_unlock(&nio->tx_batch_lock);
+      return(netio_sendv(nio,iov,iovcnt));
+   }
+
+   pkt = batch->buf + batch->buf_used;
+   netio_iov_gather(pkt,len,iov,iovcnt);
+
+   if (netio_send_prepare(nio,pkt,len) == -1) {
+      pthread_mutex_unlock(&nio->tx_batch_lock);
+      return(-1);
+   }
+
+   batch->pkt[batch->count] = pkt;
+   batch->pkt_len[batch->count] = len;
+   batch->buf_used += len;
+   batch->count++;
+
+   pthread_mutex_unlock(&nio->tx_batch_lock);
+   return(len);
+}
+
+/* Queue a packet for transmission (sent by netio_send_flush) */
+ssize_t netio_send_queued(netio_desc_t *nio,void *pkt,size_t len)
+{
+   struct iovec iov;
+
+   iov.iov_base = pkt;
+   iov.iov_len  = len;
+   return(netio_send_queuedv(nio,&iov,1));
+}
+
+/* Send the packets queued for transmission */
+void netio_send_flush(netio_desc_t *nio)
+{
+   if (!nio || !nio->tx_batch)
+      return;
+
+   pthread_mutex_lock(&nio->tx_batch_lock);
+   netio_send_flush_internal(nio);
+   pthread_mutex_unlock(&nio->tx_batch_lock);
+}
+
+/* Apply RX filters and update statistics on a received packet */
+static ssize_t netio_recv_process(netio_desc_t *nio,void *pkt,ssize_t len)
+{
+   int res;
+
    if (nio->debug) {
       printf("NIO %s: receiving a packet of %ld bytes:\n",nio->name,(long)len);
       mem_dump(stdout,pkt,len);
@@ -263,6 +408,92 @@ ssize_t netio_recv(netio_desc_t *nio,void *pkt,size_t max_len)
    return(len);
 }
 
+/* Receive a packet through a NetIO descriptor */
+ssize_t netio_recv(netio_desc_t *nio,void *pkt,size_t max_len)
+{
+   ssize_t len;
+
+   if (!nio)
+      return(-1);
+
+   /* Receive the packet */
+   memset(pkt, 0, max_len);
+   if ((len = nio->recv(nio->dptr,pkt,max_len)) <= 0)
+      return(-1);
+
+   return(netio_recv_process(nio,pkt,len));
+}
+
+/* 
+ * Receive a batch of packets through a NetIO descriptor.
+ *
+ * The packet buffers of the batch must be zeroed: the caller has to clear
+ * the received bytes once it is done with them. Dropped packets have
+ * a length of -1.
+ */
+int netio_recv_batch(netio_desc_t *nio,netio_batch_t *batch)
+{
+   ssize_t len;
+   u_int i;
+
+   batch->count = 0;
+
+   if (!nio || !nio->recv_batch)
+      return(-1);
+
+   if (nio->recv_batch(nio->dptr,batch) <= 0)
+      return(-1);
+
+   for(i=0;i<batch->count;i++) {
+      if (batch->pkt_len[i] <= 0) {
+         batch->pkt_len[i] = -1;
+         continue;
+      }
+
+      len = netio_recv_process(nio,batch->pkt[i],batch->pkt_len[i]);
+
+      /* dropped by a filter: clear the buffer now */
+      if (len == -1)
+         memset(batch->pkt[i],0,batch->pkt_len[i]);
+
+      batch->pkt_len[i] = len;
+   }
+
+   return(batch->count);
+}
+
+/* Create a packet batch */
+netio_batch_t *netio_batch_create(size_t buf_size)
+{
+   netio_batch_t *batch;
+   u_int i;
+
+   if (!(batch = calloc(1,sizeof(*batch))))
+      return NULL;
+
+   if (!(batch->buf = calloc(1,buf_size))) {
+      free(batch);
+      return NULL;
+   }
+
+   batch->buf_size = buf_size;
+   batch->pkt_size = buf_size / NETIO_BATCH_MAX;
+
+   for(i=0;i<NETIO_BATCH_MAX;i++)
+      batch->pkt[i] = batch->buf + (i * batch->pkt_size);
+
+   return batch;
+}
+
+/* Free a packet batch */
+void netio_batch_free(netio_batch_t *batch)
+{
+   if (batch) {
+      free(batch->buf);
+      free(batch);
+   }
+}
+
 /* Get a NetIO FD */
 int netio_get_fd(netio_desc_t *nio)
 {
@@ -371,6 +602,20 @@ static ssize_t netio_unix_send(netio_unix_desc_t *nud,void *pkt,size_t pkt_len)
                  sizeof(nud->remote_sock)));
 }
 
+/* Send a packet described by a list of segments to an UNIX socket */
+static ssize_t netio_unix_sendv(netio_unix_desc_t *nud,
+                                struct iovec *iov,int iovcnt)
+{
+   struct msghdr msg;
+
+   memset(&msg,0,sizeof(msg));
+   msg.msg_name    = &nud->remote_sock;
+   msg.msg_namelen = sizeof(nud->remote_sock);
+   msg.msg_iov     = iov;
+   msg.msg_iovlen  = iovcnt;
+   return(sendmsg(nud->fd,&msg,0));
+}
+
 /* Receive a packet from an UNIX socket */
 static ssize_t netio_unix_recv(netio_unix_desc_t *nud,void *pkt,size_t max_len)
 {
@@ -400,6 +645,7 @@ netio_desc_t *netio_desc_create_unix(char *nio_name,char *local,char *remote)
 
    nio->type     = NETIO_TYPE_UNIX;
    nio->send     = (void *)netio_unix_send;
+   nio->sendv    = (void *)netio_unix_sendv;
    nio->recv     = (void *)netio_unix_recv;
    nio->free     = (void *)netio_unix_free;
    nio->save_cfg = netio_unix_save_cfg;
@@ -658,6 +904,13 @@ static ssize_t netio_tap_send(netio_tap_desc_t *ntd,void *pkt,size_t pkt_len)
    return(write(ntd->fd,pkt,pkt_len));
 }
 
+/* Send a packet described by a list of segments to a TAP device */
+static ssize_t netio_tap_sendv(netio_tap_desc_t *ntd,
+                               struct iovec *iov,int iovcnt)
+{
+   return(writev(ntd->fd,iov,iovcnt));
+}
+
 /* Receive a packet through a TAP device */
 static ssize_t netio_tap_recv(netio_tap_desc_t *ntd,void *pkt,size_t max_len)
 {
@@ -689,6 +942,7 @@ netio_desc_t *netio_desc_create_tap(char *nio_name,char *tap_name)
 
    nio->type     = NETIO_TYPE_TAP;
    nio->send     = (void *)netio_tap_send;
+   nio->sendv    = (void *)netio_tap_sendv;
    nio->recv     = (void *)netio_tap_recv;
    nio->free     = (void *)netio_tap_free;
    nio->save_cfg = netio_tap_save_cfg;
@@ -919,12 +1173,89 @@ static ssize_t netio_udp_send(netio_inet_desc_t *nid,void *pkt,size_t pkt_len)
    return(send(nid->fd,pkt,pkt_len,0));
 }
 
+/* Send a packet described by a list of segments to an UDP socket */
+static ssize_t netio_udp_sendv(netio_inet_desc_t *nid,
+                               struct iovec *iov,int iovcnt)
+{
+   struct msghdr msg;
+
+   memset(&msg,0,sizeof(msg));
+   msg.msg_iov    = iov;
+   msg.msg_iovlen = iovcnt;
+   return(sendmsg(nid->fd,&msg,0));
+}
+
 /* Receive a packet from an UDP socket */
 static ssize_t netio_udp_recv(netio_inet_desc_t *nid,void *pkt,size_t max_len)
 {
    return(recvfrom(nid->fd,pkt,max_len,0,NULL,NULL));
 }
 
+#ifdef NETIO_UDP_MMSG
+/* Send a batch of packets to an UDP socket */
+static int netio_udp_send_batch(netio_inet_desc_t *nid,netio_batch_t *batch)
+{
+   struct mmsghdr msgs[NETIO_BATCH_MAX];
+   struct iovec iov[NETIO_BATCH_MAX];
+   u_int i,sent = 0;
+   int res;
+
+   memset(msgs,0,sizeof(msgs));
+
+   for(i=0;i<batch->count;i++) {
+      iov[i].iov_base = batch->pkt[i];
+      iov[i].iov_len  = batch->pkt_len[i];
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+
+   /* 
+    * sendmmsg stops at the first failing datagram: skip it (UDP gives no
+    * delivery guarantee anyway) and go on with the remaining ones.
+    */
+   while(sent < batch->count) {
+      res = sendmmsg(nid->fd,&msgs[sent],batch->count - sent,0);
+
+      if (res <= 0) {
+         if ((res == -1) && (errno == EINTR))
+            continue;
+         sent++;
+      } else
+         sent += res;
+   }
+
+   return(batch->count);
+}
+
+/* Receive a batch of packets from an UDP socket */
+static int netio_udp_recv_batch(netio_inet_desc_t *nid,netio_batch_t *batch)
+{
+   struct mmsghdr msgs[NETIO_BATCH_MAX];
+   struct iovec iov[NETIO_BATCH_MAX];
+   int i,res;
+
+   memset(msgs,0,sizeof(msgs));
+
+   for(i=0;i<NETIO_BATCH_MAX;i++) {
+      iov[i].iov_base = batch->pkt[i];
+      iov[i].iov_len  = batch->pkt_size;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+
+   res = recvmmsg(nid->fd,msgs,NETIO_BATCH_MAX,MSG_DONTWAIT,NULL);
+
+   if (res <= 0)
+      return(-1);
+
+   for(i=0;i<res;i++)
+      batch->pkt_len[i] = msgs[i].msg_len;
+
+   batch->count = res;
+   return(res);
+}
+#endif
+
 /* Save the NIO configuration */
 static void netio_udp_save_cfg(netio_desc_t *nio,FILE *fd)
 {
@@ -960,7 +1291,12 @@ netio_desc_t *netio_desc_create_udp(char *nio_name,int local_port,
 
    nio->type     = NETIO_TYPE_UDP;
    nio->send     = (void *)netio_udp_send;
+   nio->sendv    = (void *)netio_udp_sendv;
    nio->recv     = (void *)netio_udp_recv;
+#ifdef NETIO_UDP_MMSG
+   nio->send_batch = (void *)netio_udp_send_batch;
+   nio->recv_batch = (void *)netio_udp_recv_batch;
+#endif
    nio->free     = (void *)netio_udp_free;
    nio->save_cfg = netio_udp_save_cfg;
    nio->dptr     = &nio->u.nid;
@@ -1042,7 +1378,12 @@ netio_desc_t *netio_desc_create_udp_auto(char *nio_name,char *local_addr,
    
    nio->type     = NETIO_TYPE_UDP_AUTO;
    nio->send     = (void *)netio_udp_send;
+   nio->sendv    = (void *)netio_udp_sendv;
    nio->recv     = (void *)netio_udp_recv;
+#ifdef NETIO_UDP_MMSG
+   nio->send_batch = (void *)netio_udp_send_batch;
+   nio->recv_batch = (void *)netio_udp_recv_batch;
+#endif
    nio->free     = (void *)netio_udp_free;
    nio->save_cfg = netio_udp_save_cfg;
    nio->dptr     = &nio->u.nid;
@@ -1451,6 +1792,10 @@ static int netio_free(void *data,void *arg)
       netio_filter_unbind(nio,NETIO_FILTER_DIR_TX);
       netio_filter_unbind(nio,NETIO_FILTER_DIR_BOTH);
 
+      netio_send_flush(nio);
+      netio_batch_free(nio->tx_batch);
+      pthread_mutex_destroy(&nio->tx_batch_lock);
+
       if (nio->free != NULL)
          nio->free(nio->dptr);
 
@@ -1494,8 +1839,18 @@ void netio_update_bw_stat(netio_desc_t *nio,m_uint64_t bytes)
 /* Reset NIO bandwidth counter */
 void netio_clear_bw_stat(netio_desc_t *nio)
 {
-   if (++nio->bw_ptask_cnt == (NETIO_BW_SAMPLE_ITV / ptask_sleep_time)) {
-      nio->bw_ptask_cnt = 0;
+   m_tmcnt_t now = m_gettime();
+   u_int i;
+
+   /* 
+    * Rotate the samples according to the elapsed time (the TX tasks
+    * calling this are not run at a fixed rate when they are kicked).
+    */
+   for(i=0;i<NETIO_BW_SAMPLES;i++) {
+      if ((now - nio->bw_sample_time) < NETIO_BW_SAMPLE_ITV)
+         return;
+
+      nio->bw_sample_time += NETIO_BW_SAMPLE_ITV;
 
       if (++nio->bw_pos == NETIO_BW_SAMPLES)
          nio->bw_pos = 0;
@@ -1503,6 +1858,8 @@ void netio_clear_bw_stat(netio_desc_t *nio)
       nio->bw_cnt_total -= nio->bw_cnt[nio->bw_pos];
       nio->bw_cnt[nio->bw_pos] = 0;
    }
+
+   nio->bw_sample_time = now;
 }
 
 /* Set the bandwidth constraint */
@@ -1510,32 +1867,111 @@ void netio_set_bandwidth(netio_desc_t *nio,u_int bandwidth)
 {
    nio->bandwidth = bandwidth;
 }
-
 /*
  * =========================================================================
  * RX Listeners
  * =========================================================================
+ *
+ * NIO are spread over a set of RX shards. Each shard owns a worker thread
+ * which waits for incoming packets on the NIO FDs of the shard (with epoll
+ * on Linux, with select() elsewhere). Adding/removing a listener only
+ * involves the target shard: the request is queued and the worker is woken
+ * up through a pipe, so other shards keep running.
  */
 
+/* Hash a NIO to a shard */
+static inline netio_rxl_shard_t *netio_rxl_get_shard(netio_desc_t *nio)
+{
+   m_uint64_t val = (m_uint64_t)(m_iptr_t)nio;
+
+   val ^= val >> 33;
+   val *= 0xff51afd7ed558ccdULL;
+   val ^= val >> 33;
+   return(&netio_rxl_shards[val % netio_rxl_shard_count]);
+}
+
+/* Wake up a shard worker */
+static void netio_rxl_shard_wakeup(netio_rxl_shard_t *shard)
+{
+   char c = 0;
+
+   if (write(shard->wake_fd[1],&c,sizeof(c)) == -1 && errno != EAGAIN)
+      perror("netio_rxl_shard_wakeup: write");
+}
+
+/* Drain the wakeup pipe of a shard */
+static void netio_rxl_shard_drain(netio_rxl_shard_t *shard)
+{
+   char buffer[64];
+
+   while(read(shard->wake_fd[0],buffer,sizeof(buffer)) > 0)
+      ;
+}
+
 /* Find a RX listener */
-static inline struct netio_rx_listener *netio_rxl_find(netio_desc_t *nio)
+static inline struct netio_rx_listener *
+netio_rxl_find(netio_rxl_shard_t *shard,netio_desc_t *nio)
 {
    struct netio_rx_listener *rxl;
 
-   for(rxl=netio_rxl_list;rxl;rxl=rxl->next)
+   for(rxl=shard->list;rxl;rxl=rxl->next)
       if (rxl->nio == nio)
          return rxl;
 
    return NULL;
 }
 
+/* Start watching the FD of a listener */
+static void netio_rxl_watch_fd(netio_rxl_shard_t *shard,
+                               struct netio_rx_listener *rxl)
+{
+   if (rxl->fd == -1)
+      return;
+
+#ifdef NETIO_RXL_EPOLL
+   {
+      struct epoll_event ev;
+
+      memset(&ev,0,sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = rxl;
+
+      if (epoll_ctl(shard->epoll_fd,EPOLL_CTL_ADD,rxl->fd,&ev) == -1)
+         perror("netio_rxl_watch_fd: epoll_ctl");
+   }
+#endif
+
+   shard->fd_count++;
+}
+
+/* Stop watching the FD of a listener */
+static void netio_rxl_unwatch_fd(netio_rxl_shard_t *shard,
+                                 struct netio_rx_listener *rxl)
+{
+   if (rxl->fd == -1)
+      return;
+
+#ifdef NETIO_RXL_EPOLL
+   {
+      struct epoll_event ev;
+
+      /* the FD may already be closed, ignore errors */
+      memset(&ev,0,sizeof(ev));
+      epoll_ctl(shard->epoll_fd,EPOLL_CTL_DEL,rxl->fd,&ev);
+   }
+#endif
+
+   shard->fd_count--;
+}
+
 /* Remove a NIO from the listener list */
-static int netio_rxl_remove_internal(netio_desc_t *nio)
+static int netio_rxl_remove_internal(netio_rxl_shard_t *shard,
+                                     netio_desc_t *nio)
 {
    struct netio_rx_listener *rxl;
    int res = -1;
 
-   if ((rxl = netio_rxl_find(nio))) {
+   if ((rxl = netio_rxl_find(shard,nio))) {
       /* we suppress this NIO only when the ref count hits 0 */
       rxl->ref_count--;
 
@@ -1547,10 +1983,13 @@ static int netio_rxl_remove_internal(netio_desc_t *nio)
          if (rxl->prev)
             rxl->prev->next = rxl->next;
          else
-            netio_rxl_list = rxl->next;
+            shard->list = rxl->next;
+
+         shard->nio_count--;
+         netio_rxl_unwatch_fd(shard,rxl);
 
          /* if this is non-FD NIO, wait for thread to terminate */
-         if (netio_get_fd(rxl->nio) == -1) {
+         if (rxl->fd == -1) {
             rxl->running = FALSE;
             pthread_join(rxl->spec_thread,NULL);
          }
@@ -1565,18 +2004,95 @@ static int netio_rxl_remove_internal(netio_desc_t *nio)
 }
 
 /* Add a RXL listener to the listener list */
-static void netio_rxl_add_internal(struct netio_rx_listener *rxl)
+static void netio_rxl_add_internal(netio_rxl_shard_t *shard,
+                                   struct netio_rx_listener *rxl)
 {  
    struct netio_rx_listener *tmp;
    
-   if ((tmp = netio_rxl_find(rxl->nio))) {
+   if ((tmp = netio_rxl_find(shard,rxl->nio))) {
       tmp->ref_count++;
       free(rxl);
    } else {
       rxl->prev = NULL;
-      rxl->next = netio_rxl_list;
+      rxl->next = shard->list;
       if (rxl->next) rxl->next->prev = rxl;
-      netio_rxl_list = rxl;
+      shard->list = rxl;
+      shard->nio_count++;
+      netio_rxl_watch_fd(shard,rxl);
+   }
+}
+
+/* Process pending add/remove requests of a shard */
+static void netio_rxl_shard_update(netio_rxl_shard_t *shard)
+{
+   struct netio_rx_listener *rxl;
+   netio_desc_t *nio;
+
+   pthread_mutex_lock(&shard->queue_lock);
+
+   /* Add the new waiting NIO to the active list */
+   while(shard->add_list != NULL) {
+      rxl = shard->add_list;
+      shard->add_list = shard->add_list->next;
+      netio_rxl_add_internal(shard,rxl);
+   }
+
+   /* Delete the NIO present in the remove list */
+   while(shard->remove_list != NULL) {
+      nio = shard->remove_list;
+      shard->remove_list = shard->remove_list->rxl_next;
+      netio_rxl_remove_internal(shard,nio);
+   }
+
+   pthread_cond_broadcast(&shard->queue_cond);
+   pthread_mutex_unlock(&shard->queue_lock);
+}
+
+/* Receive a batch of packets for a listener and call the user handler */
+static void netio_rxl_dispatch_batch(netio_rxl_shard_t *shard,
+                                     struct netio_rx_listener *rxl)
+{
+   netio_batch_t *batch = shard->rx_batch;
+   netio_desc_t *nio = rxl->nio;
+   ssize_t pkt_len;
+   u_int i;
+
+   if (netio_recv_batch(nio,batch) <= 0)
+      return;
+
+   shard->stats.batches++;
+
+   for(i=0;i<batch->count;i++) {
+      if ((pkt_len = batch->pkt_len[i]) <= 0)
+         continue;
+
+      shard->stats.pkts++;
+      shard->stats.bytes += pkt_len;
+      rxl->rx_handler(nio,batch->pkt[i],pkt_len,rxl->arg1,rxl->arg2);
+
+      /* leave the buffer zeroed for the next batch */
+      memset(batch->pkt[i],0,pkt_len);
+   }
+}
+
+/* Receive a packet for a listener and call the user handler */
+static void netio_rxl_dispatch(netio_rxl_shard_t *shard,
+                               struct netio_rx_listener *rxl)
+{
+   netio_desc_t *nio = rxl->nio;
+   ssize_t pkt_len;
+
+   if (nio->recv_batch && shard->rx_batch) {
+      netio_rxl_dispatch_batch(shard,rxl);
+      return;
+   }
+
+   pkt_len = netio_recv(nio,nio->rx_pkt,sizeof(nio->rx_pkt));
+
+   if (pkt_len > 0) {
+      shard->stats.pkts++;
+      shard->stats.bytes += pkt_len;
+      rxl->rx_handler(nio,nio->rx_pkt,pkt_len,rxl->arg1,rxl->arg2);
    }
 }
 
@@ -1597,53 +2113,97 @@ static void *netio_rxl_spec_thread(void *arg)
    return NULL;
 }
 
-/* RX Listener General Thread */
-void *netio_rxl_gen_thread(void *arg)
+/* Bind the current thread to the CPU configured for a shard */
+static void netio_rxl_shard_set_affinity(netio_rxl_shard_t *shard)
+{
+   if (shard->cpu < 0)
+      return;
+
+#ifdef __linux__
+   {
+      cpu_set_t cpus;
+      int res;
+
+      CPU_ZERO(&cpus);
+      CPU_SET(shard->cpu,&cpus);
+
+      res = pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+
+      if (res != 0)
+         fprintf(stderr,"netio_rxl: unable to bind shard %u to CPU %d: %s\n",
+                 shard->id,shard->cpu,strerror(res));
+   }
+#else
+   fprintf(stderr,"netio_rxl: CPU affinity is not supported on this host.\n");
+#endif
+}
+
+#ifdef NETIO_RXL_EPOLL
+/* RX Listener shard thread (epoll) */
+static void *netio_rxl_shard_thread(void *arg)
 { 
-   struct netio_rx_listener *rxl;
-   ssize_t pkt_len;
-   netio_desc_t *nio;
-   struct timeval tv;
-   int fd,fd_max,res;
-   fd_set rfds;
+   struct epoll_event events[NETIO_RXL_MAX_EVENTS];
+   netio_rxl_shard_t *shard = arg;
+   int i,res;
+
+   netio_rxl_shard_set_affinity(shard);
 
    for(;;) {
-      NETIO_RXL_LOCK();
-
-      NETIO_RXQ_LOCK();
-      /* Add the new waiting NIO to the active list */
-      while(netio_rxl_add_list != NULL) {
-         rxl = netio_rxl_add_list;
-         netio_rxl_add_list = netio_rxl_add_list->next;
-         netio_rxl_add_internal(rxl);
+      netio_rxl_shard_update(shard);
+
+      /* Wait for incoming packets */
+      res = epoll_wait(shard->epoll_fd,events,NETIO_RXL_MAX_EVENTS,-1);
+
+      if (res == -1) {
+         if (errno != EINTR)
+            perror("netio_rxl_thread: epoll_wait");
+         continue;
       }
 
-      /* Delete the NIO present in the remove list */
-      while(netio_rxl_remove_list != NULL) {
-         nio = netio_rxl_remove_list;
-         netio_rxl_remove_list = netio_rxl_remove_list->rxl_next;
-         netio_rxl_remove_internal(nio);
+      shard->stats.wakeups++;
+
+      /* Call user handlers (the wakeup pipe has a NULL pointer) */
+      for(i=0;i<res;i++) {
+         if (events[i].data.ptr == NULL) {
+            netio_rxl_shard_drain(shard);
+            continue;
+         }
+
+         netio_rxl_dispatch(shard,events[i].data.ptr);
       }
+   }
+   
+   return NULL;
+}
+#else
+/* RX Listener shard thread (select) */
+static void *netio_rxl_shard_thread(void *arg)
+{ 
+   netio_rxl_shard_t *shard = arg;
+   struct netio_rx_listener *rxl;
+   int fd_max,res;
+   fd_set rfds;
 
-      pthread_cond_broadcast(&netio_rxl_cond);
-      NETIO_RXQ_UNLOCK();
+   netio_rxl_shard_set_affinity(shard);
+
+   for(;;) {
+      netio_rxl_shard_update(shard);
 
       /* Build the FD set */
       FD_ZERO(&rfds);
-      fd_max = -1;
-      for(rxl=netio_rxl_list;rxl;rxl=rxl->next) {
-         if ((fd = netio_get_fd(rxl->nio)) == -1)
+      FD_SET(shard->wake_fd[0],&rfds);
+      fd_max = shard->wake_fd[0];
+
+      for(rxl=shard->list;rxl;rxl=rxl->next) {
+         if (rxl->fd == -1)
             continue;
 
-         if (fd > fd_max) fd_max = fd;
-         FD_SET(fd,&rfds);
+         if (rxl->fd > fd_max) fd_max = rxl->fd;
+         FD_SET(rxl->fd,&rfds);
       }
-      NETIO_RXL_UNLOCK();
 
       /* Wait for incoming packets */
-      tv.tv_sec = 0;
-      tv.tv_usec = 20 * 1000;  /* 200 ms */
-      res = select(fd_max+1,&rfds,NULL,NULL,&tv);
+      res = select(fd_max+1,&rfds,NULL,NULL,NULL);
 
       if (res == -1) {
          if (errno != EINTR)
@@ -1651,91 +2211,226 @@ void *netio_rxl_gen_thread(void *arg)
          continue;
       }
 
-      /* Examine active FDs and call user handlers */
-      NETIO_RXL_LOCK();
-
-      for(rxl=netio_rxl_list;rxl;rxl=rxl->next) {
-         nio = rxl->nio;
-
-         if ((fd = netio_get_fd(nio)) == -1)
-            continue;
+      shard->stats.wakeups++;
 
-         if (FD_ISSET(fd,&rfds)) {
-            pkt_len = netio_recv(nio,nio->rx_pkt,sizeof(nio->rx_pkt));
+      if (FD_ISSET(shard->wake_fd[0],&rfds))
+         netio_rxl_shard_drain(shard);
 
-            if (pkt_len > 0)
-               rxl->rx_handler(nio,nio->rx_pkt,pkt_len,rxl->arg1,rxl->arg2);
-         }
+      /* Examine active FDs and call user handlers */
+      for(rxl=shard->list;rxl;rxl=rxl->next) {
+         if ((rxl->fd != -1) && FD_ISSET(rxl->fd,&rfds))
+            netio_rxl_dispatch(shard,rxl);
       }
-
-      NETIO_RXL_UNLOCK();
    }
    
    return NULL;
 }
+#endif
 
 /* Add a RX listener in the listener list */
 int netio_rxl_add(netio_desc_t *nio,netio_rx_handler_t rx_handler,
                   void *arg1,void *arg2)
 {
    struct netio_rx_listener *rxl;
-
-   NETIO_RXQ_LOCK();
+   netio_rxl_shard_t *shard;
 
    if (!(rxl = malloc(sizeof(*rxl)))) {
-      NETIO_RXQ_UNLOCK();
       fprintf(stderr,"netio_rxl_add: unable to create structure.\n");
       return(-1);
    }
 
    memset(rxl,0,sizeof(*rxl));
    rxl->nio = nio;
+   rxl->fd = netio_get_fd(nio);
    rxl->ref_count = 1;
    rxl->rx_handler = rx_handler;
    rxl->arg1 = arg1;
    rxl->arg2 = arg2;
    rxl->running = TRUE;
 
-   if ((netio_get_fd(rxl->nio) == -1) &&
+   shard = netio_rxl_get_shard(nio);
+   pthread_mutex_lock(&shard->queue_lock);
+
+   if ((rxl->fd == -1) &&
        pthread_create(&rxl->spec_thread,NULL,netio_rxl_spec_thread,rxl)) 
    {
-      NETIO_RXQ_UNLOCK();
+      pthread_mutex_unlock(&shard->queue_lock);
       fprintf(stderr,"netio_rxl_add: unable to create specific thread.\n");
       free(rxl);
       return(-1);
    }
 
-   rxl->next = netio_rxl_add_list;
-   netio_rxl_add_list = rxl;
-   while(netio_rxl_add_list != NULL) {
-      pthread_cond_wait(&netio_rxl_cond,&netio_rxq_mutex);
+   rxl->next = shard->add_list;
+   shard->add_list = rxl;
+   netio_rxl_shard_wakeup(shard);
+
+   while(shard->add_list != NULL) {
+      pthread_cond_wait(&shard->queue_cond,&shard->queue_lock);
    }
-   NETIO_RXQ_UNLOCK();
+   pthread_mutex_unlock(&shard->queue_lock);
    return(0);
 }
 
 /* Remove a NIO from the listener list */
 int netio_rxl_remove(netio_desc_t *nio)
 {
-   NETIO_RXQ_LOCK();
-   nio->rxl_next = netio_rxl_remove_list;
-   netio_rxl_remove_list = nio;
-   while(netio_rxl_remove_list != NULL) {
-      pthread_cond_wait(&netio_rxl_cond,&netio_rxq_mutex);
+   netio_rxl_shard_t *shard = netio_rxl_get_shard(nio);
+
+   pthread_mutex_lock(&shard->queue_lock);
+   nio->rxl_next = shard->remove_list;
+   shard->remove_list = nio;
+   netio_rxl_shard_wakeup(shard);
+
+   while(shard->remove_list != NULL) {
+      pthread_cond_wait(&shard->queue_cond,&shard->queue_lock);
    }
-   NETIO_RXQ_UNLOCK();
+   pthread_mutex_unlock(&shard->queue_lock);
    return(0);
 }
 
-/* Initialize the RXL thread */
-int netio_rxl_init(void)
+/* Set the number of RX shards (must be called before netio_rxl_init) */
+int netio_rxl_set_workers(u_int count)
 {
-   pthread_cond_init(&netio_rxl_cond,NULL);
+   if (netio_rxl_shards != NULL) {
+      fprintf(stderr,"netio_rxl: RX listener already started.\n");
+      return(-1);
+   }
+
+   if ((count == 0) || (count > NETIO_RXL_MAX_WORKERS)) {
+      fprintf(stderr,"netio_rxl: invalid number of workers %u (max: %u).\n",
+              count,NETIO_RXL_MAX_WORKERS);
+      return(-1);
+   }
+
+   netio_rxl_shard_count = count;
+   return(0);
+}
+
+/* 
+ * Set the CPU list used to bind the RX shards, with format "cpu,cpu,...".
+ * Shard n is bound to the CPU n modulo the number of CPUs in the list.
+ * Must be called before netio_rxl_init.
+ */
+int netio_rxl_set_affinity(char *cpu_list)
+{
+   char *str,*end;
+   u_int count = 0;
+   long cpu;
+
+   if (netio_rxl_shards != NULL) {
+      fprintf(stderr,"netio_rxl: RX listener already started.\n");
+      return(-1);
+   }
+
+   for(str=cpu_list;*str;str=end) {
+      cpu = strtol(str,&end,10);
+
+      if ((end == str) || (cpu < 0) || (count == NETIO_RXL_MAX_WORKERS) ||
+          ((*end != ',') && (*end != 0)))
+      {
+         fprintf(stderr,"netio_rxl: invalid CPU list '%s'.\n",cpu_list);
+         return(-1);
+      }
+
+      netio_rxl_cpus[count++] = (int)cpu;
+
+      if (*end == ',')
+         end++;
+   }
 
-   if (pthread_create(&netio_rxl_thread,NULL,netio_rxl_gen_thread,NULL)) {
+   netio_rxl_cpu_count = count;
+   return(0);
+}
+
+/* Get the number of RX shards */
+u_int netio_rxl_get_shard_count(void)
+{
+   return(netio_rxl_shard_count);
+}
+
+/* Get statistics of a RX shard */
+int netio_rxl_get_shard_stats(u_int id,netio_rxl_stats_t *stats)
+{
+   netio_rxl_shard_t *shard;
+
+   if (!netio_rxl_shards || (id >= netio_rxl_shard_count))
+      return(-1);
+
+   shard = &netio_rxl_shards[id];
+   *stats = shard->stats;
+   stats->cpu = shard->cpu;
+   stats->nio_count = shard->nio_count;
+   stats->fd_count = shard->fd_count;
+   return(0);
+}
+
+/* Initialize a RX shard */
+static int netio_rxl_shard_init(netio_rxl_shard_t *shard,u_int id)
+{
+   int i;
+
+   memset(shard,0,sizeof(*shard));
+   shard->id = id;
+   shard->cpu = netio_rxl_cpu_count ? 
+      netio_rxl_cpus[id % netio_rxl_cpu_count] : -1;
+
+   pthread_mutex_init(&shard->queue_lock,NULL);
+   pthread_cond_init(&shard->queue_cond,NULL);
+
+   /* Batched NIO fall back to single packet reception if this fails */
+   shard->rx_batch = netio_batch_create(NETIO_BATCH_MAX*NETIO_MAX_PKT_SIZE);
+
+   if (pipe(shard->wake_fd) == -1) {
+      perror("netio_rxl_init: pipe");
+      return(-1);
+   }
+
+   for(i=0;i<2;i++)
+      fcntl(shard->wake_fd[i],F_SETFL,O_NONBLOCK);
+
+#ifdef NETIO_RXL_EPOLL
+   {
+      struct epoll_event ev;
+
+      if ((shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+         perror("netio_rxl_init: epoll_create1");
+         return(-1);
+      }
+
+      memset(&ev,0,sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = NULL;
+
+      if (epoll_ctl(shard->epoll_fd,EPOLL_CTL_ADD,shard->wake_fd[0],&ev)) {
+         perror("netio_rxl_init: epoll_ctl");
+         return(-1);
+      }
+   }
+#endif
+
+   if (pthread_create(&shard->thread,NULL,netio_rxl_shard_thread,shard)) {
       perror("netio_rxl_init: pthread_create");
       return(-1);
    }
 
    return(0);
 }
+
+/* Initialize the RXL threads */
+int netio_rxl_init(void)
+{
+   u_int i;
+
+   netio_rxl_shards = calloc(netio_rxl_shard_count,sizeof(netio_rxl_shard_t));
+
+   if (!netio_rxl_shards) {
+      fprintf(stderr,"netio_rxl_init: unable to create shards.\n");
+      return(-1);
+   }
+
+   for(i=0;i<netio_rxl_shard_count;i++)
+      if (netio_rxl_shard_init(&netio_rxl_shards[i],i) == -1)
+         return(-1);
+
+   return(0);
+}
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <pthread.h>
 
 #include "utils.h"
@@ -155,6 +156,27 @@ struct netio_stat {
 #define NETIO_BW_SAMPLES     10
 #define NETIO_BW_SAMPLE_ITV  30
 
+/* Maximum number of packets in a batch */
+#define NETIO_BATCH_MAX      16
+
+/* Size of the TX batch buffer */
+#define NETIO_TX_BATCH_SIZE  65536
+
+/* Packet batch (for NIO supporting multi-packets send/recv) */
+typedef struct netio_batch netio_batch_t;
+struct netio_batch {
+   u_int count;
+   u_char *pkt[NETIO_BATCH_MAX];
+   ssize_t pkt_len[NETIO_BATCH_MAX];
+
+   /* 
+    * Packet buffer: split in NETIO_BATCH_MAX slots of pkt_size bytes for
+    * reception, filled sequentially (buf_used) for transmission.
+    */
+   u_char *buf;
+   size_t buf_size,buf_used,pkt_size;
+};
+
 /* Generic netio descriptor */
 struct netio_desc {
    u_int type;
@@ -166,12 +188,6 @@ struct netio_desc {
    m_uint8_t fr_lmi_seq;
    void *fr_conn_list;
 
-   /* Ethernet specific information */
-   u_int vlan_port_type;
-   m_uint16_t vlan_id;
-   void *vlan_input_vector;
-   m_uint16_t ethertype;
-
    union {
       netio_unix_desc_t nud;
       netio_vde_desc_t nvd;
@@ -190,6 +206,13 @@ struct netio_desc {
    ssize_t (*send)(void *desc,void *pkt,size_t len);
    ssize_t (*recv)(void *desc,void *pkt,size_t len);
 
+   /* Scatter-gather send (optional) */
+   ssize_t (*sendv)(void *desc,struct iovec *iov,int iovcnt);
+
+   /* Batched send and receive (optional) */
+   int (*send_batch)(void *desc,netio_batch_t *batch);
+   int (*recv_batch)(void *desc,netio_batch_t *batch);
+
    /* Configuration saving */
    void (*save_cfg)(netio_desc_t *nio,FILE *fd);
 
@@ -201,7 +224,7 @@ struct netio_desc {
    m_uint64_t bw_cnt[NETIO_BW_SAMPLES];
    m_uint64_t bw_cnt_total;
    u_int bw_pos;
-   u_int bw_ptask_cnt;
+   m_tmcnt_t bw_sample_time;
 
    /* Packet filters */
    netio_pktfilter_t *rx_filter,*tx_filter,*both_filter;
@@ -214,6 +237,10 @@ struct netio_desc {
    /* Next pointer (for RX listener) */
    netio_desc_t *rxl_next;
 
+   /* Packets queued for transmission (batched send) */
+   pthread_mutex_t tx_batch_lock;
+   netio_batch_t *tx_batch;
+
    /* Packet data */
    u_char rx_pkt[NETIO_MAX_PKT_SIZE];
 };
@@ -225,6 +252,7 @@ typedef int (*netio_rx_handler_t)(netio_desc_t *nio,
 
 struct netio_rx_listener {
    netio_desc_t *nio;
+   int fd;
    u_int ref_count;
    volatile int running;
    netio_rx_handler_t rx_handler;
@@ -233,6 +261,47 @@ struct netio_rx_listener {
    struct netio_rx_listener *prev,*next;
 };
 
+/* Maximum number of RX listener shards (worker threads) */
+#define NETIO_RXL_MAX_WORKERS  64
+
+/* Maximum number of events handled per shard wakeup */
+#define NETIO_RXL_MAX_EVENTS   64
+
+/* RX listener shard statistics */
+typedef struct netio_rxl_stats netio_rxl_stats_t;
+struct netio_rxl_stats {
+   int cpu;
+   u_int nio_count,fd_count;
+   m_uint64_t wakeups,pkts,bytes,batches;
+};
+
+/* RX listener shard */
+typedef struct netio_rxl_shard netio_rxl_shard_t;
+struct netio_rxl_shard {
+   u_int id;
+   int cpu;
+   pthread_t thread;
+
+   /* Pending add/remove requests */
+   pthread_mutex_t queue_lock;
+   pthread_cond_t queue_cond;
+   struct netio_rx_listener *add_list;
+   netio_desc_t *remove_list;
+
+   /* Active listeners (only modified by the shard thread) */
+   struct netio_rx_listener *list;
+   u_int nio_count,fd_count;
+
+   /* Pipe used to wake up the shard thread, epoll FD */
+   int wake_fd[2];
+   int epoll_fd;
+
+   /* Receive buffers for batched NIO */
+   netio_batch_t *rx_batch;
+
+   netio_rxl_stats_t stats;
+};
+
 /* Get NETIO type given a description */
 int netio_get_type(char *type);
 
@@ -308,9 +377,30 @@ void netio_save_config_all(FILE *fd);
 /* Send a packet through a NetIO descriptor */
 ssize_t netio_send(netio_desc_t *nio,void *pkt,size_t len);
 
+/* Send a packet described by a list of segments (scatter-gather) */
+ssize_t netio_sendv(netio_desc_t *nio,struct iovec *iov,int iovcnt);
+
+/* Queue a packet for transmission (sent by netio_send_flush) */
+ssize_t netio_send_queued(netio_desc_t *nio,void *pkt,size_t len);
+
+/* Queue a packet described by a list of segments for transmission */
+ssize_t netio_send_queuedv(netio_desc_t *nio,struct iovec *iov,int iovcnt);
+
+/* Send the packets queued for transmission */
+void netio_send_flush(netio_desc_t *nio);
+
 /* Receive a packet through a NetIO descriptor */
 ssize_t netio_recv(netio_desc_t *nio,void *pkt,size_t max_len);
 
+/* Receive a batch of packets through a NetIO descriptor */
+int netio_recv_batch(netio_desc_t *nio,netio_batch_t *batch);
+
+/* Create a packet batch */
+netio_batch_t *netio_batch_create(size_t buf_size);
+
+/* Free a packet batch */
+void netio_batch_free(netio_batch_t *batch);
+
 /* Get a NetIO FD */
 int netio_get_fd(netio_desc_t *nio);
 
@@ -339,7 +429,19 @@ int netio_rxl_add(netio_desc_t *nio,netio_rx_handler_t rx_handler,
 /* Remove a NIO from the listener list */
 int netio_rxl_remove(netio_desc_t *nio);
 
-/* Initialize the RXL thread */
+/* Set the number of RX shards (must be called before netio_rxl_init) */
+int netio_rxl_set_workers(u_int count);
+
+/* Set the CPU list used to bind the RX shards */
+int netio_rxl_set_affinity(char *cpu_list);
+
+/* Get the number of RX shards */
+u_int netio_rxl_get_shard_count(void);
+
+/* Get statistics of a RX shard */
+int netio_rxl_get_shard_stats(u_int id,netio_rxl_stats_t *stats);
+
+/* Initialize the RXL threads */
 int netio_rxl_init(void);
 
 #endif
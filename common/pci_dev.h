@@ -44,6 +44,9 @@ struct pci_device {
    pci_reg_read_t read_register;
    pci_reg_write_t write_register;
 
+   /* Device state saved in VM checkpoints (relative to priv_data) */
+   vm_ckpt_field_t *ckpt_fields;
+
    struct pci_device *next,**pprev;
 };
 
@@ -42,4 +42,15 @@ int ppc32_exec_page(cpu_ppc_t *cpu);
 /* Execute a single instruction (external) */
 int ppc32_exec_single_insn_ext(cpu_ppc_t *cpu,ppc_insn_t insn);
 
+#ifdef USE_UNSTABLE
+/* Forget the predecoded instructions of a host page */
+void ppc32_exec_predec_invalidate(cpu_ppc_t *cpu,void *host_page);
+
+/* Forget all predecoded pages */
+void ppc32_exec_predec_flush(cpu_ppc_t *cpu);
+
+/* Free the predecoded pages of a CPU */
+void ppc32_exec_predec_free(cpu_ppc_t *cpu);
+#endif
+
 #endif
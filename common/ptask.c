@@ -3,6 +3,19 @@
  * Copyright (c) 2005,2006 Christophe Fillot (cf@utc.fr)
  *
  * Periodic tasks centralization. Used for TX part of network devices.
+ *
+ * Tasks are run by a pool of worker threads. All tasks of a same group
+ * (typically a VM instance) are pinned to the same worker, so the
+ * callbacks of a VM are still serialized. Each worker keeps its tasks in
+ * a timer wheel ordered by next deadline, and sleeps until the next
+ * deadline or until a task is kicked.
+ *
+ * The worker lock is never held while a callback is running: adding,
+ * removing or kicking a task never waits for a scan to complete.
+ *
+ * Task structures are recycled and never given back to the system, so
+ * that a task can be kicked through its handle with only the worker lock:
+ * a stale handle is detected by checking the task identifier.
  */
 
 #include <stdio.h>
@@ -20,110 +33,689 @@
 #include <pthread.h>
 #include <assert.h>
 
+#include "hash.h"
 #include "ptask.h"
 
-static pthread_t ptask_thread;
+/* Worker threads */
+static ptask_worker_t ptask_workers[PTASK_MAX_WORKERS];
+static u_int ptask_worker_count = 1;
+static int ptask_initialized = FALSE;
+
+/* Task lookup table (id -> task) */
 static pthread_mutex_t ptask_mutex = PTHREAD_MUTEX_INITIALIZER;
-static ptask_t *ptask_list = NULL;
+static hash_table_t *ptask_table = NULL;
 static ptask_id_t ptask_current_id = 0;
 
+/* Recycled task structures */
+static pthread_mutex_t ptask_free_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ptask_t *ptask_free_list = NULL;
+
 u_int ptask_sleep_time = 10;
 
 #define PTASK_LOCK() pthread_mutex_lock(&ptask_mutex)
 #define PTASK_UNLOCK() pthread_mutex_unlock(&ptask_mutex)
 
-/* Periodic task thread */
-static void *ptask_run(void *arg)
+#define PTASK_WORKER_LOCK(w) pthread_mutex_lock(&(w)->lock)
+#define PTASK_WORKER_UNLOCK(w) pthread_mutex_unlock(&(w)->lock)
+
+/* Link a task in a list */
+static inline void ptask_link(ptask_t **list,ptask_t *task)
+{
+   task->next = *list;
+   task->pprev = list;
+
+   if (*list)
+      (*list)->pprev = &task->next;
+
+   *list = task;
+}
+
+/* Unlink a task from its list (wheel slot or due list) */
+static inline void ptask_unlink(ptask_t *task)
 {
-   pthread_mutex_t umutex = PTHREAD_MUTEX_INITIALIZER;
-   pthread_cond_t ucond = PTHREAD_COND_INITIALIZER;
+   if (task->pprev) {
+      if (task->next)
+         task->next->pprev = task->pprev;
+
+      *task->pprev = task->next;
+      task->next = NULL;
+      task->pprev = NULL;
+   }
+
+   task->queued = FALSE;
+}
 
+/* Get a task structure, recycled if possible */
+static ptask_t *ptask_alloc(void)
+{
    ptask_t *task;
 
-   for(;;) {
-      PTASK_LOCK();
-      for(task=ptask_list;task;task=task->next)
-         task->cbk(task->object,task->arg);
-      PTASK_UNLOCK();
+   pthread_mutex_lock(&ptask_free_mutex);
+   if ((task = ptask_free_list) != NULL)
+      ptask_free_list = task->next;
+   pthread_mutex_unlock(&ptask_free_mutex);
+
+   if (!task && (task = malloc(sizeof(*task))))
+      memset(task,0,sizeof(*task));
+
+   return(task);
+}
+
+/* Release a removed task */
+static void ptask_release(ptask_t *task)
+{
+   pthread_mutex_lock(&ptask_free_mutex);
+   task->next = ptask_free_list;
+   ptask_free_list = task;
+   pthread_mutex_unlock(&ptask_free_mutex);
+}
+
+/* Insert a task in the timer wheel of its worker (worker lock held) */
+static void ptask_schedule(ptask_worker_t *w,ptask_t *task)
+{
+   if (task->deadline <= w->current) {
+      ptask_link(&w->due,task);
+      task->queued = TRUE;
+   } else {
+      ptask_link(&w->wheel[task->deadline % PTASK_WHEEL_SIZE],task);
+   }
+}
+
+/* Queue a task to be run immediately (worker lock held) */
+static void ptask_queue(ptask_worker_t *w,ptask_t *task)
+{
+   if (!task->queued) {
+      ptask_unlink(task);
+      ptask_link(&w->due,task);
+      task->queued = TRUE;
+   }
+}
 
-      /* For testing! */
-      {
-         struct timespec t_spc;
-         m_tmcnt_t expire;
+/* Move the expired tasks of the timer wheel to the due list */
+static void ptask_worker_expire(ptask_worker_t *w,m_tmcnt_t now)
+{
+   ptask_t *task,*next;
+   m_tmcnt_t t;
+   u_int i;
+
+   if (now <= w->current)
+      return;
+
+   /* a full wheel revolution visits all slots */
+   if ((now - w->current) > PTASK_WHEEL_SIZE)
+      w->current = now - PTASK_WHEEL_SIZE;
+
+   for(t=w->current+1;t<=now;t++) {
+      i = t % PTASK_WHEEL_SIZE;
+
+      for(task=w->wheel[i];task;task=next) {
+         next = task->next;
+
+         /* the task may be scheduled for a next revolution */
+         if (task->deadline <= now)
+            ptask_queue(w,task);
+      }
+   }
+
+   w->current = now;
+}
+
+/* Return the time of the next non-empty wheel slot */
+static m_tmcnt_t ptask_worker_next_deadline(ptask_worker_t *w)
+{
+   u_int i;
+
+   for(i=1;i<=PTASK_WHEEL_SIZE;i++)
+      if (w->wheel[(w->current + i) % PTASK_WHEEL_SIZE])
+         return(w->current + i);
+
+   return(w->current + PTASK_WHEEL_SIZE);
+}
+
+/* Run a task (worker lock held, released during the callback) */
+static void ptask_worker_run_task(ptask_worker_t *w,ptask_t *task)
+{
+   m_tmcnt_t start,elapsed,now;
+   int periodic;
+
+   ptask_unlink(task);
+
+   /* the task is parked until its group is resumed */
+   if (task->suspended)
+      return;
+
+   periodic = (task->deadline <= w->current);
+   task->kicked = FALSE;
+
+   w->running = task;
+   PTASK_WORKER_UNLOCK(w);
+
+   start = m_gettime_usec();
+   task->cbk(task->object,task->arg);
+   elapsed = m_gettime_usec() - start;
+
+   PTASK_WORKER_LOCK(w);
+   w->running = NULL;
+   w->run_count++;
+   w->run_time += elapsed;
+
+   task->run_count++;
+   task->run_time += elapsed;
 
-         expire = m_gettime_usec() + (ptask_sleep_time * 1000);
+   if (elapsed > task->run_time_max)
+      task->run_time_max = elapsed;
 
-         pthread_mutex_lock(&umutex);
-         t_spc.tv_sec = expire / 1000000;
-         t_spc.tv_nsec = (expire % 1000000) * 1000;
-         pthread_cond_timedwait(&ucond,&umutex,&t_spc);
-         pthread_mutex_unlock(&umutex);
+   /* the group has been suspended during the callback */
+   if (task->suspended)
+      pthread_cond_broadcast(&w->done_cond);
+
+   /* the task has been removed during the callback */
+   if (task->removed) {
+      pthread_cond_broadcast(&w->done_cond);
+
+      if (task->orphan)
+         ptask_release(task);
+      return;
+   }
+
+   /* compute the next deadline, without drifting */
+   now = m_gettime();
+
+   if (periodic) {
+      task->deadline += task->period;
+
+      if (task->deadline <= now) {
+         task->late_count++;
+         task->deadline = now + task->period;
       }
+   } else if (task->deadline > now + task->period) {
+      task->deadline = now + task->period;
+   }
 
-      /* Old method... */
-      //usleep(ptask_sleep_time*1000);
+   if (task->kicked) {
+      ptask_link(&w->due,task);
+      task->queued = TRUE;
+   } else {
+      ptask_schedule(w,task);
    }
+}
 
+/* Worker thread */
+static void *ptask_worker_run(void *arg)
+{
+   ptask_worker_t *w = arg;
+   struct timespec t_spc;
+   m_tmcnt_t expire;
+
+   PTASK_WORKER_LOCK(w);
+
+   for(;;) {
+      ptask_worker_expire(w,m_gettime());
+
+      while(w->due != NULL)
+         ptask_worker_run_task(w,w->due);
+
+      /* Wait for the next deadline, or for a kick */
+      expire = ptask_worker_next_deadline(w);
+      t_spc.tv_sec = expire / 1000;
+      t_spc.tv_nsec = (expire % 1000) * 1000000;
+
+      pthread_cond_timedwait(&w->cond,&w->lock,&t_spc);
+      w->wakeups++;
+   }
+
+   PTASK_WORKER_UNLOCK(w);
    return NULL;
 }
 
-/* Add a new task */
-ptask_id_t ptask_add(ptask_callback cbk,void *object,void *arg)
+/* Select the worker for a task group */
+static ptask_worker_t *ptask_get_worker(void *group,ptask_id_t id)
+{
+   u_long val;
+
+   if (!group)
+      return(&ptask_workers[id % ptask_worker_count]);
+
+   val = (u_long)group;
+   val ^= val >> 7;
+   val ^= val >> 17;
+   return(&ptask_workers[val % ptask_worker_count]);
+}
+
+/* Find a task given its identifier (table lock held) */
+static inline ptask_t *ptask_find(ptask_id_t id)
+{
+   return(hash_table_lookup(ptask_table,&id));
+}
+
+/* Set the number of worker threads (before ptask_init) */
+int ptask_set_workers(u_int count)
+{
+   if (ptask_initialized) {
+      fprintf(stderr,"ptask_set_workers: module already initialized.\n");
+      return(-1);
+   }
+
+   if (!count || (count > PTASK_MAX_WORKERS)) {
+      fprintf(stderr,"ptask_set_workers: invalid number of workers "
+              "(max: %u).\n",PTASK_MAX_WORKERS);
+      return(-1);
+   }
+
+   ptask_worker_count = count;
+   return(0);
+}
+
+/* Get the number of worker threads */
+u_int ptask_get_workers(void)
+{
+   return(ptask_worker_count);
+}
+
+/* Add a new task to a group, with the specified period (0 = default) */
+ptask_id_t ptask_add_group(void *group,u_int period,
+                           ptask_callback cbk,void *object,void *arg)
 {
+   ptask_worker_t *w,*old_w;
    ptask_t *task;
    ptask_id_t id;
 
-   if (!(task = malloc(sizeof(*task)))) {
+   if (!ptask_initialized) {
+      fprintf(stderr,"ptask_add: module not initialized.\n");
+      return(-1);
+   }
+
+   if (!(task = ptask_alloc())) {
       fprintf(stderr,"ptask_add: unable to add new task.\n");
       return(-1);
    }
 
+   PTASK_LOCK();
+   id = ++ptask_current_id;
+   assert(id != 0);
+   w = ptask_get_worker(group,id);
+
+   /* a stale handle checks the identifier with the previous worker lock */
+   if ((old_w = task->worker) != NULL)
+      PTASK_WORKER_LOCK(old_w);
+
    memset(task,0,sizeof(*task));
+   task->id = id;
+   task->worker = w;
    task->cbk = cbk;
    task->object = object;
    task->arg = arg;
+   task->group = group;
+   task->base_period = task->period = period ? period : ptask_sleep_time;
+
+   if (old_w != NULL)
+      PTASK_WORKER_UNLOCK(old_w);
+
+   if (hash_table_insert(ptask_table,&task->id,task) == -1) {
+      PTASK_UNLOCK();
+      fprintf(stderr,"ptask_add: unable to add new task.\n");
+      task->removed = TRUE;
+      ptask_release(task);
+      return(-1);
+   }
+
+   PTASK_WORKER_LOCK(w);
+   task->deadline = m_gettime() + task->period;
+   ptask_schedule(w,task);
+   w->task_count++;
+   pthread_cond_signal(&w->cond);
+   PTASK_WORKER_UNLOCK(w);
 
-   PTASK_LOCK();
-   id = ++ptask_current_id;
-   assert(id != 0);
-   task->id = id;
-   task->next = ptask_list;
-   ptask_list = task;
    PTASK_UNLOCK();
    return(id);
 }
 
-/* Remove a task */
+/* Add a new task */
+ptask_id_t ptask_add(ptask_callback cbk,void *object,void *arg)
+{
+   return(ptask_add_group(NULL,0,cbk,object,arg));
+}
+
+/*
+ * Remove a task. When the task is running, wait for the end of the
+ * callback, unless the task is removing itself.
+ */
 int ptask_remove(ptask_id_t id)
-{   
-   ptask_t **task,*p;
-   int res = -1;
+{
+   ptask_worker_t *w;
+   ptask_t *task;
 
    PTASK_LOCK();
 
-   for(task=&ptask_list;*task;task=&(*task)->next)
-      if ((*task)->id == id) {
-         p = *task;
-         *task = (*task)->next;
-         free(p);
-         res = 0;
-         break;
+   if (!(task = ptask_find(id))) {
+      PTASK_UNLOCK();
+      return(-1);
+   }
+
+   hash_table_remove(ptask_table,&id);
+   w = task->worker;
+
+   PTASK_WORKER_LOCK(w);
+   PTASK_UNLOCK();
+
+   w->task_count--;
+   task->removed = TRUE;
+
+   if (w->running == task) {
+
+      if (pthread_equal(pthread_self(),w->thread)) {
+         task->orphan = TRUE;
+         PTASK_WORKER_UNLOCK(w);
+         return(0);
       }
-   
+
+      while(w->running == task)
+         pthread_cond_wait(&w->done_cond,&w->lock);
+   } else {
+      ptask_unlink(task);
+   }
+
+   PTASK_WORKER_UNLOCK(w);
+   ptask_release(task);
+   return(0);
+}
+
+/* Change the period of a task (0 = default) */
+int ptask_set_period(ptask_id_t id,u_int period)
+{
+   ptask_worker_t *w;
+   ptask_t *task;
+
+   if (!period)
+      period = ptask_sleep_time;
+
+   PTASK_LOCK();
+
+   if (!(task = ptask_find(id))) {
+      PTASK_UNLOCK();
+      return(-1);
+   }
+
+   w = task->worker;
+   PTASK_WORKER_LOCK(w);
+
+   task->base_period = period;
+   task->period = task->doorbell ? period * PTASK_DOORBELL_FALLBACK : period;
+
+   /* reschedule the task if it is waiting in the timer wheel */
+   if ((w->running != task) && !task->queued) {
+      ptask_unlink(task);
+      task->deadline = m_gettime() + task->period;
+      ptask_schedule(w,task);
+      pthread_cond_signal(&w->cond);
+   }
+
+   PTASK_WORKER_UNLOCK(w);
+   PTASK_UNLOCK();
+   return(0);
+}
+
+/* Kick a task (worker lock held) */
+static void ptask_kick_locked(ptask_worker_t *w,ptask_t *task)
+{
+   /* tasks driven by kicks are only scanned as a slow fallback */
+   if (!task->doorbell) {
+      task->doorbell = TRUE;
+      task->period = task->base_period * PTASK_DOORBELL_FALLBACK;
+   }
+
+   task->kick_count++;
+
+   if (w->running == task) {
+      task->kicked = TRUE;
+   } else {
+      ptask_queue(w,task);
+      pthread_cond_signal(&w->cond);
+   }
+}
+
+/* Run a task as soon as possible (doorbell) */
+void ptask_kick(ptask_id_t id)
+{
+   ptask_worker_t *w;
+   ptask_t *task;
+
+   PTASK_LOCK();
+
+   if (!(task = ptask_find(id))) {
+      PTASK_UNLOCK();
+      return;
+   }
+
+   w = task->worker;
+   PTASK_WORKER_LOCK(w);
+   PTASK_UNLOCK();
+
+   ptask_kick_locked(w,task);
+   PTASK_WORKER_UNLOCK(w);
+}
+
+/* Get the handle of a task */
+ptask_t *ptask_get(ptask_id_t id)
+{
+   ptask_t *task;
+
+   PTASK_LOCK();
+   task = ptask_find(id);
    PTASK_UNLOCK();
-   return(res);
+   return(task);
+}
+
+/*
+ * Run a task as soon as possible, using its handle (no table lookup).
+ * The kick is ignored if the task has been removed in the meantime.
+ */
+void ptask_kick_task(ptask_t *task,ptask_id_t id)
+{
+   ptask_worker_t *w;
+
+   if (!task || !(w = task->worker))
+      return;
+
+   PTASK_WORKER_LOCK(w);
+
+   if ((task->worker == w) && (task->id == id) && !task->removed)
+      ptask_kick_locked(w,task);
+
+   PTASK_WORKER_UNLOCK(w);
+}
+
+/* Suspend or resume a task of a group (hash table callback) */
+struct ptask_group_state {
+   void *group;
+   int suspended;
+};
+
+static void ptask_set_group_state(void *key,void *value,void *opt)
+{
+   struct ptask_group_state *gs = opt;
+   ptask_t *task = value;
+   ptask_worker_t *w = task->worker;
+
+   if (task->group != gs->group)
+      return;
+
+   PTASK_WORKER_LOCK(w);
+   task->suspended = gs->suspended;
+
+   /* a parked task is run as soon as its group is resumed */
+   if (!gs->suspended && !task->pprev && (w->running != task)) {
+      ptask_link(&w->due,task);
+      task->queued = TRUE;
+      pthread_cond_signal(&w->cond);
+   }
+
+   PTASK_WORKER_UNLOCK(w);
+}
+
+/* 
+ * Suspend the tasks of a group, waiting for the end of a running callback.
+ * Tasks are parked when they are due, kicks only make them due again.
+ */
+void ptask_suspend_group(void *group)
+{
+   struct ptask_group_state gs;
+   ptask_worker_t *w;
+
+   if (!ptask_initialized || !group)
+      return;
+
+   gs.group = group;
+   gs.suspended = TRUE;
+
+   PTASK_LOCK();
+   hash_table_foreach(ptask_table,ptask_set_group_state,&gs);
+   PTASK_UNLOCK();
+
+   /* all tasks of a group are run by the same worker */
+   w = ptask_get_worker(group,0);
+   PTASK_WORKER_LOCK(w);
+
+   if (!pthread_equal(pthread_self(),w->thread)) {
+      while(w->running && (w->running->group == group))
+         pthread_cond_wait(&w->done_cond,&w->lock);
+   }
+
+   PTASK_WORKER_UNLOCK(w);
+}
+
+/* Resume the tasks of a group (they are run immediately) */
+void ptask_resume_group(void *group)
+{
+   struct ptask_group_state gs;
+
+   if (!ptask_initialized || !group)
+      return;
+
+   gs.group = group;
+   gs.suspended = FALSE;
+
+   PTASK_LOCK();
+   hash_table_foreach(ptask_table,ptask_set_group_state,&gs);
+   PTASK_UNLOCK();
+}
+
+/* Array of task statistics, filled under the table lock */
+struct ptask_stats_array {
+   ptask_group_name_fn name_fn;
+   ptask_stats_t *stats;
+   u_int count,max;
+};
+
+/* Copy statistics of a task (hash table callback) */
+static void ptask_get_task_stats(void *key,void *value,void *opt)
+{
+   struct ptask_stats_array *array = opt;
+   ptask_t *task = value;
+   ptask_stats_t *stats;
+
+   if (array->count >= array->max)
+      return;
+
+   stats = &array->stats[array->count++];
+
+   PTASK_WORKER_LOCK(task->worker);
+   stats->id           = task->id;
+   stats->worker       = task->worker->id;
+   stats->period       = task->period;
+   stats->doorbell     = task->doorbell;
+   stats->run_count    = task->run_count;
+   stats->late_count   = task->late_count;
+   stats->kick_count   = task->kick_count;
+   stats->run_time     = task->run_time;
+   stats->run_time_max = task->run_time_max;
+   PTASK_WORKER_UNLOCK(task->worker);
+
+   /* The group can't be freed while its tasks are in the table */
+   if (task->group && array->name_fn)
+      array->name_fn(task->group,stats->group_name,PTASK_GROUP_NAME_LEN);
+   else
+      strcpy(stats->group_name,"-");
+}
+
+/*
+ * Get statistics of all tasks. The statistics and the group names are
+ * copied under the table lock, the user function is called once the lock
+ * is released.
+ */
+void ptask_get_stats(ptask_group_name_fn name_fn,ptask_stats_fn fn,void *opt)
+{
+   struct ptask_stats_array array;
+   u_int i;
+
+   memset(&array,0,sizeof(array));
+   array.name_fn = name_fn;
+
+   PTASK_LOCK();
+   if (ptask_table != NULL) {
+      array.max = ptask_table->nnodes;
+
+      if (array.max && (array.stats = malloc(array.max*sizeof(ptask_stats_t))))
+         hash_table_foreach(ptask_table,ptask_get_task_stats,&array);
+   }
+   PTASK_UNLOCK();
+
+   for(i=0;i<array.count;i++)
+      fn(&array.stats[i],opt);
+
+   free(array.stats);
+}
+
+/* Get statistics of a worker */
+int ptask_get_worker_stats(u_int id,u_int *task_count,
+                           m_uint64_t *wakeups,m_uint64_t *run_count,
+                           m_uint64_t *run_time)
+{
+   ptask_worker_t *w;
+
+   if (!ptask_initialized || (id >= ptask_worker_count))
+      return(-1);
+
+   w = &ptask_workers[id];
+
+   PTASK_WORKER_LOCK(w);
+   *task_count = w->task_count;
+   *wakeups    = w->wakeups;
+   *run_count  = w->run_count;
+   *run_time   = w->run_time;
+   PTASK_WORKER_UNLOCK(w);
+   return(0);
 }
 
 /* Initialize ptask module */
 int ptask_init(u_int sleep_time)
 {
+   ptask_worker_t *w;
+   u_int i;
+
    if (sleep_time)
       ptask_sleep_time = sleep_time;
 
-   if (pthread_create(&ptask_thread,NULL,ptask_run,NULL) != 0) {
-      fprintf(stderr,"ptask_init: unable to create thread.\n");
+   if (!(ptask_table = hash_u64_create(256))) {
+      fprintf(stderr,"ptask_init: unable to create task table.\n");
       return(-1);
    }
 
+   for(i=0;i<ptask_worker_count;i++) {
+      w = &ptask_workers[i];
+      memset(w,0,sizeof(*w));
+      w->id = i;
+      w->current = m_gettime();
+      pthread_mutex_init(&w->lock,NULL);
+      pthread_cond_init(&w->cond,NULL);
+      pthread_cond_init(&w->done_cond,NULL);
+
+      if (pthread_create(&w->thread,NULL,ptask_worker_run,w) != 0) {
+         fprintf(stderr,"ptask_init: unable to create thread.\n");
+         return(-1);
+      }
+   }
+
+   ptask_initialized = TRUE;
    return(0);
 }
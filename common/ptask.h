@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <pthread.h>
 #include "utils.h"
 
 /* ptask identifier */
@@ -19,23 +20,133 @@ typedef m_int64_t ptask_id_t;
 /* periodic task callback prototype */
 typedef int (*ptask_callback)(void *object,void *arg);
 
+/* Maximum number of worker threads */
+#define PTASK_MAX_WORKERS  64
+
+/* Timer wheel: number of slots (1 slot per msec) */
+#define PTASK_WHEEL_SIZE   256
+
+/*
+ * Number of periods between two runs of a task driven by kicks
+ * (slow fallback scan).
+ */
+#define PTASK_DOORBELL_FALLBACK  10
+
+typedef struct ptask_worker ptask_worker_t;
+
 /* periodic task definition */
 typedef struct ptask ptask_t;
 struct ptask {
    ptask_id_t id;
-   ptask_t *next;
+   ptask_t *next,**pprev;
    ptask_callback cbk;
    void *object,*arg;
+
+   /* Task group (tasks of a same group are run by the same worker) */
+   void *group;
+   ptask_worker_t *worker;
+
+   /* Period and next deadline (in msec) */
+   u_int period,base_period;
+   m_tmcnt_t deadline;
+
+   /* Set when the task has been kicked (doorbell) */
+   int doorbell;
+
+   /* Kick received while running, queued on the due list, removed */
+   int kicked,queued,removed,orphan;
+
+   /* Group suspended: the task is parked out of the timer wheel */
+   int suspended;
+
+   /* Runtime accounting (in usec) */
+   m_uint64_t run_count,late_count,kick_count;
+   m_uint64_t run_time,run_time_max;
+};
+
+/* Worker thread */
+struct ptask_worker {
+   u_int id;
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond,done_cond;
+
+   /* Timer wheel and tasks to run immediately */
+   ptask_t *wheel[PTASK_WHEEL_SIZE];
+   ptask_t *due;
+   ptask_t *running;
+
+   /* Time of the last expired wheel slot (in msec) */
+   m_tmcnt_t current;
+   u_int task_count;
+
+   /* Statistics */
+   m_uint64_t wakeups,run_count,run_time;
 };
 
+/* Task statistics */
+#define PTASK_GROUP_NAME_LEN  64
+
+typedef struct ptask_stats ptask_stats_t;
+struct ptask_stats {
+   ptask_id_t id;
+   u_int worker,period;
+   char group_name[PTASK_GROUP_NAME_LEN];
+   int doorbell;
+   m_uint64_t run_count,late_count,kick_count;
+   m_uint64_t run_time,run_time_max;
+};
+
+/* Callback used when walking through tasks */
+typedef void (*ptask_stats_fn)(ptask_stats_t *stats,void *opt);
+
+/* Callback giving the name of a task group (called under the table lock) */
+typedef void (*ptask_group_name_fn)(void *group,char *name,size_t len);
+
 extern u_int ptask_sleep_time;
 
+/* Set the number of worker threads (before ptask_init) */
+int ptask_set_workers(u_int count);
+
+/* Get the number of worker threads */
+u_int ptask_get_workers(void);
+
+/* Add a new task to a group, with the specified period (0 = default) */
+ptask_id_t ptask_add_group(void *group,u_int period,
+                           ptask_callback cbk,void *object,void *arg);
+
 /* Add a new task */
 ptask_id_t ptask_add(ptask_callback cbk,void *object,void *arg);
 
 /* Remove a task */
 int ptask_remove(ptask_id_t id);
 
+/* Change the period of a task (0 = default) */
+int ptask_set_period(ptask_id_t id,u_int period);
+
+/* Run a task as soon as possible (doorbell) */
+void ptask_kick(ptask_id_t id);
+
+/* Get the handle of a task */
+ptask_t *ptask_get(ptask_id_t id);
+
+/* Run a task as soon as possible, using its handle (no table lookup) */
+void ptask_kick_task(ptask_t *task,ptask_id_t id);
+
+/* Suspend the tasks of a group, waiting for the end of a running callback */
+void ptask_suspend_group(void *group);
+
+/* Resume the tasks of a group (they are run immediately) */
+void ptask_resume_group(void *group);
+
+/* Get statistics of all tasks */
+void ptask_get_stats(ptask_group_name_fn name_fn,ptask_stats_fn fn,void *opt);
+
+/* Get statistics of a worker */
+int ptask_get_worker_stats(u_int id,u_int *task_count,
+                           m_uint64_t *wakeups,m_uint64_t *run_count,
+                           m_uint64_t *run_time);
+
 /* Initialize ptask module */
 int ptask_init(u_int sleep_time);
 
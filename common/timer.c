@@ -23,6 +23,11 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <assert.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
 
 #include "utils.h"
 #include "mempool.h"
@@ -541,6 +546,362 @@ int timer_pool_add_queues(int nr_queues)
    return(0);
 }
 
+/* ======================================================================== */
+/* Shared tick service                                                      */
+/* ======================================================================== */
+
+/*
+ * A single thread sends the periodic ticks to all clients (virtual CPUs)
+ * instead of having one thread per CPU. Clients with the same frequency
+ * share a deadline, and deadlines close to each other (TIMER_TICK_SLACK)
+ * are served by the same wakeup. If the thread is late, the elapsed
+ * periods are given in a single callback.
+ *
+ * Callbacks are run with the service lock held: they must be short
+ * (typically increment a counter of pending IRQs).
+ */
+
+#define TIMER_TICK_LOCK()    pthread_mutex_lock(&timer_tick_mutex)
+#define TIMER_TICK_UNLOCK()  pthread_mutex_unlock(&timer_tick_mutex)
+
+static pthread_mutex_t timer_tick_mutex = PTHREAD_MUTEX_INITIALIZER;
+static timer_tick_group_t *timer_tick_groups = NULL;
+static pthread_t timer_tick_thread;
+static int timer_tick_running = FALSE;
+static int timer_tick_tickless = FALSE;
+
+#ifdef __linux__
+static int timer_tick_epoll_fd = -1;
+static int timer_tick_timer_fd = -1;
+static int timer_tick_event_fd = -1;
+#else
+static pthread_cond_t timer_tick_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* Get current time for the tick service (in usec) */
+static m_tmcnt_t timer_tick_gettime(void)
+{
+#ifdef __linux__
+   struct timespec t_spc;
+
+   clock_gettime(CLOCK_MONOTONIC,&t_spc);
+   return(((m_tmcnt_t)t_spc.tv_sec * 1000000) + (t_spc.tv_nsec / 1000));
+#else
+   return(m_gettime_usec());
+#endif
+}
+
+/* Wake up the tick thread so it recomputes its deadline */
+static void timer_tick_wakeup(void)
+{
+#ifdef __linux__
+   m_uint64_t val = 1;
+
+   /* can only fail if the counter overflows, the thread is awake then */
+   if (write(timer_tick_event_fd,&val,sizeof(val)) == -1)
+      return;
+#else
+   pthread_cond_signal(&timer_tick_cond);
+#endif
+}
+
+/* Wait until the specified deadline (0 = none), with service lock held */
+static void timer_tick_wait(m_tmcnt_t deadline)
+{
+#ifdef __linux__
+   struct epoll_event ev[2];
+   struct itimerspec its;
+   m_uint64_t val;
+   int i,res;
+
+   memset(&its,0,sizeof(its));
+
+   if (deadline) {
+      its.it_value.tv_sec  = deadline / 1000000;
+      its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+   }
+
+   timerfd_settime(timer_tick_timer_fd,TFD_TIMER_ABSTIME,&its,NULL);
+   TIMER_TICK_UNLOCK();
+
+   res = epoll_wait(timer_tick_epoll_fd,ev,2,-1);
+
+   for(i=0;i<res;i++)
+      if (read(ev[i].data.fd,&val,sizeof(val)) == -1)
+         continue;
+
+   TIMER_TICK_LOCK();
+#else
+   struct timespec t_spc;
+
+   if (deadline) {
+      t_spc.tv_sec  = deadline / 1000000;
+      t_spc.tv_nsec = (deadline % 1000000) * 1000;
+      pthread_cond_timedwait(&timer_tick_cond,&timer_tick_mutex,&t_spc);
+   } else {
+      pthread_cond_wait(&timer_tick_cond,&timer_tick_mutex);
+   }
+#endif
+}
+
+/* Send the elapsed periods of a group to its clients */
+static void timer_tick_expire_group(timer_tick_group_t *grp,m_tmcnt_t now)
+{
+   timer_tick_t *tick;
+   u_int count = 1;
+
+   /* a deadline served early (coalescing window) counts as one period */
+   if (now >= grp->expire)
+      count += (now - grp->expire) / grp->interval;
+
+   grp->expire += (m_tmcnt_t)count * grp->interval;
+
+   for(tick=grp->clients;tick;tick=tick->next) {
+      if (tick->idle)
+         tick->idle_pending += count;
+      else
+         tick->callback(tick->object,count);
+   }
+}
+
+/* Tick thread */
+static void *timer_tick_loop(void *arg)
+{
+   timer_tick_group_t *grp;
+   m_tmcnt_t now,deadline;
+
+   m_signal_block(SIGINT);
+   m_signal_block(SIGQUIT);
+   m_signal_block(SIGTERM);
+
+   TIMER_TICK_LOCK();
+
+   for(;;) {
+      now = timer_tick_gettime();
+      deadline = 0;
+
+      for(grp=timer_tick_groups;grp;grp=grp->next) {
+         /* nobody to tick (tickless mode) */
+         if (!grp->active_count)
+            continue;
+
+         if (grp->expire <= (now + TIMER_TICK_SLACK))
+            timer_tick_expire_group(grp,now);
+
+         if (!deadline || (grp->expire < deadline))
+            deadline = grp->expire;
+      }
+
+      timer_tick_wait(deadline);
+   }
+
+   TIMER_TICK_UNLOCK();
+   return NULL;
+}
+
+/* Start the tick thread (with service lock held) */
+static int timer_tick_start(void)
+{
+#ifdef __linux__
+   struct epoll_event ev;
+
+   timer_tick_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   timer_tick_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                        TFD_CLOEXEC|TFD_NONBLOCK);
+   timer_tick_event_fd = eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK);
+
+   if ((timer_tick_epoll_fd == -1) || (timer_tick_timer_fd == -1) ||
+       (timer_tick_event_fd == -1))
+   {
+      perror("timer_tick_start: unable to create descriptors");
+      goto err_fd;
+   }
+
+   memset(&ev,0,sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.fd = timer_tick_timer_fd;
+   
+   if (epoll_ctl(timer_tick_epoll_fd,EPOLL_CTL_ADD,
+                 timer_tick_timer_fd,&ev) == -1)
+   {
+      perror("timer_tick_start: epoll_ctl");
+      goto err_fd;
+   }
+
+   ev.data.fd = timer_tick_event_fd;
+
+   if (epoll_ctl(timer_tick_epoll_fd,EPOLL_CTL_ADD,
+                 timer_tick_event_fd,&ev) == -1)
+   {
+      perror("timer_tick_start: epoll_ctl");
+      goto err_fd;
+   }
+#endif
+
+   if (pthread_create(&timer_tick_thread,NULL,timer_tick_loop,NULL) != 0) {
+      fprintf(stderr,"timer_tick_start: unable to create thread.\n");
+      goto err_fd;
+   }
+
+   pthread_detach(timer_tick_thread);
+   timer_tick_running = TRUE;
+   return(0);
+
+ err_fd:
+#ifdef __linux__
+   if (timer_tick_event_fd != -1) close(timer_tick_event_fd);
+   if (timer_tick_timer_fd != -1) close(timer_tick_timer_fd);
+   if (timer_tick_epoll_fd != -1) close(timer_tick_epoll_fd);
+   timer_tick_epoll_fd = timer_tick_timer_fd = timer_tick_event_fd = -1;
+#endif
+   return(-1);
+}
+
+/* Enable/disable tickless mode (no tick sent to idle clients) */
+void timer_tick_set_tickless(int enable)
+{
+   timer_tick_tickless = enable;
+}
+
+/* Register a client to the tick service */
+timer_tick_t *timer_tick_register(u_int freq,timer_tick_proc callback,
+                                  void *object)
+{
+   timer_tick_group_t *grp;
+   timer_tick_t *tick;
+   m_tmcnt_t now;
+
+   if (!freq || (freq > 1000000))
+      return NULL;
+
+   if (!(tick = calloc(1,sizeof(*tick))))
+      return NULL;
+
+   tick->callback = callback;
+   tick->object = object;
+
+   TIMER_TICK_LOCK();
+
+   if (!timer_tick_running && (timer_tick_start() == -1))
+      goto err_start;
+
+   now = timer_tick_gettime();
+
+   /* find the group of clients using the same frequency */
+   for(grp=timer_tick_groups;grp;grp=grp->next)
+      if (grp->freq == freq)
+         break;
+
+   if (!grp) {
+      if (!(grp = calloc(1,sizeof(*grp))))
+         goto err_start;
+
+      grp->freq = freq;
+      grp->interval = 1000000 / freq;
+      grp->expire = now + grp->interval;
+      grp->next = timer_tick_groups;
+      timer_tick_groups = grp;
+   } else if (!grp->active_count && (grp->expire <= now)) {
+      /* account periods elapsed while the group was idle */
+      timer_tick_expire_group(grp,now);
+   }
+
+   tick->group = grp;
+   tick->next  = grp->clients;
+   tick->pprev = &grp->clients;
+
+   if (grp->clients)
+      grp->clients->pprev = &tick->next;
+
+   grp->clients = tick;
+   grp->client_count++;
+   grp->active_count++;
+
+   timer_tick_wakeup();
+   TIMER_TICK_UNLOCK();
+   return tick;
+
+ err_start:
+   TIMER_TICK_UNLOCK();
+   free(tick);
+   return NULL;
+}
+
+/* Unregister a client of the tick service */
+void timer_tick_unregister(timer_tick_t *tick)
+{
+   timer_tick_group_t *grp,**grp_p;
+
+   if (!tick)
+      return;
+
+   TIMER_TICK_LOCK();
+   grp = tick->group;
+
+   if (tick->next)
+      tick->next->pprev = tick->pprev;
+
+   *tick->pprev = tick->next;
+
+   grp->client_count--;
+
+   if (!tick->idle)
+      grp->active_count--;
+
+   /* remove the group when its last client leaves */
+   if (!grp->client_count) {
+      for(grp_p=&timer_tick_groups;*grp_p;grp_p=&(*grp_p)->next)
+         if (*grp_p == grp) {
+            *grp_p = grp->next;
+            break;
+         }
+
+      free(grp);
+   }
+
+   TIMER_TICK_UNLOCK();
+   free(tick);
+}
+
+/* Mark a client as idle or running (tickless mode) */
+void timer_tick_set_idle(timer_tick_t *tick,int idle)
+{
+   timer_tick_group_t *grp;
+   m_tmcnt_t now;
+   u_int count;
+
+   if (!tick || (tick->idle == idle) || (idle && !timer_tick_tickless))
+      return;
+
+   TIMER_TICK_LOCK();
+   grp = tick->group;
+
+   if (idle) {
+      tick->idle = TRUE;
+      grp->active_count--;
+   } else {
+      /* account periods elapsed while the whole group was idle */
+      if (!grp->active_count) {
+         now = timer_tick_gettime();
+
+         if (grp->expire <= now)
+            timer_tick_expire_group(grp,now);
+
+         timer_tick_wakeup();
+      }
+
+      tick->idle = FALSE;
+      grp->active_count++;
+
+      if ((count = tick->idle_pending) != 0) {
+         tick->idle_pending = 0;
+         tick->callback(tick->object,count);
+      }
+   }
+
+   TIMER_TICK_UNLOCK();
+}
+
 /* Terminate timer sub-sytem */
 static void timer_terminate(void)
 {
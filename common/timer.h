@@ -58,6 +58,37 @@ struct timer_queue {
    timer_queue_t *next;             /* Next Timer Queue (for pools) */
 };
 
+/* Shared tick service: coalescing window (in usec) */
+#define TIMER_TICK_SLACK  500
+
+typedef struct timer_tick timer_tick_t;
+typedef struct timer_tick_group timer_tick_group_t;
+
+/* Tick callback: "count" is the number of periods elapsed since last call */
+typedef void (*timer_tick_proc)(void *object,u_int count);
+
+/* Tick client (typically a virtual CPU) */
+struct timer_tick {
+   timer_tick_proc callback;
+   void *object;
+   timer_tick_group_t *group;
+   timer_tick_t *next,**pprev;
+
+   /* Tickless mode: ticks received while idle are delivered on wakeup */
+   int idle;
+   u_int idle_pending;
+};
+
+/* Tick clients using the same frequency share a same deadline */
+struct timer_tick_group {
+   u_int freq,interval;             /* Frequency (Hz), interval (usec) */
+   m_tmcnt_t expire;                /* Next deadline (in usec) */
+   u_int client_count;              /* Number of clients */
+   u_int active_count;              /* Number of non-idle clients */
+   timer_tick_t *clients;
+   timer_tick_group_t *next;
+};
+
 /* Lock and unlock access to a timer queue */
 #define TIMERQ_LOCK(queue)    pthread_mutex_lock(&(queue)->lock)
 #define TIMERQ_UNLOCK(queue)  pthread_mutex_unlock(&(queue)->lock)
@@ -86,6 +117,19 @@ void timer_flush_queues(void);
 /* Add a specified number of queues to the pool */
 int timer_pool_add_queues(int nr_queues);
 
+/* Enable/disable tickless mode (no tick sent to idle clients) */
+void timer_tick_set_tickless(int enable);
+
+/* Register a client to the tick service */
+timer_tick_t *timer_tick_register(u_int freq,timer_tick_proc callback,
+                                  void *object);
+
+/* Unregister a client of the tick service */
+void timer_tick_unregister(timer_tick_t *tick);
+
+/* Mark a client as idle or running (tickless mode) */
+void timer_tick_set_idle(timer_tick_t *tick,int idle);
+
 /* Initialize timer sub-system */
 int timer_init(void);
 
@@ -436,6 +436,122 @@ u_char *memzone_map_exec_area(size_t len)
    return(mmap_or_null(NULL,len,PROT_EXEC|PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,(off_t)0));
 }
 
+#ifdef USE_UNSTABLE
+/* Round a length to the huge page size */
+static size_t memzone_huge_len(size_t len)
+{
+   return((len + MEMZONE_HUGE_PAGE_SIZE - 1) & ~(MEMZONE_HUGE_PAGE_SIZE - 1));
+}
+
+/* 
+ * Map an anonymous memory zone backed by huge pages. With MEMZONE_HUGE_TLB,
+ * reserved huge pages are used if there are enough of them, otherwise
+ * transparent huge pages. "mode" is updated with the mode really used.
+ */
+u_char *memzone_map_huge(size_t len,int prot,int *mode)
+{
+   size_t map_len,head;
+   u_char *ptr;
+
+   len = memzone_huge_len(len);
+
+#ifdef MAP_HUGETLB
+   if (*mode == MEMZONE_HUGE_TLB) {
+      ptr = mmap_or_null(NULL,len,prot,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,
+                         -1,(off_t)0);
+      if (ptr != NULL)
+         return ptr;
+   }
+#endif
+
+   /* Align the zone on a huge page boundary */
+   map_len = len + MEMZONE_HUGE_PAGE_SIZE;
+   ptr = mmap_or_null(NULL,map_len,prot,MAP_PRIVATE|MAP_ANONYMOUS,-1,(off_t)0);
+
+   if (!ptr)
+      return NULL;
+
+   head = -(m_iptr_t)ptr & (MEMZONE_HUGE_PAGE_SIZE - 1);
+
+   if (head != 0)
+      munmap(ptr,head);
+
+   munmap(ptr + head + len,map_len - head - len);
+   ptr += head;
+
+#ifdef MADV_HUGEPAGE
+   if (!madvise(ptr,len,MADV_HUGEPAGE)) {
+      *mode = MEMZONE_HUGE_THP;
+      return ptr;
+   }
+#endif
+
+   *mode = MEMZONE_HUGE_NONE;
+   return ptr;
+}
+
+/* Unmap a memory zone created by memzone_map_huge() */
+int memzone_unmap_huge(void *addr,size_t len)
+{
+   return(munmap(addr,memzone_huge_len(len)));
+}
+
+/* 
+ * Open a file and copy it into a memory zone backed by huge pages.
+ * If "len" is 0, the zone has the size of the file.
+ */
+int memzone_open_huge_file(char *filename,size_t len,u_char **ptr,
+                           off_t *fsize,int *mode)
+{
+   struct stat fprop;
+   size_t pos,count;
+   ssize_t res;
+   int fd;
+
+   if ((fd = open(filename,O_RDONLY)) == -1)
+      return(-1);
+
+   if (fstat(fd,&fprop) == -1)
+      goto err_fstat;
+
+   *fsize = fprop.st_size;
+
+   if (!len)
+      len = fprop.st_size;
+
+   if (!(*ptr = memzone_map_huge(len,PROT_READ|PROT_WRITE,mode)))
+      goto err_fstat;
+
+   count = m_min(len,(size_t)fprop.st_size);
+
+   for(pos=0;pos<count;pos+=res) {
+      if ((res = pread(fd,*ptr + pos,count - pos,pos)) <= 0) {
+         memzone_unmap_huge(*ptr,len);
+         goto err_fstat;
+      }
+   }
+
+   return(fd);
+
+ err_fstat:
+   close(fd);
+   return(-1);
+}
+
+/* Get the name of a huge page mode */
+char *memzone_huge_mode_str(int mode)
+{
+   switch(mode) {
+      case MEMZONE_HUGE_THP:
+         return "thp";
+      case MEMZONE_HUGE_TLB:
+         return "hugetlb";
+      default:
+         return "none";
+   }
+}
+#endif
+
 /* Map a memory zone from a file */
 u_char *memzone_map_file(int fd,size_t len)
 {
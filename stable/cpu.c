@@ -15,6 +15,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include "cpu.h"
 #include "memory.h"
@@ -388,25 +392,406 @@ int cpu_group_restore_state(cpu_group_t *group)
    return(TRUE);
 }
 
-/* Virtual idle loop */
-void cpu_idle_loop(cpu_gen_t *cpu)
+/* Wait until the CPU is woken up or the timeout (in usec) expires */
+static void cpu_idle_wait(cpu_gen_t *cpu,m_uint32_t seq,u_int timeout)
 {
+#ifdef __linux__
    struct timespec t_spc;
-   m_tmcnt_t expire;
 
-   expire = m_gettime_usec() + cpu->idle_sleep_time;
+   t_spc.tv_sec = timeout / 1000000;
+   t_spc.tv_nsec = (timeout % 1000000) * 1000;
 
-   pthread_mutex_lock(&cpu->idle_mutex);
+   /* returns immediately if a wakeup occurred since "seq" was read */
+   syscall(SYS_futex,&cpu->idle_seq,FUTEX_WAIT_PRIVATE,seq,&t_spc,NULL,0);
+#else
+   struct timespec t_spc;
+   m_tmcnt_t expire;
+
+   expire = m_gettime_usec() + timeout;
    t_spc.tv_sec = expire / 1000000;
    t_spc.tv_nsec = (expire % 1000000) * 1000;
-   while(pthread_cond_timedwait(&cpu->idle_cond,&cpu->idle_mutex,&t_spc) != ETIMEDOUT) {
+
+   pthread_mutex_lock(&cpu->idle_mutex);
+   while(cpu->idle_seq == seq) {
+      if (pthread_cond_timedwait(&cpu->idle_cond,&cpu->idle_mutex,
+                                 &t_spc) == ETIMEDOUT)
+         break;
    }
    pthread_mutex_unlock(&cpu->idle_mutex);
+#endif
+}
+
+/* Virtual idle loop */
+void cpu_idle_loop(cpu_gen_t *cpu)
+{
+   m_tmcnt_t latency;
+   m_uint32_t seq;
+   u_int i;
+
+   /* a wakeup occurred since the last idle period: there is work to do */
+   seq = __atomic_load_n(&cpu->idle_seq,__ATOMIC_SEQ_CST);
+
+   if (seq != cpu->idle_seq_last) {
+      __atomic_store_n(&cpu->idle_seq_last,seq,__ATOMIC_RELAXED);
+      return;
+   }
+
+   /* no timer tick needed while sleeping (tickless mode) */
+   timer_tick_set_idle(cpu->timer_tick,TRUE);
+
+   __atomic_store_n(&cpu->idle_waiting,TRUE,__ATOMIC_SEQ_CST);
+   cpu_idle_wait(cpu,seq,cpu->idle_sleep_time);
+   __atomic_store_n(&cpu->idle_waiting,FALSE,__ATOMIC_SEQ_CST);
+
+   __atomic_store_n(&cpu->idle_seq_last,
+                    __atomic_load_n(&cpu->idle_seq,__ATOMIC_SEQ_CST),
+                    __ATOMIC_RELAXED);
+   cpu->idle_sleeps++;
+
+   if (cpu->idle_seq_last != seq) {
+      /* woken up by an event: record the idle exit latency */
+      latency = m_gettime_usec() - cpu->idle_wake_time;
+
+      for(i=0;(i < (CPU_IDLE_HIST_SIZE-1)) && (latency >> i);i++)
+         ;
+
+      cpu->idle_exit_hist[i]++;
+      cpu->idle_wakeups++;
+   } else {
+      cpu->idle_timeouts++;
+   }
+
+   timer_tick_set_idle(cpu->timer_tick,FALSE);
 }
 
 /* Break idle wait state */
 void cpu_idle_break_wait(cpu_gen_t *cpu)
 {
-   pthread_cond_signal(&cpu->idle_cond);
+   if (!cpu)
+      return;
+
+   cpu->idle_wake_time = m_gettime_usec();
+   __atomic_add_fetch(&cpu->idle_seq,1,__ATOMIC_SEQ_CST);
    cpu->idle_count = 0;
+
+   /* wake up the CPU thread if it is sleeping */
+   if (__atomic_load_n(&cpu->idle_waiting,__ATOMIC_SEQ_CST)) {
+#ifdef __linux__
+      syscall(SYS_futex,&cpu->idle_seq,FUTEX_WAKE_PRIVATE,1,NULL,NULL,0);
+#else
+      pthread_mutex_lock(&cpu->idle_mutex);
+      pthread_cond_signal(&cpu->idle_cond);
+      pthread_mutex_unlock(&cpu->idle_mutex);
+#endif
+   }
+}
+
+/* 
+ * Check if the code at the specified address looks like an idle loop:
+ * a short loop (or leaf function) with no call and no memory write,
+ * except to counters (a location read before in the loop, through a base
+ * register which is not modified by the loop).
+ */
+int cpu_idle_pc_check(cpu_gen_t *cpu,m_uint64_t addr)
+{
+   struct { u_int base; m_int64_t offset; } loads[CPU_IDLE_PC_CHECK_MAX_INSN];
+   struct cpu_idle_insn insn;
+   m_uint64_t start,pc,written,store_bases;
+   int i,j,end,load_count;
+
+   if (!cpu->idle_insn_decode)
+      return(FALSE);
+
+   start = addr;
+
+ restart:
+   load_count = 0;
+   written = store_bases = 0;
+   end = -1;
+
+   for(i=0,pc=start;i<CPU_IDLE_PC_CHECK_MAX_INSN;i++,pc+=4) {
+      if (cpu->idle_insn_decode(cpu,pc,&insn) == -1)
+         return(FALSE);
+
+      switch(insn.type) {
+         case CPU_IDLE_INSN_LOAD:
+            loads[load_count].base = insn.base;
+            loads[load_count].offset = insn.offset;
+            load_count++;
+            break;
+
+         case CPU_IDLE_INSN_STORE:
+            for(j=0;j<load_count;j++)
+               if ((loads[j].base == insn.base) && 
+                   (loads[j].offset == insn.offset))
+                  break;
+
+            if (j == load_count)
+               return(FALSE);
+
+            store_bases |= 1ULL << insn.base;
+            break;
+
+         case CPU_IDLE_INSN_BRANCH:
+            /* forward branch: continue with the sequential path */
+            if (insn.target > pc)
+               break;
+
+            /* the loop begins before: analyze it from its beginning */
+            if (insn.target < start) {
+               if ((start != addr) || 
+                   ((addr - insn.target) >= (CPU_IDLE_PC_CHECK_MAX_INSN*4)))
+                  return(FALSE);
+
+               start = insn.target;
+               goto restart;
+            }
+
+            end = i + (insn.delay_slot ? 1 : 0);
+            break;
+
+         case CPU_IDLE_INSN_RETURN:
+            end = i + (insn.delay_slot ? 1 : 0);
+            break;
+
+         case CPU_IDLE_INSN_REJECT:
+            return(FALSE);
+      }
+
+      /* a load doesn't match stores once its base register is written */
+      if (insn.dst_mask) {
+         written |= insn.dst_mask;
+
+         for(j=0;j<load_count;)
+            if (insn.dst_mask & (1ULL << loads[j].base))
+               loads[j] = loads[--load_count];
+            else
+               j++;
+      }
+
+      /* the counters must be at the same address in all iterations */
+      if (i == end)
+         return(!(store_bases & written));
+   }
+
+   return(FALSE);
+}
+
+/* Get the idle PC currently used by a CPU */
+static m_uint64_t cpu_get_idle_pc(cpu_gen_t *cpu)
+{
+   switch(cpu->type) {
+      case CPU_TYPE_MIPS64:
+         return(CPU_MIPS64(cpu)->idle_pc);
+      case CPU_TYPE_PPC32:
+         return(CPU_PPC32(cpu)->idle_pc);
+      default:
+         return(0);
+   }
+}
+
+/* Get the timer IRQ state of a CPU */
+static void cpu_get_timer_state(cpu_gen_t *cpu,u_int *pending,
+                                u_int *freq,u_int *drift)
+{
+   switch(cpu->type) {
+      case CPU_TYPE_MIPS64:
+         *pending = CPU_MIPS64(cpu)->timer_irq_pending;
+         *freq    = CPU_MIPS64(cpu)->timer_irq_freq;
+         *drift   = CPU_MIPS64(cpu)->timer_drift;
+         break;
+      case CPU_TYPE_PPC32:
+         *pending = CPU_PPC32(cpu)->timer_irq_pending;
+         *freq    = CPU_PPC32(cpu)->timer_irq_freq;
+         *drift   = CPU_PPC32(cpu)->timer_drift;
+         break;
+      default:
+         *pending = *freq = *drift = 0;
+   }
+}
+
+/* Check if a PC has been rejected by the idle PC detector */
+static int cpu_idle_auto_rejected(struct cpu_idle_auto *ia,m_uint64_t pc)
+{
+   int i;
+
+   for(i=0;i<CPU_IDLE_AUTO_BLACKLIST;i++)
+      if (ia->blacklist[i] == pc)
+         return(TRUE);
+
+   return(FALSE);
+}
+
+/* Reject a PC for automatic idle PC detection */
+static void cpu_idle_auto_reject(struct cpu_idle_auto *ia,m_uint64_t pc)
+{
+   ia->blacklist[ia->blacklist_pos] = pc;
+   ia->blacklist_pos = (ia->blacklist_pos + 1) % CPU_IDLE_AUTO_BLACKLIST;
+}
+
+/* Revert the idle PC set by the detector */
+static void cpu_idle_auto_revert(cpu_gen_t *cpu)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+
+   cpu_log(cpu,"IDLE_PC","reverting automatic idle PC 0x%llx\n",ia->pc);
+
+   cpu->set_idle_pc(cpu,0);
+   cpu_idle_auto_reject(ia,ia->pc);
+   ia->revert_count++;
+   ia->pc = 0;
+}
+
+/* Evaluate PC samples of the last window */
+static void cpu_idle_auto_eval(cpu_gen_t *cpu)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+   struct cpu_idle_auto_sample *best = &ia->table[0];
+   u_int pending,freq,drift;
+   m_uint64_t idle_pc;
+   int i;
+
+   for(i=1;i<CPU_IDLE_AUTO_HASH_SIZE;i++)
+      if (ia->table[i].count > best->count)
+         best = &ia->table[i];
+
+   idle_pc = cpu_get_idle_pc(cpu);
+   cpu_get_timer_state(cpu,&pending,&freq,&drift);
+
+   /* never change an idle PC set by the user */
+   if (idle_pc && (idle_pc != ia->pc)) {
+      ia->pc = 0;
+      goto done;
+   }
+
+   /* 
+    * The idle PC makes the CPU sleep while it has work to do if the timer
+    * IRQ are not handled in time, or if the loop polls a device: revert it.
+    */
+   if (ia->pc && ((drift != ia->drift_ref) || (pending > freq) || ia->mmio)) {
+      cpu_idle_auto_revert(cpu);
+      goto done;
+   }
+
+   /* the candidate loop accesses a device */
+   if (ia->candidate && ia->mmio) {
+      cpu_idle_auto_reject(ia,ia->candidate);
+      ia->candidate = 0;
+      ia->confirm = 0;
+      goto done;
+   }
+
+   /* no PC is hot enough (the CPU is busy) */
+   if ((best->count * 100) < (CPU_IDLE_AUTO_WINDOW*CPU_IDLE_AUTO_THRESHOLD)) {
+      ia->confirm = 0;
+      goto done;
+   }
+
+   if ((best->pc == ia->pc) || cpu_idle_auto_rejected(ia,best->pc))
+      goto done;
+
+   /* the same PC must be the hottest one in consecutive windows */
+   if (best->pc != ia->candidate) {
+      ia->candidate = best->pc;
+      ia->confirm = 1;
+      goto done;
+   }
+
+   if (++ia->confirm < CPU_IDLE_AUTO_CONFIRM)
+      goto done;
+
+   /* check that the code looks like an idle loop */
+   if (!cpu_idle_pc_check(cpu,best->pc)) {
+      cpu_idle_auto_reject(ia,best->pc);
+      goto done;
+   }
+
+   if (ia->pc)
+      cpu_idle_auto_revert(cpu);
+
+   cpu_log(cpu,"IDLE_PC","using automatic idle PC 0x%llx (%u/%u samples)\n",
+           best->pc,best->count,CPU_IDLE_AUTO_WINDOW);
+
+   cpu->set_idle_pc(cpu,best->pc);
+   ia->pc = best->pc;
+   ia->drift_ref = drift;
+   ia->apply_count++;
+
+ done:
+   memset(ia->table,0,sizeof(ia->table));
+   ia->samples = 0;
+   ia->mmio = FALSE;
+}
+
+/* Sample the PC of a JIT block (automatic idle PC detection) */
+void cpu_idle_auto_sample(cpu_gen_t *cpu,m_uint64_t pc)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+   struct cpu_idle_auto_sample *s;
+
+   ia->itv_count = 0;
+   s = &ia->table[(pc >> 2) & (CPU_IDLE_AUTO_HASH_SIZE - 1)];
+
+   /* on collision, the most frequent PC stays in the table */
+   if (s->pc == pc) {
+      s->count++;
+   } else if (s->count) {
+      s->count--;
+   } else {
+      s->pc = pc;
+      s->count = 1;
+   }
+
+   if (++ia->samples == CPU_IDLE_AUTO_WINDOW)
+      cpu_idle_auto_eval(cpu);
+}
+
+/* Enable/disable automatic idle PC detection (CPU thread) */
+void cpu_idle_auto_enable(cpu_gen_t *cpu,int enable)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+
+   if (!enable && ia->pc && (cpu_get_idle_pc(cpu) == ia->pc))
+      cpu->set_idle_pc(cpu,0);
+
+   ia->pc = 0;
+   ia->candidate = 0;
+   ia->confirm = 0;
+   ia->mmio = FALSE;
+   ia->enabled = enable;
+}
+
+/*
+ * Ask the CPU thread to enable/disable automatic idle PC detection. The
+ * detector state is only modified by the CPU thread, in its run loop.
+ */
+void cpu_idle_auto_request(cpu_gen_t *cpu,int enable)
+{
+   __atomic_store_n(&cpu->idle_auto.request,
+                    enable ? CPU_IDLE_AUTO_REQ_ENABLE :
+                    CPU_IDLE_AUTO_REQ_DISABLE,
+                    __ATOMIC_RELEASE);
+}
+
+/* Handle a request to the idle PC detector (CPU thread) */
+void cpu_idle_auto_handle_request(cpu_gen_t *cpu)
+{
+   int req;
+
+   req = __atomic_exchange_n(&cpu->idle_auto.request,
+                             CPU_IDLE_AUTO_REQ_NONE,__ATOMIC_ACQUIRE);
+
+   if (req != CPU_IDLE_AUTO_REQ_NONE)
+      cpu_idle_auto_enable(cpu,req == CPU_IDLE_AUTO_REQ_ENABLE);
+}
+
+/* Get the idle PC set by the detector (0 = none) */
+m_uint64_t cpu_idle_auto_get_pc(cpu_gen_t *cpu)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+
+   if (ia->pc && (cpu_get_idle_pc(cpu) == ia->pc))
+      return(ia->pc);
+
+   return(0);
 }
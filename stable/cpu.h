@@ -10,6 +10,7 @@
 #include <setjmp.h>
 #include "utils.h"
 #include "jit_op.h"
+#include "timer.h"
 
 #include "mips64.h"
 #include "mips64_cp0.h"
@@ -37,6 +38,80 @@ struct cpu_idle_pc {
    u_int count;
 };
 
+/* Number of buckets of the idle exit latency histogram */
+#define CPU_IDLE_HIST_SIZE  16
+
+/* Automatic idle PC detection */
+#define CPU_IDLE_AUTO_HASH_SIZE   64    /* PC sampling table size */
+#define CPU_IDLE_AUTO_SAMPLE_ITV  16    /* JIT blocks between two samples */
+#define CPU_IDLE_AUTO_WINDOW      4096  /* Samples per evaluation window */
+#define CPU_IDLE_AUTO_THRESHOLD   25    /* Min share of samples (percent) */
+#define CPU_IDLE_AUTO_CONFIRM     4     /* Windows before applying a PC */
+#define CPU_IDLE_AUTO_BLACKLIST   16    /* Rejected PCs to remember */
+
+/* Maximum number of instructions checked for an idle loop */
+#define CPU_IDLE_PC_CHECK_MAX_INSN  32
+
+/* Instruction classes for idle loop analysis */
+enum {
+   CPU_IDLE_INSN_OTHER = 0,   /* No side effect */
+   CPU_IDLE_INSN_LOAD,        /* Memory read */
+   CPU_IDLE_INSN_STORE,       /* Memory write */
+   CPU_IDLE_INSN_BRANCH,      /* Branch or jump with a known target */
+   CPU_IDLE_INSN_RETURN,      /* Return or indirect jump */
+   CPU_IDLE_INSN_REJECT,      /* Call, exception, system register write */
+};
+
+/* Decoded instruction for idle loop analysis */
+struct cpu_idle_insn {
+   int type;
+   int delay_slot;            /* Next instruction is executed (MIPS) */
+   u_int base;                /* Base register of a memory access */
+   m_int64_t offset;          /* Offset of a memory access */
+   m_uint64_t target;         /* Branch target */
+   m_uint64_t dst_mask;       /* Registers written by the instruction */
+};
+
+/* Base register of an absolute memory access (never written) */
+#define CPU_IDLE_NO_BASE  63
+
+struct cpu_idle_auto_sample {
+   m_uint64_t pc;
+   u_int count;
+};
+
+/* Requests to the automatic idle PC detector (set by other threads) */
+enum {
+   CPU_IDLE_AUTO_REQ_NONE = 0,
+   CPU_IDLE_AUTO_REQ_ENABLE,
+   CPU_IDLE_AUTO_REQ_DISABLE,
+};
+
+struct cpu_idle_auto {
+   volatile int enabled;
+   volatile int request;
+   u_int itv_count,samples;
+   struct cpu_idle_auto_sample table[CPU_IDLE_AUTO_HASH_SIZE];
+
+   /* Candidate PC and number of windows where it was the hottest one */
+   m_uint64_t candidate;
+   u_int confirm;
+
+   /* Device access seen in the loop of the candidate or of the idle PC */
+   int mmio;
+
+   /* Idle PC set by the detector (0 = none) and timer drift reference */
+   m_uint64_t pc;
+   u_int drift_ref;
+
+   /* PCs rejected or reverted */
+   m_uint64_t blacklist[CPU_IDLE_AUTO_BLACKLIST];
+   u_int blacklist_pos;
+
+   /* Statistics */
+   u_int apply_count,revert_count;
+};
+
 /* Number of recorded memory accesses (power of two) */
 #define MEMLOG_COUNT   16
 
@@ -76,6 +151,19 @@ struct cpu_gen {
    pthread_mutex_t idle_mutex;
    pthread_cond_t idle_cond;
 
+   /* Idle wakeup: sequence incremented by wakeups (futex word) */
+   volatile m_uint32_t idle_seq;
+   m_uint32_t idle_seq_last;
+   volatile int idle_waiting;
+   volatile m_tmcnt_t idle_wake_time;
+
+   /* Idle statistics (idle exit latency in usec, log2 buckets) */
+   m_uint64_t idle_sleeps,idle_wakeups,idle_timeouts;
+   m_uint64_t idle_exit_hist[CPU_IDLE_HIST_SIZE];
+
+   /* Timer IRQ (shared tick service) */
+   timer_tick_t *timer_tick;
+
    /* VM instance */
    vm_instance_t *vm;
 
@@ -86,6 +174,9 @@ struct cpu_gen {
    struct cpu_idle_pc idle_pc_prop[CPU_IDLE_PC_MAX_RES];
    u_int idle_pc_prop_count;
 
+   /* Automatic idle PC detection */
+   struct cpu_idle_auto idle_auto;
+
    /* Specific CPU part */
    union {
       cpu_mips_t mips64_cpu;
@@ -101,6 +192,8 @@ struct cpu_gen {
    void (*remove_breakpoint)(cpu_gen_t *cpu,m_uint64_t addr);
    void (*set_idle_pc)(cpu_gen_t *cpu,m_uint64_t addr);
    void (*get_idling_pc)(cpu_gen_t *cpu);   
+   int (*idle_insn_decode)(cpu_gen_t *cpu,m_uint64_t pc,
+                           struct cpu_idle_insn *insn);
    void (*mts_rebuild)(cpu_gen_t *cpu);
    void (*mts_show_stats)(cpu_gen_t *cpu);
 
@@ -216,6 +309,59 @@ void cpu_idle_loop(cpu_gen_t *cpu);
 /* Break idle wait state */
 void cpu_idle_break_wait(cpu_gen_t *cpu);
 
+/* Sample the PC of a JIT block (automatic idle PC detection) */
+void cpu_idle_auto_sample(cpu_gen_t *cpu,m_uint64_t pc);
+
+/* Check if the code at the specified address looks like an idle loop */
+int cpu_idle_pc_check(cpu_gen_t *cpu,m_uint64_t addr);
+
+/* Enable/disable automatic idle PC detection (CPU thread) */
+void cpu_idle_auto_enable(cpu_gen_t *cpu,int enable);
+
+/* Ask the CPU thread to enable/disable automatic idle PC detection */
+void cpu_idle_auto_request(cpu_gen_t *cpu,int enable);
+
+/* Handle a request to the idle PC detector (CPU thread) */
+void cpu_idle_auto_handle_request(cpu_gen_t *cpu);
+
+/* Get the idle PC set by the detector (0 = none) */
+m_uint64_t cpu_idle_auto_get_pc(cpu_gen_t *cpu);
+
+/*
+ * Check if a CPU must be woken up: it is sleeping, or no wakeup is
+ * pending yet (a pending wakeup already skips the next sleep).
+ */
+static inline int cpu_idle_wakeup_needed(cpu_gen_t *cpu)
+{
+   if (!cpu)
+      return(FALSE);
+
+   return(__atomic_load_n(&cpu->idle_waiting,__ATOMIC_SEQ_CST) ||
+          (__atomic_load_n(&cpu->idle_seq,__ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&cpu->idle_seq_last,__ATOMIC_RELAXED)));
+}
+
+/*
+ * Device access by the CPU: an idle loop must not poll devices, so mark
+ * the loop of the candidate (or applied) idle PC if it contains the PC.
+ */
+static forced_inline void cpu_idle_auto_mmio(cpu_gen_t *cpu)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+   m_uint64_t pc;
+
+   if (likely(!ia->enabled))
+      return;
+
+   /* the sampled PC may be anywhere in the loop */
+   pc = cpu_get_pc(cpu) + (CPU_IDLE_PC_CHECK_MAX_INSN * 4);
+
+   if ((ia->candidate &&
+        ((pc - ia->candidate) < (CPU_IDLE_PC_CHECK_MAX_INSN * 8))) ||
+       (ia->pc && ((pc - ia->pc) < (CPU_IDLE_PC_CHECK_MAX_INSN * 8))))
+      ia->mmio = TRUE;
+}
+
 /* Returns to the CPU exec loop */
 static inline void cpu_exec_loop_enter(cpu_gen_t *cpu)
 {
@@ -473,6 +473,58 @@ static int cmd_show_idle_pc_prop(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Enable/disable automatic idle PC detection */
+static int cmd_set_idle_pc_auto(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->idle_pc_auto = atoi(argv[1]);
+
+   /* the change is applied by the CPU threads */
+   if (vm->cpu_group != NULL) {
+      for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+         cpu_idle_auto_request(cpu,vm->idle_pc_auto);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show the state of automatic idle PC detection */
+static int cmd_show_idle_pc_auto(hypervisor_conn_t *conn,
+                                 int argc,char *argv[])
+{
+   struct cpu_idle_auto *ia;
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (!(cpu = find_cpu(conn,vm,atoi(argv[1]))))
+      return(-1);
+
+   ia = &cpu->idle_auto;
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"enabled: %s",
+                         ia->enabled ? "yes" : "no");
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"idle_pc: 0x%llx",
+                         cpu_idle_auto_get_pc(cpu));
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"candidate: 0x%llx",
+                         ia->candidate);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"applied: %u, reverted: %u",
+                         ia->apply_count,ia->revert_count);
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set CPU idle max value */
 static int cmd_set_idle_max(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -548,6 +600,41 @@ static int cmd_show_timer_drift(hypervisor_conn_t *conn,
    return(0);
 }
 
+/* Show idle statistics (wakeups and idle exit latency) */
+static int cmd_show_idle_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+   int i;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (!(cpu = find_cpu(conn,vm,atoi(argv[1]))))
+      return(-1);
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                         "sleeps: %llu, wakeups: %llu, timeouts: %llu",
+                         cpu->idle_sleeps,cpu->idle_wakeups,
+                         cpu->idle_timeouts);
+
+   for(i=0;i<CPU_IDLE_HIST_SIZE;i++) {
+      if (!cpu->idle_exit_hist[i])
+         continue;
+
+      if (i < (CPU_IDLE_HIST_SIZE - 1))
+         hypervisor_send_reply(conn,HSC_INFO_MSG,0,"exit < %u us: %llu",
+                               1 << i,cpu->idle_exit_hist[i]);
+      else
+         hypervisor_send_reply(conn,HSC_INFO_MSG,0,"exit >= %u us: %llu",
+                               1 << (i - 1),cpu->idle_exit_hist[i]);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set the exec area size */
 static int cmd_set_exec_area(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -623,6 +710,48 @@ static int cmd_set_disk1(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* 
+ * Set the base image of a PCMCIA ATA disk (the disk is a copy-on-write
+ * overlay of this image). An empty filename removes the base image.
+ *
+ * Parameters: <vm_name> <disk_id> <filename>
+ */
+static int cmd_set_disk_base(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   char *filename;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   filename = (*argv[2] != 0) ? argv[2] : NULL;
+
+   if (vm_set_disk_base(vm,atoi(argv[1]),filename) == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "unable to set base image of disk%s",argv[1]);
+      return(-1);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Map PCMCIA ATA disk files in memory */
+static int cmd_set_disk_mmap(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->pcmcia_disk_mmap = atoi(argv[1]);
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set the config register used at startup */
 static int cmd_set_conf_reg(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -1283,14 +1412,19 @@ static hypervisor_cmd_t vm_cmd_array[] = {
    { "set_exec_area", 2, 2, cmd_set_exec_area, NULL },
    { "set_disk0", 2, 2, cmd_set_disk0, NULL },
    { "set_disk1", 2, 2, cmd_set_disk1, NULL },
+   { "set_disk_base", 3, 3, cmd_set_disk_base, NULL },
+   { "set_disk_mmap", 2, 2, cmd_set_disk_mmap, NULL },
    { "set_conf_reg", 2, 2, cmd_set_conf_reg, NULL },
    { "set_idle_pc", 2, 2, cmd_set_idle_pc, NULL },
    { "set_idle_pc_online", 3, 3, cmd_set_idle_pc_online, NULL },
    { "get_idle_pc_prop", 2, 2, cmd_get_idle_pc_prop, NULL },
    { "show_idle_pc_prop", 2, 2, cmd_show_idle_pc_prop, NULL },
+   { "set_idle_pc_auto", 2, 2, cmd_set_idle_pc_auto, NULL },
+   { "show_idle_pc_auto", 2, 2, cmd_show_idle_pc_auto, NULL },
    { "set_idle_max", 3, 3, cmd_set_idle_max, NULL },
    { "set_idle_sleep_time", 3, 3, cmd_set_idle_sleep_time, NULL },
    { "show_timer_drift", 2, 2, cmd_show_timer_drift, NULL },
+   { "show_idle_stats", 2, 2, cmd_show_idle_stats, NULL },
    { "set_ghost_file", 2, 2, cmd_set_ghost_file, NULL },
    { "set_ghost_status", 2, 2, cmd_set_ghost_status, NULL },
    { "set_con_tcp_port", 2, 2, cmd_set_con_tcp_port, NULL },
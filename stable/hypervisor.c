@@ -572,6 +572,7 @@ int hypervisor_tcp_server(char *ip_addr,int tcp_port)
    hypervisor_vm_init();
    hypervisor_vm_debug_init();
    hypervisor_store_init();
+   hypervisor_ptask_init();
 
    signal(SIGPIPE,sigpipe_handler);
 
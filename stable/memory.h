@@ -7,6 +7,7 @@
 #define __MEMORY_H__
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "utils.h"
 
 /* MTS operation */
@@ -90,6 +91,37 @@ void physmem_copy_from_vm(vm_instance_t *vm,void *real_buffer,
 void physmem_copy_to_vm(vm_instance_t *vm,void *real_buffer,
                         m_uint64_t paddr,size_t len);
 
+/* Invalidate a page in the physical memory translation cache */
+void physmem_tlb_invalidate(vm_instance_t *vm,m_uint64_t paddr);
+
+/* Flush the physical memory translation cache */
+void physmem_tlb_flush(vm_instance_t *vm);
+
+/* Get the translation cache statistics of a VM, and optionally reset them */
+void physmem_tlb_get_stats(vm_instance_t *vm,m_uint64_t *hits,
+                           m_uint64_t *misses,int reset);
+
+/* 
+ * Start an access to the memory of a VM from a device. Host pointers to
+ * VM memory are valid until the end of the section.
+ */
+void physmem_dma_begin(vm_instance_t *vm);
+
+/* End an access to the memory of a VM from a device */
+void physmem_dma_end(vm_instance_t *vm);
+
+/* Maximum number of host segments for the physmem copy fast path */
+#define PHYSMEM_COPY_MAX_IOV  8
+
+/* Map a VM physical memory range to host memory segments */
+int physmem_map_iov(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                    u_int op_type,struct iovec *iov,u_int max_iov);
+
+/* Add a VM physical memory range to the segments of a packet (read) */
+int physmem_map_iov_bounce(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                           struct iovec *iov,int count,u_int max_iov,
+                           u_char *bounce,size_t pos);
+
 /* Copy a 32-bit word from the VM physical RAM to real host */
 m_uint32_t physmem_copy_u32_from_vm(vm_instance_t *vm,m_uint64_t paddr);
 
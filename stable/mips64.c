@@ -75,6 +75,122 @@ int mips64_reset(cpu_mips_t *cpu)
    return(0);
 }
 
+/* Decode an instruction for idle loop analysis */
+static int mips64_idle_insn_decode(cpu_gen_t *gen,m_uint64_t pc,
+                                   struct cpu_idle_insn *di)
+{
+   cpu_mips_t *cpu = CPU_MIPS64(gen);
+   m_uint32_t phys_page;
+   m_uint64_t paddr;
+   mips_insn_t insn;
+   u_int op,rs,rt,rd;
+
+   if (cpu->translate(cpu,pc,&phys_page) == -1)
+      return(-1);
+
+   paddr = ((m_uint64_t)phys_page << MIPS_MIN_PAGE_SHIFT);
+   paddr += pc & MIPS_MIN_PAGE_IMASK;
+   insn = physmem_copy_u32_from_vm(cpu->vm,paddr);
+
+   op = bits(insn,26,31);
+   rs = bits(insn,21,25);
+   rt = bits(insn,16,20);
+   rd = bits(insn,11,15);
+
+   memset(di,0,sizeof(*di));
+   di->base = rs;
+   di->offset = sign_extend(bits(insn,0,15),16);
+   di->target = pc + 4 + (di->offset << 2);
+
+   switch(op) {
+      case 0x00:   /* SPECIAL: the result goes to rd */
+         di->dst_mask = 1ULL << rd;
+
+         switch(bits(insn,0,5)) {
+            case 0x08:   /* JR */
+               di->type = CPU_IDLE_INSN_RETURN;
+               di->delay_slot = TRUE;
+               break;
+            case 0x09:   /* JALR */
+            case 0x0c:   /* SYSCALL */
+            case 0x0d:   /* BREAK */
+               di->type = CPU_IDLE_INSN_REJECT;
+               break;
+         }
+         break;
+
+      case 0x01:   /* REGIMM: BLTZ, BGEZ, BLTZL, BGEZL (no link, no trap) */
+         if (rt <= 0x03) {
+            di->type = CPU_IDLE_INSN_BRANCH;
+            di->delay_slot = TRUE;
+         } else {
+            di->type = CPU_IDLE_INSN_REJECT;
+         }
+         break;
+
+      case 0x02:   /* J */
+         di->type = CPU_IDLE_INSN_BRANCH;
+         di->delay_slot = TRUE;
+         di->target = ((pc + 4) & ~0x0FFFFFFFULL) | (bits(insn,0,25) << 2);
+         break;
+
+      case 0x04: case 0x05: case 0x06: case 0x07:   /* BEQ,BNE,BLEZ,BGTZ */
+      case 0x14: case 0x15: case 0x16: case 0x17:   /* Likely versions */
+         di->type = CPU_IDLE_INSN_BRANCH;
+         di->delay_slot = TRUE;
+         break;
+
+      case 0x08: case 0x09: case 0x0a: case 0x0b:   /* ADDI,ADDIU,SLTI,SLTIU */
+      case 0x0c: case 0x0d: case 0x0e: case 0x0f:   /* ANDI,ORI,XORI,LUI */
+      case 0x18: case 0x19: case 0x1a: case 0x1b:   /* DADDI,DADDIU,LDL,LDR */
+         di->dst_mask = 1ULL << rt;
+         break;
+
+      case 0x10:   /* COP0: only MFC0 and DMFC0 are harmless */
+         if (rs > 0x01)
+            di->type = CPU_IDLE_INSN_REJECT;
+         else
+            di->dst_mask = 1ULL << rt;
+         break;
+
+      case 0x11:   /* COP1: MFC1, DMFC1 and CFC1 write a GPR */
+         if (rs <= 0x02)
+            di->dst_mask = 1ULL << rt;
+         break;
+
+      case 0x1c:   /* SPECIAL2 (MUL...) */
+         di->dst_mask = 1ULL << rd;
+         break;
+
+      case 0x20: case 0x21: case 0x22: case 0x23:   /* LB,LH,LWL,LW */
+      case 0x24: case 0x25: case 0x26: case 0x27:   /* LBU,LHU,LWR,LWU */
+      case 0x30: case 0x34: case 0x37:              /* LL,LLD,LD */
+         di->type = CPU_IDLE_INSN_LOAD;
+         di->dst_mask = 1ULL << rt;
+         break;
+
+      case 0x28: case 0x29: case 0x2a: case 0x2b:   /* SB,SH,SWL,SW */
+      case 0x2c: case 0x2d: case 0x2e: case 0x3f:   /* SDL,SDR,SWR,SD */
+      case 0x39: case 0x3d:                         /* SWC1,SDC1 */
+         di->type = CPU_IDLE_INSN_STORE;
+         break;
+
+      case 0x38: case 0x3c:                         /* SC,SCD */
+         di->type = CPU_IDLE_INSN_STORE;
+         di->dst_mask = 1ULL << rt;
+         break;
+
+      case 0x03:   /* JAL */
+      case 0x2f:   /* CACHE */
+         di->type = CPU_IDLE_INSN_REJECT;
+         break;
+   }
+
+   /* writes to $zero are ignored */
+   di->dst_mask &= ~1ULL;
+   return(0);
+}
+
 /* Initialize a MIPS64 processor */
 int mips64_init(cpu_mips_t *cpu)
 {
@@ -112,6 +228,7 @@ int mips64_init(cpu_mips_t *cpu)
    cpu->gen->remove_breakpoint = (void *)mips64_remove_breakpoint;
    cpu->gen->set_idle_pc = (void *)mips64_set_idle_pc;
    cpu->gen->get_idling_pc = (void *)mips64_get_idling_pc;
+   cpu->gen->idle_insn_decode = mips64_idle_insn_decode;
 
    /* Set the startup parameters */
    mips64_reset(cpu);
@@ -152,48 +269,22 @@ void mips64_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr)
    CPU_MIPS64(cpu)->idle_pc = addr;
 }
 
-/* Timer IRQ */
-void *mips64_timer_irq_run(cpu_mips_t *cpu)
+/* Timer IRQ (called by the tick service, "count" elapsed periods) */
+void mips64_timer_tick(cpu_mips_t *cpu,u_int count)
 {
-   pthread_mutex_t umutex = PTHREAD_MUTEX_INITIALIZER;
-   pthread_cond_t ucond = PTHREAD_COND_INITIALIZER;
-   struct timespec t_spc;
-   m_tmcnt_t expire;
-   u_int interval;
    u_int threshold;
 
-   interval = 1000000 / cpu->timer_irq_freq;
-   threshold = cpu->timer_irq_freq * 10;
-   expire = m_gettime_usec() + interval;
-
-   while(cpu->gen->state != CPU_STATE_HALTED) {
-      pthread_mutex_lock(&umutex);
-      t_spc.tv_sec = expire / 1000000;
-      t_spc.tv_nsec = (expire % 1000000) * 1000;
-      pthread_cond_timedwait(&ucond,&umutex,&t_spc);
-      pthread_mutex_unlock(&umutex);
+   if (likely(!cpu->irq_disable) && 
+       likely(cpu->gen->state == CPU_STATE_RUNNING)) 
+   {
+      threshold = cpu->timer_irq_freq * 10;
+      cpu->timer_irq_pending += count;
 
-      if (likely(!cpu->irq_disable) && 
-          likely(cpu->gen->state == CPU_STATE_RUNNING)) 
-      {
-         cpu->timer_irq_pending++;
-
-         if (unlikely(cpu->timer_irq_pending > threshold)) {
-            cpu->timer_irq_pending = 0;
-            cpu->timer_drift++;
-#if 0
-            printf("Timer IRQ not accurate (%u pending IRQ): "
-                   "reduce the \"--timer-irq-check-itv\" parameter "
-                   "(current value: %u)\n",
-                   cpu->timer_irq_pending,cpu->timer_irq_check_itv);
-#endif
-         }
+      if (unlikely(cpu->timer_irq_pending > threshold)) {
+         cpu->timer_irq_pending = 0;
+         cpu->timer_drift++;
       }
-
-      expire += interval;
    }
-
-   return NULL;
 }
 
 #define IDLE_HASH_SIZE  8192
@@ -321,9 +412,6 @@ void mips64_vm_set_irq(vm_instance_t *vm,u_int irq)
    }
 
    mips64_set_irq(boot_cpu,irq);
-
-   if (boot_cpu->irq_idle_preempt[irq])
-      cpu_idle_break_wait(vm->boot_cpu);
 }
 
 /* Clear an IRQ (VM IRQ standard routing) */
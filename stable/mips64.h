@@ -401,9 +401,6 @@ struct cpu_mips {
    /* IRQ disable flag */
    volatile u_int irq_disable;
 
-   /* IRQ idling preemption */
-   u_int irq_idle_preempt[8];
-
    /* Generic CPU instance pointer */
    cpu_gen_t *gen;
 
@@ -482,7 +479,7 @@ void mips64_set_prid(cpu_mips_t *cpu,m_uint32_t prid);
 void mips64_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr);
 
 /* Timer IRQ */
-void *mips64_timer_irq_run(cpu_mips_t *cpu);
+void mips64_timer_tick(cpu_mips_t *cpu,u_int count);
 
 /* Determine an "idling" PC */
 int mips64_get_idling_pc(cpu_gen_t *cpu);
@@ -395,15 +395,15 @@ void mips64_exec_single_step(cpu_mips_t *cpu,mips_insn_t instruction)
 void *mips64_exec_run_cpu(cpu_gen_t *gen)
 {   
    cpu_mips_t *cpu = CPU_MIPS64(gen);
-   pthread_t timer_irq_thread;
    int timer_irq_check = 0;
    mips_insn_t insn;
    int res;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)mips64_timer_irq_run,cpu))
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)mips64_timer_tick,
+                                             cpu)))
    {
-      fprintf(stderr,"VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+      fprintf(stderr,"VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(gen);
       return NULL;
@@ -471,7 +471,8 @@ void *mips64_exec_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:     
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
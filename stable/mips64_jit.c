@@ -715,21 +715,24 @@ void mips64_jit_tcb_run(cpu_mips_t *cpu,mips64_jit_tcb_t *block)
 void *mips64_jit_run_cpu(cpu_gen_t *gen)
 {    
    cpu_mips_t *cpu = CPU_MIPS64(gen);
-   pthread_t timer_irq_thread;
    mips64_jit_tcb_t *block;
    int timer_irq_check = 0;
    m_uint32_t pc_hash;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)mips64_timer_irq_run,cpu)) 
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)mips64_timer_tick,
+                                             cpu)))
    {
       fprintf(stderr,
-              "VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+              "VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(cpu->gen);
       return NULL;
    }
 
+   if (cpu->vm->idle_pc_auto)
+      cpu_idle_auto_enable(gen,TRUE);
+
    gen->cpu_thread_running = TRUE;
    cpu_exec_loop_set(gen);
    
@@ -751,10 +754,18 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
          }
       }
 
+      /* Automatic idle PC detection */
+      if (unlikely(gen->idle_auto.enabled) &&
+          unlikely(++gen->idle_auto.itv_count == CPU_IDLE_AUTO_SAMPLE_ITV))
+         cpu_idle_auto_sample(gen,cpu->pc);
+
       /* Handle the virtual CPU clock */
       if (++timer_irq_check == cpu->timer_irq_check_itv) {
          timer_irq_check = 0;
 
+         if (unlikely(gen->idle_auto.request))
+            cpu_idle_auto_handle_request(gen);
+
          if (cpu->timer_irq_pending && !cpu->irq_disable) {
             mips64_trigger_timer_irq(cpu);
             mips64_trigger_irq(cpu);
@@ -808,7 +819,8 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             return NULL;
       }
       
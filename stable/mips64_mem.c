@@ -282,6 +282,7 @@ void *mips64_mts64_access(cpu_mips_t *cpu,m_uint64_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = (entry->hpa & MTS_DEVID_MASK) >> MTS_DEVID_SHIFT;
          haddr  = entry->hpa & MTS_DEVOFF_MASK;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
@@ -436,6 +437,7 @@ void *mips64_mts32_access(cpu_mips_t *cpu,m_uint64_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = (entry->hpa & MTS_DEVID_MASK) >> MTS_DEVID_SHIFT;
          haddr  = entry->hpa & MTS_DEVOFF_MASK;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
@@ -38,6 +38,155 @@ int ppc32_reset(cpu_ppc_t *cpu)
    return(0);
 }
 
+/* Decode an instruction for idle loop analysis */
+static int ppc32_idle_insn_decode(cpu_gen_t *gen,m_uint64_t pc,
+                                  struct cpu_idle_insn *di)
+{
+   cpu_ppc_t *cpu = CPU_PPC32(gen);
+   m_uint32_t phys_page;
+   m_uint64_t paddr;
+   ppc_insn_t insn;
+   m_int32_t offset;
+   u_int op,spr,rd,ra,xo;
+
+   if (cpu->translate(cpu,pc,PPC32_MTS_ICACHE,&phys_page) == -1)
+      return(-1);
+
+   paddr = ((m_uint64_t)phys_page << PPC32_MIN_PAGE_SHIFT);
+   paddr += pc & PPC32_MIN_PAGE_IMASK;
+   insn = physmem_copy_u32_from_vm(cpu->vm,paddr);
+
+   op = bits(insn,26,31);
+   rd = bits(insn,21,25);
+   ra = bits(insn,16,20);
+
+   memset(di,0,sizeof(*di));
+   di->base = ra ? ra : CPU_IDLE_NO_BASE;
+   di->offset = sign_extend(bits(insn,0,15),16);
+
+   switch(op) {
+      case 16:   /* BC */
+         offset = sign_extend_32(insn & 0xFFFC,16);
+         di->target = (m_uint32_t)((insn & 0x02) ? offset : pc + offset);
+         di->type = (insn & 0x01) ? CPU_IDLE_INSN_REJECT : CPU_IDLE_INSN_BRANCH;
+         break;
+
+      case 18:   /* B */
+         offset = sign_extend_32(insn & 0x03FFFFFC,26);
+         di->target = (m_uint32_t)((insn & 0x02) ? offset : pc + offset);
+         di->type = (insn & 0x01) ? CPU_IDLE_INSN_REJECT : CPU_IDLE_INSN_BRANCH;
+         break;
+
+      case 17:   /* SC */
+         di->type = CPU_IDLE_INSN_REJECT;
+         break;
+
+      case 19:
+         switch(bits(insn,1,10)) {
+            case 16:    /* BCLR */
+            case 528:   /* BCCTR */
+               if (insn & 0x01)
+                  di->type = CPU_IDLE_INSN_REJECT;
+               else
+                  di->type = CPU_IDLE_INSN_RETURN;
+               break;
+            case 50:    /* RFI */
+               di->type = CPU_IDLE_INSN_REJECT;
+               break;
+         }
+         break;
+
+      case 7: case 8: case 12: case 13:     /* MULLI,SUBFIC,ADDIC,ADDIC. */
+      case 14: case 15:                     /* ADDI,ADDIS */
+         di->dst_mask = 1ULL << rd;
+         break;
+
+      case 20: case 21: case 23:            /* RLWIMI,RLWINM,RLWNM */
+      case 24: case 25: case 26: case 27:   /* ORI,ORIS,XORI,XORIS */
+      case 28: case 29:                     /* ANDI.,ANDIS. */
+         di->dst_mask = 1ULL << ra;
+         break;
+
+      case 32: case 33: case 34: case 35:   /* LWZ,LWZU,LBZ,LBZU */
+      case 40: case 41: case 42: case 43:   /* LHZ,LHZU,LHA,LHAU */
+         di->type = CPU_IDLE_INSN_LOAD;
+         di->dst_mask = 1ULL << rd;
+
+         /* update forms also write the base register */
+         if (op & 0x01)
+            di->dst_mask |= 1ULL << ra;
+         break;
+
+      case 36: case 37: case 38: case 39:   /* STW,STWU,STB,STBU */
+      case 44: case 45:                     /* STH,STHU */
+         di->type = CPU_IDLE_INSN_STORE;
+
+         if (op & 0x01)
+            di->dst_mask = 1ULL << ra;
+         break;
+
+      case 46:                              /* LMW */
+         di->dst_mask = ~((1ULL << rd) - 1) & 0xFFFFFFFFULL;
+         break;
+
+      case 49: case 51:                     /* LFSU,LFDU */
+         di->dst_mask = 1ULL << ra;
+         break;
+
+      case 47:                              /* STMW */
+      case 52: case 53: case 54: case 55:   /* STFS,STFSU,STFD,STFDU */
+         di->type = CPU_IDLE_INSN_REJECT;
+         break;
+
+      case 31:
+         xo = bits(insn,1,10);
+
+         switch(xo) {
+            /* Logical operations and shifts: the result goes to rA */
+            case 24: case 26: case 28: case 60: case 124: case 284:
+            case 316: case 412: case 444: case 476: case 536: case 792:
+            case 824: case 922: case 954:
+               di->dst_mask = 1ULL << ra;
+               break;
+
+            /* Compares and cache operations don't write a GPR */
+            case 0: case 32: case 54: case 86: case 278: case 470:
+            case 598: case 854: case 982:
+               break;
+
+            /* Indexed loads with update */
+            case 55: case 119: case 311: case 375:
+               di->dst_mask = (1ULL << rd) | (1ULL << ra);
+               break;
+
+            default:
+               di->dst_mask = 1ULL << rd;
+         }
+
+         switch(xo) {
+            /* Indexed stores and cache block zero */
+            case 150: case 151: case 183: case 215: case 247:
+            case 407: case 439: case 661: case 662: case 663:
+            case 695: case 725: case 727: case 759: case 918:
+            case 983: case 1014:
+            /* MSR, segment registers and TLB management */
+            case 146: case 210: case 242: case 306: case 566:
+               di->type = CPU_IDLE_INSN_REJECT;
+               break;
+
+            case 467:   /* MTSPR: only LR and CTR are harmless */
+               spr = bits(insn,16,20) | (bits(insn,11,15) << 5);
+
+               if ((spr != 8) && (spr != 9))
+                  di->type = CPU_IDLE_INSN_REJECT;
+               break;
+         }
+         break;
+   }
+
+   return(0);
+}
+
 /* Initialize a PowerPC processor */
 int ppc32_init(cpu_ppc_t *cpu)
 {
@@ -68,6 +217,7 @@ int ppc32_init(cpu_ppc_t *cpu)
    cpu->gen->remove_breakpoint = (void *)ppc32_remove_breakpoint;
    cpu->gen->set_idle_pc = (void *)ppc32_set_idle_pc;
    cpu->gen->get_idling_pc = (void *)ppc32_get_idling_pc;
+   cpu->gen->idle_insn_decode = ppc32_idle_insn_decode;
 
    /* zzz */
    memset(cpu->vtlb,0xFF,sizeof(cpu->vtlb));
@@ -99,54 +249,23 @@ void ppc32_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr)
    CPU_PPC32(cpu)->idle_pc = (m_uint32_t)addr;
 }
 
-/* Timer IRQ */
-void *ppc32_timer_irq_run(cpu_ppc_t *cpu)
+/* Timer IRQ (called by the tick service, "count" elapsed periods) */
+void ppc32_timer_tick(cpu_ppc_t *cpu,u_int count)
 {
-   pthread_mutex_t umutex = PTHREAD_MUTEX_INITIALIZER;
-   pthread_cond_t ucond = PTHREAD_COND_INITIALIZER;
-   struct timespec t_spc;
-   m_tmcnt_t expire;
-   u_int interval;
    u_int threshold;
 
-#if 0
-   while(!cpu->timer_irq_armed)
-      sleep(1);
-#endif
-
-   interval = 1000000 / cpu->timer_irq_freq;
-   threshold = cpu->timer_irq_freq * 10;
-   expire = m_gettime_usec() + interval;
-
-   while(cpu->gen->state != CPU_STATE_HALTED) {
-      pthread_mutex_lock(&umutex);
-      t_spc.tv_sec = expire / 1000000;
-      t_spc.tv_nsec = (expire % 1000000) * 1000;
-      pthread_cond_timedwait(&ucond,&umutex,&t_spc);
-      pthread_mutex_unlock(&umutex);
-
-      if (likely(!cpu->irq_disable) &&
-          likely(cpu->gen->state == CPU_STATE_RUNNING) &&
-          likely(cpu->msr & PPC32_MSR_EE))
-      {
-         cpu->timer_irq_pending++;
+   if (likely(!cpu->irq_disable) &&
+       likely(cpu->gen->state == CPU_STATE_RUNNING) &&
+       likely(cpu->msr & PPC32_MSR_EE))
+   {
+      threshold = cpu->timer_irq_freq * 10;
+      cpu->timer_irq_pending += count;
 
-         if (unlikely(cpu->timer_irq_pending > threshold)) {
-            cpu->timer_irq_pending = 0;
-            cpu->timer_drift++;
-#if 0
-            printf("Timer IRQ not accurate (%u pending IRQ): "
-                   "reduce the \"--timer-irq-check-itv\" parameter "
-                   "(current value: %u)\n",
-                   cpu->timer_irq_pending,cpu->timer_irq_check_itv);
-#endif
-         }
+      if (unlikely(cpu->timer_irq_pending > threshold)) {
+         cpu->timer_irq_pending = 0;
+         cpu->timer_drift++;
       }
-
-      expire += interval;
    }
-
-   return NULL;
 }
 
 #define IDLE_HASH_SIZE  8192
@@ -275,9 +394,6 @@ void ppc32_vm_set_irq(vm_instance_t *vm,u_int irq)
    }
 
    ppc32_set_irq(boot_cpu,irq);
-
-   if (boot_cpu->irq_idle_preempt[irq])
-      cpu_idle_break_wait(vm->boot_cpu);
 }
 
 /* Clear an IRQ (VM IRQ standard routing) */
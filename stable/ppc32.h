@@ -506,7 +506,7 @@ void ppc32_set_pvr(cpu_ppc_t *cpu,m_uint32_t pvr);
 void ppc32_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr);
 
 /* Timer IRQ */
-void *ppc32_timer_irq_run(cpu_ppc_t *cpu);
+void ppc32_timer_tick(cpu_ppc_t *cpu,u_int count);
 
 /* Determine an "idling" PC */
 int ppc32_get_idling_pc(cpu_gen_t *cpu);
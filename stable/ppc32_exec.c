@@ -185,15 +185,15 @@ int ppc32_exec_page(cpu_ppc_t *cpu)
 void *ppc32_exec_run_cpu(cpu_gen_t *gen)
 {   
    cpu_ppc_t *cpu = CPU_PPC32(gen);
-   pthread_t timer_irq_thread;
    int timer_irq_check = 0;
    ppc_insn_t insn;
    int res;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)ppc32_timer_irq_run,cpu))
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)ppc32_timer_tick,
+                                             cpu)))
    {
-      fprintf(stderr,"VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+      fprintf(stderr,"VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(gen);
       return NULL;
@@ -256,7 +256,8 @@ void *ppc32_exec_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:     
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
@@ -348,6 +348,16 @@ void ppc32_jit_start_hreg_seq(cpu_ppc_t *cpu,char *insn)
 /* Close register allocation sequence */
 void ppc32_jit_close_hreg_seq(cpu_ppc_t *cpu)
 {
+   struct hreg_map *map;
+
+   /* 
+    * Forced registers are directly modified by the translated code: throw
+    * them so that the op optimizer does not reuse their content.
+    */
+   for(map=cpu->hreg_map_list;map;map=map->next)
+      if (map->flags & HREG_FLAG_ALLOC_FORCED)
+         ppc32_op_emit_alter_host_reg(cpu,map->hreg);
+
 #if DEBUG_HREG
    ppc32_show_hreg_status(cpu);
 #endif
@@ -1013,6 +1023,12 @@ static void ppc32_op_optimize(cpu_gen_t *cpu,ppc32_jit_tcb_t *b)
 
                last_cr_update[op->param[0]] = op;
                break;
+
+            /* Host register set by the translated code */
+            case JIT_OP_MOVE_HOST_REG:
+            case JIT_OP_SET_HOST_REG_IMM32:
+               ppc32_clear_host_reg_map(ppc_map,host_map,op->param[0]);
+               break;
          }
       }
    }
@@ -1248,22 +1264,26 @@ void ppc32_jit_tcb_run(cpu_ppc_t *cpu,ppc32_jit_tcb_t *block)
 void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 {    
    cpu_ppc_t *cpu = CPU_PPC32(gen);
-   pthread_t timer_irq_thread;
    ppc32_jit_tcb_t *block;
    m_uint32_t ia_hash;
    int timer_irq_check = 0;
 
    ppc32_jit_init_hreg_mapping(cpu);
 
-   if (pthread_create(&timer_irq_thread,NULL,(void *)ppc32_timer_irq_run,cpu)) 
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)ppc32_timer_tick,
+                                             cpu)))
    {
       fprintf(stderr,
-              "VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+              "VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(cpu->gen);
       return NULL;
    }
 
+   if (cpu->vm->idle_pc_auto)
+      cpu_idle_auto_enable(gen,TRUE);
+
    gen->cpu_thread_running = TRUE;
    cpu_exec_loop_set(gen);
 
@@ -1285,10 +1305,18 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
          }
       }
 
+      /* Automatic idle PC detection */
+      if (unlikely(gen->idle_auto.enabled) &&
+          unlikely(++gen->idle_auto.itv_count == CPU_IDLE_AUTO_SAMPLE_ITV))
+         cpu_idle_auto_sample(gen,cpu->ia);
+
       /* Handle the virtual CPU clock */
       if (++timer_irq_check == cpu->timer_irq_check_itv) {
          timer_irq_check = 0;
 
+         if (unlikely(gen->idle_auto.request))
+            cpu_idle_auto_handle_request(gen);
+
          if (cpu->timer_irq_pending && !cpu->irq_disable &&
              (cpu->msr & PPC32_MSR_EE))
          {
@@ -1351,7 +1379,8 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
@@ -416,6 +416,7 @@ static inline void *ppc32_mem_access(cpu_ppc_t *cpu,m_uint32_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = entry->gppa;
          haddr  = entry->hpa;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
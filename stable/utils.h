@@ -61,6 +61,7 @@ struct fd_pool {
 typedef struct cpu_gen cpu_gen_t;
 typedef struct vm_instance vm_instance_t;
 typedef struct vm_platform vm_platform_t;
+typedef struct vm_ckpt_field vm_ckpt_field_t;
 typedef struct mips64_jit_tcb mips64_jit_tcb_t;
 typedef struct ppc32_jit_tcb ppc32_jit_tcb_t;
 typedef struct jit_op jit_op_t;
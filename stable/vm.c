@@ -369,6 +369,8 @@ static vm_instance_t *vm_create(char *name,int instance_id,
    vm->log_file_enabled     = TRUE;
    vm->rommon_vars.filename = vm_build_filename(vm,"rommon_vars");
 
+   pthread_mutex_init(&vm->mem_lock,NULL);
+
    if (!vm->rommon_vars.filename)
       goto err_rommon;
 
@@ -399,6 +401,7 @@ static vm_instance_t *vm_create(char *name,int instance_id,
  err_lock:
    free(vm->rommon_vars.filename);
  err_rommon:
+   pthread_mutex_destroy(&vm->mem_lock);
    free(vm->name);
  err_name:
    free(vm);
@@ -466,6 +469,7 @@ void vm_free(vm_instance_t *vm)
    if (vm != NULL) {
       /* Free hardware resources */
       vm_hardware_shutdown(vm);
+      dev_map_free(vm);
 
       m_log("VM","VM %s destroyed.\n",vm->name);
 
@@ -477,6 +481,7 @@ void vm_free(vm_instance_t *vm)
 
       /* Free all chunks */
       vm_chunk_free_all(vm);
+      pthread_mutex_destroy(&vm->mem_lock);
 
       /* Free various elements */
       rommon_var_clear(&vm->rommon_vars);
@@ -484,6 +489,8 @@ void vm_free(vm_instance_t *vm)
       free(vm->ghost_ram_filename);
       free(vm->sym_filename);
       free(vm->ios_image);
+      free(vm->pcmcia_disk_base[0]);
+      free(vm->pcmcia_disk_base[1]);
       free(vm->ios_startup_config);
       free(vm->ios_private_config);
       free(vm->rom_filename);
@@ -577,6 +584,10 @@ int vm_bind_device(vm_instance_t *vm,struct vdevice *dev)
    if (*cur) (*cur)->pprev = &dev->next;
    dev->pprev = cur;
    *cur = dev;
+
+   /* Update the physical address map */
+   dev_map_update(vm,dev->phys_addr,dev->phys_len);
+   physmem_tlb_flush(vm);
    return(0);
 }
 
@@ -604,6 +615,10 @@ int vm_unbind_device(vm_instance_t *vm,struct vdevice *dev)
    /* Clear device list info */
    dev->next = NULL;
    dev->pprev = NULL;
+
+   /* Update the physical address map */
+   dev_map_update(vm,dev->phys_addr,dev->phys_len);
+   physmem_tlb_flush(vm);
    return(0);
 }
 
@@ -939,6 +954,22 @@ int vm_ios_set_image(vm_instance_t *vm,char *ios_image)
    return(0);
 }
 
+/* Set the base image of a PCMCIA disk (NULL: no base image) */
+int vm_set_disk_base(vm_instance_t *vm,u_int disk_id,char *filename)
+{
+   char *str = NULL;
+
+   if (disk_id >= 2)
+      return(-1);
+
+   if (filename && !(str = strdup(filename)))
+      return(-1);
+
+   free(vm->pcmcia_disk_base[disk_id]);
+   vm->pcmcia_disk_base[disk_id] = str;
+   return(0);
+}
+
 /* Unset a Cisco IOS configuration file */
 void vm_ios_unset_config(vm_instance_t *vm)
 {
@@ -51,6 +51,30 @@ struct vm_ghost_image {
 /* Size of the PCI bus pool */
 #define VM_PCI_POOL_SIZE  32
 
+/* Physical memory translation cache (physmem_* helpers) */
+#define VM_PMEM_TLB_SIZE   64
+#define VM_PMEM_TLB_WRITE  0x01   /* Host page is writable */
+
+typedef struct vm_pmem_tlb_entry vm_pmem_tlb_entry_t;
+struct vm_pmem_tlb_entry {
+   m_uint32_t seq;      /* Update sequence (odd: update in progress) */
+   m_uint32_t flags;
+   m_uint64_t ppage;    /* Physical page address */
+   u_char *hptr;        /* Host page address */
+};
+
+/* 
+ * Counters of the translation cache, spread over slots selected by thread
+ * so that threads don't share a cache line. Each slot fills a cache line.
+ */
+#define VM_PMEM_TLB_STATS_SLOTS  16
+
+typedef struct vm_pmem_tlb_stats vm_pmem_tlb_stats_t;
+struct vm_pmem_tlb_stats {
+   m_uint64_t hits,misses;
+   m_uint64_t pad[6];
+};
+
 /* VM instance status */
 enum {   
    VM_STATUS_HALTED = 0,      /* VM is halted and no HW resources are used */
@@ -78,12 +102,34 @@ typedef struct vm_obj vm_obj_t;
 /* Shutdown function prototype for an object */
 typedef void *(*vm_shutdown_t)(vm_instance_t *vm,void *data);
 
+/* Function called when the state of an object is restored */
+typedef void (*vm_ckpt_restore_t)(vm_instance_t *vm,void *data);
+
+/* Field saved in VM checkpoints (registers, device state) */
+struct vm_ckpt_field {
+   char *name;
+   long offset;
+   size_t size;
+};
+
+/* A single field, or a range of fields (from first to last, included) */
+#define VM_CKPT_FIELD(st,f)  { #f, OFFSET(st,f), sizeof(((st *)NULL)->f) }
+#define VM_CKPT_RANGE(st,first,last) \
+   { #first, OFFSET(st,first), \
+     OFFSET(st,last) + sizeof(((st *)NULL)->last) - OFFSET(st,first) }
+#define VM_CKPT_FIELD_END    { NULL, 0, 0 }
+
 /* VM object, used to keep track of devices and various things */
 struct vm_obj {
    char *name;
    void *data;
    struct vm_obj *next,**pprev;
    vm_shutdown_t shutdown;
+
+   /* State saved in checkpoints (fields relative to ckpt_data or data) */
+   vm_ckpt_field_t *ckpt_fields;
+   void *ckpt_data;
+   vm_ckpt_restore_t ckpt_restore;
 };
 
 /* VM instance */
@@ -100,6 +146,8 @@ struct vm_instance {
    u_int iomem_size;              /* IOMEM size in Mb */
    u_int nvram_size;              /* NVRAM size in Kb */
    u_int pcmcia_disk_size[2];     /* PCMCIA disk0 and disk1 sizes (in Mb) */
+   char *pcmcia_disk_base[2];     /* PCMCIA disk base images (COW) */
+   u_int pcmcia_disk_mmap;        /* Memory-mapped PCMCIA disks ? */
    u_int conf_reg,conf_reg_setup; /* Config register */
    u_int clock_divisor;           /* Clock Divisor (see cp0.c) */
    u_int ram_mmap;                /* Memory-mapped RAM ? */
@@ -123,6 +171,7 @@ struct vm_instance {
 
    /* Memory chunks */
    vm_chunk_t *chunks;
+   pthread_mutex_t mem_lock;
 
    /* Basic hardware: system CPU, PCI busses and PCI I/O space */
    cpu_group_t *cpu_group;
@@ -135,6 +184,13 @@ struct vm_instance {
    struct vdevice *dev_list;
    struct vdevice *dev_array[VM_DEVICE_MAX];
 
+   /* Physical address map (device id for each page, by chunks) */
+   m_uint8_t **dev_map;
+
+   /* Physical memory translation cache */
+   vm_pmem_tlb_entry_t pmem_tlb[VM_PMEM_TLB_SIZE];
+   vm_pmem_tlb_stats_t pmem_tlb_stats[VM_PMEM_TLB_STATS_SLOTS];
+
    /* IRQ routing */
    void (*set_irq)(vm_instance_t *vm,u_int irq);
    void (*clear_irq)(vm_instance_t *vm,u_int irq);
@@ -157,13 +213,11 @@ struct vm_instance {
 
    /* "idling" pointer counter */
    m_uint64_t idle_pc;
+   int idle_pc_auto;
 
    /* JIT block direct jumps */
    int exec_blk_direct_jump;
 
-   /* IRQ idling preemption */
-   u_int irq_idle_preempt[256];
-
    /* Console and AUX port VTTY type and parameters */
    int vtty_con_type,vtty_aux_type;
    int vtty_con_tcp_port,vtty_aux_tcp_port;
@@ -185,6 +239,10 @@ struct vm_instance {
    struct vm_obj *vm_object_list;   
 };
 
+/* Lock for host page allocation and sparse device maps */
+#define VM_MEM_LOCK(vm)    pthread_mutex_lock(&(vm)->mem_lock)
+#define VM_MEM_UNLOCK(vm)  pthread_mutex_unlock(&(vm)->mem_lock)
+
 /* VM Platform definition */
 struct vm_platform {
    char *name;
@@ -218,6 +276,10 @@ static inline void vm_set_irq(vm_instance_t *vm,u_int irq)
 {
    if (vm->set_irq != NULL)
       vm->set_irq(vm,irq);
+
+   /* Wake up the boot CPU if it is idling (or about to idle) */
+   if (cpu_idle_wakeup_needed(vm->boot_cpu))
+      cpu_idle_break_wait(vm->boot_cpu);
 }
 
 /* Clear an IRQ for a VM */
@@ -357,6 +419,9 @@ int vm_ios_save_config(vm_instance_t *vm);
 /* Set Cisco IOS image to use */
 int vm_ios_set_image(vm_instance_t *vm,char *ios_image);
 
+/* Set the base image of a PCMCIA disk (NULL: no base image) */
+int vm_set_disk_base(vm_instance_t *vm,u_int disk_id,char *filename);
+
 /* Unset a Cisco IOS configuration file */
 void vm_ios_unset_config(vm_instance_t *vm);
 
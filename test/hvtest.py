@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+#
+# helpers for the regression tests: run a dynamips hypervisor, send it
+# commands and build small guest images (ELF files loaded as IOS images)
+#
+# the tests are run by ctest with the path of the dynamips executable:
+#    <test>.py <dynamips>
+
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# guest images are loaded at this address (physical address 0x8000)
+IMAGE_BASE = 0x80008000
+
+def sleep(secs=0.1):
+	time.sleep(secs) # give some time to the virtual CPUs
+
+def free_port():
+	with socket.socket() as s:
+		s.bind(("127.0.0.1", 0))
+		return s.getsockname()[1]
+
+class HypervisorError(Exception):
+	pass
+
+class Hypervisor:
+	"""dynamips hypervisor running in a temporary directory"""
+
+	def __init__(self, binary):
+		self.dir = tempfile.mkdtemp(prefix="dynamips-test-")
+		self.port = free_port()
+		self.log = open(os.path.join(self.dir, "output.txt"), "w")
+		self.proc = subprocess.Popen(
+			[os.path.abspath(binary), "-H", "127.0.0.1:%d" % self.port],
+			cwd=self.dir,
+			stdin=subprocess.DEVNULL,
+			stdout=self.log,
+			stderr=subprocess.STDOUT)
+		for i in range(50):
+			try:
+				self.sock = socket.create_connection(("127.0.0.1", self.port))
+				break
+			except OSError:
+				sleep()
+		else:
+			self.close()
+			raise HypervisorError("unable to connect to the hypervisor")
+		self.file = self.sock.makefile("rw")
+
+	def __enter__(self):
+		return self
+
+	def __exit__(self, *args):
+		self.close()
+
+	def path(self, name):
+		return os.path.join(self.dir, name)
+
+	def send(self, line):
+		"""send a command, returns (code, list of reply lines)"""
+		self.file.write(line + "\n")
+		self.file.flush()
+		lines = []
+		while True:
+			reply = self.file.readline()
+			if len(reply) < 4:
+				raise HypervisorError("connection lost after '%s'" % line)
+			lines.append(reply[4:].rstrip())
+			if reply[3] == "-":
+				return int(reply[:3]), lines
+
+	def cmd(self, line):
+		"""send a command which must succeed, returns the reply lines"""
+		code, lines = self.send(line)
+		if code >= 200:
+			raise HypervisorError("'%s' failed: %s" % (line, lines[-1]))
+		return lines
+
+	def create_vm(self, name, id, image, platform="c3725", ram=32, options={}):
+		"""create a VM, options are "vm set_<option> <name> <value>" settings"""
+		self.cmd("vm create %s %d %s" % (name, id, platform))
+		self.cmd("vm set_ios %s %s" % (name, image))
+		self.cmd("vm set_ram %s %d" % (name, ram))
+		for option, value in options.items():
+			self.cmd("vm set_%s %s %s" % (option, name, value))
+
+	def read32(self, vm, paddr):
+		return int(self.cmd("vm_debug pmem_r32 %s 0 0x%x" % (vm, paddr))[-1], 16)
+
+	def write32(self, vm, paddr, value):
+		self.cmd("vm_debug pmem_w32 %s 0 0x%x 0x%x" % (vm, paddr, value))
+
+	def info(self, line):
+		"""returns the "name: value" lines of a reply as a dictionary"""
+		d = {}
+		for l in self.cmd(line):
+			if ": " in l:
+				k, v = l.split(": ", 1)
+				d[k] = v
+		return d
+
+	def kill(self):
+		"""kill the hypervisor (its VMs are not stopped)"""
+		self.proc.kill()
+		self.proc.wait()
+
+	def close(self):
+		if self.proc.poll() is None:
+			try:
+				self.file.write("hypervisor stop\n")
+				self.file.flush()
+			except (OSError, AttributeError):
+				pass
+			try:
+				self.proc.wait(10)
+			except subprocess.TimeoutExpired:
+				self.proc.kill()
+				self.proc.wait()
+		self.log.close()
+		shutil.rmtree(self.dir, ignore_errors=True)
+
+def wait_merge(hv, vms, key, timeout=90):
+	"""wait until each VM reports a non-zero "key" in show_mem_merge"""
+	for i in range(timeout):
+		counts = [int(hv.info("vm show_mem_merge %s" % vm)[key]) for vm in vms]
+		if min(counts) > 0:
+			return counts
+		sleep(1)
+	raise AssertionError("no %s after %d seconds: %s" % (key, timeout, counts))
+
+def check_counters(hv, vms, counter=0x1000):
+	"""check that the guest counters are moving"""
+	before = [hv.read32(vm, counter) for vm in vms]
+	sleep(0.5)
+	after = [hv.read32(vm, counter) for vm in vms]
+	for vm, b, a in zip(vms, before, after):
+		assert a != b, "%s: guest counter stuck at 0x%x" % (vm, a)
+
+def elf_image(path, code, machine=8):
+	"""write a big endian ELF32 image with code at IMAGE_BASE (MIPS: 8, PPC: 20)"""
+	off = 0x1000
+	strtab = b"\0.text\0.shstrtab\0"
+	stroff = off + len(code)
+	shoff = (stroff + len(strtab) + 3) & ~3
+	eh = struct.pack(">4sBBBB8sHHIIIIIHHHHHH", b"\x7fELF", 1, 2, 1, 0,
+		b"\0" * 8, 2, machine, 1, IMAGE_BASE, 52, shoff, 0, 52, 32, 1, 40, 3, 2)
+	ph = struct.pack(">IIIIIIII", 1, off, IMAGE_BASE, IMAGE_BASE,
+		len(code), len(code), 7, 0x1000)
+	d = bytearray(eh + ph)
+	d += bytearray(off - len(d))
+	d += code + strtab
+	d += bytearray(shoff - len(d))
+	d += bytearray(40)
+	d += struct.pack(">IIIIIIIIII", 1, 1, 6, IMAGE_BASE, off, len(code), 0, 0, 4, 0)
+	d += struct.pack(">IIIIIIIIII", 7, 3, 0, 0, stroff, len(strtab), 0, 0, 1, 0)
+	with open(path, "wb") as f:
+		f.write(d)
+
+def mips_image(path, insns, size=0x1000):
+	"""MIPS image from a dictionary {offset: instruction}"""
+	code = bytearray(size)
+	for offset, insn in insns.items():
+		struct.pack_into(">I", code, offset, insn)
+	elf_image(path, code, machine=8)
+
+# MIPS instructions
+def mips_i(op, rs, rt, imm): return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff)
+def mips_lui(rt, imm): return mips_i(0x0f, 0, rt, imm)
+def mips_ori(rt, rs, imm): return mips_i(0x0d, rs, rt, imm)
+def mips_addiu(rt, rs, imm): return mips_i(0x09, rs, rt, imm)
+def mips_lw(rt, off, rs): return mips_i(0x23, rs, rt, off)
+def mips_sw(rt, off, rs): return mips_i(0x2b, rs, rt, off)
+def mips_beq(rs, rt, pc, to): return mips_i(0x04, rs, rt, (to - pc - 4) >> 2)
+def mips_bne(rs, rt, pc, to): return mips_i(0x05, rs, rt, (to - pc - 4) >> 2)
+def mips_j(to): return (2 << 26) | ((to >> 2) & 0x3ffffff)
+
+MIPS_ZERO, MIPS_A0, MIPS_T0, MIPS_T1 = 0, 4, 8, 9
+
+def mips_counter_image(path, pages=4, zero_pages=0, counter=0x1000, step=1):
+	"""
+	MIPS image adding step to the word at physical address "counter": each
+	of the code pages updates it once and jumps to the next one, the code
+	pages are followed by zero_pages pages of zeroes.
+	"""
+	insns = {0: mips_lui(MIPS_T0, 0x8000), 4: mips_ori(MIPS_T0, MIPS_T0, counter)}
+	for i in range(pages):
+		offset = 0x1000 * i + (8 if i == 0 else 0)
+		next = 0x1000 * (i + 1) if i + 1 < pages else 8
+		insns[offset] = mips_lw(MIPS_T1, 0, MIPS_T0)
+		insns[offset + 4] = mips_addiu(MIPS_T1, MIPS_T1, step)
+		insns[offset + 8] = mips_sw(MIPS_T1, 0, MIPS_T0)
+		insns[offset + 12] = mips_j(IMAGE_BASE + next)
+		insns[offset + 16] = 0
+	mips_image(path, insns, size=0x1000 * (pages + zero_pages))
+
+def run(main):
+	"""run a test function with the dynamips executable given on the command line"""
+	if len(sys.argv) != 2:
+		print("usage: %s <dynamips>" % sys.argv[0])
+		sys.exit(2)
+	try:
+		main(sys.argv[1])
+	except (AssertionError, HypervisorError) as e:
+		print("FAILED: %s" % e)
+		sys.exit(1)
+	print("OK")
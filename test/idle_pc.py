@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+#
+# regression test for the idle PC detector ("vm_debug idle_pc_check"):
+# loops that only poll or update the same memory location are idle loops,
+# loops walking memory or storing through a modified base register are not.
+#
+# usage: idle_pc.py <dynamips>
+
+from hvtest import *
+
+def loop(insns, addr, code):
+	for i, insn in enumerate(code):
+		insns[addr - IMAGE_BASE + 4 * i] = insn
+
+def test(binary):
+	T0, A0, ZERO = MIPS_T0, MIPS_A0, MIPS_ZERO
+	insns = {}
+	loop(insns, IMAGE_BASE, [mips_j(IMAGE_BASE), 0])
+
+	expected = {}
+	def add(offset, idle, code):
+		loop(insns, IMAGE_BASE + offset, code)
+		expected[IMAGE_BASE + offset] = idle
+
+	L = IMAGE_BASE + 0x100 # poll a memory location
+	add(0x100, True, [mips_lw(T0, 0, A0), mips_beq(T0, ZERO, L + 4, L), 0])
+	L = IMAGE_BASE + 0x200 # increment a counter
+	add(0x200, True, [mips_lw(T0, 0, A0), mips_addiu(T0, T0, 1),
+		mips_sw(T0, 0, A0), mips_beq(ZERO, ZERO, L + 12, L), 0])
+	L = IMAGE_BASE + 0x300 # walk an array
+	add(0x300, False, [mips_lw(T0, 0, A0), mips_addiu(T0, T0, 1),
+		mips_sw(T0, 0, A0), mips_addiu(A0, A0, 4),
+		mips_bne(T0, ZERO, L + 16, L), 0])
+	L = IMAGE_BASE + 0x400 # follow a linked list
+	add(0x400, False, [mips_lw(T0, 0, A0), mips_lw(A0, 4, A0),
+		mips_sw(T0, 0, A0), mips_beq(ZERO, ZERO, L + 12, L), 0])
+	L = IMAGE_BASE + 0x500 # store without loading
+	add(0x500, False, [mips_sw(T0, 0, A0), mips_beq(ZERO, ZERO, L + 4, L), 0])
+
+	with Hypervisor(binary) as hv:
+		mips_image(hv.path("idle.elf"), insns)
+		hv.create_vm("R1", 1, "idle.elf")
+		hv.cmd("vm start R1")
+		sleep(0.5)
+		for addr, idle in sorted(expected.items()):
+			reply = hv.cmd("vm_debug idle_pc_check R1 0 0x%x" % addr)[-1]
+			want = "idle loop" if idle else "not an idle loop"
+			assert reply == want, "0x%x: '%s' instead of '%s'" % (addr, reply, want)
+		# the stable JIT doesn't leave a loop running with interrupts
+		# disabled, so the VM can't be stopped
+		hv.kill()
+
+run(test)
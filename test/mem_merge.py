@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+#
+# regression test for the memory merging of identical pages between VMs:
+# the guests keep running once their pages are merged and a write to a
+# merged page is only seen by the VM doing it (copy on write).
+#
+# usage: mem_merge.py <dynamips>
+
+from hvtest import *
+
+VMS = ["R1", "R2", "R3"]
+MERGE = {"sparse_mem": 1, "mem_merge": 1}
+
+def test(binary):
+	with Hypervisor(binary) as hv:
+		mips_counter_image(hv.path("counter.elf"), pages=4)
+		for i, vm in enumerate(VMS):
+			hv.create_vm(vm, i + 1, "counter.elf", options=MERGE)
+			hv.cmd("vm start %s" % vm)
+
+		wait_merge(hv, VMS, "merged pages")
+		check_counters(hv, VMS)
+
+		# copy on write: unused part of the second code page, identical in all VMs
+		paddr = 0x9800
+		for vm in VMS:
+			assert hv.read32(vm, paddr) == 0, "%s: 0x%x not zero" % (vm, paddr)
+		hv.write32("R1", paddr, 0xdeadbeef)
+		assert hv.read32("R1", paddr) == 0xdeadbeef, "R1: write to a merged page lost"
+		for vm in VMS[1:]:
+			value = hv.read32(vm, paddr)
+			assert value == 0, "%s: sees the write of R1 (0x%x)" % (vm, value)
+		check_counters(hv, VMS)
+
+		for vm in VMS:
+			hv.cmd("vm stop %s" % vm)
+			hv.cmd("vm delete %s" % vm)
+
+run(test)
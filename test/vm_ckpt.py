@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+#
+# regression test for the VM checkpoints: the state saved from a running VM
+# is restored into another running VM, which must go on running the restored
+# guest (and not the code translated before the restore).
+#
+# usage: vm_ckpt.py <dynamips>
+
+from hvtest import *
+
+COUNTER = 0x1000
+MARKER = 0x1800000
+
+def create_vm(hv, name, id, image):
+	hv.create_vm(name, id, image, options={"sparse_mem": 1})
+	hv.cmd("nio create_null nio_%s" % name)
+	hv.cmd("vm slot_add_nio_binding %s 0 0 nio_%s" % (name, name))
+	hv.cmd("vm start %s" % name)
+
+def counter_moves(hv, vm, up):
+	before = hv.read32(vm, COUNTER)
+	sleep(0.5)
+	after = hv.read32(vm, COUNTER)
+	delta = (after - before) & 0xffffffff
+	return delta != 0 and (delta < 0x80000000) == up
+
+def test(binary):
+	with Hypervisor(binary) as hv:
+		# R1 counts up, R2 counts down
+		mips_counter_image(hv.path("up.elf"))
+		mips_counter_image(hv.path("down.elf"), step=-1)
+		create_vm(hv, "R1", 1, "up.elf")
+		create_vm(hv, "R2", 2, "down.elf")
+		sleep(0.5)
+		assert counter_moves(hv, "R2", up=False), "R2: not counting down"
+
+		for compress in (0, 1):
+			hv.write32("R1", MARKER, 0xcafe0000 + compress)
+			hv.cmd("vm suspend R1")
+			saved = hv.read32("R1", COUNTER)
+			code, reply = hv.send("vm checkpoint R1 ckpt.bin %d" % compress)
+			hv.cmd("vm resume R1")
+			if code >= 200 and compress:
+				print("compressed checkpoints not supported")
+				break
+			assert code < 200, "checkpoint failed: %s" % reply[-1]
+
+			hv.cmd("vm restore R2 ckpt.bin")
+			value = hv.read32("R2", MARKER)
+			assert value == 0xcafe0000 + compress, "R2: bad marker 0x%x" % value
+			value = hv.read32("R2", COUNTER)
+			assert ((value - saved) & 0xffffffff) < 0x80000000, \
+				"R2: counter 0x%x behind the checkpoint (0x%x)" % (value, saved)
+			assert counter_moves(hv, "R2", up=True), "R2: not running the restored guest"
+			assert counter_moves(hv, "R1", up=True), "R1: not running after the checkpoint"
+
+		code, reply = hv.send("vm restore R2 nonexistent.bin")
+		assert code >= 200, "restore of a missing file succeeded"
+
+		for vm in ("R1", "R2"):
+			hv.cmd("vm stop %s" % vm)
+			hv.cmd("vm delete %s" % vm)
+
+run(test)
@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+#
+# regression test for the zero page reclaim: pages of zeroes are replaced
+# by a shared zero page, the guests keep running and a write to a reclaimed
+# page is only seen by the VM doing it.
+#
+# usage: zero_page.py <dynamips>
+
+from hvtest import *
+
+VMS = ["R1", "R2"]
+RECLAIM = {"sparse_mem": 1, "mem_merge": 1, "zero_reclaim": 1}
+
+def test(binary):
+	with Hypervisor(binary) as hv:
+		mips_counter_image(hv.path("zero.elf"), pages=4, zero_pages=8)
+		for i, vm in enumerate(VMS):
+			hv.create_vm(vm, i + 1, "zero.elf", options=RECLAIM)
+			hv.cmd("vm start %s" % vm)
+
+		wait_merge(hv, VMS, "zero pages")
+		check_counters(hv, VMS)
+
+		# write to the zero pages following the code
+		for paddr in (0xc000, 0xf010):
+			hv.write32("R1", paddr, 0x12345678)
+			assert hv.read32("R1", paddr) == 0x12345678, \
+				"R1: write to a zero page at 0x%x lost" % paddr
+			value = hv.read32("R2", paddr)
+			assert value == 0, "R2: sees the write of R1 at 0x%x (0x%x)" % (paddr, value)
+			value = hv.read32("R1", paddr + 0x1000)
+			assert value == 0, "R1: write at 0x%x seen at 0x%x" % (paddr, paddr + 0x1000)
+		check_counters(hv, VMS)
+
+		for vm in VMS:
+			hv.cmd("vm stop %s" % vm)
+			hv.cmd("vm delete %s" % vm)
+
+run(test)
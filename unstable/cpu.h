@@ -10,6 +10,7 @@
 #include <setjmp.h>
 #include "utils.h"
 #include "jit_op.h"
+#include "timer.h"
 
 #include "mips64.h"
 #include "mips64_cp0.h"
@@ -37,6 +38,80 @@ struct cpu_idle_pc {
    u_int count;
 };
 
+/* Number of buckets of the idle exit latency histogram */
+#define CPU_IDLE_HIST_SIZE  16
+
+/* Automatic idle PC detection */
+#define CPU_IDLE_AUTO_HASH_SIZE   64    /* PC sampling table size */
+#define CPU_IDLE_AUTO_SAMPLE_ITV  16    /* JIT blocks between two samples */
+#define CPU_IDLE_AUTO_WINDOW      4096  /* Samples per evaluation window */
+#define CPU_IDLE_AUTO_THRESHOLD   25    /* Min share of samples (percent) */
+#define CPU_IDLE_AUTO_CONFIRM     4     /* Windows before applying a PC */
+#define CPU_IDLE_AUTO_BLACKLIST   16    /* Rejected PCs to remember */
+
+/* Maximum number of instructions checked for an idle loop */
+#define CPU_IDLE_PC_CHECK_MAX_INSN  32
+
+/* Instruction classes for idle loop analysis */
+enum {
+   CPU_IDLE_INSN_OTHER = 0,   /* No side effect */
+   CPU_IDLE_INSN_LOAD,        /* Memory read */
+   CPU_IDLE_INSN_STORE,       /* Memory write */
+   CPU_IDLE_INSN_BRANCH,      /* Branch or jump with a known target */
+   CPU_IDLE_INSN_RETURN,      /* Return or indirect jump */
+   CPU_IDLE_INSN_REJECT,      /* Call, exception, system register write */
+};
+
+/* Decoded instruction for idle loop analysis */
+struct cpu_idle_insn {
+   int type;
+   int delay_slot;            /* Next instruction is executed (MIPS) */
+   u_int base;                /* Base register of a memory access */
+   m_int64_t offset;          /* Offset of a memory access */
+   m_uint64_t target;         /* Branch target */
+   m_uint64_t dst_mask;       /* Registers written by the instruction */
+};
+
+/* Base register of an absolute memory access (never written) */
+#define CPU_IDLE_NO_BASE  63
+
+struct cpu_idle_auto_sample {
+   m_uint64_t pc;
+   u_int count;
+};
+
+/* Requests to the automatic idle PC detector (set by other threads) */
+enum {
+   CPU_IDLE_AUTO_REQ_NONE = 0,
+   CPU_IDLE_AUTO_REQ_ENABLE,
+   CPU_IDLE_AUTO_REQ_DISABLE,
+};
+
+struct cpu_idle_auto {
+   volatile int enabled;
+   volatile int request;
+   u_int itv_count,samples;
+   struct cpu_idle_auto_sample table[CPU_IDLE_AUTO_HASH_SIZE];
+
+   /* Candidate PC and number of windows where it was the hottest one */
+   m_uint64_t candidate;
+   u_int confirm;
+
+   /* Device access seen in the loop of the candidate or of the idle PC */
+   int mmio;
+
+   /* Idle PC set by the detector (0 = none) and timer drift reference */
+   m_uint64_t pc;
+   u_int drift_ref;
+
+   /* PCs rejected or reverted */
+   m_uint64_t blacklist[CPU_IDLE_AUTO_BLACKLIST];
+   u_int blacklist_pos;
+
+   /* Statistics */
+   u_int apply_count,revert_count;
+};
+
 /* Number of recorded memory accesses (power of two) */
 #define MEMLOG_COUNT   16
 
@@ -55,6 +130,12 @@ typedef int (*cpu_undefined_mem_handler_t)(cpu_gen_t *cpu,m_uint64_t vaddr,
                                            u_int op_size,u_int op_type,
                                            m_uint64_t *data);
 
+/* 
+ * Maximum number of MTS invalidations requested by other threads and not
+ * yet handled by the CPU thread (the MTS is rebuilt beyond).
+ */
+#define CPU_MTS_REQ_MAX  16
+
 /* Generic CPU definition */
 struct cpu_gen {
    /* CPU type and identifier for MP systems */
@@ -67,6 +148,7 @@ struct cpu_gen {
    /* Thread running this CPU */
    pthread_t cpu_thread;
    volatile int cpu_thread_running;
+   pid_t cpu_thread_tid;
 
    /* Exception restore point */
    jmp_buf exec_loop_env;
@@ -76,6 +158,19 @@ struct cpu_gen {
    pthread_mutex_t idle_mutex;
    pthread_cond_t idle_cond;
 
+   /* Idle wakeup: sequence incremented by wakeups (futex word) */
+   volatile m_uint32_t idle_seq;
+   m_uint32_t idle_seq_last;
+   volatile int idle_waiting;
+   volatile m_tmcnt_t idle_wake_time;
+
+   /* Idle statistics (idle exit latency in usec, log2 buckets) */
+   m_uint64_t idle_sleeps,idle_wakeups,idle_timeouts;
+   m_uint64_t idle_exit_hist[CPU_IDLE_HIST_SIZE];
+
+   /* Timer IRQ (shared tick service) */
+   timer_tick_t *timer_tick;
+
    /* VM instance */
    vm_instance_t *vm;
 
@@ -86,6 +181,9 @@ struct cpu_gen {
    struct cpu_idle_pc idle_pc_prop[CPU_IDLE_PC_MAX_RES];
    u_int idle_pc_prop_count;
 
+   /* Automatic idle PC detection */
+   struct cpu_idle_auto idle_auto;
+
    /* Specific CPU part */
    union {
       cpu_mips_t mips64_cpu;
@@ -101,9 +199,22 @@ struct cpu_gen {
    void (*remove_breakpoint)(cpu_gen_t *cpu,m_uint64_t addr);
    void (*set_idle_pc)(cpu_gen_t *cpu,m_uint64_t addr);
    void (*get_idling_pc)(cpu_gen_t *cpu);   
+   int (*idle_insn_decode)(cpu_gen_t *cpu,m_uint64_t pc,
+                           struct cpu_idle_insn *insn);
    void (*mts_rebuild)(cpu_gen_t *cpu);
+   void (*mts_invalidate_hpa)(cpu_gen_t *cpu,m_iptr_t hpa);
    void (*mts_show_stats)(cpu_gen_t *cpu);
 
+   /* Parking of the CPU between two blocks, requested by another thread */
+   volatile int quiesce_req,quiesced;
+   pthread_cond_t quiesce_cond;
+
+   /* MTS invalidations requested by other threads (count > max: rebuild) */
+   pthread_mutex_t mts_req_lock;
+   volatile int mts_req_pending;
+   u_int mts_req_count;
+   m_iptr_t mts_req_hpa[CPU_MTS_REQ_MAX];
+
    cpu_undefined_mem_handler_t undef_mem_handler;
 
    /* Memory access log for fault debugging */
@@ -125,6 +236,19 @@ struct cpu_gen {
    /* Current and free lists of TBs */
    cpu_tb_t *tb_list,*tb_free_list;
 
+   /* Clock hand for eviction of cold TBs */
+   cpu_tb_t *tb_clock_hand;
+
+   /* TB lookups in physical hash table, and lookups leading to compilation */
+   m_uint64_t tb_lookups,tb_lookup_misses;
+
+   /* Background compilation: completed jobs and jobs being processed */
+   struct tc_job *tc_job_done;
+   u_int tc_job_running;
+
+   /* Number of jumps chained by this CPU */
+   u_int tc_chain_count;
+
    /* Virtual and Physical hash tables to retrieve TBs */
    cpu_tb_t **tb_virt_hash,**tb_phys_hash;
 
@@ -190,6 +314,44 @@ void cpu_group_delete(cpu_group_t *group);
 /* Rebuild the MTS subsystem for a CPU group */
 int cpu_group_rebuild_mts(cpu_group_t *group);
 
+/* Returns TRUE if a host page belongs to a sorted set of host pages */
+int cpu_hpa_lookup(m_iptr_t *hpa,u_int count,m_iptr_t page);
+
+/* Drop all the translated code of a CPU (CPU thread, or CPU parked) */
+void cpu_flush_code(cpu_gen_t *cpu);
+
+/* 
+ * Drop the translated code read from a set of host pages, before these
+ * pages are replaced (CPU thread, or CPU parked). The array is sorted in
+ * place.
+ */
+void cpu_flush_code_hpa(cpu_gen_t *cpu,m_iptr_t *hpa,u_int count);
+
+/* 
+ * Invalidate the MTS entries mapping a host page (hpa = 0: rebuild the
+ * MTS). Other threads post a request to the CPU thread, and force it out
+ * of its translated code.
+ */
+void cpu_mts_invalidate_hpa(cpu_gen_t *cpu,m_iptr_t hpa);
+
+/* Invalidate the MTS entries mapping a host page, for a CPU group */
+void cpu_group_mts_invalidate_hpa(cpu_group_t *group,m_iptr_t hpa);
+
+/* Handle the MTS invalidations requested by other threads (CPU thread) */
+void cpu_mts_handle_requests(cpu_gen_t *cpu);
+
+/* 
+ * Park the running CPUs of a group between two blocks, keeping their
+ * translated code. Returns -1 if the CPUs didn't stop in time.
+ */
+int cpu_group_quiesce(cpu_group_t *group);
+
+/* Release the CPUs parked by cpu_group_quiesce() */
+void cpu_group_unquiesce(cpu_group_t *group);
+
+/* Wait until the CPU is released (CPU thread) */
+void cpu_quiesce_wait(cpu_gen_t *cpu);
+
 /* Log a message for a CPU */
 void cpu_log(cpu_gen_t *cpu,char *module,char *format,...);
 
@@ -229,6 +391,59 @@ void cpu_idle_loop(cpu_gen_t *cpu);
 /* Break idle wait state */
 void cpu_idle_break_wait(cpu_gen_t *cpu);
 
+/* Sample the PC of a JIT block (automatic idle PC detection) */
+void cpu_idle_auto_sample(cpu_gen_t *cpu,m_uint64_t pc);
+
+/* Check if the code at the specified address looks like an idle loop */
+int cpu_idle_pc_check(cpu_gen_t *cpu,m_uint64_t addr);
+
+/* Enable/disable automatic idle PC detection (CPU thread) */
+void cpu_idle_auto_enable(cpu_gen_t *cpu,int enable);
+
+/* Ask the CPU thread to enable/disable automatic idle PC detection */
+void cpu_idle_auto_request(cpu_gen_t *cpu,int enable);
+
+/* Handle a request to the idle PC detector (CPU thread) */
+void cpu_idle_auto_handle_request(cpu_gen_t *cpu);
+
+/* Get the idle PC set by the detector (0 = none) */
+m_uint64_t cpu_idle_auto_get_pc(cpu_gen_t *cpu);
+
+/*
+ * Check if a CPU must be woken up: it is sleeping, or no wakeup is
+ * pending yet (a pending wakeup already skips the next sleep).
+ */
+static inline int cpu_idle_wakeup_needed(cpu_gen_t *cpu)
+{
+   if (!cpu)
+      return(FALSE);
+
+   return(__atomic_load_n(&cpu->idle_waiting,__ATOMIC_SEQ_CST) ||
+          (__atomic_load_n(&cpu->idle_seq,__ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&cpu->idle_seq_last,__ATOMIC_RELAXED)));
+}
+
+/*
+ * Device access by the CPU: an idle loop must not poll devices, so mark
+ * the loop of the candidate (or applied) idle PC if it contains the PC.
+ */
+static forced_inline void cpu_idle_auto_mmio(cpu_gen_t *cpu)
+{
+   struct cpu_idle_auto *ia = &cpu->idle_auto;
+   m_uint64_t pc;
+
+   if (likely(!ia->enabled))
+      return;
+
+   /* the sampled PC may be anywhere in the loop */
+   pc = cpu_get_pc(cpu) + (CPU_IDLE_PC_CHECK_MAX_INSN * 4);
+
+   if ((ia->candidate &&
+        ((pc - ia->candidate) < (CPU_IDLE_PC_CHECK_MAX_INSN * 8))) ||
+       (ia->pc && ((pc - ia->pc) < (CPU_IDLE_PC_CHECK_MAX_INSN * 8))))
+      ia->mmio = TRUE;
+}
+
 /* Returns to the CPU exec loop */
 static inline void cpu_exec_loop_enter(cpu_gen_t *cpu)
 {
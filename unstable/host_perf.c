@@ -0,0 +1,170 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Host performance counters (TLB misses of the CPU threads).
+ *
+ * Counters are opened for each thread with perf_event_open(), for user
+ * mode only, so that the default "perf_event_paranoid" setting allows
+ * them. Counters which can't be opened (iTLB loads are not available on
+ * all CPUs) are reported as missing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "host_perf.h"
+
+#ifdef __linux__
+/* Counter definitions */
+#define HOST_PERF_CACHE(cache,result) \
+   ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+static struct {
+   m_uint32_t type;
+   m_uint64_t config;
+} host_perf_tlb_events[HOST_PERF_TLB_COUNT] = {
+   { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { PERF_TYPE_HW_CACHE, HOST_PERF_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+                                         PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+   { PERF_TYPE_HW_CACHE, HOST_PERF_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS) },
+   { PERF_TYPE_HW_CACHE, HOST_PERF_CACHE(PERF_COUNT_HW_CACHE_ITLB,
+                                         PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+   { PERF_TYPE_HW_CACHE, HOST_PERF_CACHE(PERF_COUNT_HW_CACHE_ITLB,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS) },
+};
+
+/* Value read from a counter */
+struct host_perf_value {
+   m_uint64_t value;
+   m_uint64_t time_enabled;
+   m_uint64_t time_running;
+};
+
+/* Get the identifier of the calling thread */
+pid_t host_perf_gettid(void)
+{
+   return((pid_t)syscall(SYS_gettid));
+}
+
+/* Open a counter for a thread (disabled) */
+static int host_perf_open(pid_t tid,u_int event)
+{
+   struct perf_event_attr attr;
+
+   memset(&attr,0,sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = host_perf_tlb_events[event].type;
+   attr.config = host_perf_tlb_events[event].config;
+   attr.disabled = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+      PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+   return(syscall(__NR_perf_event_open,&attr,tid,-1,-1,0));
+}
+
+/* Read a counter, scaled if the counter has been multiplexed */
+static int host_perf_read(int fd,m_uint64_t *value)
+{
+   struct host_perf_value v;
+
+   if (read(fd,&v,sizeof(v)) != sizeof(v))
+      return(-1);
+
+   if (!v.time_running)
+      return(-1);
+
+   if (v.time_running < v.time_enabled)
+      v.value = (m_uint64_t)((double)v.value * v.time_enabled /
+                             v.time_running);
+
+   *value = v.value;
+   return(0);
+}
+
+/*
+ * Measure TLB activity of a set of threads during "msec" milliseconds.
+ * Returns -1 if performance counters are not available.
+ */
+int host_perf_tlb_measure(pid_t *tids,u_int count,u_int msec,
+                          struct host_perf_tlb *res)
+{
+   m_uint64_t value;
+   u_int i,j,opened = 0;
+   int *fds;
+
+   memset(res,0,sizeof(*res));
+
+   if (!count || !(fds = malloc(count * HOST_PERF_TLB_COUNT * sizeof(int))))
+      return(-1);
+
+   for(i=0;i<count;i++) {
+      for(j=0;j<HOST_PERF_TLB_COUNT;j++) {
+         fds[(i*HOST_PERF_TLB_COUNT)+j] = host_perf_open(tids[i],j);
+
+         if (fds[(i*HOST_PERF_TLB_COUNT)+j] != -1)
+            opened++;
+      }
+   }
+
+   if (!opened) {
+      free(fds);
+      return(-1);
+   }
+
+   for(i=0;i<count*HOST_PERF_TLB_COUNT;i++)
+      if (fds[i] != -1)
+         ioctl(fds[i],PERF_EVENT_IOC_ENABLE,0);
+
+   usleep(msec * 1000);
+
+   for(i=0;i<count*HOST_PERF_TLB_COUNT;i++)
+      if (fds[i] != -1)
+         ioctl(fds[i],PERF_EVENT_IOC_DISABLE,0);
+
+   for(i=0;i<count;i++) {
+      for(j=0;j<HOST_PERF_TLB_COUNT;j++) {
+         if (fds[(i*HOST_PERF_TLB_COUNT)+j] == -1)
+            continue;
+
+         if (host_perf_read(fds[(i*HOST_PERF_TLB_COUNT)+j],&value) != -1) {
+            res->count[j] += value;
+            res->valid |= 1 << j;
+         }
+
+         close(fds[(i*HOST_PERF_TLB_COUNT)+j]);
+      }
+   }
+
+   res->threads = count;
+   free(fds);
+   return(0);
+}
+#else
+/* Get the identifier of the calling thread */
+pid_t host_perf_gettid(void)
+{
+   return(0);
+}
+
+/* Performance counters are only supported on Linux */
+int host_perf_tlb_measure(pid_t *tids,u_int count,u_int msec,
+                          struct host_perf_tlb *res)
+{
+   memset(res,0,sizeof(*res));
+   return(-1);
+}
+#endif
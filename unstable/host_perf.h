@@ -0,0 +1,42 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Host performance counters (TLB misses of the CPU threads).
+ */
+
+#ifndef __HOST_PERF_H__
+#define __HOST_PERF_H__
+
+#include <sys/types.h>
+
+#include "utils.h"
+
+/* Counters measured for TLB benchmarks */
+enum {
+   HOST_PERF_INSNS = 0,
+   HOST_PERF_DTLB_LOADS,
+   HOST_PERF_DTLB_MISSES,
+   HOST_PERF_ITLB_LOADS,
+   HOST_PERF_ITLB_MISSES,
+   HOST_PERF_TLB_COUNT,
+};
+
+/* Result of a TLB benchmark */
+struct host_perf_tlb {
+   m_uint64_t count[HOST_PERF_TLB_COUNT];
+   u_int valid;                  /* Counters supported by the host */
+   u_int threads;                /* Number of threads measured */
+};
+
+/* Get the identifier of the calling thread (0 if not available) */
+pid_t host_perf_gettid(void);
+
+/*
+ * Measure TLB activity of a set of threads during "msec" milliseconds.
+ * Returns -1 if performance counters are not available.
+ */
+int host_perf_tlb_measure(pid_t *tids,u_int count,u_int msec,
+                          struct host_perf_tlb *res);
+
+#endif
@@ -43,6 +43,9 @@
 #include "registry.h"
 #include "hypervisor.h"
 #include "get_cpu_time.h"
+#include "mem_merge.h"
+#include "vm_ckpt.h"
+#include "host_perf.h"
 
 /* Find the specified CPU */
 static cpu_gen_t *find_cpu(hypervisor_conn_t *conn,vm_instance_t *vm,
@@ -376,6 +379,246 @@ static int cmd_set_sparse_mem(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Enable/disable merging of identical pages with other VMs */
+static int cmd_set_mem_merge(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->mem_merge = atoi(argv[1]);
+
+   /* The VM may be already running */
+   if (vm->mem_merge && vm->sparse_mem)
+      mem_merge_start();
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Enable/disable reclaim of zero pages */
+static int cmd_set_zero_reclaim(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->mem_zero_reclaim = atoi(argv[1]);
+
+   /* The VM may be already running */
+   if (vm->mem_zero_reclaim && vm->sparse_mem)
+      mem_merge_start();
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show memory saved by merging identical pages and reclaiming zero pages */
+static int cmd_show_mem_merge(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   u_int pages,zero_pages,shared_pages,shared_refs;
+   m_uint64_t saved;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   mem_merge_get_vm_stats(vm,&pages,&zero_pages,&saved);
+   mem_merge_get_stats(&shared_pages,&shared_refs);
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"enabled: %s",
+                         (vm->mem_merge && vm->sparse_mem) ? "yes" : "no");
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"zero page reclaim: %s",
+                         (vm->mem_zero_reclaim && vm->sparse_mem) ? 
+                         "yes" : "no");
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"merged pages: %u",pages);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"zero pages: %u",zero_pages);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"saved memory: %llu bytes",
+                         saved);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                         "shared pages (all VMs): %u, references: %u",
+                         shared_pages,shared_refs);
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Set the huge page mode used for RAM and exec areas */
+static int cmd_set_huge_pages(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (vm_set_huge_pages(vm,atoi(argv[1])) == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "invalid huge page mode %s",argv[1]);
+      return(-1);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show a TLB access counter and its miss rate */
+static void cmd_show_tlb_counter(hypervisor_conn_t *conn,char *name,
+                                 struct host_perf_tlb *res,
+                                 u_int loads,u_int misses)
+{
+   m_uint64_t insns = res->count[HOST_PERF_INSNS];
+   m_uint64_t nr_loads = res->count[loads];
+   m_uint64_t nr_misses = res->count[misses];
+
+   if (!(res->valid & (1 << misses))) {
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,"%s misses: n/a",name);
+      return;
+   }
+
+   if ((res->valid & (1 << loads)) && nr_loads) {
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                            "%s loads: %llu, misses: %llu (%.3f%%)",
+                            name,nr_loads,nr_misses,
+                            (double)nr_misses * 100.0 / nr_loads);
+   } else {
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,"%s misses: %llu",
+                            name,nr_misses);
+   }
+
+   if ((res->valid & (1 << HOST_PERF_INSNS)) && insns) {
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                            "%s misses per 1000 instructions: %.3f",
+                            name,(double)nr_misses * 1000.0 / insns);
+   }
+}
+
+/* Measure host TLB misses of the CPU threads of a running VM */
+static int cmd_tlb_bench(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   struct host_perf_tlb res;
+   vm_instance_t *vm;
+   u_int count = 0;
+   u_int msec = 1000;
+   cpu_gen_t *cpu;
+   pid_t *tids;
+   int err;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (argc == 2)
+      msec = atoi(argv[1]);
+
+   if (vm->cpu_group != NULL) {
+      for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+         count++;
+   }
+
+   if (!count || !(tids = calloc(count,sizeof(pid_t)))) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_BAD_OBJ,1,
+                            "VM '%s' has no CPU",argv[0]);
+      return(-1);
+   }
+
+   count = 0;
+
+   for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next) {
+      if (cpu->cpu_thread_running && cpu->cpu_thread_tid)
+         tids[count++] = cpu->cpu_thread_tid;
+   }
+
+   if (!count) {
+      free(tids);
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_BAD_OBJ,1,
+                            "VM '%s' is not running",argv[0]);
+      return(-1);
+   }
+
+   err = host_perf_tlb_measure(tids,count,msec,&res);
+   free(tids);
+
+   if (err == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_UNSPECIFIED,1,
+                            "host performance counters not available");
+      return(-1);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"huge pages: %s",
+                         memzone_huge_mode_str(vm->huge_pages));
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"CPU threads: %u, duration: %u ms",
+                         res.threads,msec);
+
+   if (res.valid & (1 << HOST_PERF_INSNS)) {
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,"host instructions: %llu",
+                            res.count[HOST_PERF_INSNS]);
+   }
+
+   cmd_show_tlb_counter(conn,"dTLB",&res,
+                        HOST_PERF_DTLB_LOADS,HOST_PERF_DTLB_MISSES);
+   cmd_show_tlb_counter(conn,"iTLB",&res,
+                        HOST_PERF_ITLB_LOADS,HOST_PERF_ITLB_MISSES);
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Save the state of a running VM into a checkpoint file */
+static int cmd_checkpoint(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   int compress = 0;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (argc == 3)
+      compress = atoi(argv[2]);
+
+   if (vm_ckpt_save(vm,argv[1],compress) == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_FILE,1,
+                            "unable to save checkpoint of VM '%s' to '%s'",
+                            argv[0],argv[1]);
+      return(-1);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Restore the state of a VM from a checkpoint file */
+static int cmd_restore(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (vm_ckpt_restore(vm,argv[1]) == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_FILE,1,
+                            "unable to restore VM '%s' from '%s'",
+                            argv[0],argv[1]);
+      return(-1);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"VM '%s' restored",argv[0]);
+   return(0);
+}
+
 /* Set the clock divisor */
 static int cmd_set_clock_divisor(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -494,6 +737,58 @@ static int cmd_show_idle_pc_prop(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Enable/disable automatic idle PC detection */
+static int cmd_set_idle_pc_auto(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->idle_pc_auto = atoi(argv[1]);
+
+   /* the change is applied by the CPU threads */
+   if (vm->cpu_group != NULL) {
+      for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+         cpu_idle_auto_request(cpu,vm->idle_pc_auto);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Show the state of automatic idle PC detection */
+static int cmd_show_idle_pc_auto(hypervisor_conn_t *conn,
+                                 int argc,char *argv[])
+{
+   struct cpu_idle_auto *ia;
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (!(cpu = find_cpu(conn,vm,atoi(argv[1]))))
+      return(-1);
+
+   ia = &cpu->idle_auto;
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"enabled: %s",
+                         ia->enabled ? "yes" : "no");
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"idle_pc: 0x%llx",
+                         cpu_idle_auto_get_pc(cpu));
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"candidate: 0x%llx",
+                         ia->candidate);
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,"applied: %u, reverted: %u",
+                         ia->apply_count,ia->revert_count);
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set CPU idle max value */
 static int cmd_set_idle_max(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -569,6 +864,41 @@ static int cmd_show_timer_drift(hypervisor_conn_t *conn,
    return(0);
 }
 
+/* Show idle statistics (wakeups and idle exit latency) */
+static int cmd_show_idle_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   cpu_gen_t *cpu;
+   int i;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   if (!(cpu = find_cpu(conn,vm,atoi(argv[1]))))
+      return(-1);
+
+   hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                         "sleeps: %llu, wakeups: %llu, timeouts: %llu",
+                         cpu->idle_sleeps,cpu->idle_wakeups,
+                         cpu->idle_timeouts);
+
+   for(i=0;i<CPU_IDLE_HIST_SIZE;i++) {
+      if (!cpu->idle_exit_hist[i])
+         continue;
+
+      if (i < (CPU_IDLE_HIST_SIZE - 1))
+         hypervisor_send_reply(conn,HSC_INFO_MSG,0,"exit < %u us: %llu",
+                               1 << i,cpu->idle_exit_hist[i]);
+      else
+         hypervisor_send_reply(conn,HSC_INFO_MSG,0,"exit >= %u us: %llu",
+                               1 << (i - 1),cpu->idle_exit_hist[i]);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set the exec area size */
 static int cmd_set_exec_area(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -644,6 +974,48 @@ static int cmd_set_disk1(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* 
+ * Set the base image of a PCMCIA ATA disk (the disk is a copy-on-write
+ * overlay of this image). An empty filename removes the base image.
+ *
+ * Parameters: <vm_name> <disk_id> <filename>
+ */
+static int cmd_set_disk_base(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+   char *filename;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   filename = (*argv[2] != 0) ? argv[2] : NULL;
+
+   if (vm_set_disk_base(vm,atoi(argv[1]),filename) == -1) {
+      vm_release(vm);
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "unable to set base image of disk%s",argv[1]);
+      return(-1);
+   }
+
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Map PCMCIA ATA disk files in memory */
+static int cmd_set_disk_mmap(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   vm_instance_t *vm;
+
+   if (!(vm = hypervisor_find_object(conn,argv[0],OBJ_TYPE_VM)))
+      return(-1);
+
+   vm->pcmcia_disk_mmap = atoi(argv[1]);
+   vm_release(vm);
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Set the config register used at startup */
 static int cmd_set_conf_reg(hypervisor_conn_t *conn,int argc,char *argv[])
 {
@@ -1292,19 +1664,31 @@ static hypervisor_cmd_t vm_cmd_array[] = {
    { "set_nvram", 2, 2, cmd_set_nvram, NULL },
    { "set_ram_mmap", 2, 2, cmd_set_ram_mmap, NULL },
    { "set_sparse_mem", 2, 2, cmd_set_sparse_mem, NULL },
+   { "set_mem_merge", 2, 2, cmd_set_mem_merge, NULL },
+   { "set_zero_reclaim", 2, 2, cmd_set_zero_reclaim, NULL },
+   { "show_mem_merge", 1, 1, cmd_show_mem_merge, NULL },
+   { "set_huge_pages", 2, 2, cmd_set_huge_pages, NULL },
+   { "tlb_bench", 1, 2, cmd_tlb_bench, NULL },
+   { "checkpoint", 2, 3, cmd_checkpoint, NULL },
+   { "restore", 2, 2, cmd_restore, NULL },
    { "set_clock_divisor", 2, 2, cmd_set_clock_divisor, NULL },
    { "set_blk_direct_jump", 2, 2, cmd_set_blk_direct_jump, NULL },
    { "set_exec_area", 2, 2, cmd_set_exec_area, NULL },
    { "set_disk0", 2, 2, cmd_set_disk0, NULL },
    { "set_disk1", 2, 2, cmd_set_disk1, NULL },
+   { "set_disk_base", 3, 3, cmd_set_disk_base, NULL },
+   { "set_disk_mmap", 2, 2, cmd_set_disk_mmap, NULL },
    { "set_conf_reg", 2, 2, cmd_set_conf_reg, NULL },
    { "set_idle_pc", 2, 2, cmd_set_idle_pc, NULL },
    { "set_idle_pc_online", 3, 3, cmd_set_idle_pc_online, NULL },
    { "get_idle_pc_prop", 2, 2, cmd_get_idle_pc_prop, NULL },
    { "show_idle_pc_prop", 2, 2, cmd_show_idle_pc_prop, NULL },
+   { "set_idle_pc_auto", 2, 2, cmd_set_idle_pc_auto, NULL },
+   { "show_idle_pc_auto", 2, 2, cmd_show_idle_pc_auto, NULL },
    { "set_idle_max", 3, 3, cmd_set_idle_max, NULL },
    { "set_idle_sleep_time", 3, 3, cmd_set_idle_sleep_time, NULL },
    { "show_timer_drift", 2, 2, cmd_show_timer_drift, NULL },
+   { "show_idle_stats", 2, 2, cmd_show_idle_stats, NULL },
    { "set_ghost_file", 2, 2, cmd_set_ghost_file, NULL },
    { "set_ghost_status", 2, 2, cmd_set_ghost_status, NULL },
    { "set_con_tcp_port", 2, 2, cmd_set_con_tcp_port, NULL },
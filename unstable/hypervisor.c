@@ -32,6 +32,8 @@
 #include "vm.h"
 #include "dynamips.h"
 #include "tcb.h"
+#include "tc_cache.h"
+#include "ios_unpack.h"
 #include "dev_c7200.h"
 #include "dev_c3600.h"
 #include "dev_c2691.h"
@@ -176,6 +178,97 @@ static int cmd_tsg_stats(hypervisor_conn_t *conn,int argc,char *argv[])
    return(0);
 }
 
+/* Statistics about the JIT code cache of translation groups */
+static int cmd_tsg_cache_stats(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   struct tsg_stats s;
+   int i,first,last,count = 0;
+   u_int hit_rate;
+
+   if (argc == 1) {
+      first = last = atoi(argv[0]);
+   } else {
+      first = 0;
+      last  = TSG_MAX_GROUPS - 1;
+   }
+
+   for(i=first;i<=last;i++) {
+      if (tsg_get_group_stats(i,&s) == -1)
+         continue;
+
+      if (s.lookups)
+         hit_rate = ((s.lookups - s.lookup_misses) * 100) / s.lookups;
+      else
+         hit_rate = 100;
+
+      hypervisor_send_reply(conn,HSC_INFO_MSG,0,
+                            "tsg %d: tc=%u shared_tc=%u alloc_pages=%u "
+                            "total_pages=%u compiles=%llu recompiles=%llu "
+                            "cache_loads=%llu async_compiles=%llu "
+                            "async_dropped=%llu chain_links=%llu "
+                            "chain_unlinks=%llu evictions=%llu evicted_pages=%llu "
+                            "lookups=%llu misses=%llu hit_rate=%u%%",
+                            i,s.total_tc,s.shared_tc,s.alloc_pages,
+                            s.total_pages,s.compiles,s.recompiles,
+                            s.cache_loads,s.async_compiles,s.async_dropped,
+                            s.chain_links,s.chain_unlinks,
+                            s.evictions,s.evicted_pages,
+                            s.lookups,s.lookup_misses,hit_rate);
+      count++;
+   }
+
+   if ((argc == 1) && !count) {
+      hypervisor_send_reply(conn,HSC_ERR_UNK_OBJ,1,
+                            "unknown translation group %d",first);
+      return(-1);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Set the directory of the persistent JIT cache (none to disable it) */
+static int cmd_jit_cache_dir(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   if (tc_cache_set_dir(argc ? argv[0] : NULL) == -1) {
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "unable to set JIT cache directory");
+      return(-1);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Set the directory of the IOS decompression cache (none to disable it) */
+static int cmd_unpack_cache_dir(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   if (ios_unpack_set_dir(argc ? argv[0] : NULL) == -1) {
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "unable to set IOS unpack cache directory");
+      return(-1);
+   }
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
+/* Set the number of background JIT threads and the compile threshold */
+static int cmd_jit_async(hypervisor_conn_t *conn,int argc,char *argv[])
+{
+   if (tc_job_set_workers(atoi(argv[0])) == -1) {
+      hypervisor_send_reply(conn,HSC_ERR_INV_PARAM,1,
+                            "invalid number of JIT threads");
+      return(-1);
+   }
+
+   if (argc == 2)
+      tc_job_set_threshold(atoi(argv[1]));
+
+   hypervisor_send_reply(conn,HSC_INFO_OK,1,"OK");
+   return(0);
+}
+
 /* Hypervisor commands */
 static hypervisor_cmd_t hypervisor_cmd_array[] = {
    { "version", 0, 0, cmd_version, NULL },
@@ -188,6 +281,10 @@ static hypervisor_cmd_t hypervisor_cmd_array[] = {
    { "close", 0, 0, cmd_close, NULL },
    { "stop", 0, 0, cmd_stop, NULL },
    { "tsg_stats", 0, 0, cmd_tsg_stats, NULL },
+   { "tsg_cache_stats", 0, 1, cmd_tsg_cache_stats, NULL },
+   { "jit_cache_dir", 0, 1, cmd_jit_cache_dir, NULL },
+   { "jit_async", 1, 2, cmd_jit_async, NULL },
+   { "unpack_cache_dir", 0, 1, cmd_unpack_cache_dir, NULL },
    { NULL, -1, -1, NULL, NULL },
 };
 
@@ -582,6 +679,7 @@ int hypervisor_tcp_server(char *ip_addr,int tcp_port)
    hypervisor_vm_init();
    hypervisor_vm_debug_init();
    hypervisor_store_init();
+   hypervisor_ptask_init();
 
    signal(SIGPIPE,sigpipe_handler);
 
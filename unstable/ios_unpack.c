@@ -0,0 +1,363 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Cache of self-decompressed IOS images.
+ *
+ * Compressed IOS images start with a small program which decompresses
+ * the real image into RAM, and then jumps to its entry point (which is
+ * usually the entry point of the ELF file). This takes a lot of emulated
+ * CPU time at each boot.
+ *
+ * When the cache is enabled, the content of the entry page is recorded
+ * after loading the ELF file, and the CPU checks its PC when it looks up
+ * a new page. If the entry point is reached with a different content in
+ * the entry page, the decompression is done: the RAM is saved in an image
+ * file and the CPU registers in a checkpoint file, keyed by the hash of
+ * the IOS file, the platform, the CPU type and the RAM size.
+ *
+ * At the next boot, the RAM image is mapped like a ghost RAM file (it is
+ * shared between VMs using the same image), the CPU registers are loaded
+ * and the VM starts directly at the entry point of the decompressed image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "vm.h"
+#include "device.h"
+#include "memory.h"
+#include "mips64.h"
+#include "ppc32.h"
+#include "tc_cache.h"
+#include "vm_ckpt.h"
+#include "ios_unpack.h"
+
+/* Directory used to store decompressed images */
+char *ios_unpack_dir = NULL;
+
+/* Set the cache directory */
+int ios_unpack_set_dir(char *dir)
+{
+   char *str = NULL;
+
+   if (dir && *dir && !(str = strdup(dir)))
+      return(-1);
+
+   free(ios_unpack_dir);
+   ios_unpack_dir = str;
+   return(0);
+}
+
+/* Release the cache information of a VM */
+void ios_unpack_free(vm_instance_t *vm)
+{
+   ios_unpack_t *iu = vm->ios_unpack;
+
+   vm->ios_unpack_armed = FALSE;
+
+   if (iu != NULL) {
+      free(iu->ram_file);
+      free(iu->state_file);
+      free(iu->entry_page);
+      free(iu);
+      vm->ios_unpack = NULL;
+   }
+}
+
+/* Build a filename in the cache directory */
+static char *ios_unpack_filename(vm_instance_t *vm,m_uint64_t hash,
+                                 char *suffix)
+{
+   char filename[4096];
+
+   snprintf(filename,sizeof(filename),"%s/unpack_%s_%u_%16.16llx_%u.%s",
+            ios_unpack_dir,vm->platform->name,vm->boot_cpu->type,
+            hash,vm->ram_size,suffix);
+
+   return(strdup(filename));
+}
+
+/* Get the decompressed image to use as RAM of a VM (NULL if none) */
+char *ios_unpack_ram_file(vm_instance_t *vm)
+{
+   ios_unpack_t *iu;
+   m_uint64_t hash;
+
+   ios_unpack_free(vm);
+
+   if (!ios_unpack_dir || !vm->ios_image || !vm->boot_cpu ||
+       (vm->ghost_status != VM_GHOST_RAM_NONE))
+      return NULL;
+
+   if (tc_cache_hash_file(vm->ios_image,&hash) == -1) {
+      vm_error(vm,"IOS unpack: unable to read image '%s'.\n",vm->ios_image);
+      return NULL;
+   }
+
+   if (!(iu = calloc(1,sizeof(*iu))))
+      return NULL;
+
+   iu->ram_file   = ios_unpack_filename(vm,hash,"ram");
+   iu->state_file = ios_unpack_filename(vm,hash,"state");
+   vm->ios_unpack = iu;
+
+   if (!iu->ram_file || !iu->state_file) {
+      ios_unpack_free(vm);
+      return NULL;
+   }
+
+   iu->cached = !access(iu->ram_file,R_OK) && !access(iu->state_file,R_OK);
+
+   if (!iu->cached)
+      return NULL;
+
+   vm_log(vm,"IOS_UNPACK","using decompressed image '%s'.\n",iu->ram_file);
+   return(iu->ram_file);
+}
+
+/* Get the host address of the page containing the entry point */
+static void *ios_unpack_get_page(cpu_gen_t *cpu,m_uint64_t entry,int ifetch)
+{
+   cpu_mips_t *mcpu;
+   cpu_ppc_t *pcpu;
+
+   switch(cpu->type) {
+      case CPU_TYPE_MIPS64:
+         mcpu = CPU_MIPS64(cpu);
+         entry &= MIPS_MIN_PAGE_MASK;
+
+         if (ifetch)
+            return(mcpu->mem_op_ifetch(mcpu,entry));
+
+         return(mcpu->mem_op_lookup(mcpu,entry));
+
+      case CPU_TYPE_PPC32:
+         pcpu = CPU_PPC32(cpu);
+         entry &= PPC32_MIN_PAGE_MASK;
+
+         if (ifetch)
+            return(pcpu->mem_op_ifetch(pcpu,entry));
+
+         return(pcpu->mem_op_lookup(pcpu,entry,PPC32_MTS_DCACHE));
+   }
+
+   return NULL;
+}
+
+/*
+ * Load the CPU state at the end of the decompression if the IOS image
+ * is cached. Returns -1 if the ELF file must be loaded, -2 on error.
+ */
+int ios_unpack_load(cpu_gen_t *cpu,char *filename,m_uint32_t *entry_point)
+{
+   vm_instance_t *vm = cpu->vm;
+   ios_unpack_t *iu = vm->ios_unpack;
+
+   if (!iu || !iu->cached || !vm->ios_image || strcmp(filename,vm->ios_image))
+      return(-1);
+
+   /* The RAM already contains the image, only the CPU state is missing */
+   if (vm_ckpt_load(vm,iu->state_file) == -1) {
+      vm_error(vm,"IOS unpack: unable to load '%s', removing it.\n",
+               iu->state_file);
+      unlink(iu->state_file);
+      return(-2);
+   }
+
+   iu->entry = cpu_get_pc(cpu);
+
+   printf("ELF loading skipped, using decompressed image '%s'.\n",
+          iu->ram_file);
+   printf("Decompressed image entry point: 0x%llx\n",iu->entry);
+
+   if (entry_point)
+      *entry_point = iu->entry;
+
+   return(0);
+}
+
+/* Watch the entry point of an IOS image which has just been loaded */
+void ios_unpack_arm(cpu_gen_t *cpu,char *filename,m_uint64_t entry)
+{
+   vm_instance_t *vm = cpu->vm;
+   ios_unpack_t *iu = vm->ios_unpack;
+   void *page;
+
+   if (!iu || iu->cached || !vm->ios_image || strcmp(filename,vm->ios_image))
+      return;
+
+   if (!(page = ios_unpack_get_page(cpu,entry,FALSE)))
+      return;
+
+   if (!iu->entry_page && !(iu->entry_page = malloc(VM_PAGE_SIZE)))
+      return;
+
+   memcpy(iu->entry_page,page,VM_PAGE_SIZE);
+   iu->entry = entry;
+   vm->ios_unpack_armed = TRUE;
+}
+
+/* Returns TRUE if a page is filled with zeroes */
+static int ios_unpack_zero_page(void *page)
+{
+   m_uint64_t *p = page;
+   u_int i;
+
+   for(i=0;i<VM_PAGE_SIZE/sizeof(m_uint64_t);i++)
+      if (p[i] != 0)
+         return(FALSE);
+
+   return(TRUE);
+}
+
+/* Save the RAM (pages filled with zeroes are holes in the file) */
+static int ios_unpack_save_ram(vm_instance_t *vm,char *filename,
+                               u_int *pages)
+{
+   struct vdevice *dev;
+   u_int i,nr_pages;
+   m_iptr_t ptr;
+   int fd;
+
+   if (!(dev = dev_get_by_name(vm,"ram")) ||
+       (dev->flags & (VDEVICE_FLAG_REMAP|VDEVICE_FLAG_GHOST)))
+      return(-1);
+
+   if ((fd = open(filename,O_WRONLY|O_CREAT|O_EXCL,0644)) == -1)
+      return(-1);
+
+   if (ftruncate(fd,dev->phys_len) == -1)
+      goto err;
+
+   nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+   for(i=0;i<nr_pages;i++) {
+      if (dev->flags & VDEVICE_FLAG_SPARSE) {
+         ptr = dev->sparse_map[i];
+
+         if (!(ptr & (VDEVICE_PTE_DIRTY|VDEVICE_PTE_SHARED)))
+            continue;
+
+         ptr &= VM_PAGE_MASK;
+      } else {
+         ptr = dev->host_addr + ((m_iptr_t)i << VM_PAGE_SHIFT);
+      }
+
+      if (ios_unpack_zero_page((void *)ptr))
+         continue;
+
+      if (pwrite(fd,(void *)ptr,VM_PAGE_SIZE,
+                 (off_t)i << VM_PAGE_SHIFT) != VM_PAGE_SIZE)
+         goto err;
+
+      (*pages)++;
+   }
+
+   if (close(fd) == -1)
+      return(-1);
+
+   return(0);
+
+ err:
+   close(fd);
+   return(-1);
+}
+
+/* Counter used to build unique temporary file names */
+static u_int ios_unpack_tmp_count = 0;
+
+/* Store the decompressed image (the CPU is at the entry point) */
+static int ios_unpack_save(vm_instance_t *vm)
+{
+   ios_unpack_t *iu = vm->ios_unpack;
+   char ram_tmp[4096],state_tmp[4096];
+   m_tmcnt_t start;
+   u_int pages = 0;
+   u_int count;
+   int res;
+
+   start = m_gettime_usec();
+
+   /* VMs of a same process may save the same image simultaneously */
+   count = __atomic_add_fetch(&ios_unpack_tmp_count,1,__ATOMIC_RELAXED);
+
+   snprintf(ram_tmp,sizeof(ram_tmp),"%s.%ld.%d.%u.tmp",
+            iu->ram_file,(long)getpid(),vm->instance_id,count);
+   snprintf(state_tmp,sizeof(state_tmp),"%s.%ld.%d.%u.tmp",
+            iu->state_file,(long)getpid(),vm->instance_id,count);
+
+   /* Already saved by another VM */
+   if (access(iu->state_file,F_OK) == 0)
+      return(0);
+
+   /*
+    * The CPU is the only one to modify RAM during boot, so its content
+    * is stable while we are saving it.
+    */
+   if ((ios_unpack_save_ram(vm,ram_tmp,&pages) == -1) ||
+       (vm_ckpt_save_cpus(vm,state_tmp) == -1))
+   {
+      vm_error(vm,"IOS unpack: unable to write '%s': %s\n",
+               iu->ram_file,strerror(errno));
+      goto err;
+   }
+
+   /*
+    * The state file is published last, and only if it doesn't exist: it
+    * validates the RAM image. A RAM image replaced by a concurrent save
+    * has the same content.
+    */
+   if (rename(ram_tmp,iu->ram_file) == -1)
+      goto err;
+
+   res = link(state_tmp,iu->state_file);
+
+   if ((res == -1) && (errno != EEXIST))
+      goto err;
+
+   unlink(state_tmp);
+
+   if (res == -1)
+      return(0);
+
+   vm_log(vm,"IOS_UNPACK","decompressed image saved to '%s' "
+          "(%u pages, entry point 0x%llx) in %llu ms.\n",
+          iu->ram_file,pages,iu->entry,
+          (m_tmcnt_t)(m_gettime_usec() - start) / 1000);
+   return(0);
+
+ err:
+   unlink(ram_tmp);
+   unlink(state_tmp);
+   return(-1);
+}
+
+/* Check if the decompressed image is being started (CPU thread) */
+void ios_unpack_check(cpu_gen_t *cpu)
+{
+   vm_instance_t *vm = cpu->vm;
+   ios_unpack_t *iu = vm->ios_unpack;
+   void *page;
+
+   if ((cpu != vm->boot_cpu) || (cpu_get_pc(cpu) != iu->entry))
+      return;
+
+   /* Entry page unchanged: this is the decompression program */
+   if (!(page = ios_unpack_get_page(cpu,iu->entry,TRUE)) ||
+       !memcmp(page,iu->entry_page,VM_PAGE_SIZE))
+      return;
+
+   vm->ios_unpack_armed = FALSE;
+   ios_unpack_save(vm);
+
+   free(iu->entry_page);
+   iu->entry_page = NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Cache of self-decompressed IOS images.
+ */
+
+#ifndef __IOS_UNPACK_H__
+#define __IOS_UNPACK_H__
+
+#include "utils.h"
+#include "vm.h"
+
+/* Decompressed image of a VM */
+struct ios_unpack {
+   char *ram_file,*state_file;   /* RAM image and CPU registers */
+   int cached;                   /* Files found, decompression skipped */
+   m_uint64_t entry;             /* Entry point of the image */
+   u_char *entry_page;           /* Entry page as loaded from the ELF file */
+};
+
+/* Directory used to store decompressed images (NULL: no cache) */
+extern char *ios_unpack_dir;
+
+/* Set the cache directory */
+int ios_unpack_set_dir(char *dir);
+
+/* Get the decompressed image to use as RAM of a VM (NULL if none) */
+char *ios_unpack_ram_file(vm_instance_t *vm);
+
+/*
+ * Load the CPU state at the end of the decompression if the IOS image
+ * is cached. Returns -1 if the ELF file must be loaded, -2 on error.
+ */
+int ios_unpack_load(cpu_gen_t *cpu,char *filename,m_uint32_t *entry_point);
+
+/* Watch the entry point of an IOS image which has just been loaded */
+void ios_unpack_arm(cpu_gen_t *cpu,char *filename,m_uint64_t entry);
+
+/* Check if the decompressed image is being started (CPU thread) */
+void ios_unpack_check(cpu_gen_t *cpu);
+
+/* Release the cache information of a VM */
+void ios_unpack_free(vm_instance_t *vm);
+
+#endif
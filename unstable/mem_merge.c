@@ -0,0 +1,714 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Merging of identical sparse memory pages between VMs.
+ *
+ * A background thread periodically computes a checksum of the private
+ * pages of sparse memory devices, for all VMs with page merging or zero
+ * page reclaim enabled. Pages whose checksum did not change since the
+ * previous scan and which are identical to another page are replaced by
+ * a single read-only copy, shared between VMs and reference counted.
+ * Pages filled with zeroes are replaced by a static zero page, without
+ * reference counting. Writes to a shared page go through the copy-on-write
+ * path of sparse devices, which gives a private copy to the VM again.
+ *
+ * The pages of a VM are remapped while its CPUs are parked between two
+ * blocks and the device accesses to its memory are suspended. The MTS
+ * caches are rebuilt and the translated code read from the replaced pages
+ * is dropped before the CPUs are released. Replaced pages are freed after
+ * the next scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "cpu.h"
+#include "vm.h"
+#include "device.h"
+#include "memory.h"
+#include "registry.h"
+#include "mem_merge.h"
+
+/* Shared pages, by content checksum and by host address */
+static mem_merge_page_t *mem_merge_hash[MEM_MERGE_HASH_SIZE];
+static mem_merge_page_t *mem_merge_addr[MEM_MERGE_HASH_SIZE];
+static u_int mem_merge_pages = 0,mem_merge_refs = 0;
+static pthread_mutex_t mem_merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Zero page and its checksum */
+static u_char *mem_merge_zero_page = NULL;
+static m_uint64_t mem_merge_zero_hash;
+
+/* Shared pages not used anymore, freed during the next scans */
+static mem_merge_page_t *mem_merge_retired = NULL;
+static mem_merge_page_t *mem_merge_retired_prev = NULL;
+
+/* Scanner thread, the scan lock is held while it works on a VM */
+static pthread_t mem_merge_thread;
+static int mem_merge_running = FALSE;
+static pthread_mutex_t mem_merge_scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sorted checksums of the stable pages found during the current scan */
+static m_uint64_t *mem_merge_cand = NULL;
+static u_int mem_merge_cand_count = 0,mem_merge_cand_max = 0;
+
+/* Names of the VMs to scan */
+struct mem_merge_vm_list {
+   char **names;
+   u_int count,max;
+};
+
+#define MEM_MERGE_LOCK()   pthread_mutex_lock(&mem_merge_mutex)
+#define MEM_MERGE_UNLOCK() pthread_mutex_unlock(&mem_merge_mutex)
+
+/* Compute the checksum of a page */
+static m_uint64_t mem_merge_hash_page(void *page)
+{
+   m_uint64_t *p = page;
+   m_uint64_t h0,h1,h2,h3;
+   u_int i;
+
+   h0 = h1 = h2 = h3 = 0x9E3779B97F4A7C15ULL;
+
+   /* 4 independent lanes, to keep the multiplier busy */
+   for(i=0;i<(VM_PAGE_SIZE/sizeof(m_uint64_t));i+=4) {
+      h0 = (h0 ^ p[i])   * 0xFF51AFD7ED558CCDULL; h0 ^= h0 >> 29;
+      h1 = (h1 ^ p[i+1]) * 0xFF51AFD7ED558CCDULL; h1 ^= h1 >> 29;
+      h2 = (h2 ^ p[i+2]) * 0xFF51AFD7ED558CCDULL; h2 ^= h2 >> 29;
+      h3 = (h3 ^ p[i+3]) * 0xFF51AFD7ED558CCDULL; h3 ^= h3 >> 29;
+   }
+
+   h0 ^= (h1 << 16) ^ (h1 >> 48) ^ (h2 << 32) ^ (h2 >> 32);
+   h0 ^= (h3 << 48) ^ (h3 >> 16);
+   h0 = (h0 ^ (h0 >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+   h0 ^= h0 >> 33;
+
+   return(h0 & ~MEM_MERGE_STABLE);
+}
+
+/* Hash on a page checksum */
+static inline u_int mem_merge_hash_cksum(m_uint64_t hash)
+{
+   return((u_int)(hash ^ (hash >> 32)) & MEM_MERGE_HASH_MASK);
+}
+
+/* Hash on a host page address */
+static inline u_int mem_merge_hash_addr(void *ptr)
+{
+   return((u_int)((m_iptr_t)ptr >> VM_PAGE_SHIFT) & MEM_MERGE_HASH_MASK);
+}
+
+/* Find a shared page from its host address (mutex held) */
+static mem_merge_page_t **mem_merge_find_addr(void *ptr)
+{
+   mem_merge_page_t **pp;
+
+   pp = &mem_merge_addr[mem_merge_hash_addr(ptr)];
+
+   for(;*pp;pp=&(*pp)->addr_next)
+      if ((*pp)->ptr == ptr)
+         return pp;
+
+   return NULL;
+}
+
+/* Find a shared page with the specified checksum (mutex held) */
+static mem_merge_page_t *mem_merge_find_hash(m_uint64_t hash)
+{
+   mem_merge_page_t *p;
+
+   p = mem_merge_hash[mem_merge_hash_cksum(hash)];
+
+   for(;p;p=p->hash_next)
+      if (p->hash == hash)
+         return p;
+
+   return NULL;
+}
+
+/* Find a shared page identical to the specified page (mutex held) */
+static mem_merge_page_t *mem_merge_lookup(void *page,m_uint64_t hash)
+{
+   mem_merge_page_t *p;
+
+   p = mem_merge_hash[mem_merge_hash_cksum(hash)];
+
+   for(;p;p=p->hash_next)
+      if ((p->hash == hash) && !memcmp(p->ptr,page,VM_PAGE_SIZE))
+         return p;
+
+   return NULL;
+}
+
+/* Create a shared page from a copy of the specified page (mutex held) */
+static mem_merge_page_t *mem_merge_create_page(void *page,m_uint64_t hash)
+{
+   mem_merge_page_t *p;
+   u_int h;
+
+   if (!(p = malloc(sizeof(*p))))
+      return NULL;
+
+   if (!(p->ptr = m_memalign(VM_PAGE_SIZE,VM_PAGE_SIZE))) {
+      free(p);
+      return NULL;
+   }
+
+   memcpy(p->ptr,page,VM_PAGE_SIZE);
+   p->hash = hash;
+   p->ref_count = 0;
+
+   h = mem_merge_hash_cksum(hash);
+   p->hash_next = mem_merge_hash[h];
+   mem_merge_hash[h] = p;
+
+   h = mem_merge_hash_addr(p->ptr);
+   p->addr_next = mem_merge_addr[h];
+   mem_merge_addr[h] = p;
+
+   mem_merge_pages++;
+   return p;
+}
+
+/* Returns TRUE if the host page is the zero page */
+int mem_merge_is_zero_page(void *ptr)
+{
+   return((mem_merge_zero_page != NULL) && (ptr == mem_merge_zero_page));
+}
+
+/* Release a reference to a shared page (nothing to do for the zero page) */
+void mem_merge_put_page(void *ptr)
+{
+   mem_merge_page_t **pp,*p;
+
+   MEM_MERGE_LOCK();
+
+   if (!(pp = mem_merge_find_addr(ptr))) {
+      MEM_MERGE_UNLOCK();
+      return;
+   }
+
+   p = *pp;
+   mem_merge_refs--;
+
+   if (--p->ref_count == 0) {
+      /* Remove the page from the hash tables, and retire it */
+      *pp = p->addr_next;
+
+      for(pp=&mem_merge_hash[mem_merge_hash_cksum(p->hash)];*pp;
+          pp=&(*pp)->hash_next)
+      {
+         if (*pp == p) {
+            *pp = p->hash_next;
+            break;
+         }
+      }
+
+      p->hash_next = mem_merge_retired;
+      mem_merge_retired = p;
+      mem_merge_pages--;
+   }
+
+   MEM_MERGE_UNLOCK();
+}
+
+/* Free the shared pages retired before the previous scan */
+static void mem_merge_free_retired(void)
+{
+   mem_merge_page_t *p,*next;
+
+   MEM_MERGE_LOCK();
+
+   for(p=mem_merge_retired_prev;p;p=next) {
+      next = p->hash_next;
+      free(p->ptr);
+      free(p);
+   }
+
+   mem_merge_retired_prev = mem_merge_retired;
+   mem_merge_retired = NULL;
+
+   MEM_MERGE_UNLOCK();
+}
+
+/* Record the checksum of a stable page */
+static void mem_merge_add_cand(m_uint64_t hash)
+{
+   m_uint64_t *cand;
+   u_int max;
+
+   if (mem_merge_cand_count == mem_merge_cand_max) {
+      max = mem_merge_cand_max ? (mem_merge_cand_max * 2) : 4096;
+
+      if (!(cand = realloc(mem_merge_cand,max * sizeof(m_uint64_t))))
+         return;
+
+      mem_merge_cand = cand;
+      mem_merge_cand_max = max;
+   }
+
+   mem_merge_cand[mem_merge_cand_count++] = hash;
+}
+
+static int mem_merge_cand_cmp(const void *a,const void *b)
+{
+   m_uint64_t va = *(m_uint64_t *)a;
+   m_uint64_t vb = *(m_uint64_t *)b;
+
+   if (va < vb)
+      return(-1);
+
+   return(va > vb);
+}
+
+/* Returns TRUE if several stable pages have the specified checksum */
+static int mem_merge_cand_dup(m_uint64_t hash)
+{
+   u_int low,high,mid;
+
+   low = 0;
+   high = mem_merge_cand_count;
+
+   /* Find the first occurence */
+   while(low < high) {
+      mid = (low + high) / 2;
+
+      if (mem_merge_cand[mid] < hash)
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   return(((low + 1) < mem_merge_cand_count) &&
+          (mem_merge_cand[low] == hash) && (mem_merge_cand[low+1] == hash));
+}
+
+/* Returns TRUE if a device has pages that can be merged */
+static inline int mem_merge_dev_candidate(struct vdevice *dev)
+{
+   return((dev->flags & VDEVICE_FLAG_SPARSE) &&
+          !(dev->flags & VDEVICE_FLAG_REMAP) && (dev->sparse_map != NULL));
+}
+
+/* Returns TRUE if the pages of a VM can be scanned */
+static inline int mem_merge_vm_active(vm_instance_t *vm)
+{
+   return((vm->status == VM_STATUS_RUNNING) ||
+          (vm->status == VM_STATUS_SUSPENDED));
+}
+
+/* Free the pages replaced during the previous scan of a VM */
+static void mem_merge_vm_free_retired(vm_instance_t *vm)
+{
+   u_int i;
+
+   VM_MEM_LOCK(vm);
+
+   for(i=0;i<vm->mem_merge_retired_count;i++)
+      vm_free_host_page(vm,(void *)vm->mem_merge_retired[i]);
+
+   vm->mem_merge_retired_count = 0;
+   VM_MEM_UNLOCK(vm);
+}
+
+/* Compute the checksums of the private pages of a device */
+static void mem_merge_scan_dev(vm_instance_t *vm,struct vdevice *dev)
+{
+   u_int i,nr_pages;
+   m_uint64_t hash;
+   m_iptr_t ptr;
+
+   nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+   if (!dev->sparse_hash &&
+       !(dev->sparse_hash = calloc(nr_pages,sizeof(m_uint64_t))))
+      return;
+
+   for(i=0;i<nr_pages;i++) {
+      ptr = dev->sparse_map[i];
+
+      if (!(ptr & VDEVICE_PTE_DIRTY)) {
+         dev->sparse_hash[i] = 0;
+         continue;
+      }
+
+      hash = mem_merge_hash_page((void *)(ptr & VM_PAGE_MASK));
+
+      if ((dev->sparse_hash[i] & ~MEM_MERGE_STABLE) == hash) {
+         dev->sparse_hash[i] = hash | MEM_MERGE_STABLE;
+
+         if (vm->mem_merge)
+            mem_merge_add_cand(hash);
+      } else {
+         dev->sparse_hash[i] = hash;
+      }
+   }
+}
+
+/* Check if a stable page can be merged or reclaimed */
+static inline int mem_merge_page_candidate(vm_instance_t *vm,m_uint64_t hash)
+{
+   mem_merge_page_t *p;
+
+   if (vm->mem_zero_reclaim && (hash == mem_merge_zero_hash))
+      return(TRUE);
+
+   if (!vm->mem_merge)
+      return(FALSE);
+
+   if (mem_merge_cand_dup(hash))
+      return(TRUE);
+
+   MEM_MERGE_LOCK();
+   p = mem_merge_find_hash(hash);
+   MEM_MERGE_UNLOCK();
+
+   return(p != NULL);
+}
+
+/* 
+ * Merge the stable pages of a device and reclaim zero pages (VM paused,
+ * memory lock held).
+ */
+static u_int mem_merge_dev_pages(vm_instance_t *vm,struct vdevice *dev,
+                                 u_int *zero_count)
+{
+   u_int i,nr_pages,count = 0;
+   mem_merge_page_t *p;
+   m_uint64_t hash;
+   m_iptr_t *retired;
+   void *page;
+   u_int max;
+
+   nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+   for(i=0;i<nr_pages;i++) {
+      if (!(dev->sparse_map[i] & VDEVICE_PTE_DIRTY) ||
+          !(dev->sparse_hash[i] & MEM_MERGE_STABLE))
+         continue;
+
+      page = (void *)(dev->sparse_map[i] & VM_PAGE_MASK);
+      hash = dev->sparse_hash[i] & ~MEM_MERGE_STABLE;
+
+      /* The replaced page is freed after the next scan */
+      if (vm->mem_merge_retired_count == vm->mem_merge_retired_max) {
+         max = vm->mem_merge_retired_max ?
+            (vm->mem_merge_retired_max * 2) : VM_CHUNK_AREA_SIZE;
+
+         retired = realloc(vm->mem_merge_retired,max * sizeof(m_iptr_t));
+         if (!retired) break;
+
+         vm->mem_merge_retired = retired;
+         vm->mem_merge_retired_max = max;
+      }
+
+      /* Zero page: no reference counting */
+      if (vm->mem_zero_reclaim && (hash == mem_merge_zero_hash) &&
+          !memcmp(page,mem_merge_zero_page,VM_PAGE_SIZE))
+      {
+         dev->sparse_map[i] = (m_iptr_t)mem_merge_zero_page | 
+            VDEVICE_PTE_SHARED;
+         dev->sparse_hash[i] = 0;
+         vm->mem_merge_retired[vm->mem_merge_retired_count++] = (m_iptr_t)page;
+         (*zero_count)++;
+         continue;
+      }
+
+      if (!vm->mem_merge)
+         continue;
+
+      MEM_MERGE_LOCK();
+
+      /*
+       * Use an identical shared page, or create it if another page
+       * probably has the same content (the page may have been modified
+       * since its checksum was computed).
+       */
+      if (!(p = mem_merge_lookup(page,hash)) && mem_merge_cand_dup(hash) &&
+          (mem_merge_hash_page(page) == hash))
+         p = mem_merge_create_page(page,hash);
+
+      if (p != NULL) {
+         p->ref_count++;
+         mem_merge_refs++;
+      }
+
+      MEM_MERGE_UNLOCK();
+
+      if (!p)
+         continue;
+
+      dev->sparse_map[i] = (m_iptr_t)p->ptr | VDEVICE_PTE_SHARED;
+      dev->sparse_hash[i] = 0;
+      vm->mem_merge_retired[vm->mem_merge_retired_count++] = (m_iptr_t)page;
+      count++;
+   }
+
+   return(count);
+}
+
+/* Merge the stable pages of a VM */
+static void mem_merge_vm(vm_instance_t *vm)
+{
+   struct vdevice *dev;
+   u_int i,nr_pages,count,zero_count,first;
+   m_uint64_t hash;
+   cpu_gen_t *cpu;
+   int found = FALSE;
+
+   /* Don't pause the VM if nothing can be merged */
+   for(dev=vm->dev_list;dev && !found;dev=dev->next) {
+      if (!mem_merge_dev_candidate(dev) || !dev->sparse_hash)
+         continue;
+
+      nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+      for(i=0;i<nr_pages;i++) {
+         hash = dev->sparse_hash[i];
+
+         if ((hash & MEM_MERGE_STABLE) &&
+             mem_merge_page_candidate(vm,hash & ~MEM_MERGE_STABLE))
+         {
+            found = TRUE;
+            break;
+         }
+      }
+   }
+
+   if (!found || (vm_pause(vm) == -1))
+      return;
+
+   /* Device threads keep host pointers during their memory accesses */
+   physmem_dma_suspend(vm);
+
+   VM_MEM_LOCK(vm);
+
+   count = zero_count = 0;
+   first = vm->mem_merge_retired_count;
+
+   for(dev=vm->dev_list;dev;dev=dev->next)
+      if (mem_merge_dev_candidate(dev) && dev->sparse_hash)
+         count += mem_merge_dev_pages(vm,dev,&zero_count);
+
+   VM_MEM_UNLOCK(vm);
+
+   /* Drop the mappings and the translated code of the replaced pages */
+   if (vm->mem_merge_retired_count > first) {
+      cpu_group_rebuild_mts(vm->cpu_group);
+
+      for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+         cpu_flush_code_hpa(cpu,&vm->mem_merge_retired[first],
+                            vm->mem_merge_retired_count - first);
+
+      physmem_tlb_flush(vm);
+   }
+
+   physmem_dma_resume(vm);
+   vm_unpause(vm);
+
+   if ((count > 0) || (zero_count > 0)) {
+      vm_log(vm,"MEM_MERGE","%u pages merged, %u zero pages reclaimed.\n",
+             count,zero_count);
+   }
+}
+
+/* Record the name of a VM to scan */
+static void mem_merge_add_vm(registry_entry_t *entry,void *opt,int *err)
+{
+   struct mem_merge_vm_list *list = opt;
+   vm_instance_t *vm = entry->data;
+   char **names;
+   u_int max;
+
+   if (!(vm->mem_merge || vm->mem_zero_reclaim) || !vm->sparse_mem)
+      return;
+
+   if (list->count == list->max) {
+      max = list->max ? (list->max * 2) : 16;
+
+      if (!(names = realloc(list->names,max * sizeof(char *))))
+         return;
+
+      list->names = names;
+      list->max = max;
+   }
+
+   if ((list->names[list->count] = strdup(entry->name)) != NULL)
+      list->count++;
+}
+
+/* Scan memory of all VMs */
+static void mem_merge_scan(void)
+{
+   struct mem_merge_vm_list list;
+   struct vdevice *dev;
+   vm_instance_t *vm;
+   u_int i;
+
+   mem_merge_free_retired();
+
+   memset(&list,0,sizeof(list));
+   registry_foreach_type(OBJ_TYPE_VM,mem_merge_add_vm,&list,NULL);
+
+   /* Compute page checksums */
+   mem_merge_cand_count = 0;
+
+   for(i=0;i<list.count;i++) {
+      if (!(vm = vm_acquire(list.names[i])))
+         continue;
+
+      pthread_mutex_lock(&mem_merge_scan_mutex);
+
+      if (mem_merge_vm_active(vm)) {
+         mem_merge_vm_free_retired(vm);
+
+         for(dev=vm->dev_list;dev;dev=dev->next)
+            if (mem_merge_dev_candidate(dev))
+               mem_merge_scan_dev(vm,dev);
+      }
+
+      pthread_mutex_unlock(&mem_merge_scan_mutex);
+      vm_release(vm);
+   }
+
+   qsort(mem_merge_cand,mem_merge_cand_count,sizeof(m_uint64_t),
+         mem_merge_cand_cmp);
+
+   /* Merge pages */
+   for(i=0;i<list.count;i++) {
+      if ((vm = vm_acquire(list.names[i])) != NULL) {
+         pthread_mutex_lock(&mem_merge_scan_mutex);
+
+         if (mem_merge_vm_active(vm))
+            mem_merge_vm(vm);
+
+         pthread_mutex_unlock(&mem_merge_scan_mutex);
+         vm_release(vm);
+      }
+
+      free(list.names[i]);
+   }
+
+   free(list.names);
+}
+
+/* Scanner thread */
+static void *mem_merge_thread_run(void *arg)
+{
+   for(;;) {
+      sleep(MEM_MERGE_INTERVAL);
+      mem_merge_scan();
+   }
+
+   return NULL;
+}
+
+/* Start the memory scanner (if not already running) */
+int mem_merge_start(void)
+{
+   int res = 0;
+
+   MEM_MERGE_LOCK();
+
+   if (!mem_merge_zero_page) {
+      if (!(mem_merge_zero_page = m_memalign(VM_PAGE_SIZE,VM_PAGE_SIZE))) {
+         MEM_MERGE_UNLOCK();
+         return(-1);
+      }
+
+      memset(mem_merge_zero_page,0,VM_PAGE_SIZE);
+      mem_merge_zero_hash = mem_merge_hash_page(mem_merge_zero_page);
+   }
+
+   if (!mem_merge_running) {
+      if (pthread_create(&mem_merge_thread,NULL,mem_merge_thread_run,NULL)) {
+         fprintf(stderr,"mem_merge_start: unable to create thread.\n");
+         res = -1;
+      } else {
+         pthread_detach(mem_merge_thread);
+         mem_merge_running = TRUE;
+      }
+   }
+
+   MEM_MERGE_UNLOCK();
+   return(res);
+}
+
+/* Wait for the scanner to be done with a VM being shut down */
+void mem_merge_vm_shutdown(vm_instance_t *vm)
+{
+   pthread_mutex_lock(&mem_merge_scan_mutex);
+   pthread_mutex_unlock(&mem_merge_scan_mutex);
+}
+
+/* 
+ * Get the number of pages of a VM mapped to shared pages and to the zero
+ * page, and memory saved.
+ */
+int mem_merge_get_vm_stats(vm_instance_t *vm,u_int *pages,u_int *zero_pages,
+                           m_uint64_t *saved)
+{
+   mem_merge_page_t **pp;
+   struct vdevice *dev;
+   u_int i,nr_pages;
+   m_iptr_t ptr;
+
+   *pages = *zero_pages = 0;
+   *saved = 0;
+
+   pthread_mutex_lock(&mem_merge_scan_mutex);
+
+   if (!mem_merge_vm_active(vm)) {
+      pthread_mutex_unlock(&mem_merge_scan_mutex);
+      return(-1);
+   }
+
+   VM_MEM_LOCK(vm);
+   MEM_MERGE_LOCK();
+
+   for(dev=vm->dev_list;dev;dev=dev->next) {
+      if (!mem_merge_dev_candidate(dev))
+         continue;
+
+      nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+      for(i=0;i<nr_pages;i++) {
+         ptr = dev->sparse_map[i];
+
+         if (!(ptr & VDEVICE_PTE_SHARED))
+            continue;
+
+         if (mem_merge_is_zero_page((void *)(ptr & VM_PAGE_MASK))) {
+            (*zero_pages)++;
+            *saved += VM_PAGE_SIZE;
+            continue;
+         }
+
+         /* The cost of a shared page is split between its users */
+         if ((pp = mem_merge_find_addr((void *)(ptr & VM_PAGE_MASK)))) {
+            (*pages)++;
+            *saved += VM_PAGE_SIZE - (VM_PAGE_SIZE / (*pp)->ref_count);
+         }
+      }
+   }
+
+   MEM_MERGE_UNLOCK();
+   VM_MEM_UNLOCK(vm);
+   pthread_mutex_unlock(&mem_merge_scan_mutex);
+   return(0);
+}
+
+/* Get the number of shared pages and the number of references to them */
+void mem_merge_get_stats(u_int *pages,u_int *refs)
+{
+   MEM_MERGE_LOCK();
+   *pages = mem_merge_pages;
+   *refs  = mem_merge_refs;
+   MEM_MERGE_UNLOCK();
+}
@@ -0,0 +1,56 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Merging of identical sparse memory pages between VMs.
+ */
+
+#ifndef __MEM_MERGE_H__
+#define __MEM_MERGE_H__
+
+#include "utils.h"
+#include "vm.h"
+
+/* Interval between two scans of VM memory (in seconds) */
+#define MEM_MERGE_INTERVAL  10
+
+/* Hash tables of shared pages (by content and by host address) */
+#define MEM_MERGE_HASH_BITS  16
+#define MEM_MERGE_HASH_SIZE  (1 << MEM_MERGE_HASH_BITS)
+#define MEM_MERGE_HASH_MASK  (MEM_MERGE_HASH_SIZE - 1)
+
+/* Page checksum unchanged since the previous scan (in sparse_hash) */
+#define MEM_MERGE_STABLE  0x1ULL
+
+/* Page shared between VMs */
+typedef struct mem_merge_page mem_merge_page_t;
+struct mem_merge_page {
+   u_char *ptr;
+   m_uint64_t hash;
+   u_int ref_count;
+   mem_merge_page_t *hash_next,*addr_next;
+};
+
+/* Start the memory scanner (if not already running) */
+int mem_merge_start(void);
+
+/* Returns TRUE if the host page is the zero page */
+int mem_merge_is_zero_page(void *ptr);
+
+/* Release a reference to a shared page (nothing to do for the zero page) */
+void mem_merge_put_page(void *ptr);
+
+/* Wait for the scanner to be done with a VM being shut down */
+void mem_merge_vm_shutdown(vm_instance_t *vm);
+
+/* 
+ * Get the number of pages of a VM mapped to shared pages and to the zero
+ * page, and memory saved.
+ */
+int mem_merge_get_vm_stats(vm_instance_t *vm,u_int *pages,u_int *zero_pages,
+                           m_uint64_t *saved);
+
+/* Get the number of shared pages and the number of references to them */
+void mem_merge_get_stats(u_int *pages,u_int *refs);
+
+#endif
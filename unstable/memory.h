@@ -7,6 +7,7 @@
 #define __MEMORY_H__
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include "utils.h"
 
 /* MTS operation */
@@ -39,18 +40,28 @@
 /* Macro for easy hash computing */
 #define MTS_SHR(v,sr) ((v) >> (sr))
 
-/* Hash table size for MTS64 (default: [shift:16,bits:12]) */
+/* 
+ * MIPS MTS cache: set-associative, the number of sets and of ways being 
+ * configurable. The set index is the hash on virtual addresses. The first
+ * way of a set holds the most recently used entry (the only one checked 
+ * by the JIT fast paths).
+ */
+#define MTS_CACHE_DEF_ENTRIES  4096
+#define MTS_CACHE_DEF_WAYS     4
+#define MTS_CACHE_MAX_WAYS     4
+#define MTS_CACHE_MAX_SET_BITS 12
+
+/* MTS64 hash on virtual addresses (set index before masking) */
 #define MTS64_HASH_SHIFT1  12
 #define MTS64_HASH_SHIFT2  20
-#define MTS64_HASH_BITS    8
-#define MTS64_HASH_SIZE    (1 << MTS64_HASH_BITS)
-#define MTS64_HASH_MASK    (MTS64_HASH_SIZE - 1)
 
-/* MTS64 hash on virtual addresses */
 #define MTS64_SHR(v,i)    (MTS_SHR((v),MTS64_HASH_SHIFT##i))
-#define MTS64_HASH(vaddr) ((MTS64_SHR(vaddr,1) ^ MTS64_SHR(vaddr,2)) & MTS64_HASH_MASK)
+#define MTS64_HASH_SET(vaddr) (MTS64_SHR(vaddr,1) ^ MTS64_SHR(vaddr,2))
 
-/* Hash table size for MTS32 (default: [shift:15,bits:15]) */
+/* 
+ * Hash table size for MTS32 (default: [shift:15,bits:15]).
+ * The size is only used by the PPC32 MTS, which is direct-mapped.
+ */
 #define MTS32_HASH_SHIFT1  12
 #define MTS32_HASH_SHIFT2  20
 #define MTS32_HASH_BITS    8
@@ -59,7 +70,18 @@
 
 /* MTS32 hash on virtual addresses */
 #define MTS32_SHR(v,i)    (MTS_SHR((v),MTS32_HASH_SHIFT##i))
-#define MTS32_HASH(vaddr) ((MTS32_SHR(vaddr,1) ^ MTS32_SHR(vaddr,2)) & MTS32_HASH_MASK)
+#define MTS32_HASH_SET(vaddr) (MTS32_SHR(vaddr,1) ^ MTS32_SHR(vaddr,2))
+#define MTS32_HASH(vaddr) (MTS32_HASH_SET(vaddr) & MTS32_HASH_MASK)
+
+/* 
+ * MIPS MTS entry tags, stored in the upper bits of the entry flags:
+ * ASID of the TLB entry used for the mapping, or global mapping.
+ */
+#define MTS_TAG_SHIFT     16
+#define MTS_TAG_MASK      0x03ff0000
+#define MTS_TAG_ASID(asid) ((asid) << MTS_TAG_SHIFT)
+#define MTS_TAG_GLOBAL    0x01000000   /* TLB entry with G bit set */
+#define MTS_TAG_UNMAPPED  0x02000000   /* Unmapped segment (kseg0, ...) */
 
 /* Number of entries per chunk */
 #define MTS64_CHUNK_SIZE   256
@@ -97,6 +119,43 @@ void physmem_copy_from_vm(vm_instance_t *vm,void *real_buffer,
 void physmem_copy_to_vm(vm_instance_t *vm,void *real_buffer,
                         m_uint64_t paddr,size_t len);
 
+/* Invalidate a page in the physical memory translation cache */
+void physmem_tlb_invalidate(vm_instance_t *vm,m_uint64_t paddr);
+
+/* Flush the physical memory translation cache */
+void physmem_tlb_flush(vm_instance_t *vm);
+
+/* Get the translation cache statistics of a VM, and optionally reset them */
+void physmem_tlb_get_stats(vm_instance_t *vm,m_uint64_t *hits,
+                           m_uint64_t *misses,int reset);
+
+/* 
+ * Start an access to the memory of a VM from a device. Host pointers to
+ * VM memory are valid until the end of the section.
+ */
+void physmem_dma_begin(vm_instance_t *vm);
+
+/* End an access to the memory of a VM from a device */
+void physmem_dma_end(vm_instance_t *vm);
+
+/* Stop the device accesses to the memory of a VM, and wait for them */
+void physmem_dma_suspend(vm_instance_t *vm);
+
+/* Allow device accesses to the memory of a VM again */
+void physmem_dma_resume(vm_instance_t *vm);
+
+/* Maximum number of host segments for the physmem copy fast path */
+#define PHYSMEM_COPY_MAX_IOV  8
+
+/* Map a VM physical memory range to host memory segments */
+int physmem_map_iov(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                    u_int op_type,struct iovec *iov,u_int max_iov);
+
+/* Add a VM physical memory range to the segments of a packet (read) */
+int physmem_map_iov_bounce(vm_instance_t *vm,m_uint64_t paddr,size_t len,
+                           struct iovec *iov,int count,u_int max_iov,
+                           u_char *bounce,size_t pos);
+
 /* Copy a 32-bit word from the VM physical RAM to real host */
 m_uint32_t physmem_copy_u32_from_vm(vm_instance_t *vm,m_uint64_t paddr);
 
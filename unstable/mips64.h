@@ -286,6 +286,9 @@ enum {
 /* Number of instructions per page */
 #define MIPS_INSN_PER_PAGE (MIPS_MIN_PAGE_SIZE/sizeof(mips_insn_t))
 
+/* Number of predecoded pages kept by the interpreter (power of 2) */
+#define MIPS64_PREDEC_CACHE_SIZE  64
+
 /* MIPS CPU Identifiers */
 #define MIPS_PRID_R4600    0x00002012
 #define MIPS_PRID_R4700    0x00002112
@@ -431,9 +434,6 @@ struct cpu_mips {
    /* IRQ disable flag */
    volatile u_int irq_disable;
 
-   /* IRQ idling preemption */
-   u_int irq_idle_preempt[8];
-
    /* Generic CPU instance pointer */
    cpu_gen_t *gen;
 
@@ -445,10 +445,21 @@ struct cpu_mips {
 
    /* MTS invalidate/shutdown operations */
    void (*mts_invalidate)(cpu_mips_t *cpu);
+   void (*mts_invalidate_range)(cpu_mips_t *cpu,m_uint64_t vaddr,
+                                m_uint64_t len);
+   void (*mts_invalidate_asid)(cpu_mips_t *cpu);
    void (*mts_shutdown)(cpu_mips_t *cpu);
 
+   /* MTS cache geometry: 2^set_bits sets of 2^way_bits entries */
+   u_int mts_set_bits,mts_way_bits,mts_set_shift;
+   m_uint32_t mts_set_mask;
+
+   /* Upper bound of the number of MTS entries tagged with an ASID */
+   u_int mts_asid_entries;
+
    /* MTS cache statistics */
    m_uint64_t mts_misses,mts_lookups;
+   m_uint64_t mts_way_hits,mts_inval_entries,mts_flushes;
 
    /* JIT flush method */
    u_int jit_flush_method;
@@ -469,6 +480,11 @@ struct cpu_mips {
    m_uint64_t njm_exec_page;
    mips_insn_t *njm_exec_ptr;
 
+   /* Predecoded pages (non-JIT), indexed by host page address */
+   struct mips64_predec_page *njm_predec;
+   struct mips64_predec_page *njm_predec_cache[MIPS64_PREDEC_CACHE_SIZE];
+   m_uint64_t njm_predec_fills;
+
    /* Performance counter (number of instructions executed by CPU) */
    m_uint32_t perf_counter;
 
@@ -509,7 +525,7 @@ void mips64_set_prid(cpu_mips_t *cpu,m_uint32_t prid);
 void mips64_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr);
 
 /* Timer IRQ */
-void *mips64_timer_irq_run(cpu_mips_t *cpu);
+void mips64_timer_tick(cpu_mips_t *cpu,u_int count);
 
 /* Determine an "idling" PC */
 int mips64_get_idling_pc(cpu_gen_t *cpu);
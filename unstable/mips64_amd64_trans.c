@@ -74,21 +74,100 @@ void mips64_set_ra(cpu_tc_t *b,m_uint64_t ret_pc)
                          AMD64_RAX,8);
 }
 
+/* 
+ * Data of a jump to another page, stored after its code. The jump is
+ * chained to the target code by mips64_chain_set_link() when it has been
+ * executed TC_CHAIN_THRESHOLD times.
+ */
+struct mips64_chain_data {
+   m_uint32_t counter;
+   m_uint32_t pad;
+   cpu_mips_t *cpu;
+   cpu_tb_t *tb;
+   u_char *target;
+};
+
+/* Chain information passed to mips64_chain_set_link() */
+struct mips64_chain_info {
+   struct mips64_chain_data *data;
+   u_char *target;
+};
+
+/* Prepare a chained jump, returns the displacement of the jump to the stub */
+static m_uint32_t mips64_chain_set_link(cpu_gen_t *cpu,cpu_tb_t *tb,
+                                        m_uint32_t *jit_insn,void *opt)
+{
+   struct mips64_chain_info *info = opt;
+
+   info->data->cpu    = CPU_MIPS64(cpu);
+   info->data->tb     = tb;
+   info->data->target = info->target;
+
+   /* The stub immediately follows the jump */
+   return(0);
+}
+
+/* Chain a jump to another page (called from translated code) */
+static void mips64_chain_link(cpu_mips_t *cpu,m_uint32_t *jit_insn,
+                              cpu_tb_t *tb,u_char *target,
+                              struct mips64_chain_data *data)
+{
+   struct mips64_chain_info info;
+
+   data->counter = TC_CHAIN_THRESHOLD;
+
+   info.data = data;
+   info.target = target;
+   tc_chain_add(cpu->gen,tb,jit_insn,mips64_chain_set_link,&info);
+}
+
 /* 
  * Try to branch directly to the specified JIT block without returning to 
  * the main loop.
+ *
+ * The jump starts with a "jmp rel32" to the block lookup, which is patched
+ * to jump to a stub once the jump is chained. The stub checks that the 
+ * link has been set by the current CPU (translated code can be shared)
+ * and jumps directly to the target code.
  */
 static void mips64_try_direct_far_jump(cpu_mips_t *cpu,cpu_tc_t *b,
                                        m_uint64_t new_pc)
 {
    m_uint64_t new_page;
    m_uint32_t pc_hash,pc_offset;
-   u_char *test1,*test2,*test3,*test4;
+   u_char *test1,*test2,*test3,*test4,*test5,*test_cpu;
+   u_char *site,*stub_lea,*count_lea,*link_lea,*data;
 
    new_page = new_pc & MIPS_MIN_PAGE_MASK;
    pc_offset = (new_pc & MIPS_MIN_PAGE_IMASK) >> 2;
    pc_hash = mips64_jit_get_virt_hash(new_pc);
 
+   /* The displacement of the jump must be 32-bit aligned to be patched */
+   while(((u_long)b->jit_ptr + 1) & 0x03)
+      amd64_nop(b->jit_ptr);
+
+   site = b->jit_ptr;
+   x86_jump32(b->jit_ptr,0);
+
+   /* Chained jump */
+   amd64_lea_membase(b->jit_ptr,AMD64_RAX,AMD64_RIP,0);
+   stub_lea = b->jit_ptr;
+
+   amd64_alu_reg_membase_size(b->jit_ptr,X86_CMP,AMD64_R15,AMD64_RAX,
+                              OFFSET(struct mips64_chain_data,cpu),8);
+   test_cpu = b->jit_ptr;
+   amd64_branch8(b->jit_ptr, X86_CC_NE, 0, 1);
+
+   amd64_mov_reg_membase(b->jit_ptr,AMD64_RDX,
+                         AMD64_RAX,OFFSET(struct mips64_chain_data,tb),8);
+   amd64_inc_membase(b->jit_ptr,AMD64_RDX,OFFSET(cpu_tb_t,acc_count));
+   amd64_jump_membase(b->jit_ptr,AMD64_RAX,
+                      OFFSET(struct mips64_chain_data,target));
+
+   /* Block lookup */
+   *(m_int32_t *)(site + 1) = b->jit_ptr - (site + 5);
+   amd64_patch(test_cpu,b->jit_ptr);
+
    /* Get generic CPU pointer */
    amd64_mov_reg_membase(b->jit_ptr,AMD64_RSI,
                          AMD64_R15,OFFSET(cpu_mips_t,gen),8);
@@ -128,6 +207,31 @@ static void mips64_try_direct_far_jump(cpu_mips_t *cpu,cpu_tc_t *b,
    amd64_test_reg_reg(b->jit_ptr,AMD64_RAX,AMD64_RAX);
    test4 = b->jit_ptr;
    amd64_branch8(b->jit_ptr, X86_CC_Z, 0, 1);
+
+   /* Account the block use for the eviction clock */
+   amd64_inc_membase(b->jit_ptr,AMD64_RDX,OFFSET(cpu_tb_t,acc_count));
+
+   /* Count the executions of this jump */
+   amd64_lea_membase(b->jit_ptr,AMD64_RSI,AMD64_RIP,0);
+   count_lea = b->jit_ptr;
+   amd64_dec_membase_size(b->jit_ptr,AMD64_RSI,0,4);
+   test5 = b->jit_ptr;
+   amd64_branch8(b->jit_ptr, X86_CC_Z, 0, 1);
+   amd64_jump_reg(b->jit_ptr,AMD64_RAX);
+
+   /* The jump is hot: chain it, and go to the target code */
+   amd64_patch(test5,b->jit_ptr);
+   amd64_push_reg(b->jit_ptr,AMD64_RAX);
+   amd64_mov_reg_reg(b->jit_ptr,AMD64_R8,AMD64_RSI,8);
+   amd64_mov_reg_reg(b->jit_ptr,AMD64_RDI,AMD64_R15,8);
+   amd64_lea_membase(b->jit_ptr,AMD64_RSI,AMD64_RIP,0);
+   link_lea = b->jit_ptr;
+   *(m_int32_t *)(link_lea - 4) = (site + 1) - link_lea;
+   amd64_mov_reg_reg(b->jit_ptr,AMD64_RCX,AMD64_RAX,8);
+   amd64_mov_reg_imm_size(b->jit_ptr,AMD64_RAX,mips64_chain_link,8);
+   tc_record_reloc(b,b->jit_ptr - sizeof(m_uint64_t));
+   amd64_call_reg(b->jit_ptr,AMD64_RAX);
+   amd64_pop_reg(b->jit_ptr,AMD64_RAX);
    amd64_jump_reg(b->jit_ptr,AMD64_RAX);
 
    /* Returns to caller... */
@@ -138,6 +242,18 @@ static void mips64_try_direct_far_jump(cpu_mips_t *cpu,cpu_tc_t *b,
 
    mips64_set_pc(b,new_pc);
    mips64_jit_tcb_push_epilog(b);
+
+   /* Chain data (64-bit aligned) */
+   while((u_long)b->jit_ptr & 0x07)
+      amd64_nop(b->jit_ptr);
+
+   data = b->jit_ptr;
+   memset(data,0,sizeof(struct mips64_chain_data));
+   ((struct mips64_chain_data *)data)->counter = TC_CHAIN_THRESHOLD;
+   b->jit_ptr += sizeof(struct mips64_chain_data);
+
+   *(m_int32_t *)(stub_lea - 4) = data - stub_lea;
+   *(m_int32_t *)(count_lea - 4) = data - count_lea;
 }
 
 /* Set Jump */
@@ -175,10 +291,17 @@ static void mips64_set_jump(cpu_mips_t *cpu,cpu_tc_t *b,
    }
 }
 
+/* Load a C function address (always 64-bit, recorded for relocation) */
+static forced_inline void mips64_emit_load_fn(cpu_tc_t *b,void *f)
+{
+   amd64_mov_reg_imm_size(b->jit_ptr,AMD64_RCX,f,8);
+   tc_record_reloc(b,b->jit_ptr - sizeof(m_uint64_t));
+}
+
 /* Basic C call */
 static forced_inline void mips64_emit_basic_c_call(cpu_tc_t *b,void *f)
 {
-   amd64_mov_reg_imm(b->jit_ptr,AMD64_RCX,f);
+   mips64_emit_load_fn(b,f);
    amd64_call_reg(b->jit_ptr,AMD64_RCX);
 }
 
@@ -186,7 +309,7 @@ static forced_inline void mips64_emit_basic_c_call(cpu_tc_t *b,void *f)
 static void mips64_emit_c_call(cpu_tc_t *b,void *f)
 {   
    mips64_set_pc(b,b->vaddr+((b->trans_pos-1)<<2));
-   amd64_mov_reg_imm(b->jit_ptr,AMD64_RCX,f);
+   mips64_emit_load_fn(b,f);
    amd64_call_reg(b->jit_ptr,AMD64_RCX);
 }
 
@@ -201,6 +324,51 @@ void mips64_emit_single_step(cpu_tc_t *b,mips_insn_t insn)
 /* Fast memory operation prototype */
 typedef void (*memop_fast_access)(cpu_tc_t *b,int target);
 
+/* Fast LB */
+static void mips64_memop_fast_lb(cpu_tc_t *b,int target)
+{
+   amd64_widen_memindex_size(b->jit_ptr,AMD64_RDX,AMD64_RBX,0,AMD64_RSI,0,
+                             TRUE,FALSE,8);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RDX,8);
+}
+
+/* Fast LBU */
+static void mips64_memop_fast_lbu(cpu_tc_t *b,int target)
+{
+   amd64_widen_memindex_size(b->jit_ptr,X86_EDX,AMD64_RBX,0,AMD64_RSI,0,
+                             FALSE,FALSE,4);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RDX,8);
+}
+
+/* Fast LD */
+static void mips64_memop_fast_ld(cpu_tc_t *b,int target)
+{
+   amd64_mov_reg_memindex(b->jit_ptr,AMD64_RAX,AMD64_RBX,0,AMD64_RSI,0,8);
+   amd64_bswap64(b->jit_ptr,AMD64_RAX);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RAX,8);
+}
+
+/* Fast LH */
+static void mips64_memop_fast_lh(cpu_tc_t *b,int target)
+{
+   amd64_widen_memindex_size(b->jit_ptr,X86_EAX,AMD64_RBX,0,AMD64_RSI,0,
+                             FALSE,TRUE,4);
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_movsxd_reg_reg(b->jit_ptr,AMD64_RDX,X86_EAX);
+   amd64_shift_reg_imm(b->jit_ptr,X86_SAR,AMD64_RDX,16);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RDX,8);
+}
+
+/* Fast LHU */
+static void mips64_memop_fast_lhu(cpu_tc_t *b,int target)
+{
+   amd64_widen_memindex_size(b->jit_ptr,X86_EAX,AMD64_RBX,0,AMD64_RSI,0,
+                             FALSE,TRUE,4);
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_shift_reg_imm_size(b->jit_ptr,X86_SHR,X86_EAX,16,4);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RAX,8);
+}
+
 /* Fast LW */
 static void mips64_memop_fast_lw(cpu_tc_t *b,int target)
 {
@@ -212,6 +380,99 @@ static void mips64_memop_fast_lw(cpu_tc_t *b,int target)
    amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RDX,8);
 }
 
+/* Fast LWU */
+static void mips64_memop_fast_lwu(cpu_tc_t *b,int target)
+{
+   amd64_mov_reg_memindex(b->jit_ptr,AMD64_RAX,AMD64_RBX,0,AMD64_RSI,0,4);
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RAX,8);
+}
+
+/* 
+ * Unaligned word accesses: ECX = shift count computed from the low address
+ * bits (left: (addr & 3) * 8, right: (3 - (addr & 3)) * 8) and ESI is
+ * aligned on the word boundary.
+ */
+static void mips64_memop_fast_unaligned_setup(cpu_tc_t *b,int right)
+{
+   amd64_mov_reg_reg(b->jit_ptr,X86_ECX,X86_ESI,4);
+
+   if (right)
+      amd64_not_reg_size(b->jit_ptr,X86_ECX,4);
+
+   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_ECX,0x03,4);
+   amd64_shift_reg_imm_size(b->jit_ptr,X86_SHL,X86_ECX,3,4);
+   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_ESI,~0x03,4);
+   
+   /* EAX = aligned word */
+   amd64_mov_reg_memindex(b->jit_ptr,AMD64_RAX,AMD64_RBX,0,AMD64_RSI,0,4);
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+}
+
+/* Fast LWL */
+static void mips64_memop_fast_lwl(cpu_tc_t *b,int target)
+{
+   mips64_memop_fast_unaligned_setup(b,FALSE);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHL,X86_EAX,4);
+
+   /* EDX = bits of the register kept = (1 << shift) - 1 */
+   amd64_mov_reg_imm(b->jit_ptr,X86_EDX,1);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHL,X86_EDX,4);
+   amd64_dec_reg_size(b->jit_ptr,X86_EDX,4);
+   amd64_alu_reg_membase_size(b->jit_ptr,X86_AND,X86_EDX,
+                              AMD64_R15,REG_OFFSET(target),4);
+
+   amd64_alu_reg_reg_size(b->jit_ptr,X86_OR,X86_EAX,X86_EDX,4);
+   amd64_movsxd_reg_reg(b->jit_ptr,AMD64_RDX,X86_EAX);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RDX,8);
+}
+
+/* Fast LWR */
+static void mips64_memop_fast_lwr(cpu_tc_t *b,int target)
+{
+   mips64_memop_fast_unaligned_setup(b,TRUE);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHR,X86_EAX,4);
+   amd64_movsxd_reg_reg(b->jit_ptr,AMD64_RAX,X86_EAX);
+
+   /* 
+    * RDX = bits of the register replaced (sign-extended, so that the 
+    * whole register is replaced for an aligned access).
+    */
+   amd64_mov_reg_imm(b->jit_ptr,X86_EDX,0xffffffff);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHR,X86_EDX,4);
+   amd64_movsxd_reg_reg(b->jit_ptr,AMD64_RDX,X86_EDX);
+   amd64_not_reg(b->jit_ptr,AMD64_RDX);
+   amd64_alu_reg_membase(b->jit_ptr,X86_AND,AMD64_RDX,
+                         AMD64_R15,REG_OFFSET(target));
+
+   amd64_alu_reg_reg(b->jit_ptr,X86_OR,AMD64_RAX,AMD64_RDX);
+   amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,REG_OFFSET(target),AMD64_RAX,8);
+}
+
+/* Fast SB */
+static void mips64_memop_fast_sb(cpu_tc_t *b,int target)
+{
+   amd64_mov_reg_membase(b->jit_ptr,AMD64_RAX,AMD64_R15,REG_OFFSET(target),4);
+   amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,X86_EAX,1);
+}
+
+/* Fast SD */
+static void mips64_memop_fast_sd(cpu_tc_t *b,int target)
+{
+   amd64_mov_reg_membase(b->jit_ptr,AMD64_RAX,AMD64_R15,REG_OFFSET(target),8);
+   amd64_bswap64(b->jit_ptr,AMD64_RAX);
+   amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RAX,8);
+}
+
+/* Fast SH */
+static void mips64_memop_fast_sh(cpu_tc_t *b,int target)
+{
+   amd64_mov_reg_membase(b->jit_ptr,AMD64_RAX,AMD64_R15,REG_OFFSET(target),4);
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_shift_reg_imm_size(b->jit_ptr,X86_SHR,X86_EAX,16,4);
+   amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,X86_EAX,2);
+}
+
 /* Fast SW */
 static void mips64_memop_fast_sw(cpu_tc_t *b,int target)
 {
@@ -221,9 +482,48 @@ static void mips64_memop_fast_sw(cpu_tc_t *b,int target)
    amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RAX,4);
 }
 
+/* Fast SWL */
+static void mips64_memop_fast_swl(cpu_tc_t *b,int target)
+{
+   mips64_memop_fast_unaligned_setup(b,FALSE);
+
+   /* Keep the bytes of the memory word on the left of the address */
+   amd64_mov_reg_imm(b->jit_ptr,X86_EDX,0xffffffff);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHR,X86_EDX,4);
+   amd64_not_reg_size(b->jit_ptr,X86_EDX,4);
+   amd64_alu_reg_reg_size(b->jit_ptr,X86_AND,X86_EAX,X86_EDX,4);
+
+   amd64_mov_reg_membase(b->jit_ptr,X86_EDX,AMD64_R15,REG_OFFSET(target),4);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHR,X86_EDX,4);
+   amd64_alu_reg_reg_size(b->jit_ptr,X86_OR,X86_EAX,X86_EDX,4);
+
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RAX,4);
+}
+
+/* Fast SWR */
+static void mips64_memop_fast_swr(cpu_tc_t *b,int target)
+{
+   mips64_memop_fast_unaligned_setup(b,TRUE);
+
+   /* Keep the bytes of the memory word on the right of the address */
+   amd64_mov_reg_imm(b->jit_ptr,X86_EDX,1);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHL,X86_EDX,4);
+   amd64_dec_reg_size(b->jit_ptr,X86_EDX,4);
+   amd64_alu_reg_reg_size(b->jit_ptr,X86_AND,X86_EAX,X86_EDX,4);
+
+   amd64_mov_reg_membase(b->jit_ptr,X86_EDX,AMD64_R15,REG_OFFSET(target),4);
+   amd64_shift_reg_size(b->jit_ptr,X86_SHL,X86_EDX,4);
+   amd64_alu_reg_reg_size(b->jit_ptr,X86_OR,X86_EAX,X86_EDX,4);
+
+   amd64_bswap32(b->jit_ptr,X86_EAX);
+   amd64_mov_memindex_reg(b->jit_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RAX,4);
+}
+
 /* Fast memory operation (64-bit) */
-static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast64(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {   
@@ -235,12 +535,18 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    /* XXX */
    amd64_inc_membase(b->jit_ptr,AMD64_R15,OFFSET(cpu_mips_t,mts_lookups));
 
+   if (!keep_ll_bit) {
+      amd64_clear_reg(b->jit_ptr,AMD64_RCX);
+      amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,OFFSET(cpu_mips_t,ll_bit),
+                            X86_ECX,4);
+   }
+
    /* RSI = GPR[base] + sign-extended offset */
    mips64_load_imm(b,AMD64_RSI,val);
    amd64_alu_reg_membase(b->jit_ptr,X86_ADD,
                          AMD64_RSI,AMD64_R15,REG_OFFSET(base));
 
-   /* RBX = mts64_entry index */
+   /* RBX = index of the first mts64 entry of the set */
    amd64_mov_reg_reg_size(b->jit_ptr,X86_EBX,X86_ESI,4);
    amd64_mov_reg_reg_size(b->jit_ptr,X86_EAX,X86_ESI,4);
 
@@ -248,13 +554,13 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    amd64_shift_reg_imm_size(b->jit_ptr,X86_SHR,X86_EAX,MTS64_HASH_SHIFT2,4);
    amd64_alu_reg_reg(b->jit_ptr,X86_XOR,AMD64_RBX,AMD64_RAX);
 
-   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_EBX,MTS64_HASH_MASK,8);
+   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_EBX,cpu->mts_set_mask,8);
 
    /* RCX = mts64 entry */
    amd64_mov_reg_membase(b->jit_ptr,AMD64_RCX,
                          AMD64_R15,
                          OFFSET(cpu_mips_t,mts_u.mts64_cache),8);
-   amd64_shift_reg_imm(b->jit_ptr,X86_SHL,AMD64_RBX,5);  /* TO FIX */
+   amd64_shift_reg_imm(b->jit_ptr,X86_SHL,AMD64_RBX,cpu->mts_set_shift);
    amd64_alu_reg_reg(b->jit_ptr,X86_ADD,AMD64_RCX,AMD64_RBX);
 
    /* Compare virtual page address (EAX = vpage) */
@@ -266,11 +572,14 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    test1 = b->jit_ptr;
    x86_branch8(b->jit_ptr, X86_CC_NZ, 0, 1);
 
-   /* Test if we are writing to a COW page */
+   /* 
+    * Test if we are writing to a COW page or to a page containing 
+    * translated code (invalidated by the slow path).
+    */
    if (write_op) {
       amd64_test_membase_imm_size(b->jit_ptr,
                                   AMD64_RCX,OFFSET(mts64_entry_t,flags),
-                                  MTS_FLAG_WRCATCH,4);
+                                  MTS_FLAG_WRCATCH|MTS_FLAG_EXEC,4);
       test2 = b->jit_ptr;
       amd64_branch8(b->jit_ptr, X86_CC_NZ, 0, 1);
    }
@@ -312,8 +621,9 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
 }
 
 /* Fast memory operation (32-bit) */
-static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast32(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {   
@@ -325,12 +635,18 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    /* XXX */
    amd64_inc_membase(b->jit_ptr,AMD64_R15,OFFSET(cpu_mips_t,mts_lookups));
 
+   if (!keep_ll_bit) {
+      amd64_clear_reg(b->jit_ptr,AMD64_RCX);
+      amd64_mov_membase_reg(b->jit_ptr,AMD64_R15,OFFSET(cpu_mips_t,ll_bit),
+                            X86_ECX,4);
+   }
+
    /* ESI = GPR[base] + sign-extended offset */
    amd64_mov_reg_imm(b->jit_ptr,X86_ESI,val);
    amd64_alu_reg_membase_size(b->jit_ptr,X86_ADD,
                               X86_ESI,AMD64_R15,REG_OFFSET(base),4);
 
-   /* RBX = mts32_entry index */
+   /* RBX = index of the first mts32 entry of the set */
    amd64_mov_reg_reg_size(b->jit_ptr,X86_EBX,X86_ESI,4);
    amd64_mov_reg_reg_size(b->jit_ptr,X86_EAX,X86_ESI,4);
 
@@ -338,13 +654,13 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    amd64_shift_reg_imm_size(b->jit_ptr,X86_SHR,X86_EAX,MTS32_HASH_SHIFT2,4);
    amd64_alu_reg_reg(b->jit_ptr,X86_XOR,AMD64_RBX,AMD64_RAX);
 
-   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_EBX,MTS32_HASH_MASK,4);
+   amd64_alu_reg_imm_size(b->jit_ptr,X86_AND,X86_EBX,cpu->mts_set_mask,4);
 
    /* RCX = mts32 entry */
    amd64_mov_reg_membase(b->jit_ptr,AMD64_RCX,
                          AMD64_R15,
                          OFFSET(cpu_mips_t,mts_u.mts32_cache),8);
-   amd64_shift_reg_imm(b->jit_ptr,X86_SHL,AMD64_RBX,5);  /* TO FIX */
+   amd64_shift_reg_imm(b->jit_ptr,X86_SHL,AMD64_RBX,cpu->mts_set_shift);
    amd64_alu_reg_reg(b->jit_ptr,X86_ADD,AMD64_RCX,AMD64_RBX);
 
    /* Compare virtual page address (EAX = vpage) */
@@ -356,11 +672,14 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    test1 = b->jit_ptr;
    x86_branch8(b->jit_ptr, X86_CC_NZ, 0, 1);
 
-   /* Test if we are writing to a COW page */
+   /* 
+    * Test if we are writing to a COW page or to a page containing 
+    * translated code (invalidated by the slow path).
+    */
    if (write_op) {
       amd64_test_membase_imm_size(b->jit_ptr,
                                   AMD64_RCX,OFFSET(mts32_entry_t,flags),
-                                  MTS_FLAG_WRCATCH,4);
+                                  MTS_FLAG_WRCATCH|MTS_FLAG_EXEC,4);
       test2 = b->jit_ptr;
       amd64_branch8(b->jit_ptr, X86_CC_NZ, 0, 1);
    }
@@ -410,12 +729,12 @@ static void mips64_emit_memop_fast(cpu_mips_t *cpu,cpu_tc_t *b,
 {
    switch(cpu->addr_mode) {
       case 32:
-         mips64_emit_memop_fast32(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast32(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
       case 64:
-         mips64_emit_memop_fast64(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast64(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
    }
 }
@@ -1764,7 +2083,12 @@ DECLARE_INSN(LB)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LB,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LB,base,offset,rt,TRUE,
+                             mips64_memop_fast_lb);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LB,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1775,7 +2099,12 @@ DECLARE_INSN(LBU)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LBU,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LBU,base,offset,rt,TRUE,
+                             mips64_memop_fast_lbu);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LBU,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1786,7 +2115,12 @@ DECLARE_INSN(LD)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LD,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LD,base,offset,rt,TRUE,
+                             mips64_memop_fast_ld);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LD,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1830,7 +2164,12 @@ DECLARE_INSN(LH)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LH,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LH,base,offset,rt,TRUE,
+                             mips64_memop_fast_lh);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LH,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1841,7 +2180,12 @@ DECLARE_INSN(LHU)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LHU,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LHU,base,offset,rt,TRUE,
+                             mips64_memop_fast_lhu);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LHU,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1910,7 +2254,12 @@ DECLARE_INSN(LWL)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LWL,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LWL,base,offset,rt,TRUE,
+                             mips64_memop_fast_lwl);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LWL,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1921,7 +2270,12 @@ DECLARE_INSN(LWR)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LWR,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LWR,base,offset,rt,TRUE,
+                             mips64_memop_fast_lwr);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LWR,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -1932,7 +2286,12 @@ DECLARE_INSN(LWU)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_LWU,base,offset,rt,TRUE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,0,MIPS_MEMOP_LWU,base,offset,rt,TRUE,
+                             mips64_memop_fast_lwu);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_LWU,base,offset,rt,TRUE);
+   }
    return(0);
 }
 
@@ -2201,7 +2560,12 @@ DECLARE_INSN(SB)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_SB,base,offset,rt,FALSE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,1,MIPS_MEMOP_SB,base,offset,rt,FALSE,
+                             mips64_memop_fast_sb);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_SB,base,offset,rt,FALSE);
+   }
    return(0);
 }
 
@@ -2223,7 +2587,12 @@ DECLARE_INSN(SD)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_SD,base,offset,rt,FALSE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,1,MIPS_MEMOP_SD,base,offset,rt,FALSE,
+                             mips64_memop_fast_sd);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_SD,base,offset,rt,FALSE);
+   }
    return(0);
 }
 
@@ -2267,7 +2636,12 @@ DECLARE_INSN(SH)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_SH,base,offset,rt,FALSE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,1,MIPS_MEMOP_SH,base,offset,rt,FALSE,
+                             mips64_memop_fast_sh);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_SH,base,offset,rt,FALSE);
+   }
    return(0);
 }
 
@@ -2544,7 +2918,12 @@ DECLARE_INSN(SWL)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_SWL,base,offset,rt,FALSE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,1,MIPS_MEMOP_SWL,base,offset,rt,FALSE,
+                             mips64_memop_fast_swl);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_SWL,base,offset,rt,FALSE);
+   }
    return(0);
 }
 
@@ -2555,7 +2934,12 @@ DECLARE_INSN(SWR)
    int rt     = bits(insn,16,20);
    int offset = bits(insn,0,15);
 
-   mips64_emit_memop(b,MIPS_MEMOP_SWR,base,offset,rt,FALSE);
+   if (cpu->fast_memop) {
+      mips64_emit_memop_fast(cpu,b,1,MIPS_MEMOP_SWR,base,offset,rt,FALSE,
+                             mips64_memop_fast_swr);
+   } else {
+      mips64_emit_memop(b,MIPS_MEMOP_SWR,base,offset,rt,FALSE);
+   }
    return(0);
 }
 
@@ -14,6 +14,9 @@
 
 #define JIT_SUPPORT 1
 
+/* Host absolute addresses are recorded (persistent TC cache) */
+#define JIT_RELOC_SUPPORT 1
+
 /* Manipulate bitmasks atomically */
 static forced_inline void atomic_or(m_uint32_t *v,m_uint32_t m)
 {
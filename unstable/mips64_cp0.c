@@ -19,6 +19,7 @@
 #include "mips64_cp0.h"
 #include "dynamips.h"
 #include "memory.h"
+#include "tcb.h"
 
 /* MIPS cp0 registers names */
 char *mips64_cp0_reg_names[MIPS64_CP0_REG_NR] = {
@@ -171,6 +172,12 @@ static inline void mips64_cp0_set_reg(cpu_mips_t *cpu,u_int cp0_reg,
          break;
 
      case MIPS_CP0_TLB_HI:
+         /* Mappings of the previous address space are not valid anymore */
+         if ((cp0->reg[cp0_reg] ^ val) & MIPS_TLB_ASID_MASK) {
+            cpu->mts_invalidate_asid(cpu);
+            cpu_jit_unlink_chains(cpu->gen);
+         }
+
          cp0->reg[cp0_reg] = val & MIPS_CP0_HI_SAFE_MASK;
          break;
 
@@ -352,7 +359,7 @@ int mips64_cp0_tlb_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
    mips_cp0_t *cp0 = &cpu->cp0;
    m_uint64_t vpn_addr,vpn2_mask;
    m_uint64_t page_mask,hi_addr;
-   m_uint32_t page_size,pca;
+   m_uint32_t page_size,pca,tag;
    tlb_entry_t *entry;
    u_int asid;
    int i;
@@ -374,6 +381,12 @@ int mips64_cp0_tlb_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
       {
          page_size = get_page_size(entry->mask);
 
+         /* Tag the MTS entries with the address space */
+         if (entry->hi & MIPS_TLB_G_MASK)
+            tag = MTS_TAG_GLOBAL;
+         else
+            tag = MTS_TAG_ASID(asid);
+
          if ((vaddr & page_size) == 0) {
             /* Even Page */
             if (entry->lo0 & MIPS_TLB_V_MASK) 
@@ -382,7 +395,7 @@ int mips64_cp0_tlb_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                if ((op_type == MTS_WRITE) && !(entry->lo0 & MIPS_TLB_D_MASK))
                   return MIPS_TLB_LOOKUP_MOD;
                
-               res->flags = 0;
+               res->flags = tag;
                res->vaddr = vaddr & MIPS_MIN_PAGE_MASK;
                res->paddr = (entry->lo0 & MIPS_TLB_PFN_MASK) << 6;
                res->paddr += (res->vaddr & (page_size-1));
@@ -407,7 +420,7 @@ int mips64_cp0_tlb_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                if ((op_type == MTS_WRITE) && !(entry->lo1 & MIPS_TLB_D_MASK))
                   return MIPS_TLB_LOOKUP_MOD;
 
-               res->flags = 0;
+               res->flags = tag;
                res->vaddr = vaddr & MIPS_MIN_PAGE_MASK;
                res->paddr = (entry->lo1 & MIPS_TLB_PFN_MASK) << 6;
                res->paddr += (res->vaddr & (page_size-1));
@@ -486,6 +499,12 @@ void mips64_cp0_exec_tlbr(cpu_mips_t *cpu)
    {
       entry = &cp0->tlb[index];
 
+      /* The ASID of the entry becomes the current one */
+      if ((cp0->reg[MIPS_CP0_TLB_HI] ^ entry->hi) & MIPS_TLB_ASID_MASK) {
+         cpu->mts_invalidate_asid(cpu);
+         cpu_jit_unlink_chains(cpu->gen);
+      }
+
       cp0->reg[MIPS_CP0_PAGEMASK] = entry->mask;
       cp0->reg[MIPS_CP0_TLB_HI]   = entry->hi;
       cp0->reg[MIPS_CP0_TLB_LO_0] = entry->lo0;
@@ -503,6 +522,30 @@ void mips64_cp0_exec_tlbr(cpu_mips_t *cpu)
    }
 }
 
+/* Invalidate the MTS entries of pages covered by a TLB entry */
+static void mips64_cp0_tlb_invalidate_mts(cpu_mips_t *cpu,tlb_entry_t *entry)
+{
+   m_uint64_t vaddr;
+   m_uint32_t page_size;
+
+   /* Jumps chained to pages of the previous mapping */
+   cpu_jit_unlink_chains(cpu->gen);
+
+   /* 
+    * In 64-bit mode, the VPN2 of the entry doesn't give directly the
+    * (sign-extended) virtual address: flush everything.
+    */
+   if (cpu->addr_mode == 64) {
+      cpu->mts_invalidate(cpu);
+      return;
+   }
+
+   page_size = get_page_size(entry->mask);
+   vaddr = entry->hi & mips64_cp0_get_vpn2_mask(cpu) & ~entry->mask;
+
+   cpu->mts_invalidate_range(cpu,vaddr,2 * (m_uint64_t)page_size);
+}
+
 /* TLBW: Write a TLB entry */
 static inline void mips64_cp0_exec_tlbw(cpu_mips_t *cpu,u_int index)
 {
@@ -522,6 +565,9 @@ static inline void mips64_cp0_exec_tlbw(cpu_mips_t *cpu,u_int index)
 
       mips64_cp0_tlb_callback(cpu,entry,TLB_ZONE_ADD);
 
+      /* Inform the MTS subsystem that the previous mapping disappears */
+      mips64_cp0_tlb_invalidate_mts(cpu,entry);
+
       entry->mask = cp0->reg[MIPS_CP0_PAGEMASK] & MIPS_TLB_PAGE_MASK;
       entry->hi   = cp0->reg[MIPS_CP0_TLB_HI];
       entry->lo0  = cp0->reg[MIPS_CP0_TLB_LO_0];
@@ -538,7 +584,7 @@ static inline void mips64_cp0_exec_tlbw(cpu_mips_t *cpu,u_int index)
       entry->lo1 &= ~MIPS_CP0_LO_G_MASK;
 
       /* Inform the MTS subsystem */
-      cpu->mts_invalidate(cpu);
+      mips64_cp0_tlb_invalidate_mts(cpu,entry);
 
       mips64_cp0_tlb_callback(cpu,entry,TLB_ZONE_DELETE);
 
@@ -23,11 +23,50 @@
 #include "insn_lookup.h"
 #include "dynamips.h"
 #include "crc.h"
+#include "ios_unpack.h"
+#include "host_perf.h"
 
 /* Forward declaration of instruction array */
 static struct mips64_insn_exec_tag mips64_exec_tags[];
 static insn_lookup_t *ilt = NULL;
 
+struct mips64_predec_insn;
+
+/* Handler of a predecoded instruction */
+typedef int (*mips64_predec_fn)(cpu_mips_t *,struct mips64_predec_insn *);
+
+/* Predecoded instruction: handler and operands of an instruction word */
+struct mips64_predec_insn {
+   mips64_predec_fn exec;
+   mips_insn_t insn;
+   m_int32_t imm;
+   m_uint8_t rs,rt,rd,sa;
+   m_uint16_t index;
+};
+
+/* Predecoded page, bound to the host page holding the instructions */
+struct mips64_predec_page {
+   mips_insn_t *host_page;
+   struct mips64_predec_insn insn[MIPS_INSN_PER_PAGE];
+};
+
+/* Immediate operand of a predecoded instruction */
+enum {
+   MIPS64_PREDEC_IMM_S16 = 0,   /* sign-extended 16-bit value */
+   MIPS64_PREDEC_IMM_U16,       /* zero-extended 16-bit value */
+   MIPS64_PREDEC_IMM_BRANCH,    /* branch offset */
+   MIPS64_PREDEC_IMM_JUMP,      /* jump target in the current 256 Mb */
+};
+
+/* Instruction with a handler using predecoded operands */
+struct mips64_predec_tag {
+   int (*exec)(cpu_mips_t *,mips_insn_t);
+   mips64_predec_fn predec;
+   int imm_type;
+};
+
+static struct mips64_predec_tag mips64_predec_tags[];
+
 /* ILT */
 static forced_inline void *mips64_exec_get_insn(int index)
 {
@@ -85,6 +124,7 @@ void mips64_dump_stats(cpu_mips_t *cpu)
              mips64_exec_tags[i].name,mips64_exec_tags[i].count);
 
    printf("%llu instructions executed since startup.\n",cpu->insn_exec_count);
+   printf("%llu pages predecoded since startup.\n",cpu->njm_predec_fills);
 #else
    printf("Statistics support is not compiled in.\n");
 #endif
@@ -318,6 +358,133 @@ static forced_inline void mips64_exec_memop2(cpu_mips_t *cpu,int memop,
    fn(cpu,vaddr,dst_reg);
 }
 
+/* Instruction without predecoded operands */
+static int mips64_exec_predec_generic(cpu_mips_t *cpu,
+                                      struct mips64_predec_insn *p)
+{
+   return(mips64_exec_tags[p->index].exec(cpu,p->insn));
+}
+
+/* Decode an instruction, with its operands if its handler uses them */
+static void mips64_exec_predecode(struct mips64_predec_insn *p,
+                                  mips_insn_t instruction)
+{
+   struct mips64_predec_tag *tag;
+   int (*exec)(cpu_mips_t *,mips_insn_t);
+
+   p->insn  = instruction;
+   p->index = ilt_lookup(ilt,instruction);
+   p->exec  = mips64_exec_predec_generic;
+   p->rs    = bits(instruction,21,25);
+   p->rt    = bits(instruction,16,20);
+   p->rd    = bits(instruction,11,15);
+   p->sa    = bits(instruction,6,10);
+   p->imm   = sign_extend(bits(instruction,0,15),16);
+
+   exec = mips64_exec_tags[p->index].exec;
+
+   for(tag=mips64_predec_tags;tag->exec;tag++) {
+      if (tag->exec != exec)
+         continue;
+
+      switch(tag->imm_type) {
+         case MIPS64_PREDEC_IMM_U16:
+            p->imm = bits(instruction,0,15);
+            break;
+         case MIPS64_PREDEC_IMM_BRANCH:
+            p->imm = sign_extend(bits(instruction,0,15) << 2,18);
+            break;
+         case MIPS64_PREDEC_IMM_JUMP:
+            p->imm = bits(instruction,0,25) << 2;
+            break;
+      }
+
+      p->exec = tag->predec;
+      break;
+   }
+}
+
+/* Hash on host page addresses for predecoded pages */
+static forced_inline u_int mips64_exec_predec_hash(void *host_page)
+{
+   return(((m_iptr_t)host_page >> MIPS_MIN_PAGE_SHIFT) & 
+          (MIPS64_PREDEC_CACHE_SIZE - 1));
+}
+
+/* Get the predecoded page of a host page (NULL if no memory) */
+static struct mips64_predec_page *
+mips64_exec_predec_get(cpu_mips_t *cpu,mips_insn_t *host_page)
+{
+   struct mips64_predec_page **pp,*p;
+   u_int i;
+
+   pp = &cpu->njm_predec_cache[mips64_exec_predec_hash(host_page)];
+
+   if (likely((p = *pp) != NULL) && likely(p->host_page == host_page))
+      return p;
+
+   /* 
+    * Reuse the slot: entries only depend on the instruction word, which
+    * is checked before each execution.
+    */
+   if (!p) {
+      if (!(p = *pp = malloc(sizeof(*p))))
+         return NULL;
+
+      mips64_exec_predecode(&p->insn[0],0);
+
+      for(i=1;i<MIPS_INSN_PER_PAGE;i++)
+         p->insn[i] = p->insn[0];
+   }
+
+   p->host_page = host_page;
+   cpu->njm_predec_fills++;
+   return p;
+}
+
+/* Forget the predecoded instructions of a host page */
+void mips64_exec_predec_invalidate(cpu_mips_t *cpu,void *host_page)
+{
+   struct mips64_predec_page *p;
+
+   p = cpu->njm_predec_cache[mips64_exec_predec_hash(host_page)];
+
+   if ((p != NULL) && (p->host_page == host_page))
+      p->host_page = NULL;
+}
+
+/* Forget all predecoded pages (entries are kept for reuse) */
+void mips64_exec_predec_flush(cpu_mips_t *cpu)
+{
+   u_int i;
+
+   for(i=0;i<MIPS64_PREDEC_CACHE_SIZE;i++)
+      if (cpu->njm_predec_cache[i] != NULL)
+         cpu->njm_predec_cache[i]->host_page = NULL;
+}
+
+/* Free the predecoded pages of a CPU */
+void mips64_exec_predec_free(cpu_mips_t *cpu)
+{
+   u_int i;
+
+   for(i=0;i<MIPS64_PREDEC_CACHE_SIZE;i++) {
+      free(cpu->njm_predec_cache[i]);
+      cpu->njm_predec_cache[i] = NULL;
+   }
+
+   cpu->njm_predec = NULL;
+}
+
+/* Set the current exec page (non-JIT) */
+static forced_inline void mips64_exec_set_page(cpu_mips_t *cpu,
+                                               m_uint64_t exec_page)
+{
+   cpu->njm_exec_ptr  = cpu->mem_op_ifetch(cpu,exec_page);
+   cpu->njm_exec_page = exec_page;
+   cpu->njm_predec    = mips64_exec_predec_get(cpu,cpu->njm_exec_ptr);
+}
+
 /* Fetch an instruction */
 static forced_inline int mips64_exec_fetch(cpu_mips_t *cpu,m_uint64_t pc,
                                            mips_insn_t *insn)
@@ -328,8 +495,11 @@ static forced_inline int mips64_exec_fetch(cpu_mips_t *cpu,m_uint64_t pc,
    exec_page = pc & MIPS_MIN_PAGE_MASK;
 
    if (unlikely(exec_page != cpu->njm_exec_page)) {
-      cpu->njm_exec_ptr  = cpu->mem_op_ifetch(cpu,exec_page);
-      cpu->njm_exec_page = exec_page;
+      /* End of the IOS self-decompression ? */
+      if (unlikely(cpu->vm->ios_unpack_armed))
+         ios_unpack_check(cpu->gen);
+
+      mips64_exec_set_page(cpu,exec_page);
    }
 
    offset = (pc & MIPS_MIN_PAGE_IMASK) >> 2;
@@ -380,6 +550,39 @@ mips64_exec_single_instruction(cpu_mips_t *cpu,mips_insn_t instruction)
    return(exec(cpu,instruction));
 }
 
+/* 
+ * Execute an instruction of the current exec page, located at "pc",
+ * through the handler set when the instruction was predecoded.
+ */
+static forced_inline int 
+mips64_exec_predec_instruction(cpu_mips_t *cpu,m_uint64_t pc,
+                               mips_insn_t instruction)
+{
+   struct mips64_predec_insn *p;
+
+   if (unlikely(!cpu->njm_predec))
+      return(mips64_exec_single_instruction(cpu,instruction));
+
+   p = &cpu->njm_predec->insn[(pc & MIPS_MIN_PAGE_IMASK) >> 2];
+
+   /* Instruction executed for the first time or modified since */
+   if (unlikely(p->insn != instruction))
+      mips64_exec_predecode(p,instruction);
+
+#if DEBUG_INSN_PERF_CNT
+   cpu->perf_counter++;
+#endif
+
+   /* Increment CP0 count register */
+   mips64_exec_inc_cp0_cnt(cpu);
+
+#if NJM_STATS_ENABLE
+   cpu->insn_exec_count++;
+   mips64_exec_tags[p->index].count++;
+#endif
+   return(p->exec(cpu,p));
+}
+
 /* Single-step execution */
 void mips64_exec_single_step(cpu_mips_t *cpu,mips_insn_t instruction)
 {
@@ -396,14 +599,18 @@ int mips64_exec_page(cpu_mips_t *cpu)
 {
    m_uint32_t offset;
    mips_insn_t insn;
+   u_int count = 0;
    int res;
 
    /* Check IRQ */
    if (unlikely(cpu->irq_pending))
       mips64_trigger_irq(cpu);
 
-   cpu->njm_exec_page = cpu->pc & MIPS_MIN_PAGE_MASK;
-   cpu->njm_exec_ptr  = cpu->mem_op_ifetch(cpu,cpu->njm_exec_page);
+   /* End of the IOS self-decompression ? */
+   if (unlikely(cpu->vm->ios_unpack_armed))
+      ios_unpack_check(cpu->gen);
+
+   mips64_exec_set_page(cpu,cpu->pc & MIPS_MIN_PAGE_MASK);
 
    do {
       /* Reset "zero register" (for safety) */
@@ -412,9 +619,10 @@ int mips64_exec_page(cpu_mips_t *cpu)
       offset = (cpu->pc & MIPS_MIN_PAGE_IMASK) >> 2;
       insn = vmtoh32(cpu->njm_exec_ptr[offset]);
 
-      res = mips64_exec_single_instruction(cpu,insn);
+      res = mips64_exec_predec_instruction(cpu,cpu->pc,insn);
       if (likely(!res)) cpu->pc += sizeof(mips_insn_t);
-   }while((cpu->pc & MIPS_MIN_PAGE_MASK) == cpu->njm_exec_page);
+   }while(((cpu->pc & MIPS_MIN_PAGE_MASK) == cpu->njm_exec_page) &&
+          (++count < MIPS64_EXEC_PAGE_MAX_INSN));
 
    return(0);
 }
@@ -423,21 +631,22 @@ int mips64_exec_page(cpu_mips_t *cpu)
 void *mips64_exec_run_cpu(cpu_gen_t *gen)
 {   
    cpu_mips_t *cpu = CPU_MIPS64(gen);
-   pthread_t timer_irq_thread;
    int timer_irq_check = 0;
    mips_insn_t insn;
    int res;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)mips64_timer_irq_run,cpu))
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)mips64_timer_tick,
+                                             cpu)))
    {
-      fprintf(stderr,"VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+      fprintf(stderr,"VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(gen);
       return NULL;
    }
 
    gen->cpu_thread_running = TRUE;
+   gen->cpu_thread_tid = host_perf_gettid();
    cpu_exec_loop_set(gen);
 
  start_cpu:
@@ -447,6 +656,14 @@ void *mips64_exec_run_cpu(cpu_gen_t *gen)
       if (unlikely(gen->state != CPU_STATE_RUNNING))
          break;
 
+      /* Parked by another thread (remapping of memory pages) */
+      if (unlikely(gen->quiesce_req))
+         cpu_quiesce_wait(gen);
+
+      /* MTS invalidations requested by other threads */
+      if (unlikely(gen->mts_req_pending))
+         cpu_mts_handle_requests(gen);
+
       /* Handle virtual idle loop */
       if (unlikely(cpu->pc == cpu->idle_pc)) {
          if (++gen->idle_count == gen->idle_max) {
@@ -477,7 +694,7 @@ void *mips64_exec_run_cpu(cpu_gen_t *gen)
 
       /* Fetch and execute the instruction */      
       mips64_exec_fetch(cpu,cpu->pc,&insn);
-      res = mips64_exec_single_instruction(cpu,insn);
+      res = mips64_exec_predec_instruction(cpu,cpu->pc,insn);
 
       /* Normal flow ? */
       if (likely(!res)) cpu->pc += sizeof(mips_insn_t);
@@ -499,7 +716,8 @@ void *mips64_exec_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:     
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
@@ -522,7 +740,7 @@ static forced_inline void mips64_exec_bdslot(cpu_mips_t *cpu)
    mips64_exec_fetch(cpu,cpu->pc+4,&insn);
 
    /* Execute the instruction */
-   mips64_exec_single_instruction(cpu,insn);
+   mips64_exec_predec_instruction(cpu,cpu->pc+4,insn);
    
    /* Clear BD slot flag */
    cpu->bd_slot = 0;
@@ -2162,6 +2380,351 @@ static int mips64_exec_XORI(cpu_mips_t *cpu,mips_insn_t insn)
    return(0);
 }
 
+/* Execute a memory operation (predecoded operands) */
+static forced_inline void mips64_predec_memop(cpu_mips_t *cpu,int memop,
+                                              struct mips64_predec_insn *p,
+                                              int keep_ll_bit)
+{
+   m_uint64_t vaddr = cpu->gpr[p->rs] + (m_int64_t)p->imm;
+   mips_memop_fn fn;
+
+   if (!keep_ll_bit) cpu->ll_bit = 0;
+   fn = cpu->mem_op_fn[memop];
+   fn(cpu,vaddr,p->rt);
+}
+
+/* ADDIU (predecoded) */
+static int mips64_predec_ADDIU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint32_t res;
+
+   res = (m_uint32_t)cpu->gpr[p->rs] + (m_uint32_t)p->imm;
+   cpu->gpr[p->rt] = sign_extend(res,32);
+   return(0);
+}
+
+/* ADDU (predecoded) */
+static int mips64_predec_ADDU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint32_t res;
+
+   res = (m_uint32_t)cpu->gpr[p->rs] + (m_uint32_t)cpu->gpr[p->rt];
+   cpu->gpr[p->rd] = sign_extend(res,32);
+   return(0);
+}
+
+/* AND (predecoded) */
+static int mips64_predec_AND(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->gpr[p->rs] & cpu->gpr[p->rt];
+   return(0);
+}
+
+/* ANDI (predecoded) */
+static int mips64_predec_ANDI(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rt] = cpu->gpr[p->rs] & (m_uint32_t)p->imm;
+   return(0);
+}
+
+/* B (predecoded) */
+static int mips64_predec_B(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t new_pc;
+
+   /* compute the new pc */
+   new_pc = (cpu->pc + 4) + (m_int64_t)p->imm;
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* set the new pc in cpu structure */
+   cpu->pc = new_pc;
+   return(1);
+}
+
+/* BAL (predecoded) */
+static int mips64_predec_BAL(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t new_pc;
+
+   /* compute the new pc */
+   new_pc = (cpu->pc + 4) + (m_int64_t)p->imm;
+
+   /* set the return address (instruction after the delay slot) */
+   cpu->gpr[MIPS_GPR_RA] = cpu->pc + 8;
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* set the new pc in cpu structure */
+   cpu->pc = new_pc;
+   return(1);
+}
+
+/* Conditional branch (predecoded), "res" is the test result */
+static forced_inline int mips64_predec_branch(cpu_mips_t *cpu,
+                                              struct mips64_predec_insn *p,
+                                              int res)
+{
+   m_uint64_t new_pc;
+
+   /* compute the new pc */
+   new_pc = (cpu->pc + 4) + (m_int64_t)p->imm;
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* take the branch if the test result is true */
+   if (res)
+      cpu->pc = new_pc;
+   else
+      cpu->pc += 8;
+
+   return(1);
+}
+
+/* BEQ (predecoded) */
+static int mips64_predec_BEQ(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   return(mips64_predec_branch(cpu,p,cpu->gpr[p->rs] == cpu->gpr[p->rt]));
+}
+
+/* BEQZ (predecoded) */
+static int mips64_predec_BEQZ(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   return(mips64_predec_branch(cpu,p,cpu->gpr[p->rs] == 0));
+}
+
+/* BNE (predecoded) */
+static int mips64_predec_BNE(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   return(mips64_predec_branch(cpu,p,cpu->gpr[p->rs] != cpu->gpr[p->rt]));
+}
+
+/* BNEZ (predecoded) */
+static int mips64_predec_BNEZ(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   return(mips64_predec_branch(cpu,p,cpu->gpr[p->rs] != 0));
+}
+
+/* J (predecoded) */
+static int mips64_predec_J(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t new_pc;
+
+   /* compute the new pc */
+   new_pc = cpu->pc & ~((1 << 28) - 1);
+   new_pc |= (m_uint32_t)p->imm;
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* set the new pc */
+   cpu->pc = new_pc;
+   return(1);
+}
+
+/* JAL (predecoded) */
+static int mips64_predec_JAL(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t new_pc;
+
+   /* compute the new pc */
+   new_pc = cpu->pc & ~((1 << 28) - 1);
+   new_pc |= (m_uint32_t)p->imm;
+
+   /* set the return address (instruction after the delay slot) */
+   cpu->gpr[MIPS_GPR_RA] = cpu->pc + 8;
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* set the new pc */
+   cpu->pc = new_pc;
+   return(1);
+}
+
+/* JR (predecoded) */
+static int mips64_predec_JR(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t new_pc;
+
+   /* get the new pc */
+   new_pc = cpu->gpr[p->rs];
+
+   /* exec the instruction in the delay slot */
+   mips64_exec_bdslot(cpu);
+
+   /* set the new pc */
+   cpu->pc = new_pc;
+   return(1);
+}
+
+/* LBU (predecoded) */
+static int mips64_predec_LBU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   mips64_predec_memop(cpu,MIPS_MEMOP_LBU,p,TRUE);
+   return(0);
+}
+
+/* LI (predecoded) */
+static int mips64_predec_LI(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rt] = (m_int64_t)p->imm;
+   return(0);
+}
+
+/* LUI (predecoded) */
+static int mips64_predec_LUI(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rt] = (m_uint64_t)(m_int64_t)p->imm << 16;
+   return(0);
+}
+
+/* LW (predecoded) */
+static int mips64_predec_LW(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   mips64_predec_memop(cpu,MIPS_MEMOP_LW,p,TRUE);
+   return(0);
+}
+
+/* MOVE (predecoded) */
+static int mips64_predec_MOVE(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rd] = sign_extend(cpu->gpr[p->rs],32);
+   return(0);
+}
+
+/* NOP (predecoded) */
+static int mips64_predec_NOP(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   return(0);
+}
+
+/* OR (predecoded) */
+static int mips64_predec_OR(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->gpr[p->rs] | cpu->gpr[p->rt];
+   return(0);
+}
+
+/* ORI (predecoded) */
+static int mips64_predec_ORI(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rt] = cpu->gpr[p->rs] | (m_uint32_t)p->imm;
+   return(0);
+}
+
+/* SB (predecoded) */
+static int mips64_predec_SB(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   mips64_predec_memop(cpu,MIPS_MEMOP_SB,p,FALSE);
+   return(0);
+}
+
+/* SLL (predecoded) */
+static int mips64_predec_SLL(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint32_t res;
+
+   res = (m_uint32_t)cpu->gpr[p->rt] << p->sa;
+   cpu->gpr[p->rd] = sign_extend(res,32);
+   return(0);
+}
+
+/* SLTIU (predecoded) */
+static int mips64_predec_SLTIU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint64_t val = (m_int64_t)p->imm;
+
+   cpu->gpr[p->rt] = (cpu->gpr[p->rs] < val) ? 1 : 0;
+   return(0);
+}
+
+/* SLTU (predecoded) */
+static int mips64_predec_SLTU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rd] = (cpu->gpr[p->rs] < cpu->gpr[p->rt]) ? 1 : 0;
+   return(0);
+}
+
+/* SRL (predecoded) */
+static int mips64_predec_SRL(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint32_t res;
+
+   res = (m_uint32_t)cpu->gpr[p->rt] >> p->sa;
+   cpu->gpr[p->rd] = sign_extend(res,32);
+   return(0);
+}
+
+/* SUBU (predecoded) */
+static int mips64_predec_SUBU(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   m_uint32_t res;
+
+   res = (m_uint32_t)cpu->gpr[p->rs] - (m_uint32_t)cpu->gpr[p->rt];
+   cpu->gpr[p->rd] = sign_extend(res,32);
+   return(0);
+}
+
+/* SW (predecoded) */
+static int mips64_predec_SW(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   mips64_predec_memop(cpu,MIPS_MEMOP_SW,p,FALSE);
+   return(0);
+}
+
+/* XOR (predecoded) */
+static int mips64_predec_XOR(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->gpr[p->rs] ^ cpu->gpr[p->rt];
+   return(0);
+}
+
+/* XORI (predecoded) */
+static int mips64_predec_XORI(cpu_mips_t *cpu,struct mips64_predec_insn *p)
+{
+   cpu->gpr[p->rt] = cpu->gpr[p->rs] ^ (m_uint32_t)p->imm;
+   return(0);
+}
+
+/* Instructions run with predecoded operands (the others use their tag) */
+static struct mips64_predec_tag mips64_predec_tags[] = {
+   { mips64_exec_ADDIU , mips64_predec_ADDIU , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_ADDU  , mips64_predec_ADDU  , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_AND   , mips64_predec_AND   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_ANDI  , mips64_predec_ANDI  , MIPS64_PREDEC_IMM_U16 },
+   { mips64_exec_B     , mips64_predec_B     , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_BAL   , mips64_predec_BAL   , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_BEQ   , mips64_predec_BEQ   , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_BEQZ  , mips64_predec_BEQZ  , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_BNE   , mips64_predec_BNE   , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_BNEZ  , mips64_predec_BNEZ  , MIPS64_PREDEC_IMM_BRANCH },
+   { mips64_exec_J     , mips64_predec_J     , MIPS64_PREDEC_IMM_JUMP },
+   { mips64_exec_JAL   , mips64_predec_JAL   , MIPS64_PREDEC_IMM_JUMP },
+   { mips64_exec_JR    , mips64_predec_JR    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_LBU   , mips64_predec_LBU   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_LI    , mips64_predec_LI    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_LUI   , mips64_predec_LUI   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_LW    , mips64_predec_LW    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_MOVE  , mips64_predec_MOVE  , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_NOP   , mips64_predec_NOP   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_OR    , mips64_predec_OR    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_ORI   , mips64_predec_ORI   , MIPS64_PREDEC_IMM_U16 },
+   { mips64_exec_SB    , mips64_predec_SB    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SLL   , mips64_predec_SLL   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SLTIU , mips64_predec_SLTIU , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SLTU  , mips64_predec_SLTU  , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SRL   , mips64_predec_SRL   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SUBU  , mips64_predec_SUBU  , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_SW    , mips64_predec_SW    , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_XOR   , mips64_predec_XOR   , MIPS64_PREDEC_IMM_S16 },
+   { mips64_exec_XORI  , mips64_predec_XORI  , MIPS64_PREDEC_IMM_U16 },
+   { NULL              , NULL                , 0 },
+};
+
 /* MIPS instruction array */
 static struct mips64_insn_exec_tag mips64_exec_tags[] = {
    { "li"     , mips64_exec_LI      , 0xffe00000 , 0x24000000, 1, 16 },
@@ -8,6 +8,12 @@
 
 #include "utils.h"
 
+/* 
+ * Maximum number of instructions executed by mips64_exec_page() before
+ * returning to the main loop (for loops contained in a single page).
+ */
+#define MIPS64_EXEC_PAGE_MAX_INSN  1024
+
 /* MIPS instruction recognition */
 struct mips64_insn_exec_tag {
    char *name;
@@ -38,6 +44,15 @@ void mips64_exec_single_step(cpu_mips_t *cpu,mips_insn_t instruction);
 /* Execute a page */
 int mips64_exec_page(cpu_mips_t *cpu);
 
+/* Forget the predecoded instructions of a host page */
+void mips64_exec_predec_invalidate(cpu_mips_t *cpu,void *host_page);
+
+/* Forget all predecoded pages */
+void mips64_exec_predec_flush(cpu_mips_t *cpu);
+
+/* Free the predecoded pages of a CPU */
+void mips64_exec_predec_free(cpu_mips_t *cpu);
+
 /* Run MIPS code in step-by-step mode */
 void *mips64_exec_run_cpu(cpu_gen_t *cpu);
 
@@ -19,6 +19,7 @@
 #include "cpu.h"
 #include "device.h"
 #include "tcb.h"
+#include "tc_cache.h"
 #include "mips64.h"
 #include "mips64_cp0.h"
 #include "mips64_exec.h"
@@ -27,6 +28,8 @@
 #include "memory.h"
 #include "ptask.h"
 #include "crc.h"
+#include "ios_unpack.h"
+#include "host_perf.h"
 
 #include MIPS64_ARCH_INC_FILE
 
@@ -111,6 +114,12 @@ int mips64_jit_init(cpu_mips_t *cpu)
 {
    if (tsg_bind_cpu(cpu->gen) == -1)
       return(-1);
+
+#if JIT_RELOC_SUPPORT
+   /* Persistent cache of translated code, shared by CPUs of the VM */
+   if (!cpu->vm->tc_cache)
+      cpu->vm->tc_cache = tc_cache_open(cpu->vm->ios_image);
+#endif
    
    return(cpu_jit_init(cpu->gen,
                        MIPS_JIT_VIRT_HASH_SIZE,
@@ -282,14 +291,40 @@ static int mips64_jit_tcb_adjust_buffer(cpu_mips_t *cpu,cpu_tc_t *tc)
    return(tc_adjust_jit_buffer(cpu->gen,tc,mips64_jit_tcb_set_jump));
 }
 
+#if JIT_RELOC_SUPPORT
+/* 
+ * Get the code generation variant used to key the persistent cache.
+ * Returns -1 if there is no cache or if the code depends on debug options.
+ */
+static int mips64_jit_cache_variant(cpu_mips_t *cpu,m_uint32_t *variant)
+{
+   if (!cpu->vm->tc_cache || cpu->sym_trace)
+      return(-1);
+
+#if BREAKPOINT_ENABLE
+   if (cpu->breakpoints_enabled)
+      return(-1);
+#endif
+
+   /* The fast memory operations embed the MTS cache geometry */
+   *variant = (cpu->mts_set_bits << 24) | (cpu->mts_set_shift << 16);
+   *variant |= (cpu->addr_mode << 8) | cpu->fast_memop;
+   return(0);
+}
+#endif
+
 /* Produce translated code for a page. If this fails, use non-compiled mode */
-static cpu_tc_t *mips64_jit_tcb_translate(cpu_mips_t *cpu,cpu_tb_t *tb)
+static cpu_tc_t *mips64_jit_tcb_translate(cpu_mips_t *cpu,cpu_tb_t *tb,
+                                          u_int tc_flags)
 {
    struct mips64_insn_tag *tag;
    cpu_tc_t *tc;
+#if JIT_RELOC_SUPPORT
+   m_uint32_t variant;
+#endif
    
    /* The page is not shared, we have to compile it */
-   tc = tc_alloc(cpu->gen,tb->vaddr,tb->exec_state);
+   tc = tc_alloc(cpu->gen,tb->vaddr,tb->exec_state,tc_flags);
    
    if (tc == NULL)
       return NULL;
@@ -319,10 +354,81 @@ static cpu_tc_t *mips64_jit_tcb_translate(cpu_mips_t *cpu,cpu_tb_t *tb)
    mips64_jit_tcb_add_end(tc);
    mips64_jit_tcb_apply_patches(cpu,tc);
    tc_free_patches(tc);
+
+#if JIT_RELOC_SUPPORT
+   if (mips64_jit_cache_variant(cpu,&variant) != -1)
+      tc_cache_store(cpu->vm->tc_cache,tb,tc,variant);
+#endif
+   tc_free_relocs(tc);
+
    tc->target_code = NULL;
    return tc;
 }
 
+/* 
+ * Translate a page in a background thread, on copies of the TB and
+ * of the CPU state.
+ */
+static cpu_tc_t *mips64_jit_tcb_translate_job(cpu_gen_t *gen,cpu_tb_t *tb)
+{
+   return(mips64_jit_tcb_translate(CPU_MIPS64(gen),tb,TC_FLAG_ASYNC));
+}
+
+/* 
+ * Set the translated code of an enabled TB. If no code is provided,
+ * the page is translated synchronously.
+ */
+static void mips64_jit_tcb_set_code(cpu_mips_t *cpu,cpu_tb_t *tb,
+                                    cpu_tc_t *tc)
+{
+   if (!tc)
+      tc = mips64_jit_tcb_translate(cpu,tb,0);
+
+   tb->flags &= ~(TB_FLAG_PENDING|TB_FLAG_JOB);
+
+   if (tc != NULL)
+      tc_register(cpu->gen,tb,tc);
+   else
+      tb->flags |= TB_FLAG_NOJIT;
+}
+
+/* 
+ * A page waiting for translation has been executed enough times:
+ * compile it in background, or synchronously if this is not possible.
+ */
+static void mips64_jit_tcb_submit(cpu_mips_t *cpu,cpu_tb_t *tb)
+{
+   if (tc_job_submit(cpu->gen,tb,mips64_jit_tcb_translate_job) == -1)
+      mips64_jit_tcb_set_code(cpu,tb,NULL);
+}
+
+/* Install code translated by background threads */
+static void mips64_jit_tcb_install_jobs(cpu_mips_t *cpu)
+{
+   struct tc_job *job,*next;
+   cpu_tb_t *tb;
+
+   for(job=tc_job_get_done(cpu->gen);job;job=next) {
+      next = job->next;
+
+      /* 
+       * The TB may have been freed or modified in the meantime.
+       * If the background translation failed (no exec page available),
+       * translate the page now since cold TBs can be evicted here.
+       */
+      if ((tb = tc_job_find_tb(cpu->gen,job)) != NULL) {
+         if (!(tb->flags & TB_FLAG_SMC)) {
+            mips64_jit_tcb_set_code(cpu,tb,job->tc);
+            job->tc = NULL;
+         } else {
+            tb->flags &= ~TB_FLAG_JOB;
+         }
+      }
+
+      tc_job_free(cpu->gen,job);
+   }
+}
+
 /* Compile a MIPS instruction page */
 static cpu_tb_t *
 mips64_jit_tcb_compile(cpu_mips_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state)
@@ -332,6 +438,9 @@ mips64_jit_tcb_compile(cpu_mips_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state)
    m_uint64_t page_addr;
    mips_insn_t *mips_code;
    m_uint32_t phys_page;
+#if JIT_RELOC_SUPPORT
+   m_uint32_t variant;
+#endif
 
    page_addr = vaddr & MIPS_MIN_PAGE_MASK;
 
@@ -365,20 +474,27 @@ mips64_jit_tcb_compile(cpu_mips_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state)
       return tb;
    }
 
-   /* The page is not shared, we have to compile it */
-   tc = mips64_jit_tcb_translate(cpu,tb);
-   
-   if (tc != NULL) {
-      tc->target_code = tb->target_code;
-      tc->trans_pos   = 0;
- 
+#if JIT_RELOC_SUPPORT
+   /* Try to reuse code translated by a previous instance */
+   if ((mips64_jit_cache_variant(cpu,&variant) != -1) &&
+       (tc = tc_cache_load(cpu->gen,cpu->vm->tc_cache,tb,variant)))
+   {
       tb_enable(cpu->gen,tb);
       tc_register(cpu->gen,tb,tc);
-   } else {
-      tb->flags |= TB_FLAG_NOJIT;
-      tb_enable(cpu->gen,tb);
+      return tb;
    }
-   
+#endif
+
+   tb_enable(cpu->gen,tb);
+
+   /* Cold pages are interpreted until they reach the compile threshold */
+   if (tc_job_workers) {
+      tb->flags |= TB_FLAG_PENDING;
+      return tb;
+   }
+
+   /* The page is not shared, we have to compile it */
+   mips64_jit_tcb_set_code(cpu,tb,NULL);
    return tb;
 }
 
@@ -429,29 +545,45 @@ void mips64_jit_tcb_run(cpu_mips_t *cpu,cpu_tb_t *tb)
 void *mips64_jit_run_cpu(cpu_gen_t *gen)
 {    
    cpu_mips_t *cpu = CPU_MIPS64(gen);
-   pthread_t timer_irq_thread;
    cpu_tb_t *tb;
    m_uint32_t hv,hp;
    m_uint32_t phys_page;
    int timer_irq_check = 0;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)mips64_timer_irq_run,cpu)) 
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)mips64_timer_tick,
+                                             cpu)))
    {
       fprintf(stderr,
-              "VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+              "VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(cpu->gen);
       return NULL;
    }
 
+   if (cpu->vm->idle_pc_auto)
+      cpu_idle_auto_enable(gen,TRUE);
+
    gen->cpu_thread_running = TRUE;
+   gen->cpu_thread_tid = host_perf_gettid();
    cpu_exec_loop_set(gen);
    
  start_cpu:   
    gen->idle_count = 0;
 
    for(;;) {
+      /* Parked by another thread (remapping of memory pages) */
+      if (unlikely(gen->quiesce_req))
+         cpu_quiesce_wait(gen);
+
+      /* MTS invalidations requested by other threads */
+      if (unlikely(gen->mts_req_pending))
+         cpu_mts_handle_requests(gen);
+
+      /* Install pages translated in background */
+      if (unlikely(gen->tc_job_done != NULL))
+         mips64_jit_tcb_install_jobs(cpu);
+
       if (unlikely(gen->state != CPU_STATE_RUNNING)) {
          /* 
           * We are paused/halted, so free the TCB/TCD in order to allow
@@ -472,10 +604,18 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
          }
       }
 
+      /* Automatic idle PC detection */
+      if (unlikely(gen->idle_auto.enabled) &&
+          unlikely(++gen->idle_auto.itv_count == CPU_IDLE_AUTO_SAMPLE_ITV))
+         cpu_idle_auto_sample(gen,cpu->pc);
+
       /* Handle the virtual CPU clock */
       if (++timer_irq_check == cpu->timer_irq_check_itv) {
          timer_irq_check = 0;
 
+         if (unlikely(gen->idle_auto.request))
+            cpu_idle_auto_handle_request(gen);
+
          if (cpu->timer_irq_pending && !cpu->irq_disable) {
             mips64_trigger_timer_irq(cpu);
             mips64_trigger_irq(cpu);
@@ -489,15 +629,21 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
 
       if (unlikely(!tb) || unlikely(!mips64_jit_tcb_match(cpu,tb))) 
       {
+         /* End of the IOS self-decompression ? */
+         if (unlikely(cpu->vm->ios_unpack_armed))
+            ios_unpack_check(gen);
+
          /* slow lookup: try to find the page by physical address */
          cpu->translate(cpu,cpu->pc,&phys_page);
          hp = mips64_jit_get_phys_hash(phys_page);
+         gen->tb_lookups++;
 
          for(tb=gen->tb_phys_hash[hp];tb;tb=tb->phys_next)
             if (mips64_jit_tcb_match(cpu,tb))
                goto tb_found;
 
          /* the TB doesn't exist, compile the page */
+         gen->tb_lookup_misses++;
          tb = mips64_jit_tcb_compile(cpu,cpu->pc,cpu->exec_state);
 
          if (unlikely(!tb)) {
@@ -520,8 +666,14 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
  
       cpu->current_tb = tb;
 
-      if (unlikely(tb->flags & TB_FLAG_NOTRANS))
+      if (unlikely(tb->flags & TB_FLAG_NOTRANS)) {
+         if (unlikely(tb->acc_count >= tc_job_threshold) &&
+             ((tb->flags & (TB_FLAG_PENDING|TB_FLAG_SMC|TB_FLAG_JOB)) ==
+              TB_FLAG_PENDING))
+            mips64_jit_tcb_submit(cpu,tb);
+
          mips64_exec_page(cpu);
+      }
       else
          mips64_jit_tcb_run(cpu,tb);
    }
@@ -537,7 +689,8 @@ void *mips64_jit_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             return NULL;
       }
       
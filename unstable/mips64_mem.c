@@ -18,6 +18,7 @@
 #include "vm.h"
 #include "tcb.h"
 #include "mips64_jit.h"
+#include "mips64_exec.h"
 #include "dynamips.h"
 #include "memory.h"
 #include "device.h"
@@ -131,12 +132,62 @@ static void mips64_ae_error(cpu_mips_t *cpu,m_uint64_t vaddr,
    cpu_exec_loop_enter(cpu->gen);
 }
 
+/* MTS cache geometry used for new CPUs */
+static u_int mts_cache_entries = MTS_CACHE_DEF_ENTRIES;
+static u_int mts_cache_ways = MTS_CACHE_DEF_WAYS;
+
+/* Set the number of entries of the MTS cache (rounded to a power of 2) */
+int mips64_mts_set_cache_entries(u_int entries)
+{
+   if (entries < 1) {
+      fprintf(stderr,"MTS: invalid number of cache entries %u\n",entries);
+      return(-1);
+   }
+
+   mts_cache_entries = entries;
+   return(0);
+}
+
+/* Set the number of ways of the MTS cache */
+int mips64_mts_set_cache_ways(u_int ways)
+{
+   if (!ways || (ways > MTS_CACHE_MAX_WAYS) || (ways & (ways - 1))) {
+      fprintf(stderr,"MTS: number of ways must be 1, 2 or 4.\n");
+      return(-1);
+   }
+
+   mts_cache_ways = ways;
+   return(0);
+}
+
+/* Compute the MTS cache geometry of a CPU */
+static void mips64_mts_init_geometry(cpu_mips_t *cpu,size_t entry_size)
+{
+   u_int set_bits,way_bits,entry_bits;
+
+   for(way_bits=0;(2 << way_bits) <= mts_cache_ways;way_bits++)
+      ;
+
+   for(set_bits=0;set_bits < MTS_CACHE_MAX_SET_BITS;set_bits++)
+      if ((2 << (set_bits + way_bits)) > mts_cache_entries)
+         break;
+
+   for(entry_bits=0;(1 << entry_bits) < entry_size;entry_bits++)
+      ;
+
+   cpu->mts_set_bits  = set_bits;
+   cpu->mts_way_bits  = way_bits;
+   cpu->mts_set_mask  = (1 << set_bits) - 1;
+   cpu->mts_set_shift = entry_bits + way_bits;
+}
+
 /* === MTS for 64-bit address space ======================================= */
 #define MTS_ADDR_SIZE      64
 #define MTS_NAME(name)     mts64_##name
 #define MTS_NAME_UP(name)  MTS64_##name
 #define MTS_PROTO(name)    mips64_mts64_##name
 #define MTS_PROTO_UP(name) MIPS64_MTS64_##name
+#define MTS_VPAGE(vaddr)   ((vaddr) & MIPS_MIN_PAGE_MASK)
 
 #include "mips_mts.c"
 
@@ -146,6 +197,7 @@ static void mips64_ae_error(cpu_mips_t *cpu,m_uint64_t vaddr,
 #define MTS_NAME_UP(name)  MTS32_##name
 #define MTS_PROTO(name)    mips64_mts32_##name
 #define MTS_PROTO_UP(name) MIPS64_MTS32_##name
+#define MTS_VPAGE(vaddr)   ((m_uint32_t)(vaddr) & MIPS_MIN_PAGE_MASK)
 
 #include "mips_mts.c"
 
@@ -158,13 +210,12 @@ mips64_mts64_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                          u_int op_type,m_uint64_t *data,
                          mts64_entry_t *alt_entry)
 {
-   m_uint32_t hash_bucket,zone,sub_zone,cca;
+   m_uint32_t zone,sub_zone,cca;
    mts64_entry_t *entry;
    mts_map_t map;
    int tlb_res;
 
-   hash_bucket = MTS64_HASH(vaddr);
-   entry = &cpu->mts_u.mts64_cache[hash_bucket];
+   entry = mips64_mts64_get_set(cpu,vaddr);
    zone = vaddr >> 40;
 
 #if DEBUG_MTS_STATS
@@ -195,7 +246,7 @@ mips64_mts64_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                map.paddr  = map.vaddr - 0xFFFFFFFF80000000ULL;
                map.offset = vaddr & MIPS_MIN_PAGE_IMASK;
                map.cached = TRUE;
-               map.flags  = 0;
+               map.flags  = MTS_TAG_UNMAPPED;
 
                if (!(entry = mips64_mts64_map(cpu,op_type,&map,
                                               entry,alt_entry)))
@@ -208,7 +259,7 @@ mips64_mts64_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                map.paddr  = map.vaddr - 0xFFFFFFFFA0000000ULL;
                map.offset = vaddr & MIPS_MIN_PAGE_IMASK;
                map.cached = FALSE;
-               map.flags  = 0;
+               map.flags  = MTS_TAG_UNMAPPED;
 
                if (!(entry = mips64_mts64_map(cpu,op_type,&map,
                                               entry,alt_entry)))
@@ -251,7 +302,7 @@ mips64_mts64_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
          map.paddr  = (vaddr & MIPS64_XKPHYS_PHYS_MASK);
          map.paddr  &= MIPS_MIN_PAGE_MASK;
          map.offset = vaddr & MIPS_MIN_PAGE_IMASK;
-         map.flags  = 0;
+         map.flags  = MTS_TAG_UNMAPPED;
 
          if (!(entry = mips64_mts64_map(cpu,op_type,&map,entry,alt_entry)))
             goto err_undef;
@@ -280,8 +331,7 @@ void *mips64_mts64_access(cpu_mips_t *cpu,m_uint64_t vaddr,
                           u_int op_code,u_int op_size,
                           u_int op_type,m_uint64_t *data)
 {   
-   mts64_entry_t *entry,alt_entry;
-   m_uint32_t hash_bucket;
+   mts64_entry_t *entry,*set,alt_entry;
    m_iptr_t haddr;
    u_int dev_id;
    int wr_catch;
@@ -291,18 +341,22 @@ void *mips64_mts64_access(cpu_mips_t *cpu,m_uint64_t vaddr,
    memlog_rec_access(cpu->gen,vaddr,*data,op_size,op_type);
 #endif
    
-   hash_bucket = MTS64_HASH(vaddr);
-   entry = &cpu->mts_u.mts64_cache[hash_bucket];
+   entry = set = mips64_mts64_get_set(cpu,vaddr);
 
 #if DEBUG_MTS_STATS
    cpu->mts_lookups++;
 #endif
 
+   /* Look in the other ways of the set if not in the first one */
+   if (unlikely((vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa))
+      entry = mips64_mts64_way_lookup(cpu,set,vaddr);
+
    /* Copy-On-Write for sparse device or Read-only page ? */
-   wr_catch = (op_type == MTS_WRITE) && (entry->flags & MTS_FLAG_WRCATCH);
+   wr_catch = entry && (op_type == MTS_WRITE) && 
+      (entry->flags & MTS_FLAG_WRCATCH);
 
    /* Slow lookup if nothing found in cache */
-   if (unlikely(((vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa) || wr_catch)) {
+   if (unlikely(!entry || wr_catch)) {
       entry = mips64_mts64_slow_lookup(cpu,vaddr,op_code,op_size,op_type,
                                        data,&alt_entry);
       if (!entry) 
@@ -311,6 +365,7 @@ void *mips64_mts64_access(cpu_mips_t *cpu,m_uint64_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = (entry->hpa & MTS_DEVID_MASK) >> MTS_DEVID_SHIFT;
          haddr  = entry->hpa & MTS_DEVOFF_MASK;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
@@ -332,14 +387,16 @@ static int mips64_mts64_translate(cpu_mips_t *cpu,m_uint64_t vaddr,
                                            m_uint32_t *phys_page)
 {   
    mts64_entry_t *entry,alt_entry;
-   m_uint32_t hash_bucket;
    m_uint64_t data = 0;
    
-   hash_bucket = MTS64_HASH(vaddr);
-   entry = &cpu->mts_u.mts64_cache[hash_bucket];
+   entry = mips64_mts64_get_set(cpu,vaddr);
+
+   /* Look in the other ways of the set */
+   if (unlikely((vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa))
+      entry = mips64_mts64_way_lookup(cpu,entry,vaddr);
 
    /* Slow lookup if nothing found in cache */
-   if (unlikely((vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa)) {
+   if (unlikely(!entry)) {
       entry = mips64_mts64_slow_lookup(cpu,vaddr,MIPS_MEMOP_LOOKUP,4,MTS_READ,
                                        &data,&alt_entry);
       if (!entry)
@@ -359,13 +416,12 @@ mips64_mts32_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
                          u_int op_type,m_uint64_t *data,
                          mts32_entry_t *alt_entry)
 {
-   m_uint32_t hash_bucket,zone;
+   m_uint32_t zone;
    mts32_entry_t *entry;
    mts_map_t map;
    int tlb_res;
 
-   hash_bucket = MTS32_HASH(vaddr);
-   entry = &cpu->mts_u.mts32_cache[hash_bucket];
+   entry = mips64_mts32_get_set(cpu,vaddr);
    zone = (vaddr >> 29) & 0x7;
 
 #if DEBUG_MTS_STATS
@@ -390,7 +446,7 @@ mips64_mts32_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
          map.paddr  = map.vaddr - 0xFFFFFFFF80000000ULL;
          map.offset = vaddr & MIPS_MIN_PAGE_IMASK;
          map.cached = TRUE;
-         map.flags  = 0;
+         map.flags  = MTS_TAG_UNMAPPED;
 
          if (!(entry = mips64_mts32_map(cpu,op_type,&map,entry,alt_entry)))
             goto err_undef;
@@ -402,7 +458,7 @@ mips64_mts32_slow_lookup(cpu_mips_t *cpu,m_uint64_t vaddr,
          map.paddr  = map.vaddr - 0xFFFFFFFFA0000000ULL;
          map.offset = vaddr & MIPS_MIN_PAGE_IMASK;
          map.cached = FALSE;
-         map.flags  = 0;
+         map.flags  = MTS_TAG_UNMAPPED;
 
          if (!(entry = mips64_mts32_map(cpu,op_type,&map,entry,alt_entry)))
             goto err_undef;
@@ -442,8 +498,7 @@ void *mips64_mts32_access(cpu_mips_t *cpu,m_uint64_t vaddr,
                           u_int op_code,u_int op_size,
                           u_int op_type,m_uint64_t *data)
 {
-   mts32_entry_t *entry,alt_entry;
-   m_uint32_t hash_bucket;
+   mts32_entry_t *entry,*set,alt_entry;
    m_iptr_t haddr;
    u_int dev_id;
    int wr_catch;
@@ -453,19 +508,22 @@ void *mips64_mts32_access(cpu_mips_t *cpu,m_uint64_t vaddr,
    memlog_rec_access(cpu->gen,vaddr,*data,op_size,op_type);
 #endif
 
-   hash_bucket = MTS32_HASH(vaddr);
-   entry = &cpu->mts_u.mts32_cache[hash_bucket];
+   entry = set = mips64_mts32_get_set(cpu,vaddr);
 
 #if DEBUG_MTS_STATS
    cpu->mts_lookups++;
 #endif
 
+   /* Look in the other ways of the set if not in the first one */
+   if (unlikely(((m_uint32_t)vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa))
+      entry = mips64_mts32_way_lookup(cpu,set,vaddr);
+
    /* Copy-On-Write for sparse device or read-only page ? */
-   wr_catch = (op_type == MTS_WRITE) && (entry->flags & MTS_FLAG_WRCATCH);
+   wr_catch = entry && (op_type == MTS_WRITE) && 
+      (entry->flags & MTS_FLAG_WRCATCH);
 
    /* Slow lookup if nothing found in cache */
-   if (unlikely((((m_uint32_t)vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa) || 
-                wr_catch))
+   if (unlikely(!entry || wr_catch))
    {
       entry = mips64_mts32_slow_lookup(cpu,vaddr,op_code,op_size,op_type,
                                        data,&alt_entry);
@@ -475,6 +533,7 @@ void *mips64_mts32_access(cpu_mips_t *cpu,m_uint64_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = (entry->hpa & MTS_DEVID_MASK) >> MTS_DEVID_SHIFT;
          haddr  = entry->hpa & MTS_DEVOFF_MASK;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
@@ -496,14 +555,16 @@ static int mips64_mts32_translate(cpu_mips_t *cpu,m_uint64_t vaddr,
                                            m_uint32_t *phys_page)
 {     
    mts32_entry_t *entry,alt_entry;
-   m_uint32_t hash_bucket;
    m_uint64_t data = 0;
    
-   hash_bucket = MTS32_HASH(vaddr);
-   entry = &cpu->mts_u.mts32_cache[hash_bucket];
+   entry = mips64_mts32_get_set(cpu,vaddr);
+
+   /* Look in the other ways of the set */
+   if (unlikely(((m_uint32_t)vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa))
+      entry = mips64_mts32_way_lookup(cpu,entry,vaddr);
 
    /* Slow lookup if nothing found in cache */
-   if (unlikely(((m_uint32_t)vaddr & MIPS_MIN_PAGE_MASK) != entry->gvpa)) {
+   if (unlikely(!entry)) {
       entry = mips64_mts32_slow_lookup(cpu,vaddr,MIPS_MEMOP_LOOKUP,4,MTS_READ,
                                        &data,&alt_entry);
       if (!entry)
@@ -14,6 +14,7 @@
 #include "dynamips.h"
 
 #define JIT_SUPPORT 0
+#define JIT_RELOC_SUPPORT 0
 
 static inline void mips64_jit_tcb_set_patch(u_char *code,u_char *target) {}
 static inline void mips64_jit_tcb_set_jump(u_char **instp,u_char *target) {}
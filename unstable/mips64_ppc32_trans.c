@@ -310,9 +310,24 @@ static void mips64_memop_fast_sw(cpu_tc_t *b,int target)
    ppc_stwx(b->jit_ptr,ppc_r10,ppc_r7,ppc_r8);
 }
 
+/* r7 = offset of the MTS set whose hash is in r8 */
+static void mips64_emit_mts_set_offset(cpu_mips_t *cpu,cpu_tc_t *b)
+{
+   if (!cpu->mts_set_bits) {
+      ppc_li(b->jit_ptr,ppc_r7,0);
+      return;
+   }
+
+   ppc_rlwinm(b->jit_ptr,ppc_r7,ppc_r8,
+              cpu->mts_set_shift,
+              32-(cpu->mts_set_bits+cpu->mts_set_shift),
+              31-cpu->mts_set_shift);
+}
+
 /* Fast memory operation (64-bit) */
-static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast64(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {
@@ -333,10 +348,7 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    ppc_srwi(b->jit_ptr,ppc_r7,ppc_r5,MTS64_HASH_SHIFT1);
    ppc_srwi(b->jit_ptr,ppc_r6,ppc_r5,MTS64_HASH_SHIFT2);
    ppc_xor(b->jit_ptr,ppc_r8,ppc_r7,ppc_r6);
-   ppc_rlwinm(b->jit_ptr,ppc_r7,ppc_r8,
-              MTS64_HASH_BITS+5,
-              32-(MTS64_HASH_BITS+5),
-              31-MTS64_HASH_BITS);
+   mips64_emit_mts_set_offset(cpu,b);
                  
    /* r8 = mts64_cache */
    ppc_lwz(b->jit_ptr,ppc_r8,OFFSET(cpu_mips_t,mts_u.mts64_cache),ppc_r3);
@@ -402,8 +414,9 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
 }
 
 /* Fast memory operation (32-bit) */
-static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast32(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {
@@ -419,10 +432,7 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    ppc_srwi(b->jit_ptr,ppc_r7,ppc_r5,MTS32_HASH_SHIFT1);
    ppc_srwi(b->jit_ptr,ppc_r6,ppc_r5,MTS32_HASH_SHIFT2);
    ppc_xor(b->jit_ptr,ppc_r8,ppc_r7,ppc_r6);
-   ppc_rlwinm(b->jit_ptr,ppc_r7,ppc_r8,
-              MTS32_HASH_BITS+4,
-              32-(MTS32_HASH_BITS+4),
-              31-MTS32_HASH_BITS);         
+   mips64_emit_mts_set_offset(cpu,b);
               
    /* r8 = mts32_cache */
    ppc_lwz(b->jit_ptr,ppc_r8,OFFSET(cpu_mips_t,mts_u.mts32_cache),ppc_r3);
@@ -490,12 +500,12 @@ static void mips64_emit_memop_fast(cpu_mips_t *cpu,cpu_tc_t *b,
 {
    switch(cpu->addr_mode) {
       case 32:
-         mips64_emit_memop_fast32(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast32(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
       case 64:
-         mips64_emit_memop_fast64(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast64(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
    }
 }
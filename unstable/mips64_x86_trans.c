@@ -241,8 +241,9 @@ static void mips64_memop_fast_sw(cpu_tc_t *b,int target)
 }
 
 /* Fast memory operation (64-bit) */
-static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast64(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {
@@ -258,7 +259,7 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    x86_alu_reg_membase(b->jit_ptr,X86_ADD,X86_EBX,X86_EDI,REG_OFFSET(base));
    x86_alu_reg_membase(b->jit_ptr,X86_ADC,X86_ECX,X86_EDI,REG_OFFSET(base)+4);
 
-   /* EAX = mts64_entry index */
+   /* EAX = index of the first mts64 entry of the set */
    x86_mov_reg_reg(b->jit_ptr,X86_EAX,X86_EBX,4);
    x86_mov_reg_reg(b->jit_ptr,X86_ESI,X86_EBX,4);
 
@@ -266,13 +267,13 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
    x86_shift_reg_imm(b->jit_ptr,X86_SHR,X86_ESI,MTS64_HASH_SHIFT2);
    x86_alu_reg_reg(b->jit_ptr,X86_XOR,X86_EAX,X86_ESI);
 
-   x86_alu_reg_imm(b->jit_ptr,X86_AND,X86_EAX,MTS64_HASH_MASK);
+   x86_alu_reg_imm(b->jit_ptr,X86_AND,X86_EAX,cpu->mts_set_mask);
 
    /* EDX = mts64_entry */
    x86_mov_reg_membase(b->jit_ptr,X86_EDX,
                        X86_EDI,OFFSET(cpu_mips_t,mts_u.mts64_cache),
                        4);
-   x86_shift_reg_imm(b->jit_ptr,X86_SHL,X86_EAX,5);
+   x86_shift_reg_imm(b->jit_ptr,X86_SHL,X86_EAX,cpu->mts_set_shift);
    x86_alu_reg_reg(b->jit_ptr,X86_ADD,X86_EDX,X86_EAX);
 
    /* Compare virtual page address (ESI = vpage) */
@@ -339,8 +340,9 @@ static void mips64_emit_memop_fast64(cpu_tc_t *b,int write_op,
 }
 
 /* Fast memory operation (32-bit) */
-static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
-                                     int opcode,int base,int offset,
+static void mips64_emit_memop_fast32(cpu_mips_t *cpu,cpu_tc_t *b,
+                                     int write_op,int opcode,
+                                     int base,int offset,
                                      int target,int keep_ll_bit,
                                      memop_fast_access op_handler)
 {
@@ -355,7 +357,7 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    /* EBX = GPR[base] + sign-extended offset */
    x86_alu_reg_membase(b->jit_ptr,X86_ADD,X86_EBX,X86_EDI,REG_OFFSET(base));
 
-   /* EAX = mts32_entry index */
+   /* EAX = index of the first mts32 entry of the set */
    x86_mov_reg_reg(b->jit_ptr,X86_EAX,X86_EBX,4);
    x86_mov_reg_reg(b->jit_ptr,X86_ESI,X86_EBX,4);
 
@@ -363,13 +365,13 @@ static void mips64_emit_memop_fast32(cpu_tc_t *b,int write_op,
    x86_shift_reg_imm(b->jit_ptr,X86_SHR,X86_ESI,MTS32_HASH_SHIFT2);
    x86_alu_reg_reg(b->jit_ptr,X86_XOR,X86_EAX,X86_ESI);
 
-   x86_alu_reg_imm(b->jit_ptr,X86_AND,X86_EAX,MTS32_HASH_MASK);
+   x86_alu_reg_imm(b->jit_ptr,X86_AND,X86_EAX,cpu->mts_set_mask);
 
    /* EDX = mts32_entry */
    x86_mov_reg_membase(b->jit_ptr,X86_EDX,
                        X86_EDI,OFFSET(cpu_mips_t,mts_u.mts32_cache),
                        4);
-   x86_shift_reg_imm(b->jit_ptr,X86_SHL,X86_EAX,4);
+   x86_shift_reg_imm(b->jit_ptr,X86_SHL,X86_EAX,cpu->mts_set_shift);
    x86_alu_reg_reg(b->jit_ptr,X86_ADD,X86_EDX,X86_EAX);
 
    /* Compare virtual page address (ESI = vpage) */
@@ -441,12 +443,12 @@ static void mips64_emit_memop_fast(cpu_mips_t *cpu,cpu_tc_t *b,
 {
    switch(cpu->addr_mode) {
       case 32:
-         mips64_emit_memop_fast32(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast32(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
       case 64:
-         mips64_emit_memop_fast64(b,write_op,opcode,base,offset,target,
-                                  keep_ll_bit,op_handler);
+         mips64_emit_memop_fast64(cpu,b,write_op,opcode,base,offset,
+                                  target,keep_ll_bit,op_handler);
          break;
    }
 }
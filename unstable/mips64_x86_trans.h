@@ -13,6 +13,7 @@
 #include "dynamips.h"
 
 #define JIT_SUPPORT 1
+#define JIT_RELOC_SUPPORT 0
 
 /* Manipulate bitmasks atomically */
 static forced_inline void atomic_or(m_uint32_t *v,m_uint32_t m)
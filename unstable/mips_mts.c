@@ -16,19 +16,29 @@ static forced_inline void *MTS_PROTO(access)(cpu_mips_t *cpu,m_uint64_t vaddr,
 static int MTS_PROTO(translate)(cpu_mips_t *cpu,m_uint64_t vaddr,
                                          m_uint32_t *phys_page);
 
+/* Total number of entries of the MTS cache */
+#define MTS_CACHE_ENTRIES(cpu) \
+   (1 << ((cpu)->mts_set_bits + (cpu)->mts_way_bits))
+
 /* Initialize the MTS subsystem for the specified CPU */
 int MTS_PROTO(init)(cpu_mips_t *cpu)
 {
    size_t len;
 
+   mips64_mts_init_geometry(cpu,sizeof(MTS_ENTRY));
+
    /* Initialize the cache entries to 0 (empty) */
-   len = MTS_NAME_UP(HASH_SIZE) * sizeof(MTS_ENTRY);
+   len = MTS_CACHE_ENTRIES(cpu) * sizeof(MTS_ENTRY);
    if (!(MTS_CACHE(cpu) = malloc(len)))
       return(-1);
 
    memset(MTS_CACHE(cpu),0xFF,len);
+   cpu->mts_asid_entries = 0;
    cpu->mts_lookups = 0;
    cpu->mts_misses  = 0;
+   cpu->mts_way_hits = 0;
+   cpu->mts_inval_entries = 0;
+   cpu->mts_flushes = 0;
    return(0);
 }
 
@@ -53,7 +63,7 @@ void MTS_PROTO(show_stats)(cpu_gen_t *gen_cpu)
 
 #if DEBUG_MTS_MAP_VIRT
    /* Valid hash entries */
-   for(count=0,i=0;i<MTS_NAME_UP(HASH_SIZE);i++) {
+   for(count=0,i=0;i<MTS_CACHE_ENTRIES(cpu);i++) {
       entry = &(MTS_CACHE(cpu)[i]);
 
       if (!(entry->gvpa & MTS_INV_ENTRY_MASK)) {
@@ -64,13 +74,83 @@ void MTS_PROTO(show_stats)(cpu_gen_t *gen_cpu)
       }
    }
 
-   printf("   %u/%u valid hash entries.\n",count,MTS_NAME_UP(HASH_SIZE));
+   printf("   %u/%u valid hash entries.\n",count,MTS_CACHE_ENTRIES(cpu));
 #endif
 
+   printf("   Cache: %u sets, %u-way\n",
+          1 << cpu->mts_set_bits,1 << cpu->mts_way_bits);
+
    printf("   Total lookups: %llu, misses: %llu, efficiency: %g%%\n",
           cpu->mts_lookups, cpu->mts_misses,
           100 - ((double)(cpu->mts_misses*100)/
                  (double)cpu->mts_lookups));
+
+   printf("   Hits in other ways: %llu, entries invalidated: %llu, "
+          "flushes: %llu\n",
+          cpu->mts_way_hits,cpu->mts_inval_entries,cpu->mts_flushes);
+}
+
+/* Get the first entry of the set of a virtual address */
+static forced_inline MTS_ENTRY *MTS_PROTO(get_set)(cpu_mips_t *cpu,
+                                                   m_uint64_t vaddr)
+{
+   m_uint32_t set;
+
+   set = MTS_NAME_UP(HASH_SET)(vaddr) & cpu->mts_set_mask;
+   return(&MTS_CACHE(cpu)[set << cpu->mts_way_bits]);
+}
+
+/* 
+ * Look for a page in the other ways of a set. If found, the entry is 
+ * moved to the first way, where the JIT code looks for it.
+ */
+static forced_inline MTS_ENTRY *
+MTS_PROTO(way_lookup)(cpu_mips_t *cpu,MTS_ENTRY *set,m_uint64_t vaddr)
+{
+   MTS_ENTRY tmp;
+   u_int i,ways;
+
+   ways = 1 << cpu->mts_way_bits;
+
+   for(i=1;i<ways;i++) {
+      if (set[i].gvpa == MTS_VPAGE(vaddr)) {
+         tmp = set[i];
+         memmove(&set[1],&set[0],i*sizeof(MTS_ENTRY));
+         set[0] = tmp;
+#if DEBUG_MTS_STATS
+         cpu->mts_way_hits++;
+#endif
+         return(set);
+      }
+   }
+
+   return NULL;
+}
+
+/* 
+ * Free the first way of a set for a new entry. A previous entry for
+ * the same page is replaced, otherwise the least recently used one.
+ */
+static void MTS_PROTO(set_push)(cpu_mips_t *cpu,MTS_ENTRY *set,
+                                m_uint64_t vaddr)
+{
+   u_int i,ways;
+
+   ways = 1 << cpu->mts_way_bits;
+
+   for(i=0;i<ways-1;i++)
+      if (set[i].gvpa == MTS_VPAGE(vaddr))
+         break;
+
+   memmove(&set[1],&set[0],i*sizeof(MTS_ENTRY));
+}
+
+/* Invalidate an entry */
+static inline void MTS_PROTO(invalidate_entry)(cpu_mips_t *cpu,
+                                               MTS_ENTRY *entry)
+{
+   memset(entry,0xFF,sizeof(*entry));
+   cpu->mts_inval_entries++;
 }
 
 /* Invalidate the complete MTS cache */
@@ -78,8 +158,69 @@ void MTS_PROTO(invalidate_cache)(cpu_mips_t *cpu)
 {
    size_t len;
 
-   len = MTS_NAME_UP(HASH_SIZE) * sizeof(MTS_ENTRY);
+   len = MTS_CACHE_ENTRIES(cpu) * sizeof(MTS_ENTRY);
    memset(MTS_CACHE(cpu),0xFF,len);
+   cpu->mts_asid_entries = 0;
+   cpu->mts_flushes++;
+}
+
+/* Invalidate the entries of mapped pages in a virtual address range */
+void MTS_PROTO(invalidate_range)(cpu_mips_t *cpu,m_uint64_t vaddr,
+                                 m_uint64_t len)
+{
+   MTS_ENTRY *entry;
+   m_uint64_t i,count;
+   u_int j,ways;
+
+   ways = 1 << cpu->mts_way_bits;
+   vaddr &= MIPS_MIN_PAGE_MASK;
+   count = (len + MIPS_MIN_PAGE_SIZE - 1) >> MIPS_MIN_PAGE_SHIFT;
+
+   if (count <= cpu->mts_set_mask) {
+      /* Check only the sets where the pages can be */
+      for(i=0;i<count;i++,vaddr+=MIPS_MIN_PAGE_SIZE) {
+         entry = MTS_PROTO(get_set)(cpu,vaddr);
+
+         for(j=0;j<ways;j++) {
+            if ((entry[j].gvpa == MTS_VPAGE(vaddr)) &&
+                !(entry[j].flags & MTS_TAG_UNMAPPED))
+               MTS_PROTO(invalidate_entry)(cpu,&entry[j]);
+         }
+      }
+   } else {
+      count = MTS_CACHE_ENTRIES(cpu);
+
+      for(i=0;i<count;i++) {
+         entry = &MTS_CACHE(cpu)[i];
+
+         if (!(entry->gvpa & MTS_INV_ENTRY_MASK) &&
+             !(entry->flags & MTS_TAG_UNMAPPED) &&
+             ((entry->gvpa - MTS_VPAGE(vaddr)) < len))
+            MTS_PROTO(invalidate_entry)(cpu,entry);
+      }
+   }
+}
+
+/* Invalidate the entries of non-global mappings (ASID change) */
+void MTS_PROTO(invalidate_asid)(cpu_mips_t *cpu)
+{
+   MTS_ENTRY *entry;
+   u_int i,count;
+
+   if (!cpu->mts_asid_entries)
+      return;
+
+   count = MTS_CACHE_ENTRIES(cpu);
+
+   for(i=0;i<count;i++) {
+      entry = &MTS_CACHE(cpu)[i];
+
+      if (!(entry->gvpa & MTS_INV_ENTRY_MASK) &&
+          !(entry->flags & (MTS_TAG_GLOBAL|MTS_TAG_UNMAPPED)))
+         MTS_PROTO(invalidate_entry)(cpu,entry);
+   }
+
+   cpu->mts_asid_entries = 0;
 }
 
 /* 
@@ -108,9 +249,13 @@ MTS_PROTO(map)(cpu_mips_t *cpu,u_int op_type,mts_map_t *map,
          exec_flag = MTS_FLAG_EXEC;
    }
 
+   if (!(map->flags & (MTS_TAG_GLOBAL|MTS_TAG_UNMAPPED)))
+      cpu->mts_asid_entries++;
+
    if (dev->flags & VDEVICE_FLAG_SPARSE) {
       host_ptr = dev_sparse_get_host_addr(cpu->vm,dev,map->paddr,op_type,&cow);
 
+      MTS_PROTO(set_push)(cpu,entry,map->vaddr);
       entry->gvpa  = map->vaddr;
       entry->gppa  = map->paddr;
       entry->hpa   = host_ptr;
@@ -128,6 +273,7 @@ MTS_PROTO(map)(cpu_mips_t *cpu,u_int op_type,mts_map_t *map,
       return alt_entry;
    }
 
+   MTS_PROTO(set_push)(cpu,entry,map->vaddr);
    entry->gvpa  = map->vaddr;
    entry->gppa  = map->paddr;
    entry->hpa   = dev->host_addr + (map->paddr - dev->phys_addr);
@@ -149,6 +295,7 @@ static void MTS_PROTO(invalidate_tcb)(cpu_mips_t *cpu,MTS_ENTRY *entry)
    cpu->translate(cpu,cpu->pc,&pc_phys_page);
 
    entry->flags &= ~MTS_FLAG_EXEC;
+   mips64_exec_predec_invalidate(cpu,(void *)entry->hpa);
    cpu_jit_write_on_exec_page(cpu->gen,phys_page,hp,pc_phys_page);
 }
 
@@ -543,6 +690,28 @@ void MTS_PROTO(api_rebuild)(cpu_gen_t *cpu)
    MTS_PROTO(invalidate_cache)(CPU_MIPS64(cpu));
 }
 
+/* Invalidate the entries mapping a host page */
+void MTS_PROTO(api_invalidate_hpa)(cpu_gen_t *gen,m_iptr_t hpa)
+{
+   cpu_mips_t *cpu = CPU_MIPS64(gen);
+   MTS_ENTRY *entry;
+   u_int i,count;
+
+   count = MTS_CACHE_ENTRIES(cpu);
+
+   for(i=0;i<count;i++) {
+      entry = &MTS_CACHE(cpu)[i];
+
+      if (!(entry->gvpa & MTS_INV_ENTRY_MASK) &&
+          !(entry->flags & MTS_FLAG_DEV) &&
+          (entry->hpa == hpa))
+         MTS_PROTO(invalidate_entry)(cpu,entry);
+   }
+
+   /* the instruction fetch of the interpreter may use this page */
+   cpu->njm_exec_page = (m_uint64_t)-1;
+}
+
 /* ======================================================================== */
 
 /* Initialize memory access vectors */
@@ -563,10 +732,13 @@ void MTS_PROTO(init_memop_vectors)(cpu_mips_t *cpu)
 
    /* Invalidate and Shutdown operations */
    cpu->mts_invalidate = MTS_PROTO(invalidate_cache);
+   cpu->mts_invalidate_range = MTS_PROTO(invalidate_range);
+   cpu->mts_invalidate_asid = MTS_PROTO(invalidate_asid);
    cpu->mts_shutdown = MTS_PROTO(shutdown);
 
    /* Rebuild MTS data structures */
    cpu->gen->mts_rebuild = MTS_PROTO(api_rebuild);
+   cpu->gen->mts_invalidate_hpa = MTS_PROTO(api_invalidate_hpa);
 
    /* Show statistics */
    cpu->gen->mts_show_stats = MTS_PROTO(show_stats);
@@ -619,3 +791,5 @@ void MTS_PROTO(init_memop_vectors)(cpu_mips_t *cpu)
 #undef MTS_PROTO_UP
 #undef MTS_ENTRY
 #undef MTS_CHUNK
+#undef MTS_VPAGE
+#undef MTS_CACHE_ENTRIES
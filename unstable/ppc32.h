@@ -32,6 +32,9 @@
 /* Number of instructions per page */
 #define PPC32_INSN_PER_PAGE    (PPC32_MIN_PAGE_SIZE/sizeof(ppc_insn_t))
 
+/* Number of predecoded pages kept by the interpreter (power of 2) */
+#define PPC32_PREDEC_CACHE_SIZE  64
+
 /* Starting point for ROM */
 #define PPC32_ROM_START  0xfff00100
 #define PPC32_ROM_SP     0x00006000
@@ -337,6 +340,7 @@ struct cpu_ppc {
    /* Executable page area */
    void *exec_page_area;
    size_t exec_page_area_size;
+   int exec_page_area_huge;
    size_t exec_page_count,exec_page_alloc;
    insn_exec_page_t *exec_page_free_list;
    insn_exec_page_t *exec_page_array;
@@ -422,6 +426,11 @@ struct cpu_ppc {
    m_uint64_t njm_exec_page;
    mips_insn_t *njm_exec_ptr;
 
+   /* Predecoded pages (non-JIT), indexed by host page address */
+   struct ppc32_predec_page *njm_predec;
+   struct ppc32_predec_page *njm_predec_cache[PPC32_PREDEC_CACHE_SIZE];
+   m_uint64_t njm_predec_fills;
+
    /* Performance counter (non-JIT) */
    m_uint32_t perf_counter;
 
@@ -500,7 +509,7 @@ void ppc32_set_pvr(cpu_ppc_t *cpu,m_uint32_t pvr);
 void ppc32_set_idle_pc(cpu_gen_t *cpu,m_uint64_t addr);
 
 /* Timer IRQ */
-void *ppc32_timer_irq_run(cpu_ppc_t *cpu);
+void ppc32_timer_tick(cpu_ppc_t *cpu,u_int count);
 
 /* Determine an "idling" PC */
 int ppc32_get_idling_pc(cpu_gen_t *cpu);
@@ -157,6 +157,25 @@ static void ppc32_try_direct_far_jump(cpu_ppc_t *cpu,jit_op_t *iop,
    ppc32_jit_tcb_push_epilog(&iop->ob_ptr);
 }
 
+/* 
+ * Return to the caller if the IRQ check flag is set. Loops in a page and
+ * chained blocks would otherwise delay IRQs and requests of other threads.
+ */
+static void ppc32_check_exit_req(jit_op_t *iop,m_uint32_t new_ia)
+{
+   u_char *test1;
+
+   amd64_alu_membase_imm_size(iop->ob_ptr,X86_CMP,AMD64_R15,
+                              OFFSET(cpu_ppc_t,irq_check),0,4);
+   test1 = iop->ob_ptr;
+   amd64_branch8(iop->ob_ptr, X86_CC_Z, 0, 1);
+
+   ppc32_set_ia(&iop->ob_ptr,new_ia);
+   ppc32_jit_tcb_push_epilog(&iop->ob_ptr);
+
+   amd64_patch(test1,iop->ob_ptr);
+}
+
 /* Set Jump */
 static void ppc32_set_jump(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,jit_op_t *iop,
                            m_uint32_t new_ia,int local_jump)
@@ -170,11 +189,16 @@ static void ppc32_set_jump(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,jit_op_t *iop,
 #endif
 
    if (!return_to_caller && ppc32_jit_tcb_local_addr(b,new_ia,&jump_ptr)) {
+      /* backward jump: loop in the page */
+      if (new_ia <= (b->start_ia + (b->ppc_trans_pos << 2)))
+         ppc32_check_exit_req(iop,new_ia);
+
       ppc32_jit_tcb_record_patch(b,iop,iop->ob_ptr,new_ia);
       amd64_jump32(iop->ob_ptr,0);
    } else {   
       if (cpu->exec_blk_direct_jump) {
          /* Block lookup optimization */
+         ppc32_check_exit_req(iop,new_ia);
          ppc32_try_direct_far_jump(cpu,iop,new_ia);
       } else {
          ppc32_set_ia(&iop->ob_ptr,new_ia);
@@ -489,35 +513,61 @@ static void ppc32_memop_fast_stw(jit_op_t *iop,int target)
    amd64_mov_memindex_reg(iop->ob_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RDX,4);
 }
 
-/* Fast memory operation */
-static void ppc32_emit_memop_fast(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,
-                                  int write_op,int opcode,
-                                  int base,int offset,int target,
-                                  memop_fast_access op_handler)
-{   
-   m_uint32_t val = sign_extend(offset,16);
-   u_char *test1,*test2,*p_exit;
-   jit_op_t *iop;
+/* Fast LHZ */
+static void ppc32_memop_fast_lhz(jit_op_t *iop,int target)
+{
+   amd64_widen_memindex_size(iop->ob_ptr,X86_EAX,AMD64_RBX,0,AMD64_RSI,0,
+                             FALSE,TRUE,4);
+   amd64_bswap32(iop->ob_ptr,AMD64_RAX);
+   amd64_shift_reg_imm_size(iop->ob_ptr,X86_SHR,X86_EAX,16,4);
+   ppc32_store_gpr(&iop->ob_ptr,target,AMD64_RAX);
+}
 
-   /* 
-    * Since an exception can be triggered, clear JIT state. This allows
-    * to use branch target tag (we can directly branch on this instruction).
-    */
-   ppc32_op_emit_basic_opcode(cpu,JIT_OP_BRANCH_TARGET);
-   ppc32_op_emit_basic_opcode(cpu,JIT_OP_EOB);
+/* Fast LHA */
+static void ppc32_memop_fast_lha(jit_op_t *iop,int target)
+{
+   amd64_widen_memindex_size(iop->ob_ptr,X86_EAX,AMD64_RBX,0,AMD64_RSI,0,
+                             FALSE,TRUE,4);
+   amd64_bswap32(iop->ob_ptr,AMD64_RAX);
+   amd64_shift_reg_imm_size(iop->ob_ptr,X86_SAR,X86_EAX,16,4);
+   ppc32_store_gpr(&iop->ob_ptr,target,AMD64_RAX);
+}
 
-   iop = ppc32_op_emit_insn_output(cpu,5,"memop_fast");
+/* Fast STH */
+static void ppc32_memop_fast_sth(jit_op_t *iop,int target)
+{
+   ppc32_load_gpr(&iop->ob_ptr,AMD64_RDX,target);
+   amd64_bswap32(iop->ob_ptr,AMD64_RDX);
+   amd64_shift_reg_imm_size(iop->ob_ptr,X86_SHR,X86_EDX,16,4);
+   amd64_mov_memindex_reg(iop->ob_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RDX,2);
+}
+
+/* Fast LWBR (memory is already in host byte order) */
+static void ppc32_memop_fast_lwbr(jit_op_t *iop,int target)
+{
+   amd64_mov_reg_memindex(iop->ob_ptr,AMD64_RAX,AMD64_RBX,0,AMD64_RSI,0,4);
+   ppc32_store_gpr(&iop->ob_ptr,target,AMD64_RAX);
+}
+
+/* Fast STWBR */
+static void ppc32_memop_fast_stwbr(jit_op_t *iop,int target)
+{
+   ppc32_load_gpr(&iop->ob_ptr,AMD64_RDX,target);
+   amd64_mov_memindex_reg(iop->ob_ptr,AMD64_RBX,0,AMD64_RSI,0,AMD64_RDX,4);
+}
+
+/* Fast memory operation, with RSI = virtual address */
+static void ppc32_emit_memop_fast_access(ppc32_jit_tcb_t *b,jit_op_t *iop,
+                                         int write_op,int opcode,int target,
+                                         memop_fast_access op_handler)
+{
+   u_char *test1,*test2,*p_exit;
 
    test2 = NULL;
 
    /* XXX */
    amd64_inc_membase(iop->ob_ptr,AMD64_R15,OFFSET(cpu_ppc_t,mts_lookups));
 
-   /* RSI = GPR[base] + sign-extended offset */
-   ppc32_load_imm(&iop->ob_ptr,AMD64_RSI,val);
-   if (base != 0)
-      ppc32_alu_gpr(&iop->ob_ptr,X86_ADD,AMD64_RSI,base);
-
    /* RBX = mts32_entry index */
    amd64_mov_reg_reg_size(iop->ob_ptr,X86_EBX,X86_ESI,4);
    amd64_mov_reg_reg_size(iop->ob_ptr,X86_EAX,X86_ESI,4);
@@ -586,6 +636,58 @@ static void ppc32_emit_memop_fast(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,
    amd64_patch(p_exit,iop->ob_ptr);
 }
 
+/* Fast memory operation */
+static void ppc32_emit_memop_fast(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,
+                                  int write_op,int opcode,
+                                  int base,int offset,int target,
+                                  memop_fast_access op_handler)
+{   
+   m_uint32_t val = sign_extend(offset,16);
+   jit_op_t *iop;
+
+   /* 
+    * Since an exception can be triggered, clear JIT state. This allows
+    * to use branch target tag (we can directly branch on this instruction).
+    */
+   ppc32_op_emit_basic_opcode(cpu,JIT_OP_BRANCH_TARGET);
+   ppc32_op_emit_basic_opcode(cpu,JIT_OP_EOB);
+
+   iop = ppc32_op_emit_insn_output(cpu,5,"memop_fast");
+
+   /* RSI = GPR[base] + sign-extended offset */
+   ppc32_load_imm(&iop->ob_ptr,AMD64_RSI,val);
+   if (base != 0)
+      ppc32_alu_gpr(&iop->ob_ptr,X86_ADD,AMD64_RSI,base);
+
+   ppc32_emit_memop_fast_access(b,iop,write_op,opcode,target,op_handler);
+}
+
+/* Fast memory operation (indexed) */
+static void ppc32_emit_memop_fast_idx(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,
+                                      int write_op,int opcode,
+                                      int ra,int rb,int target,
+                                      memop_fast_access op_handler)
+{
+   jit_op_t *iop;
+
+   /* 
+    * Since an exception can be triggered, clear JIT state. This allows
+    * to use branch target tag (we can directly branch on this instruction).
+    */
+   ppc32_op_emit_basic_opcode(cpu,JIT_OP_BRANCH_TARGET);
+   ppc32_op_emit_basic_opcode(cpu,JIT_OP_EOB);
+
+   iop = ppc32_op_emit_insn_output(cpu,5,"memop_fast_idx");
+
+   /* RSI = $rb + $ra */
+   ppc32_load_gpr(&iop->ob_ptr,AMD64_RSI,rb);
+
+   if (ra != 0)
+      ppc32_alu_gpr(&iop->ob_ptr,X86_ADD,AMD64_RSI,ra);
+
+   ppc32_emit_memop_fast_access(b,iop,write_op,opcode,target,op_handler);
+}
+
 /* Emit unhandled instruction code */
 static int ppc32_emit_unknown(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,
                               ppc_insn_t opcode)
@@ -2323,7 +2425,8 @@ DECLARE_INSN(LBZX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_LBZ,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,0,PPC_MEMOP_LBZ,ra,rb,rs,
+                             ppc32_memop_fast_lbz);
    return(0);
 }
 
@@ -2334,7 +2437,8 @@ DECLARE_INSN(LHA)
    int ra = bits(insn,16,20);
    m_uint16_t offset = bits(insn,0,15);
 
-   ppc32_emit_memop(cpu,b,PPC_MEMOP_LHA,ra,offset,rs,0);
+   ppc32_emit_memop_fast(cpu,b,0,PPC_MEMOP_LHA,ra,offset,rs,
+                         ppc32_memop_fast_lha);
    return(0);
 }
 
@@ -2367,7 +2471,8 @@ DECLARE_INSN(LHAX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_LHA,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,0,PPC_MEMOP_LHA,ra,rb,rs,
+                             ppc32_memop_fast_lha);
    return(0);
 }
 
@@ -2378,7 +2483,8 @@ DECLARE_INSN(LHZ)
    int ra = bits(insn,16,20);
    m_uint16_t offset = bits(insn,0,15);
 
-   ppc32_emit_memop(cpu,b,PPC_MEMOP_LHZ,ra,offset,rs,0);
+   ppc32_emit_memop_fast(cpu,b,0,PPC_MEMOP_LHZ,ra,offset,rs,
+                         ppc32_memop_fast_lhz);
    return(0);
 }
 
@@ -2411,7 +2517,20 @@ DECLARE_INSN(LHZX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_LHZ,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,0,PPC_MEMOP_LHZ,ra,rb,rs,
+                             ppc32_memop_fast_lhz);
+   return(0);
+}
+
+/* LWBRX - Load Word Byte-Reverse Indexed */
+DECLARE_INSN(LWBRX)
+{
+   int rs = bits(insn,21,25);
+   int ra = bits(insn,16,20);
+   int rb = bits(insn,11,15);
+
+   ppc32_emit_memop_fast_idx(cpu,b,0,PPC_MEMOP_LWBR,ra,rb,rs,
+                             ppc32_memop_fast_lwbr);
    return(0);
 }
 
@@ -2457,7 +2576,8 @@ DECLARE_INSN(LWZX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_LWZ,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,0,PPC_MEMOP_LWZ,ra,rb,rs,
+                             ppc32_memop_fast_lwz);
    return(0);
 }
 
@@ -3333,7 +3453,8 @@ DECLARE_INSN(STBX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_STB,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,1,PPC_MEMOP_STB,ra,rb,rs,
+                             ppc32_memop_fast_stb);
    return(0);
 }
 
@@ -3344,7 +3465,8 @@ DECLARE_INSN(STH)
    int ra = bits(insn,16,20);
    m_uint16_t offset = bits(insn,0,15);
 
-   ppc32_emit_memop(cpu,b,PPC_MEMOP_STH,ra,offset,rs,0);
+   ppc32_emit_memop_fast(cpu,b,1,PPC_MEMOP_STH,ra,offset,rs,
+                         ppc32_memop_fast_sth);
    return(0);
 }
 
@@ -3377,7 +3499,8 @@ DECLARE_INSN(STHX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_STH,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,1,PPC_MEMOP_STH,ra,rb,rs,
+                             ppc32_memop_fast_sth);
    return(0);
 }
 
@@ -3394,6 +3517,18 @@ DECLARE_INSN(STW)
    return(0);
 }
 
+/* STWBRX - Store Word Byte-Reverse Indexed */
+DECLARE_INSN(STWBRX)
+{
+   int rs = bits(insn,21,25);
+   int ra = bits(insn,16,20);
+   int rb = bits(insn,11,15);
+
+   ppc32_emit_memop_fast_idx(cpu,b,1,PPC_MEMOP_STWBR,ra,rb,rs,
+                             ppc32_memop_fast_stwbr);
+   return(0);
+}
+
 /* STWU - Store Word with Update */
 DECLARE_INSN(STWU)
 {
@@ -3423,7 +3558,8 @@ DECLARE_INSN(STWX)
    int ra = bits(insn,16,20);
    int rb = bits(insn,11,15);
 
-   ppc32_emit_memop_idx(cpu,b,PPC_MEMOP_STW,ra,rb,rs,0);
+   ppc32_emit_memop_fast_idx(cpu,b,1,PPC_MEMOP_STW,ra,rb,rs,
+                             ppc32_memop_fast_stw);
    return(0);
 }
 
@@ -3789,6 +3925,7 @@ struct ppc32_insn_tag ppc32_insn_tags[] = {
    { ppc32_emit_LHZU       , 0xfc000000 , 0xa4000000 },
    { ppc32_emit_LHZUX      , 0xfc0007ff , 0x7c00026e },
    { ppc32_emit_LHZX       , 0xfc0007ff , 0x7c00022e },
+   { ppc32_emit_LWBRX      , 0xfc0007ff , 0x7c00042c },
    { ppc32_emit_LWZ        , 0xfc000000 , 0x80000000 },
    { ppc32_emit_LWZU       , 0xfc000000 , 0x84000000 },
    { ppc32_emit_LWZUX      , 0xfc0007ff , 0x7c00006e },
@@ -3824,6 +3961,7 @@ struct ppc32_insn_tag ppc32_insn_tags[] = {
    { ppc32_emit_STHUX      , 0xfc0007ff , 0x7c00036e },
    { ppc32_emit_STHX       , 0xfc0007ff , 0x7c00032e },
    { ppc32_emit_STW        , 0xfc000000 , 0x90000000 },
+   { ppc32_emit_STWBRX     , 0xfc0007ff , 0x7c00052c },
    { ppc32_emit_STWU       , 0xfc000000 , 0x94000000 },
    { ppc32_emit_STWUX      , 0xfc0007ff , 0x7c00016e },
    { ppc32_emit_STWX       , 0xfc0007ff , 0x7c00012e },
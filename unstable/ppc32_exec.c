@@ -22,11 +22,52 @@
 #include "insn_lookup.h"
 #include "dynamips.h"
 #include "crc.h"
+#include "ios_unpack.h"
+#include "host_perf.h"
 
 /* Forward declaration of instruction array */
 static struct ppc32_insn_exec_tag ppc32_exec_tags[];
 static insn_lookup_t *ilt = NULL;
 
+struct ppc32_predec_insn;
+
+/* Handler of a predecoded instruction */
+typedef int (*ppc32_predec_fn)(cpu_ppc_t *,struct ppc32_predec_insn *);
+
+/* Predecoded instruction: handler and operands of an instruction word */
+struct ppc32_predec_insn {
+   ppc32_predec_fn exec;
+   ppc_insn_t insn;
+   m_uint32_t imm;
+   m_uint8_t rd,ra,rb;
+   m_uint16_t index;
+};
+
+/* Predecoded page, bound to the host page holding the instructions */
+struct ppc32_predec_page {
+   ppc_insn_t *host_page;
+   struct ppc32_predec_insn insn[PPC32_INSN_PER_PAGE];
+};
+
+/* Immediate operand of a predecoded instruction */
+enum {
+   PPC32_PREDEC_IMM_S16 = 0,    /* sign-extended 16-bit value */
+   PPC32_PREDEC_IMM_U16,        /* zero-extended 16-bit value */
+   PPC32_PREDEC_IMM_HI,         /* 16-bit value, shifted left by 16 */
+   PPC32_PREDEC_IMM_BRANCH,     /* 26-bit branch offset (b, bl) */
+   PPC32_PREDEC_IMM_BC,         /* 16-bit branch offset (bc) */
+   PPC32_PREDEC_IMM_MASK,       /* rotation mask (mb, me) */
+};
+
+/* Instruction with a handler using predecoded operands */
+struct ppc32_predec_tag {
+   int (*exec)(cpu_ppc_t *,ppc_insn_t);
+   ppc32_predec_fn predec;
+   int imm_type;
+};
+
+static struct ppc32_predec_tag ppc32_predec_tags[];
+
 /* ILT */
 static forced_inline void *ppc32_exec_get_insn(int index)
 {
@@ -84,6 +125,7 @@ void ppc32_dump_stats(cpu_ppc_t *cpu)
              ppc32_exec_tags[i].name,ppc32_exec_tags[i].count);
 
    printf("%llu instructions executed since startup.\n",cpu->insn_exec_count);
+   printf("%llu pages predecoded since startup.\n",cpu->njm_predec_fills);
 #else
    printf("Statistics support is not compiled in.\n");
 #endif
@@ -99,6 +141,130 @@ static forced_inline void ppc32_exec_memop(cpu_ppc_t *cpu,int memop,
    fn(cpu,vaddr,dst_reg);
 }
 
+/* Instruction without predecoded operands */
+static int ppc32_exec_predec_generic(cpu_ppc_t *cpu,
+                                     struct ppc32_predec_insn *p)
+{
+   return(ppc32_exec_tags[p->index].exec(cpu,p->insn));
+}
+
+/* Decode an instruction, with its operands if its handler uses them */
+static void ppc32_exec_predecode(struct ppc32_predec_insn *p,
+                                 ppc_insn_t instruction)
+{
+   struct ppc32_predec_tag *tag;
+   int (*exec)(cpu_ppc_t *,ppc_insn_t);
+
+   p->insn  = instruction;
+   p->index = ilt_lookup(ilt,instruction);
+   p->exec  = ppc32_exec_predec_generic;
+   p->rd    = bits(instruction,21,25);
+   p->ra    = bits(instruction,16,20);
+   p->rb    = bits(instruction,11,15);
+   p->imm   = sign_extend_32(bits(instruction,0,15),16);
+
+   exec = ppc32_exec_tags[p->index].exec;
+
+   for(tag=ppc32_predec_tags;tag->exec;tag++) {
+      if (tag->exec != exec)
+         continue;
+
+      switch(tag->imm_type) {
+         case PPC32_PREDEC_IMM_U16:
+            p->imm = bits(instruction,0,15);
+            break;
+         case PPC32_PREDEC_IMM_HI:
+            p->imm = bits(instruction,0,15) << 16;
+            break;
+         case PPC32_PREDEC_IMM_BRANCH:
+            p->imm = sign_extend_32(bits(instruction,2,25) << 2,26);
+            break;
+         case PPC32_PREDEC_IMM_BC:
+            p->imm = sign_extend_32(bits(instruction,2,15) << 2,16);
+            break;
+         case PPC32_PREDEC_IMM_MASK:
+            p->imm = ppc32_rotate_mask(bits(instruction,6,10),
+                                       bits(instruction,1,5));
+            break;
+      }
+
+      p->exec = tag->predec;
+      break;
+   }
+}
+
+/* Hash on host page addresses for predecoded pages */
+static forced_inline u_int ppc32_exec_predec_hash(void *host_page)
+{
+   return(((m_iptr_t)host_page >> PPC32_MIN_PAGE_SHIFT) & 
+          (PPC32_PREDEC_CACHE_SIZE - 1));
+}
+
+/* Get the predecoded page of a host page (NULL if no memory) */
+static struct ppc32_predec_page *
+ppc32_exec_predec_get(cpu_ppc_t *cpu,ppc_insn_t *host_page)
+{
+   struct ppc32_predec_page **pp,*p;
+   u_int i;
+
+   pp = &cpu->njm_predec_cache[ppc32_exec_predec_hash(host_page)];
+
+   if (likely((p = *pp) != NULL) && likely(p->host_page == host_page))
+      return p;
+
+   /* 
+    * Reuse the slot: entries only depend on the instruction word, which
+    * is checked before each execution.
+    */
+   if (!p) {
+      if (!(p = *pp = malloc(sizeof(*p))))
+         return NULL;
+
+      ppc32_exec_predecode(&p->insn[0],0);
+
+      for(i=1;i<PPC32_INSN_PER_PAGE;i++)
+         p->insn[i] = p->insn[0];
+   }
+
+   p->host_page = host_page;
+   cpu->njm_predec_fills++;
+   return p;
+}
+
+/* Forget the predecoded instructions of a host page */
+void ppc32_exec_predec_invalidate(cpu_ppc_t *cpu,void *host_page)
+{
+   struct ppc32_predec_page *p;
+
+   p = cpu->njm_predec_cache[ppc32_exec_predec_hash(host_page)];
+
+   if ((p != NULL) && (p->host_page == host_page))
+      p->host_page = NULL;
+}
+
+/* Forget all predecoded pages (entries are kept for reuse) */
+void ppc32_exec_predec_flush(cpu_ppc_t *cpu)
+{
+   u_int i;
+
+   for(i=0;i<PPC32_PREDEC_CACHE_SIZE;i++)
+      if (cpu->njm_predec_cache[i] != NULL)
+         cpu->njm_predec_cache[i]->host_page = NULL;
+}
+
+/* Free the predecoded pages of a CPU */
+void ppc32_exec_predec_free(cpu_ppc_t *cpu)
+{
+   u_int i;
+
+   for(i=0;i<PPC32_PREDEC_CACHE_SIZE;i++) {
+      free(cpu->njm_predec_cache[i]);
+      cpu->njm_predec_cache[i] = NULL;
+   }
+
+   cpu->njm_predec = NULL;
+}
+
 /* Fetch an instruction */
 static forced_inline int ppc32_exec_fetch(cpu_ppc_t *cpu,m_uint32_t ia,
                                           ppc_insn_t *insn)
@@ -108,8 +274,13 @@ static forced_inline int ppc32_exec_fetch(cpu_ppc_t *cpu,m_uint32_t ia,
    exec_page = ia & ~PPC32_MIN_PAGE_IMASK;
 
    if (unlikely(exec_page != cpu->njm_exec_page)) {
+      /* End of the IOS self-decompression ? */
+      if (unlikely(cpu->vm->ios_unpack_armed))
+         ios_unpack_check(cpu->gen);
+
       cpu->njm_exec_ptr  = cpu->mem_op_ifetch(cpu,exec_page);
       cpu->njm_exec_page = exec_page;
+      cpu->njm_predec    = ppc32_exec_predec_get(cpu,cpu->njm_exec_ptr);
    }
 
    offset = (ia & PPC32_MIN_PAGE_IMASK) >> 2;
@@ -149,6 +320,35 @@ ppc32_exec_single_instruction(cpu_ppc_t *cpu,ppc_insn_t instruction)
    return(exec(cpu,instruction));
 }
 
+/* 
+ * Execute an instruction of the current exec page, located at "ia",
+ * through the handler set when the instruction was predecoded.
+ */
+static forced_inline int 
+ppc32_exec_predec_instruction(cpu_ppc_t *cpu,m_uint32_t ia,
+                              ppc_insn_t instruction)
+{
+   struct ppc32_predec_insn *p;
+
+   if (unlikely(!cpu->njm_predec))
+      return(ppc32_exec_single_instruction(cpu,instruction));
+
+   p = &cpu->njm_predec->insn[(ia & PPC32_MIN_PAGE_IMASK) >> 2];
+
+   /* Instruction executed for the first time or modified since */
+   if (unlikely(p->insn != instruction))
+      ppc32_exec_predecode(p,instruction);
+
+#if DEBUG_INSN_PERF_CNT
+   cpu->perf_counter++;
+#endif
+#if NJM_STATS_ENABLE
+   cpu->insn_exec_count++;
+   ppc32_exec_tags[p->index].count++;
+#endif
+   return(p->exec(cpu,p));
+}
+
 /* Execute a single instruction (external) */
 int ppc32_exec_single_insn_ext(cpu_ppc_t *cpu,ppc_insn_t insn)
 {
@@ -166,15 +366,20 @@ int ppc32_exec_page(cpu_ppc_t *cpu)
    ppc_insn_t insn;
    int res;
 
+   /* End of the IOS self-decompression ? */
+   if (unlikely(cpu->vm->ios_unpack_armed))
+      ios_unpack_check(cpu->gen);
+
    exec_page = cpu->ia & PPC32_MIN_PAGE_MASK;
    cpu->njm_exec_page = exec_page;
    cpu->njm_exec_ptr  = cpu->mem_op_lookup(cpu,exec_page,PPC32_MTS_ICACHE);
+   cpu->njm_predec    = ppc32_exec_predec_get(cpu,cpu->njm_exec_ptr);
 
    do {
       offset = (cpu->ia & PPC32_MIN_PAGE_IMASK) >> 2;
       insn = vmtoh32(cpu->njm_exec_ptr[offset]);
 
-      res = ppc32_exec_single_instruction(cpu,insn);
+      res = ppc32_exec_predec_instruction(cpu,cpu->ia,insn);
       if (likely(!res)) cpu->ia += sizeof(ppc_insn_t);
    }while((cpu->ia & PPC32_MIN_PAGE_MASK) == exec_page);
 
@@ -185,21 +390,22 @@ int ppc32_exec_page(cpu_ppc_t *cpu)
 void *ppc32_exec_run_cpu(cpu_gen_t *gen)
 {   
    cpu_ppc_t *cpu = CPU_PPC32(gen);
-   pthread_t timer_irq_thread;
    int timer_irq_check = 0;
    ppc_insn_t insn;
    int res;
 
-   if (pthread_create(&timer_irq_thread,NULL,
-                      (void *)ppc32_timer_irq_run,cpu))
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)ppc32_timer_tick,
+                                             cpu)))
    {
-      fprintf(stderr,"VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+      fprintf(stderr,"VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(gen);
       return NULL;
    }
 
    gen->cpu_thread_running = TRUE;
+   gen->cpu_thread_tid = host_perf_gettid();
    cpu_exec_loop_set(gen);
 
  start_cpu:
@@ -207,6 +413,14 @@ void *ppc32_exec_run_cpu(cpu_gen_t *gen)
       if (unlikely(gen->state != CPU_STATE_RUNNING))
          break;
 
+      /* Parked by another thread (remapping of memory pages) */
+      if (unlikely(gen->quiesce_req))
+         cpu_quiesce_wait(gen);
+
+      /* MTS invalidations requested by other threads */
+      if (unlikely(gen->mts_req_pending))
+         cpu_mts_handle_requests(gen);
+
       /* Check IRQ */
       if (unlikely(cpu->irq_check))
          ppc32_trigger_irq(cpu);
@@ -239,7 +453,7 @@ void *ppc32_exec_run_cpu(cpu_gen_t *gen)
 
       /* Fetch and execute the instruction */
       ppc32_exec_fetch(cpu,cpu->ia,&insn);
-      res = ppc32_exec_single_instruction(cpu,insn);
+      res = ppc32_exec_predec_instruction(cpu,cpu->ia,insn);
 
       /* Normal flow ? */
       if (likely(!res)) cpu->ia += sizeof(ppc_insn_t);
@@ -256,7 +470,8 @@ void *ppc32_exec_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:     
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
@@ -3659,6 +3874,277 @@ static int ppc32_exec_TLBWE(cpu_ppc_t *cpu,ppc_insn_t insn)
    return(0);
 }
 
+/* Set a CR field after a comparison (predecoded operands) */
+static forced_inline void ppc32_predec_cmp(cpu_ppc_t *cpu,u_int crf,
+                                           int lt,int gt)
+{
+   m_uint32_t res;
+
+   if (lt)
+      res = 0x08;
+   else {
+      if (gt)
+         res = 0x04;
+      else
+         res = 0x02;
+   }
+
+   if (cpu->xer & PPC32_XER_SO)
+      res |= 0x01;
+
+   cpu->cr_fields[crf] = res;
+}
+
+/* Effective address of a D-form memory operation (predecoded operands) */
+static forced_inline m_uint32_t ppc32_predec_ea(cpu_ppc_t *cpu,
+                                                struct ppc32_predec_insn *p)
+{
+   m_uint32_t vaddr = p->imm;
+
+   if (p->ra != 0)
+      vaddr += cpu->gpr[p->ra];
+
+   return(vaddr);
+}
+
+/* ADD (predecoded) */
+static int ppc32_predec_ADD(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->gpr[p->ra] + cpu->gpr[p->rb];
+   return(0);
+}
+
+/* ADDI and ADDIS (predecoded) */
+static int ppc32_predec_ADDI(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->rd] = ppc32_predec_ea(cpu,p);
+   return(0);
+}
+
+/* AND (predecoded) */
+static int ppc32_predec_AND(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->ra] = cpu->gpr[p->rd] & cpu->gpr[p->rb];
+   return(0);
+}
+
+/* ANDI. (predecoded) */
+static int ppc32_predec_ANDI_dot(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   register m_uint32_t tmp;
+
+   tmp = cpu->gpr[p->rd] & p->imm;
+   ppc32_exec_update_cr0(cpu,tmp);
+   cpu->gpr[p->ra] = tmp;
+   return(0);
+}
+
+/* B (predecoded) */
+static int ppc32_predec_B(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->ia += p->imm;
+   return(1);
+}
+
+/* BC (predecoded) */
+static int ppc32_predec_BC(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   if (ppc32_check_cond(cpu,p->rd,p->ra)) {
+      cpu->ia += p->imm;
+      return(1);
+   }
+
+   return(0);
+}
+
+/* BCLR (predecoded) */
+static int ppc32_predec_BCLR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   if (ppc32_check_cond(cpu,p->rd,p->ra)) {
+      cpu->ia = cpu->lr & ~0x3;
+      return(1);
+   }
+
+   return(0);
+}
+
+/* BL (predecoded) */
+static int ppc32_predec_BL(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->lr = cpu->ia + 4;
+   cpu->ia += p->imm;
+   return(1);
+}
+
+/* CMP (predecoded) */
+static int ppc32_predec_CMP(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   m_int32_t a = cpu->gpr[p->ra];
+   m_int32_t b = cpu->gpr[p->rb];
+
+   ppc32_predec_cmp(cpu,p->rd >> 2,a < b,a > b);
+   return(0);
+}
+
+/* CMPI (predecoded) */
+static int ppc32_predec_CMPI(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   m_int32_t a = cpu->gpr[p->ra];
+   m_int32_t b = p->imm;
+
+   ppc32_predec_cmp(cpu,p->rd >> 2,a < b,a > b);
+   return(0);
+}
+
+/* CMPL (predecoded) */
+static int ppc32_predec_CMPL(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   m_uint32_t a = cpu->gpr[p->ra];
+   m_uint32_t b = cpu->gpr[p->rb];
+
+   ppc32_predec_cmp(cpu,p->rd >> 2,a < b,a > b);
+   return(0);
+}
+
+/* CMPLI (predecoded) */
+static int ppc32_predec_CMPLI(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   m_uint32_t a = cpu->gpr[p->ra];
+
+   ppc32_predec_cmp(cpu,p->rd >> 2,a < p->imm,a > p->imm);
+   return(0);
+}
+
+/* LBZ (predecoded) */
+static int ppc32_predec_LBZ(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   ppc32_exec_memop(cpu,PPC_MEMOP_LBZ,ppc32_predec_ea(cpu,p),p->rd);
+   return(0);
+}
+
+/* LWZ (predecoded) */
+static int ppc32_predec_LWZ(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   ppc32_exec_memop(cpu,PPC_MEMOP_LWZ,ppc32_predec_ea(cpu,p),p->rd);
+   return(0);
+}
+
+/* MFCTR (predecoded) */
+static int ppc32_predec_MFCTR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->ctr;
+   return(0);
+}
+
+/* MFLR (predecoded) */
+static int ppc32_predec_MFLR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->lr;
+   return(0);
+}
+
+/* MTCTR (predecoded) */
+static int ppc32_predec_MTCTR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->ctr = cpu->gpr[p->rd];
+   return(0);
+}
+
+/* MTLR (predecoded) */
+static int ppc32_predec_MTLR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->lr = cpu->gpr[p->rd];
+   return(0);
+}
+
+/* OR (predecoded) */
+static int ppc32_predec_OR(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->ra] = cpu->gpr[p->rd] | cpu->gpr[p->rb];
+   return(0);
+}
+
+/* ORI and ORIS (predecoded) */
+static int ppc32_predec_ORI(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->ra] = cpu->gpr[p->rd] | p->imm;
+   return(0);
+}
+
+/* RLWINM (predecoded) */
+static int ppc32_predec_RLWINM(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   register m_uint32_t r;
+
+   r = (cpu->gpr[p->rd] << p->rb) | (cpu->gpr[p->rd] >> (32 - p->rb));
+   cpu->gpr[p->ra] = r & p->imm;
+   return(0);
+}
+
+/* STB (predecoded) */
+static int ppc32_predec_STB(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   ppc32_exec_memop(cpu,PPC_MEMOP_STB,ppc32_predec_ea(cpu,p),p->rd);
+   return(0);
+}
+
+/* STW (predecoded) */
+static int ppc32_predec_STW(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   ppc32_exec_memop(cpu,PPC_MEMOP_STW,ppc32_predec_ea(cpu,p),p->rd);
+   return(0);
+}
+
+/* STWU (predecoded) */
+static int ppc32_predec_STWU(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   m_uint32_t vaddr;
+
+   vaddr = cpu->gpr[p->ra] + p->imm;
+   ppc32_exec_memop(cpu,PPC_MEMOP_STW,vaddr,p->rd);
+   cpu->gpr[p->ra] = vaddr;
+   return(0);
+}
+
+/* SUBF (predecoded) */
+static int ppc32_predec_SUBF(cpu_ppc_t *cpu,struct ppc32_predec_insn *p)
+{
+   cpu->gpr[p->rd] = cpu->gpr[p->rb] - cpu->gpr[p->ra];
+   return(0);
+}
+
+/* Instructions run with predecoded operands (the others use their tag) */
+static struct ppc32_predec_tag ppc32_predec_tags[] = {
+   { ppc32_exec_ADD      , ppc32_predec_ADD      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_ADDI     , ppc32_predec_ADDI     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_ADDIS    , ppc32_predec_ADDI     , PPC32_PREDEC_IMM_HI },
+   { ppc32_exec_AND      , ppc32_predec_AND      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_ANDI_dot , ppc32_predec_ANDI_dot , PPC32_PREDEC_IMM_U16 },
+   { ppc32_exec_B        , ppc32_predec_B        , PPC32_PREDEC_IMM_BRANCH },
+   { ppc32_exec_BC       , ppc32_predec_BC       , PPC32_PREDEC_IMM_BC },
+   { ppc32_exec_BCLR     , ppc32_predec_BCLR     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_BL       , ppc32_predec_BL       , PPC32_PREDEC_IMM_BRANCH },
+   { ppc32_exec_CMP      , ppc32_predec_CMP      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_CMPI     , ppc32_predec_CMPI     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_CMPL     , ppc32_predec_CMPL     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_CMPLI    , ppc32_predec_CMPLI    , PPC32_PREDEC_IMM_U16 },
+   { ppc32_exec_LBZ      , ppc32_predec_LBZ      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_LWZ      , ppc32_predec_LWZ      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_MFCTR    , ppc32_predec_MFCTR    , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_MFLR     , ppc32_predec_MFLR     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_MTCTR    , ppc32_predec_MTCTR    , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_MTLR     , ppc32_predec_MTLR     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_OR       , ppc32_predec_OR       , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_ORI      , ppc32_predec_ORI      , PPC32_PREDEC_IMM_U16 },
+   { ppc32_exec_ORIS     , ppc32_predec_ORI      , PPC32_PREDEC_IMM_HI },
+   { ppc32_exec_RLWINM   , ppc32_predec_RLWINM   , PPC32_PREDEC_IMM_MASK },
+   { ppc32_exec_STB      , ppc32_predec_STB      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_STW      , ppc32_predec_STW      , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_STWU     , ppc32_predec_STWU     , PPC32_PREDEC_IMM_S16 },
+   { ppc32_exec_SUBF     , ppc32_predec_SUBF     , PPC32_PREDEC_IMM_S16 },
+   { NULL                , NULL                  , 0 },
+};
+
 /* PowerPC instruction array */
 static struct ppc32_insn_exec_tag ppc32_exec_tags[] = {
    { "mflr"    , ppc32_exec_MFLR       , 0xfc1fffff , 0x7c0802a6, 0 },
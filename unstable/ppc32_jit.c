@@ -11,6 +11,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <assert.h>
@@ -24,6 +25,8 @@
 #include "memory.h"
 #include "ptask.h"
 #include "crc.h"
+#include "ios_unpack.h"
+#include "host_perf.h"
 
 #include PPC32_ARCH_INC_FILE
 
@@ -80,7 +83,7 @@ int ppc32_jit_init(cpu_ppc_t *cpu)
    u_char *cp_addr;
    u_int area_size;
    size_t len;
-   int i;
+   int i,mode;
 
    /* Virtual address mapping for TCB */
    len = PPC_JIT_VIRT_HASH_SIZE * sizeof(void *);
@@ -104,7 +107,16 @@ int ppc32_jit_init(cpu_ppc_t *cpu)
 
    /* Create executable page area */
    cpu->exec_page_area_size = area_size * 1048576;
-   cpu->exec_page_area = memzone_map_exec_area(cpu->exec_page_area_size);
+   cpu->exec_page_area_huge = cpu->vm->huge_pages;
+
+   if (cpu->exec_page_area_huge) {
+      mode = cpu->exec_page_area_huge;
+      cpu->exec_page_area = memzone_map_huge(cpu->exec_page_area_size,
+                                             PROT_EXEC|PROT_READ|PROT_WRITE,
+                                             &mode);
+   } else {
+      cpu->exec_page_area = memzone_map_exec_area(cpu->exec_page_area_size);
+   }
 
    if (!cpu->exec_page_area) {
       fprintf(stderr,
@@ -138,10 +150,19 @@ int ppc32_jit_init(cpu_ppc_t *cpu)
           cpu->gen->id,
           (u_long)(cpu->exec_page_area_size / 1048576),
           (u_long)cpu->exec_page_count,PPC_JIT_BUFSIZE / 1024);
+
+   if (cpu->exec_page_area_huge) {
+      printf("CPU%u: JIT exec zone allocated with huge pages (%s).\n",
+             cpu->gen->id,memzone_huge_mode_str(mode));
+   }
+
    return(0);
 
 err_exec_page_array:
-   memzone_unmap(cpu->exec_page_area, cpu->exec_page_area_size);
+   if (cpu->exec_page_area_huge)
+      memzone_unmap_huge(cpu->exec_page_area,cpu->exec_page_area_size);
+   else
+      memzone_unmap(cpu->exec_page_area, cpu->exec_page_area_size);
    cpu->exec_page_area = NULL;
 err_exec_page_area:
    free(cpu->tcb_phys_hash);
@@ -185,6 +206,35 @@ u_int ppc32_jit_flush(cpu_ppc_t *cpu,u_int threshold)
    return(count);
 }
 
+/* Flush the blocks whose code is read from a sorted set of host pages */
+u_int ppc32_jit_flush_hpa(cpu_ppc_t *cpu,m_iptr_t *hpa,u_int count)
+{
+   ppc32_jit_tcb_t *p,*next;
+   m_iptr_t page;
+   m_uint32_t hv;
+   u_int flushed = 0;
+
+   for(p=cpu->tcb_list;p;p=next) {
+      next = p->next;
+      page = (m_iptr_t)p->ppc_code & VM_PAGE_MASK;
+
+      if ((p->flags & PPC32_JIT_TCB_FLAG_NO_FLUSH) ||
+          !cpu_hpa_lookup(hpa,count,page))
+         continue;
+
+      hv = ppc32_jit_get_virt_hash(p->start_ia);
+      ppc32_jit_tcb_free(cpu,p,TRUE);
+
+      if (cpu->tcb_virt_hash[hv] == p)
+         cpu->tcb_virt_hash[hv] = NULL;
+
+      flushed++;
+   }
+
+   cpu->compiled_pages -= flushed;
+   return(flushed);
+}
+
 /* Shutdown the JIT */
 void ppc32_jit_shutdown(cpu_ppc_t *cpu)
 {   
@@ -200,8 +250,12 @@ void ppc32_jit_shutdown(cpu_ppc_t *cpu)
    }
 
    /* Unmap the executable page area */
-   if (cpu->exec_page_area)
-      memzone_unmap(cpu->exec_page_area,cpu->exec_page_area_size);
+   if (cpu->exec_page_area) {
+      if (cpu->exec_page_area_huge)
+         memzone_unmap_huge(cpu->exec_page_area,cpu->exec_page_area_size);
+      else
+         memzone_unmap(cpu->exec_page_area,cpu->exec_page_area_size);
+   }
 
    /* Free the exec page array */
    free(cpu->exec_page_array);
@@ -347,6 +401,16 @@ void ppc32_jit_start_hreg_seq(cpu_ppc_t *cpu,char *insn)
 /* Close register allocation sequence */
 void ppc32_jit_close_hreg_seq(cpu_ppc_t *cpu)
 {
+   struct hreg_map *map;
+
+   /* 
+    * Forced registers are directly modified by the translated code: throw
+    * them so that the op optimizer does not reuse their content.
+    */
+   for(map=cpu->hreg_map_list;map;map=map->next)
+      if (map->flags & HREG_FLAG_ALLOC_FORCED)
+         ppc32_op_emit_alter_host_reg(cpu,map->hreg);
+
 #if DEBUG_HREG
    ppc32_show_hreg_status(cpu);
 #endif
@@ -1037,6 +1101,12 @@ static void ppc32_op_optimize(cpu_gen_t *cpu,ppc32_jit_tcb_t *tcb)
 
                last_cr_update[op->param[0]] = op;
                break;
+
+            /* Host register set by the translated code */
+            case JIT_OP_MOVE_HOST_REG:
+            case JIT_OP_SET_HOST_REG_IMM32:
+               ppc32_clear_host_reg_map(ppc_map,host_map,op->param[0]);
+               break;
          }
       }
    }
@@ -1272,7 +1342,6 @@ void ppc32_jit_tcb_run(cpu_ppc_t *cpu,ppc32_jit_tcb_t *tcb)
 void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 {    
    cpu_ppc_t *cpu = CPU_PPC32(gen);
-   pthread_t timer_irq_thread;
    ppc32_jit_tcb_t *tcb;
    m_uint32_t hv,hp;
    m_uint32_t phys_page;
@@ -1280,16 +1349,22 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 
    ppc32_jit_init_hreg_mapping(cpu);
 
-   if (pthread_create(&timer_irq_thread,NULL,(void *)ppc32_timer_irq_run,cpu)) 
+   if (!(gen->timer_tick = timer_tick_register(cpu->timer_irq_freq,
+                                             (timer_tick_proc)ppc32_timer_tick,
+                                             cpu)))
    {
       fprintf(stderr,
-              "VM '%s': unable to create Timer IRQ thread for CPU%u.\n",
+              "VM '%s': unable to register Timer IRQ for CPU%u.\n",
               cpu->vm->name,gen->id);
       cpu_stop(cpu->gen);
       return NULL;
    }
 
+   if (cpu->vm->idle_pc_auto)
+      cpu_idle_auto_enable(gen,TRUE);
+
    gen->cpu_thread_running = TRUE;
+   gen->cpu_thread_tid = host_perf_gettid();
    cpu_exec_loop_set(gen);
 
  start_cpu:   
@@ -1299,6 +1374,14 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
       if (unlikely(gen->state != CPU_STATE_RUNNING))
          break;
 
+      /* Parked by another thread (remapping of memory pages) */
+      if (unlikely(gen->quiesce_req))
+         cpu_quiesce_wait(gen);
+
+      /* MTS invalidations requested by other threads */
+      if (unlikely(gen->mts_req_pending))
+         cpu_mts_handle_requests(gen);
+
 #if DEBUG_BLOCK_PERF_CNT
       cpu->perf_counter++;
 #endif
@@ -1310,10 +1393,18 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
          }
       }
 
+      /* Automatic idle PC detection */
+      if (unlikely(gen->idle_auto.enabled) &&
+          unlikely(++gen->idle_auto.itv_count == CPU_IDLE_AUTO_SAMPLE_ITV))
+         cpu_idle_auto_sample(gen,cpu->ia);
+
       /* Handle the virtual CPU clock */
       if (++timer_irq_check == cpu->timer_irq_check_itv) {
          timer_irq_check = 0;
 
+         if (unlikely(gen->idle_auto.request))
+            cpu_idle_auto_handle_request(gen);
+
          if (cpu->timer_irq_pending && !cpu->irq_disable &&
              (cpu->msr & PPC32_MSR_EE))
          {
@@ -1333,6 +1424,10 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 
       if (unlikely(!tcb) || unlikely(!ppc32_jit_tcb_match(cpu,tcb))) 
       {
+         /* End of the IOS self-decompression ? */
+         if (unlikely(cpu->vm->ios_unpack_armed))
+            ios_unpack_check(gen);
+
          /* slow lookup: try to find the page by physical address */
          cpu->translate(cpu,cpu->ia,PPC32_MTS_ICACHE,&phys_page);
          hp = ppc32_jit_get_phys_hash(phys_page);
@@ -1384,7 +1479,8 @@ void *ppc32_jit_run_cpu(cpu_gen_t *gen)
 
          case CPU_STATE_HALTED:
             gen->cpu_thread_running = FALSE;
-            pthread_join(timer_irq_thread,NULL);
+            timer_tick_unregister(gen->timer_tick);
+            gen->timer_tick = NULL;
             break;
       }
       
@@ -324,6 +324,9 @@ int ppc32_jit_init(cpu_ppc_t *cpu);
 /* Flush the JIT */
 u_int ppc32_jit_flush(cpu_ppc_t *cpu,u_int threshold);
 
+/* Flush the blocks whose code is read from a sorted set of host pages */
+u_int ppc32_jit_flush_hpa(cpu_ppc_t *cpu,m_iptr_t *hpa,u_int count);
+
 /* Shutdown the JIT */
 void ppc32_jit_shutdown(cpu_ppc_t *cpu);
 
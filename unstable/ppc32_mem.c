@@ -21,6 +21,7 @@
 #include "memory.h"
 #include "device.h"
 #include "ppc32_jit.h"
+#include "ppc32_exec.h"
 
 #define DEBUG_ICBI  0
 
@@ -389,6 +390,8 @@ static void ppc32_mem_invalidate_tcb(cpu_ppc_t *cpu,mts32_entry_t *entry)
    if (cpu->tcb_phys_hash == NULL)
       return;
 
+   ppc32_exec_predec_invalidate(cpu,(void *)entry->hpa);
+
    phys_page = entry->gppa >> VM_PAGE_SHIFT;
    hp = ppc32_jit_get_phys_hash(phys_page);
  
@@ -457,6 +460,7 @@ static inline void *ppc32_mem_access(cpu_ppc_t *cpu,m_uint32_t vaddr,
       if (entry->flags & MTS_FLAG_DEV) {
          dev_id = entry->gppa;
          haddr  = entry->hpa;
+         cpu_idle_auto_mmio(cpu->gen);
          return(dev_access_fast(cpu->gen,dev_id,haddr,op_size,op_type,data));
       }
    }
@@ -988,6 +992,28 @@ static void ppc32_mem_rebuild_mts(cpu_gen_t *gen_cpu)
    ppc32_mem_invalidate_cache(CPU_PPC32(gen_cpu));
 }
 
+/* Invalidate the entries mapping a host page */
+static void ppc32_mem_invalidate_hpa(cpu_gen_t *gen_cpu,m_iptr_t hpa)
+{
+   cpu_ppc_t *cpu = CPU_PPC32(gen_cpu);
+   mts32_entry_t *entry;
+   u_int i,cid;
+
+   for(cid=PPC32_MTS_ICACHE;cid<=PPC32_MTS_DCACHE;cid++) {
+      for(i=0;i<MTS32_HASH_SIZE;i++) {
+         entry = &cpu->mts_cache[cid][i];
+
+         if (!(entry->gvpa & MTS_INV_ENTRY_MASK) &&
+             !(entry->flags & MTS_FLAG_DEV) &&
+             (entry->hpa == hpa))
+            memset(entry,0xFF,sizeof(*entry));
+      }
+   }
+
+   /* the instruction fetch of the interpreter may use this page */
+   cpu->njm_exec_page = (m_uint64_t)-1;
+}
+
 /* Initialize memory access vectors */
 void ppc32_init_memop_vectors(cpu_ppc_t *cpu)
 {
@@ -996,6 +1022,7 @@ void ppc32_init_memop_vectors(cpu_ppc_t *cpu)
 
    /* MTS rebuild */
    cpu->gen->mts_rebuild = ppc32_mem_rebuild_mts;
+   cpu->gen->mts_invalidate_hpa = ppc32_mem_invalidate_hpa;
 
    /* MTS statistics */
    cpu->gen->mts_show_stats = ppc32_mem_show_stats;
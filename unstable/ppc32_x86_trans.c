@@ -164,6 +164,25 @@ static void ppc32_try_direct_far_jump(cpu_ppc_t *cpu,jit_op_t *iop,
    ppc32_jit_tcb_push_epilog(&iop->ob_ptr);
 }
 
+/* 
+ * Return to the caller if the IRQ check flag is set. Loops in a page and
+ * chained blocks would otherwise delay IRQs and requests of other threads.
+ */
+static void ppc32_check_exit_req(jit_op_t *iop,m_uint32_t new_ia)
+{
+   u_char *test1;
+
+   x86_alu_membase_imm(iop->ob_ptr,X86_CMP,X86_EDI,
+                       OFFSET(cpu_ppc_t,irq_check),0);
+   test1 = iop->ob_ptr;
+   x86_branch8(iop->ob_ptr, X86_CC_Z, 0, 1);
+
+   ppc32_set_ia(&iop->ob_ptr,new_ia);
+   ppc32_jit_tcb_push_epilog(&iop->ob_ptr);
+
+   x86_patch(test1,iop->ob_ptr);
+}
+
 /* Set Jump */
 static void ppc32_set_jump(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,jit_op_t *iop,
                            m_uint32_t new_ia,int local_jump)
@@ -177,11 +196,16 @@ static void ppc32_set_jump(cpu_ppc_t *cpu,ppc32_jit_tcb_t *b,jit_op_t *iop,
 #endif
       
    if (!return_to_caller && ppc32_jit_tcb_local_addr(b,new_ia,&jump_ptr)) {
+      /* backward jump: loop in the page */
+      if (new_ia <= (b->start_ia + (b->ppc_trans_pos << 2)))
+         ppc32_check_exit_req(iop,new_ia);
+
       ppc32_jit_tcb_record_patch(b,iop,iop->ob_ptr,new_ia);
       x86_jump32(iop->ob_ptr,0);
    } else {
       if (cpu->exec_blk_direct_jump) {
          /* Block lookup optimization */
+         ppc32_check_exit_req(iop,new_ia);
          ppc32_try_direct_far_jump(cpu,iop,new_ia);
       } else {
          ppc32_set_ia(&iop->ob_ptr,new_ia);
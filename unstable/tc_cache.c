@@ -0,0 +1,635 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Persistent cache of translated code.
+ *
+ * Translated pages are stored in a file keyed by the image hash and the
+ * host CPU, so that a new instance running the same image can reuse them
+ * instead of translating the code again. An entry is found from the page
+ * checksum, and is only used if the virtual address, the execution state,
+ * the code generation variant and the whole guest page are identical.
+ *
+ * Translated code is relocatable: jumps inside a page are relative, and
+ * the absolute host addresses (C helpers) are recorded during translation
+ * and relocated at load. Only code using a single exec page is stored.
+ * The emulator binary must be exactly the same, this is checked with a
+ * hash of the executable file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "cpu.h"
+#include "vm.h"
+#include "tcb.h"
+#include "tc_cache.h"
+
+/* Directory used to store cache files */
+char *tc_cache_dir = NULL;
+
+/* List of opened caches */
+static tc_cache_t *tc_cache_list = NULL;
+static pthread_mutex_t tc_cache_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash of the emulator binary (0 if unknown) */
+static m_uint64_t tc_cache_exe_hash = 0;
+
+#define TC_CACHE_LOCK(c)   pthread_mutex_lock(&(c)->lock)
+#define TC_CACHE_UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+
+/* Size of the payload following an entry header */
+#define TC_CACHE_PAYLOAD_SIZE(code_size,reloc_count)            \
+   (VM_PAGE_SIZE + ((VM_PAGE_SIZE / sizeof(m_uint32_t)) * sizeof(m_uint32_t)) + \
+    ((reloc_count) * sizeof(m_uint32_t)) + (code_size))
+
+/* Compute a hash on a memory block (64-bit words, then remaining bytes) */
+static m_uint64_t tc_cache_hash_block(m_uint64_t hash,void *ptr,size_t len)
+{
+   u_char *p = ptr;
+   m_uint64_t val;
+
+   for(;len>=sizeof(val);p+=sizeof(val),len-=sizeof(val)) {
+      memcpy(&val,p,sizeof(val));
+      hash ^= val;
+      hash *= 0x100000001B3ULL;
+   }
+
+   for(;len>0;p++,len--) {
+      hash ^= *p;
+      hash *= 0x100000001B3ULL;
+   }
+
+   return(hash);
+}
+
+/* Compute a hash on a file */
+int tc_cache_hash_file(char *filename,m_uint64_t *hash)
+{
+   u_char *ptr;
+   off_t fsize;
+   int fd;
+
+   if ((fd = memzone_open_file_ro(filename,&ptr,&fsize)) == -1)
+      return(-1);
+
+   *hash = tc_cache_hash_block(0xCBF29CE484222325ULL,ptr,fsize);
+
+   memzone_unmap(ptr,fsize);
+   close(fd);
+   return(0);
+}
+
+/* Set the cache directory */
+int tc_cache_set_dir(char *dir)
+{
+   char *str = NULL;
+
+   if (dir && *dir && !(str = strdup(dir)))
+      return(-1);
+
+   free(tc_cache_dir);
+   tc_cache_dir = str;
+   return(0);
+}
+
+/* Get the payload of an entry */
+static inline u_char *tc_cache_entry_payload(struct tc_cache_entry *entry)
+{
+   return((u_char *)(entry + 1));
+}
+
+/* Compute the size of an entry */
+static inline size_t tc_cache_entry_size(m_uint32_t code_size,
+                                         m_uint32_t reloc_count)
+{
+   size_t len;
+
+   len = sizeof(struct tc_cache_entry);
+   len += TC_CACHE_PAYLOAD_SIZE(code_size,reloc_count);
+   return((len + 7) & ~7);
+}
+
+/* Compute the hash bucket of a checksum */
+static inline u_int tc_cache_hash(tsg_checksum_t cksum)
+{
+   cksum *= 0x9E3779B97F4A7C15ULL;
+   return((u_int)(cksum >> 32) & TC_CACHE_HASH_MASK);
+}
+
+/* Find an entry reference */
+static struct tc_cache_ref *
+tc_cache_find_ref(tc_cache_t *cache,tsg_checksum_t checksum,
+                  m_uint64_t vaddr,m_uint32_t exec_state,m_uint32_t variant,
+                  struct tc_cache_ref *start)
+{
+   struct tc_cache_ref *ref;
+
+   ref = start ? start->next : cache->hash[tc_cache_hash(checksum)];
+
+   for(;ref;ref=ref->next)
+      if ((ref->checksum == checksum) && (ref->vaddr == vaddr) &&
+          (ref->exec_state == exec_state) && (ref->variant == variant))
+         return ref;
+
+   return NULL;
+}
+
+/* Add an entry reference */
+static int tc_cache_add_ref(tc_cache_t *cache,struct tc_cache_entry *entry,
+                            tsg_checksum_t checksum,m_uint64_t vaddr,
+                            m_uint32_t exec_state,m_uint32_t variant)
+{
+   struct tc_cache_ref *ref;
+   u_int bucket;
+
+   if (!(ref = malloc(sizeof(*ref))))
+      return(-1);
+
+   ref->entry      = entry;
+   ref->checksum   = checksum;
+   ref->vaddr      = vaddr;
+   ref->exec_state = exec_state;
+   ref->variant    = variant;
+   ref->status     = 0;
+
+   bucket = tc_cache_hash(checksum);
+   ref->next = cache->hash[bucket];
+   cache->hash[bucket] = ref;
+   return(0);
+}
+
+/* Map the cache file and index its entries */
+static int tc_cache_map_file(tc_cache_t *cache)
+{
+   struct tc_cache_header *hdr;
+   struct tc_cache_entry *entry;
+   off_t pos;
+   u_int i;
+
+   cache->fd = memzone_open_file_ro(cache->filename,&cache->map,
+                                    &cache->map_size);
+   if (cache->fd == -1) {
+      cache->map = NULL;
+      return(-1);
+   }
+
+   hdr = (struct tc_cache_header *)cache->map;
+
+   if ((cache->map_size < sizeof(*hdr)) ||
+       (hdr->magic != TC_CACHE_MAGIC) ||
+       (hdr->version != TC_CACHE_VERSION) ||
+       (hdr->host_cpu != JIT_CPU) ||
+       (hdr->exe_hash != tc_cache_exe_hash) ||
+       (hdr->image_hash != cache->image_hash))
+   {
+      m_log("TC_CACHE","%s: not usable with this binary or image.\n",
+            cache->filename);
+      goto err_invalid;
+   }
+
+   for(i=0,pos=sizeof(*hdr);i<hdr->entry_count;i++) {
+      entry = (struct tc_cache_entry *)(cache->map + pos);
+
+      if (((pos + sizeof(*entry)) > cache->map_size) ||
+          (entry->size & 7) || (entry->size < sizeof(*entry)) ||
+          ((pos + entry->size) > cache->map_size) ||
+          (entry->size != tc_cache_entry_size(entry->code_size,
+                                              entry->reloc_count)))
+      {
+         m_log("TC_CACHE","%s: corrupted entry %u.\n",cache->filename,i);
+         break;
+      }
+
+      if (tc_cache_add_ref(cache,entry,entry->checksum,entry->vaddr,
+                           entry->exec_state,entry->variant) == -1)
+         break;
+
+      cache->loaded++;
+      pos += entry->size;
+   }
+
+   return(0);
+
+ err_invalid:
+   memzone_unmap(cache->map,cache->map_size);
+   close(cache->fd);
+   cache->map = NULL;
+   cache->fd = -1;
+   return(-1);
+}
+
+/* Write the cache file header */
+static int tc_cache_write_header(FILE *fd,m_uint64_t image_hash,u_int count)
+{
+   struct tc_cache_header hdr;
+
+   memset(&hdr,0,sizeof(hdr));
+   hdr.magic       = TC_CACHE_MAGIC;
+   hdr.version     = TC_CACHE_VERSION;
+   hdr.host_cpu    = JIT_CPU;
+   hdr.exe_hash    = tc_cache_exe_hash;
+   hdr.image_hash  = image_hash;
+   hdr.entry_count = count;
+
+   if ((fseek(fd,0,SEEK_SET) != 0) || (fwrite(&hdr,sizeof(hdr),1,fd) != 1))
+      return(-1);
+
+   return(0);
+}
+
+/* Create a new cache */
+static tc_cache_t *tc_cache_create(m_uint64_t hash)
+{
+   char filename[4096];
+   tc_cache_t *cache;
+
+   if (!(cache = malloc(sizeof(*cache))))
+      return NULL;
+
+   memset(cache,0,sizeof(*cache));
+   cache->fd = -1;
+   cache->ref_count = 1;
+   cache->image_hash = hash;
+   pthread_mutex_init(&cache->lock,NULL);
+
+   snprintf(filename,sizeof(filename),"%s/tc_%u_%16.16llx.cache",
+            tc_cache_dir,JIT_CPU,hash);
+
+   if (!(cache->filename = strdup(filename)))
+      goto err_name;
+
+   snprintf(filename,sizeof(filename),"%s.%ld.tmp",
+            cache->filename,(long)getpid());
+
+   if (!(cache->tmp_filename = strdup(filename)))
+      goto err_tmp_name;
+
+   if (!(cache->tmp_fd = fopen(cache->tmp_filename,"w"))) {
+      fprintf(stderr,"TC cache: unable to create file '%s': %s\n",
+              cache->tmp_filename,strerror(errno));
+      goto err_tmp_file;
+   }
+
+   if (tc_cache_write_header(cache->tmp_fd,cache->image_hash,0) == -1)
+      goto err_header;
+
+   tc_cache_map_file(cache);
+
+   m_log("TC_CACHE","%s: %u entries loaded.\n",cache->filename,cache->loaded);
+   return cache;
+
+ err_header:
+   fclose(cache->tmp_fd);
+   unlink(cache->tmp_filename);
+ err_tmp_file:
+   free(cache->tmp_filename);
+ err_tmp_name:
+   free(cache->filename);
+ err_name:
+   free(cache);
+   return NULL;
+}
+
+/* Get the cache of translated code for an image */
+tc_cache_t *tc_cache_open(char *image)
+{
+   tc_cache_t *cache;
+   m_uint64_t hash;
+
+   if (!tc_cache_dir || !image)
+      return NULL;
+
+   pthread_mutex_lock(&tc_cache_list_mutex);
+
+   if (!tc_cache_exe_hash &&
+       (tc_cache_hash_file("/proc/self/exe",&tc_cache_exe_hash) == -1))
+   {
+      fprintf(stderr,"TC cache: unable to identify the emulator binary, "
+              "persistent cache disabled.\n");
+      tc_cache_set_dir(NULL);
+      pthread_mutex_unlock(&tc_cache_list_mutex);
+      return NULL;
+   }
+
+   if (tc_cache_hash_file(image,&hash) == -1) {
+      fprintf(stderr,"TC cache: unable to read image '%s'.\n",image);
+      pthread_mutex_unlock(&tc_cache_list_mutex);
+      return NULL;
+   }
+
+   for(cache=tc_cache_list;cache;cache=cache->next)
+      if (cache->image_hash == hash) {
+         cache->ref_count++;
+         pthread_mutex_unlock(&tc_cache_list_mutex);
+         return cache;
+      }
+
+   if ((cache = tc_cache_create(hash)) != NULL) {
+      cache->next = tc_cache_list;
+      tc_cache_list = cache;
+   }
+
+   pthread_mutex_unlock(&tc_cache_list_mutex);
+   return cache;
+}
+
+/* Write the entries of the mapped cache file to the new file */
+static int tc_cache_copy_entries(tc_cache_t *cache,u_int *count)
+{
+   struct tc_cache_ref *ref;
+   int i;
+
+   for(i=0;i<TC_CACHE_HASH_SIZE;i++)
+      for(ref=cache->hash[i];ref;ref=ref->next) {
+         if (!ref->entry || (ref->status < 0))
+            continue;
+
+         if (fwrite(ref->entry,ref->entry->size,1,cache->tmp_fd) != 1)
+            return(-1);
+
+         (*count)++;
+      }
+
+   return(0);
+}
+
+/* Free a cache */
+static void tc_cache_free(tc_cache_t *cache)
+{
+   struct tc_cache_ref *ref,*next;
+   u_int count;
+   int i,err;
+
+   /* Update the cache file only if entries have been added or rejected */
+   if ((cache->new_entries > 0 || cache->rejected > 0) && !cache->tmp_error) {
+      count = cache->new_entries;
+
+      err = (fseek(cache->tmp_fd,0,SEEK_END) != 0) ||
+         (tc_cache_copy_entries(cache,&count) == -1) ||
+         (tc_cache_write_header(cache->tmp_fd,cache->image_hash,count) == -1);
+
+      err |= (fclose(cache->tmp_fd) != 0);
+
+      if (err || (rename(cache->tmp_filename,cache->filename) == -1)) {
+         fprintf(stderr,"TC cache: unable to update file '%s'.\n",
+                 cache->filename);
+         unlink(cache->tmp_filename);
+      } else {
+         m_log("TC_CACHE","%s: %u entries saved.\n",cache->filename,count);
+      }
+   } else {
+      fclose(cache->tmp_fd);
+      unlink(cache->tmp_filename);
+   }
+
+   m_log("TC_CACHE","%s: loaded=%u, hits=%u, rejected=%u, stored=%u\n",
+         cache->filename,cache->loaded,cache->hits,cache->rejected,
+         cache->stored);
+
+   for(i=0;i<TC_CACHE_HASH_SIZE;i++)
+      for(ref=cache->hash[i];ref;ref=next) {
+         next = ref->next;
+         free(ref);
+      }
+
+   if (cache->map != NULL) {
+      memzone_unmap(cache->map,cache->map_size);
+      close(cache->fd);
+   }
+
+   pthread_mutex_destroy(&cache->lock);
+   free(cache->tmp_filename);
+   free(cache->filename);
+   free(cache);
+}
+
+/* Release a cache, the cache file is updated when it is not used anymore */
+void tc_cache_close(tc_cache_t *cache)
+{
+   tc_cache_t **cp;
+
+   if (!cache)
+      return;
+
+   pthread_mutex_lock(&tc_cache_list_mutex);
+
+   if (--cache->ref_count > 0) {
+      pthread_mutex_unlock(&tc_cache_list_mutex);
+      return;
+   }
+
+   for(cp=&tc_cache_list;*cp;cp=&(*cp)->next)
+      if (*cp == cache) {
+         *cp = cache->next;
+         break;
+      }
+
+   pthread_mutex_unlock(&tc_cache_list_mutex);
+   tc_cache_free(cache);
+}
+
+/* Check that an entry is consistent (done once, before its first use) */
+static int tc_cache_check_entry(struct tc_cache_entry *entry)
+{
+   m_uint32_t *insn_offset,*reloc;
+   u_char *payload;
+   size_t len;
+   int i;
+
+   payload = tc_cache_entry_payload(entry);
+   len = TC_CACHE_PAYLOAD_SIZE(entry->code_size,entry->reloc_count);
+
+   if (tc_cache_hash_block(0,payload,len) != entry->hash)
+      return(-1);
+
+   if (!entry->code_size || (entry->code_size > TC_JIT_PAGE_SIZE))
+      return(-1);
+
+   insn_offset = (m_uint32_t *)(payload + VM_PAGE_SIZE);
+   reloc = insn_offset + (VM_PAGE_SIZE / sizeof(m_uint32_t));
+
+   for(i=0;i<(VM_PAGE_SIZE / sizeof(m_uint32_t));i++)
+      if ((insn_offset[i] != TC_CACHE_NO_INSN) &&
+          (insn_offset[i] >= entry->code_size))
+         return(-1);
+
+   for(i=0;i<entry->reloc_count;i++)
+      if ((reloc[i] + sizeof(m_uint64_t)) > entry->code_size)
+         return(-1);
+
+   return(0);
+}
+
+/* Copy the translated code of an entry into a TC descriptor */
+static void tc_cache_copy_code(cpu_tc_t *tc,struct tc_cache_entry *entry)
+{
+   m_uint32_t *insn_offset,*reloc;
+   m_uint64_t delta,addr;
+   u_char *payload,*code,*dst;
+   int i;
+
+   payload = tc_cache_entry_payload(entry);
+   insn_offset = (m_uint32_t *)(payload + VM_PAGE_SIZE);
+   reloc = insn_offset + (VM_PAGE_SIZE / sizeof(m_uint32_t));
+   code = (u_char *)(reloc + entry->reloc_count);
+   dst = tc->jit_buffer->ptr;
+
+   memcpy(dst,code,entry->code_size);
+
+   /* Relocate host absolute addresses */
+   delta = (m_uint64_t)(u_long)tc_cache_open - entry->reloc_base;
+
+   for(i=0;i<entry->reloc_count;i++) {
+      memcpy(&addr,dst+reloc[i],sizeof(addr));
+      addr += delta;
+      memcpy(dst+reloc[i],&addr,sizeof(addr));
+   }
+
+   for(i=0;i<(VM_PAGE_SIZE / sizeof(m_uint32_t));i++) {
+      if (insn_offset[i] != TC_CACHE_NO_INSN)
+         tc->jit_insn_ptr[i] = dst + insn_offset[i];
+      else
+         tc->jit_insn_ptr[i] = NULL;
+   }
+
+   tc->jit_ptr = dst + entry->code_size;
+   tc->flags |= TC_FLAG_CACHED;
+}
+
+/* Create a TC descriptor from the cache if a matching page is found */
+cpu_tc_t *tc_cache_load(cpu_gen_t *cpu,tc_cache_t *cache,cpu_tb_t *tb,
+                        m_uint32_t variant)
+{
+   struct tc_cache_ref *ref = NULL;
+   struct tc_cache_entry *entry;
+   cpu_tc_t *tc;
+
+   TC_CACHE_LOCK(cache);
+
+   while((ref = tc_cache_find_ref(cache,tb->checksum,tb->vaddr,
+                                  tb->exec_state,variant,ref)) != NULL)
+   {
+      if (!(entry = ref->entry) || (ref->status < 0))
+         continue;
+
+      if (!ref->status) {
+         if (tc_cache_check_entry(entry) == -1) {
+            cpu_log(cpu,"TC_CACHE","invalid entry for page 0x%8.8llx.\n",
+                    tb->vaddr);
+            ref->status = -1;
+            cache->rejected++;
+            continue;
+         }
+
+         ref->status = 1;
+      }
+
+      if (memcmp(tc_cache_entry_payload(entry),tb->target_code,VM_PAGE_SIZE))
+         continue;
+
+      TC_CACHE_UNLOCK(cache);
+
+      if (!(tc = tc_alloc(cpu,tb->vaddr,tb->exec_state,0)))
+         return NULL;
+
+      tc_cache_copy_code(tc,entry);
+
+      TC_CACHE_LOCK(cache);
+      cache->hits++;
+      TC_CACHE_UNLOCK(cache);
+      return tc;
+   }
+
+   TC_CACHE_UNLOCK(cache);
+   return NULL;
+}
+
+/* Store a newly translated TC descriptor in the cache */
+int tc_cache_store(tc_cache_t *cache,cpu_tb_t *tb,cpu_tc_t *tc,
+                   m_uint32_t variant)
+{
+   struct tc_cache_entry *entry;
+   struct tc_cache_ref *ref = NULL;
+   m_uint32_t *insn_offset,*reloc;
+   u_char *payload,*base;
+   size_t len;
+   int i,res = -1;
+
+   /* Code spanning several exec pages is not relocatable */
+   if (tc->jit_chunk_pos != 1)
+      return(-1);
+
+   TC_CACHE_LOCK(cache);
+
+   /* The new cache file cannot be written */
+   if (cache->tmp_error)
+      goto done;
+
+   /* Already in the cache (rejected entries are replaced) */
+   while((ref = tc_cache_find_ref(cache,tb->checksum,tb->vaddr,
+                                  tb->exec_state,variant,ref)) != NULL)
+   {
+      if (ref->status >= 0)
+         goto done;
+   }
+
+   base = tc->jit_chunks[0]->ptr;
+   len = tc_cache_entry_size(tc->jit_ptr - base,tc->reloc_count);
+
+   if (!(entry = calloc(1,len)))
+      goto done;
+
+   entry->size        = len;
+   entry->exec_state  = tb->exec_state;
+   entry->vaddr       = tb->vaddr;
+   entry->checksum    = tb->checksum;
+   entry->variant     = variant;
+   entry->code_size   = tc->jit_ptr - base;
+   entry->reloc_count = tc->reloc_count;
+   entry->reloc_base  = (m_uint64_t)(u_long)tc_cache_open;
+
+   payload = tc_cache_entry_payload(entry);
+   memcpy(payload,tb->target_code,VM_PAGE_SIZE);
+
+   insn_offset = (m_uint32_t *)(payload + VM_PAGE_SIZE);
+   reloc = insn_offset + (VM_PAGE_SIZE / sizeof(m_uint32_t));
+
+   for(i=0;i<(VM_PAGE_SIZE / sizeof(m_uint32_t));i++) {
+      if (tc->jit_insn_ptr[i] != NULL)
+         insn_offset[i] = tc->jit_insn_ptr[i] - base;
+      else
+         insn_offset[i] = TC_CACHE_NO_INSN;
+   }
+
+   for(i=0;i<tc->reloc_count;i++)
+      reloc[i] = tc->reloc_table[i] - base;
+
+   memcpy(reloc + tc->reloc_count,base,entry->code_size);
+
+   entry->hash = tc_cache_hash_block(0,payload,
+                                     TC_CACHE_PAYLOAD_SIZE(entry->code_size,
+                                                           entry->reloc_count));
+
+   if (fwrite(entry,len,1,cache->tmp_fd) != 1) {
+      /* the file is not consistent anymore, it will be dropped */
+      cache->tmp_error = TRUE;
+   } else if (tc_cache_add_ref(cache,NULL,tb->checksum,tb->vaddr,
+                               tb->exec_state,variant) != -1) {
+      cache->new_entries++;
+      cache->stored++;
+      res = 0;
+   }
+
+   free(entry);
+ done:
+   TC_CACHE_UNLOCK(cache);
+   return(res);
+}
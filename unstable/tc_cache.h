@@ -0,0 +1,122 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * Persistent cache of translated code.
+ */
+
+#ifndef __TC_CACHE_H__
+#define __TC_CACHE_H__
+
+#include "utils.h"
+#include "tcb.h"
+
+/* Cache file identification */
+#define TC_CACHE_MAGIC    0x4459544343414348ULL  /* "DYTCCACH" */
+#define TC_CACHE_VERSION  1
+
+/* Hash table to retrieve cache entries from page checksums */
+#define TC_CACHE_HASH_BITS  12
+#define TC_CACHE_HASH_SIZE  (1 << TC_CACHE_HASH_BITS)
+#define TC_CACHE_HASH_MASK  (TC_CACHE_HASH_SIZE - 1)
+
+/* No translated code for an instruction */
+#define TC_CACHE_NO_INSN  0xFFFFFFFF
+
+/* Cache file header */
+struct tc_cache_header {
+   m_uint64_t magic;
+   m_uint32_t version;
+   m_uint32_t host_cpu;
+   m_uint64_t exe_hash;
+   m_uint64_t image_hash;
+   m_uint32_t entry_count;
+   m_uint32_t pad;
+};
+
+/*
+ * Cache entry, followed by:
+ *   - the guest page (VM_PAGE_SIZE bytes), used to validate the entry,
+ *   - the offsets of translated instructions (one 32-bit word per insn),
+ *   - the offsets of host absolute addresses (reloc_count 32-bit words),
+ *   - the translated code (code_size bytes), padded to 8 bytes.
+ */
+struct tc_cache_entry {
+   m_uint32_t size;
+   m_uint32_t exec_state;
+   m_uint64_t vaddr;
+   tsg_checksum_t checksum;
+
+   /* Code generation variant (CPU-dependent) */
+   m_uint32_t variant;
+   m_uint32_t code_size;
+   m_uint32_t reloc_count;
+   m_uint32_t pad;
+
+   /* Reference address used to relocate host absolute addresses */
+   m_uint64_t reloc_base;
+
+   /* Hash of the entry payload */
+   m_uint64_t hash;
+};
+
+/* Reference to an entry in the hash table */
+struct tc_cache_ref {
+   struct tc_cache_ref *next;
+   struct tc_cache_entry *entry;   /* NULL if recorded during this run */
+   tsg_checksum_t checksum;
+   m_uint64_t vaddr;
+   m_uint32_t exec_state,variant;
+   int status;
+};
+
+/* Persistent cache of translated code for an image */
+typedef struct tc_cache tc_cache_t;
+struct tc_cache {
+   char *filename,*tmp_filename;
+   int ref_count;
+   tc_cache_t *next;
+   pthread_mutex_t lock;
+
+   m_uint64_t image_hash;
+
+   /* Mapped cache file */
+   int fd;
+   u_char *map;
+   off_t map_size;
+
+   /* File being built, renamed to the cache file when released */
+   FILE *tmp_fd;
+   u_int new_entries;
+   int tmp_error;
+
+   struct tc_cache_ref *hash[TC_CACHE_HASH_SIZE];
+
+   /* Statistics */
+   u_int loaded,hits,rejected,stored;
+};
+
+/* Directory used to store cache files (NULL: no persistent cache) */
+extern char *tc_cache_dir;
+
+/* Set the cache directory */
+int tc_cache_set_dir(char *dir);
+
+/* Compute a hash on a file */
+int tc_cache_hash_file(char *filename,m_uint64_t *hash);
+
+/* Get the cache of translated code for an image */
+tc_cache_t *tc_cache_open(char *image);
+
+/* Release a cache, the cache file is updated when it is not used anymore */
+void tc_cache_close(tc_cache_t *cache);
+
+/* Create a TC descriptor from the cache if a matching page is found */
+cpu_tc_t *tc_cache_load(cpu_gen_t *cpu,tc_cache_t *cache,cpu_tb_t *tb,
+                        m_uint32_t variant);
+
+/* Store a newly translated TC descriptor in the cache */
+int tc_cache_store(tc_cache_t *cache,cpu_tb_t *tb,cpu_tc_t *tc,
+                   m_uint32_t variant);
+
+#endif
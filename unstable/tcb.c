@@ -13,6 +13,7 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <assert.h>
 
 #include "device.h"
@@ -26,9 +27,6 @@
 #define DEBUG_JIT_BUFFER_ADJUST  0
 #define DEBUG_JIT_PATCH          0
 
-/* Size of a JIT page */
-#define TC_JIT_PAGE_SIZE  32768
-
 /* CPU provisionning */
 #ifndef __CYGWIN__
 #define TSG_EXEC_AREA_SINGLE_CPU  64
@@ -40,8 +38,15 @@
 /* Minimal number of exec pages to have to satisfy an allocation request */
 #define TCB_MIN_EXEC_PAGES  (2 * TCB_DESC_MAX_CHUNKS)
 
-/* Maximum number of translation sharing groups */
-#define TSG_MAX_GROUPS  128
+/* 
+ * When the exec area is full, cold TBs are evicted until this fraction
+ * of the exec pages (1/n) has been released.
+ */
+#define TSG_EVICT_RATIO  8
+
+/* History of evicted checksums (to detect recompilations) */
+#define TSG_EVICT_HIST_SIZE  4096
+#define TSG_EVICT_HIST_MASK  (TSG_EVICT_HIST_SIZE - 1)
 
 /* Hash table to retrieve Translated Code descriptors from their checksums */
 #define TC_HASH_BITS   16
@@ -69,9 +74,21 @@ struct tsg {
    insn_exec_page_t *exec_page_array;
    insn_exec_page_t *exec_page_free_list;
 
+   /* TC descriptor using each exec page */
+   cpu_tc_t **exec_page_owner;
+
    size_t exec_area_alloc_size;
    u_int exec_page_alloc,exec_page_total;
-   u_int exec_area_full;
+   int exec_area_huge;
+
+   /* Checksums of recently evicted TC */
+   tsg_checksum_t evict_hist[TSG_EVICT_HIST_SIZE];
+
+   /* Code cache statistics */
+   m_uint64_t compiles,recompiles,cache_loads;
+   m_uint64_t evictions,evicted_pages;
+   m_uint64_t async_compiles,async_dropped;
+   m_uint64_t chain_links,chain_unlinks;
 };
 
 #define TSG_LOCK(g)   pthread_mutex_lock(&(g)->lock)
@@ -80,9 +97,23 @@ struct tsg {
 /* TCB groups */
 static tsg_t *tsg_array[TSG_MAX_GROUPS];
 
+/* Background compilation */
+u_int tc_job_workers = TC_JOB_DEFAULT_WORKERS;
+u_int tc_job_threshold = TC_JOB_DEFAULT_THRESHOLD;
+
+static pthread_mutex_t tc_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tc_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t tc_job_done_cond = PTHREAD_COND_INITIALIZER;
+static struct tc_job *tc_job_queue = NULL,**tc_job_queue_tail = &tc_job_queue;
+static u_int tc_job_threads = 0;
+
+#define TC_JOB_LOCK()   pthread_mutex_lock(&tc_job_mutex)
+#define TC_JOB_UNLOCK() pthread_mutex_unlock(&tc_job_mutex)
+
 /* forward prototype declarations */
 int tsg_remove_single_desc(cpu_gen_t *cpu);
 static int tc_free(tsg_t *tsg,cpu_tc_t *tc);
+static int tsg_evict_cold(tsg_t *tsg,cpu_gen_t *cpu,u_int target);
 
 /* Create a new exec area */
 static int exec_page_create_area(tsg_t *tsg)
@@ -90,7 +121,7 @@ static int exec_page_create_area(tsg_t *tsg)
    size_t area_size,page_count;
    insn_exec_page_t *cp;
    u_char *cp_addr;
-   int i;
+   int i,mode;
    
    /* Area already created */
    if (tsg->exec_area != NULL)
@@ -98,19 +129,36 @@ static int exec_page_create_area(tsg_t *tsg)
       
    /* Allocate an executable area through MMAP */
    area_size = tsg->exec_area_alloc_size * 1048756;
-   tsg->exec_area = memzone_map_exec_area(area_size);
+
+   if (tsg->exec_area_huge) {
+      mode = tsg->exec_area_huge;
+      tsg->exec_area = memzone_map_huge(area_size,
+                                        PROT_EXEC|PROT_READ|PROT_WRITE,&mode);
+   } else {
+      tsg->exec_area = memzone_map_exec_area(area_size);
+   }
   
    if (!tsg->exec_area) {
       perror("exec_page_create_area: mmap");
       goto err_mmap;
    }
 
+   if (tsg->exec_area_huge) {
+      m_log("TSG","exec area of %lu Mb allocated with huge pages (%s)\n",
+            (u_long)tsg->exec_area_alloc_size,memzone_huge_mode_str(mode));
+   }
+
    /* Create the page array */  
    page_count = area_size / TC_JIT_PAGE_SIZE;
    tsg->exec_page_array = calloc(page_count,sizeof(insn_exec_page_t));
       
    if (!tsg->exec_page_array)
       goto err_array;
+
+   tsg->exec_page_owner = calloc(page_count,sizeof(cpu_tc_t *));
+
+   if (!tsg->exec_page_owner)
+      goto err_owner;
    
    for(i=0,cp_addr=tsg->exec_area;i<page_count;i++) {
       cp = &tsg->exec_page_array[i];
@@ -125,15 +173,23 @@ static int exec_page_create_area(tsg_t *tsg)
    }
 
    return(0);
-   
+
+ err_owner:
+   free(tsg->exec_page_array);
  err_array:
-   memzone_unmap(tsg->exec_area,area_size);
+   if (tsg->exec_area_huge)
+      memzone_unmap_huge(tsg->exec_area,area_size);
+   else
+      memzone_unmap(tsg->exec_area,area_size);
  err_mmap:
    return(-1);
 }
 
-/* Allocate an exec page */
-static insn_exec_page_t *exec_page_alloc(cpu_gen_t *cpu)
+/* 
+ * Allocate an exec page. Background threads (TC_FLAG_ASYNC) don't own
+ * the TBs of the CPU, so they cannot evict anything.
+ */
+static insn_exec_page_t *exec_page_alloc(cpu_gen_t *cpu,u_int flags)
 {
    tsg_t *tsg = tsg_array[cpu->tsg];
    insn_exec_page_t *p;
@@ -144,30 +200,26 @@ static insn_exec_page_t *exec_page_alloc(cpu_gen_t *cpu)
    //tcb_desc_check_consistency(tcbg);
 
    /* 
-    * If the free list is empty, try to increase exec area capacity, then
-    * flush JIT for the requesting CPU.
+    * If the free list is empty, evict cold TBs of the requesting CPU.
+    * Only TBs of this CPU can be released safely since other CPUs may
+    * be running their translated code.
     */
    if (unlikely(!(p = tsg->exec_page_free_list))) {
-      count = tsg_remove_single_desc(cpu);
+      if (flags & TC_FLAG_ASYNC) {
+         TSG_UNLOCK(tsg);
+         return NULL;
+      }
+
+      count = tsg_evict_cold(tsg,cpu,tsg->exec_page_total / TSG_EVICT_RATIO);
 #if DEBUG_JIT_FLUSH
-      cpu_log(cpu,"JIT","flushed %d TCB\n",count);
+      cpu_log(cpu,"JIT","evicted %d TB\n",count);
 #endif
 
-      if (unlikely(!(p = tsg->exec_page_free_list)))
-         tsg->exec_area_full = TRUE;
-   }
-
-   /* If the area is full, stop allocating pages and free TCB */
-   if (tsg->exec_area_full) {
-      cpu_jit_tcb_flush_all(cpu);
-      
-      /* if we get >= 25% of free pages, we can reallocate */
-      if (tsg->exec_page_total >= (tsg->exec_page_alloc * 4)) {
-         tsg->exec_area_full = FALSE;
+      /* Pages are held by other CPUs, the caller will use non-JIT mode */
+      if (unlikely(!(p = tsg->exec_page_free_list))) {
+         TSG_UNLOCK(tsg);
+         return NULL;
       }
-
-      TSG_UNLOCK(tsg);
-      return NULL;
    }
 
    tsg->exec_page_free_list = p->next;
@@ -201,8 +253,11 @@ int tsg_alloc(void)
    return(-1);
 }
 
-/* Create a translation sharing group */
-int tsg_create(int id,size_t alloc_size)
+/* 
+ * Create a translation sharing group. The exec area uses huge pages
+ * if "huge" is set (MEMZONE_HUGE_* mode).
+ */
+int tsg_create(int id,size_t alloc_size,int huge)
 {
    tsg_t *tsg;
    
@@ -215,8 +270,8 @@ int tsg_create(int id,size_t alloc_size)
       return(-1);
       
    memset(tsg,0,sizeof(*tsg));
-   tsg->exec_area_full = FALSE;
    tsg->exec_area_alloc_size = alloc_size;
+   tsg->exec_area_huge = huge;
    
    /* Create the TC hash table */
    if (!(tsg->tc_hash = calloc(sizeof(cpu_tc_t *),TC_HASH_SIZE)))
@@ -257,7 +312,7 @@ int tsg_bind_cpu(cpu_gen_t *cpu)
       alloc_size = TSG_EXEC_AREA_SHARED;
    }
       
-   if (tsg_create(cpu->tsg,alloc_size) == -1)
+   if (tsg_create(cpu->tsg,alloc_size,cpu->vm->huge_pages) == -1)
       return(-1);
       
    tsg = tsg_array[cpu->tsg];
@@ -289,6 +344,7 @@ int tsg_unbind_cpu(cpu_gen_t *cpu)
    
    cpu->tb_list = NULL;
    cpu->tb_free_list = NULL;
+   cpu->tb_clock_hand = NULL;
    
    tsg = tsg_array[cpu->tsg];
    TSG_LOCK(tsg);
@@ -300,6 +356,7 @@ int tsg_unbind_cpu(cpu_gen_t *cpu)
 /* Create a JIT chunk */
 int tc_alloc_jit_chunk(cpu_gen_t *cpu,cpu_tc_t *tc)
 {
+   tsg_t *tsg = tsg_array[cpu->tsg];
    insn_exec_page_t *chunk;
    
    if (tc->jit_chunk_pos >= TC_MAX_CHUNKS) {
@@ -307,11 +364,12 @@ int tc_alloc_jit_chunk(cpu_gen_t *cpu,cpu_tc_t *tc)
       return(-1);
    }
    
-   if (!(chunk = exec_page_alloc(cpu)))
+   if (!(chunk = exec_page_alloc(cpu,tc->flags)))
       return(-1);
    
    tc->jit_chunks[tc->jit_chunk_pos++] = chunk;
    tc->jit_buffer = chunk;
+   tsg->exec_page_owner[chunk - tsg->exec_page_array] = tc;
    return(0);
 }
 
@@ -321,6 +379,7 @@ static void tc_free_jit_chunks(tsg_t *tsg,cpu_tc_t *tc)
    int i;
 
    for(i=0;i<tc->jit_chunk_pos;i++) {
+      tsg->exec_page_owner[tc->jit_chunks[i] - tsg->exec_page_array] = NULL;
       exec_page_free(tsg,tc->jit_chunks[i]);
       tc->jit_chunks[i] = NULL;
    }
@@ -363,6 +422,7 @@ static int tc_free(tsg_t *tsg,cpu_tc_t *tc)
       tc->flags &= ~TC_FLAG_VALID;
       
       tc_free_patches(tc);
+      tc_free_relocs(tc);
       
       tc_remove_from_hash(tc);
       tc_remove_cpu_local(tc);
@@ -381,7 +441,8 @@ static int tc_free(tsg_t *tsg,cpu_tc_t *tc)
 }
 
 /* Allocate a new TC descriptor */
-cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state)
+cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state,
+                   u_int flags)
 {
    tsg_t *tsg = tsg_array[cpu->tsg];
    cpu_tc_t *tc;
@@ -402,6 +463,7 @@ cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state)
    memset(tc,0,sizeof(*tc));
    tc->vaddr = vaddr;
    tc->exec_state = exec_state;
+   tc->flags = flags;
    tc->ref_count = 1;
    
    /* 
@@ -507,6 +569,94 @@ int tc_find_shared(cpu_gen_t *cpu,cpu_tb_t *tb)
    return(TSG_LOOKUP_NEW);
 }
 
+/* Hash a checksum for the eviction history (all bits are significant) */
+static inline u_int tsg_evict_hist_hash(tsg_checksum_t cksum)
+{
+   cksum *= 0x9E3779B97F4A7C15ULL;
+   return((u_int)(cksum >> 32) & TSG_EVICT_HIST_MASK);
+}
+
+/* Record the checksum of an evicted TC */
+static inline void tsg_evict_hist_add(tsg_t *tsg,tsg_checksum_t cksum)
+{
+   tsg->evict_hist[tsg_evict_hist_hash(cksum)] = cksum;
+}
+
+/* Check if a checksum belongs to a recently evicted TC (and forget it) */
+static inline int tsg_evict_hist_check(tsg_t *tsg,tsg_checksum_t cksum)
+{
+   u_int pos = tsg_evict_hist_hash(cksum);
+
+   if (!cksum || (tsg->evict_hist[pos] != cksum))
+      return(FALSE);
+
+   tsg->evict_hist[pos] = 0;
+   return(TRUE);
+}
+
+/* 
+ * Evict cold TBs of a CPU, using a clock algorithm: when the hand passes
+ * on a TB which has been executed since its last visit, the TB gets a
+ * second chance, otherwise it is released. The hand does at most two turns
+ * of the TB list, and stops when "target" exec pages have been returned
+ * to the pool. Only TBs with translated code are considered: TB with
+ * self-modifying code are kept so that they are not compiled again.
+ *
+ * TBs are released with tb_free(), which restores the jumps chained to
+ * them from other pages, so remaining translated code doesn't jump to
+ * freed exec pages.
+ *
+ * Returns the number of evicted TBs.
+ */
+static int tsg_evict_cold(tsg_t *tsg,cpu_gen_t *cpu,u_int target)
+{
+   cpu_tb_t *tb,*next;
+   u_int freed = 0;
+   int turns = 0,count = 0;
+
+   if (!(tb = cpu->tb_clock_hand))
+      tb = cpu->tb_list;
+
+   while((freed < target) && (turns < 2)) {
+      if (!tb) {
+         turns++;
+
+         if (!(tb = cpu->tb_list))
+            break;
+
+         continue;
+      }
+
+      next = tb->tb_next;
+
+      /* 
+       * TBs without translated code don't hold exec pages. They are kept,
+       * since one of them may be the page being translated.
+       */
+      if (tb->tc != NULL) {
+         if (tb->acc_count != tb->acc_mark) {
+            /* Used since last visit: second chance */
+            tb->acc_mark = tb->acc_count;
+         } else {
+            if (tb->tc->ref_count == 1) {
+               freed += tb->tc->jit_chunk_pos;
+               tsg->evicted_pages += tb->tc->jit_chunk_pos;
+               tsg_evict_hist_add(tsg,tb->tc->checksum);
+            }
+
+            tsg->evictions++;
+            tb_free(cpu,tb);
+            count++;
+         }
+      }
+
+      tb = next;
+   }
+
+   cpu->tb_clock_hand = tb;
+   return(count);
+}
+
 /* Register a newly compiled TCB descriptor */
 void tc_register(cpu_gen_t *cpu,cpu_tb_t *tb,cpu_tc_t *tc)
 {
@@ -517,6 +667,20 @@ void tc_register(cpu_gen_t *cpu,cpu_tb_t *tb,cpu_tc_t *tc)
    tc->checksum = tb->checksum;
 
    TSG_LOCK(tsg);   
+
+   if (tc->flags & TC_FLAG_CACHED) {
+      tsg->cache_loads++;
+   } else {
+      tsg->compiles++;
+
+      if (tc->flags & TC_FLAG_ASYNC)
+         tsg->async_compiles++;
+
+      /* Check if this code has been translated before being evicted */
+      if (tsg_evict_hist_check(tsg,tc->checksum))
+         tsg->recompiles++;
+   }
+
    tc_add_cpu_local(cpu,tc);
    M_LIST_ADD(tb,tc->tb_list,tb_dl);
    M_LIST_ADD(tc,tsg->tc_hash[hash_bucket],hash);
@@ -619,15 +783,34 @@ int tc_check_consistency(cpu_gen_t *cpu)
 /* Statistics: compute number of shared pages in a translation group */
 static int tsg_get_stats(tsg_t *tsg,struct tsg_stats *s)
 {
+   cpu_gen_t *cpu;
    cpu_tc_t *tc;
    int i;
    
-   s->shared_tc = s->total_tc = 0;
-   s->shared_pages = 0; 
+   memset(s,0,sizeof(*s));
    
    if (!tsg)
       return(-1);
 
+   TSG_LOCK(tsg);
+
+   s->alloc_pages   = tsg->exec_page_alloc;
+   s->total_pages   = tsg->exec_page_total;
+   s->compiles      = tsg->compiles;
+   s->recompiles    = tsg->recompiles;
+   s->cache_loads   = tsg->cache_loads;
+   s->evictions     = tsg->evictions;
+   s->evicted_pages = tsg->evicted_pages;
+   s->async_compiles = tsg->async_compiles;
+   s->async_dropped = tsg->async_dropped;
+   s->chain_links = tsg->chain_links;
+   s->chain_unlinks = tsg->chain_unlinks;
+
+   for(cpu=tsg->cpu_list;cpu;cpu=cpu->tsg_next) {
+      s->lookups += cpu->tb_lookups;
+      s->lookup_misses += cpu->tb_lookup_misses;
+   }
+
    for(i=0;i<TC_HASH_SIZE;i++) {
       for(tc=tsg->tc_hash[i];tc;tc=tc->hash_next) {
          if (tc->ref_count > 1) {
@@ -639,9 +822,28 @@ static int tsg_get_stats(tsg_t *tsg,struct tsg_stats *s)
       }
    }
    
+   TSG_UNLOCK(tsg);
    return(0);
 }
 
+/* Get statistics about a translation group */
+int tsg_get_group_stats(int id,struct tsg_stats *s)
+{
+   if ((id < 0) || (id >= TSG_MAX_GROUPS))
+      return(-1);
+
+   return(tsg_get_stats(tsg_array[id],s));
+}
+
+/* Compute the lookup hit rate (in percent) */
+static u_int tsg_hit_rate(struct tsg_stats *s)
+{
+   if (!s->lookups)
+      return(100);
+
+   return((u_int)(((s->lookups - s->lookup_misses) * 100) / s->lookups));
+}
+
 /* Show statistics about all translation groups */
 void tsg_show_stats(void)
 {
@@ -650,15 +852,18 @@ void tsg_show_stats(void)
 
    printf("\nTSG statistics:\n\n");
 
-   printf("  ID   Shared TC     Total TC     Alloc.Pages  Shared Pages   Total Pages\n");
+   printf("  ID   Shared TC     Total TC     Alloc.Pages  Shared Pages   Total Pages"
+          "    Evictions   Recompiles  Hit%%\n");
 
    for(i=0;i<TSG_MAX_GROUPS;i++) {
       if (!tsg_get_stats(tsg_array[i],&s)) {
-         printf(" %3d     %8u     %8u       %8u      %8u      %8u\n",
+         printf(" %3d     %8u     %8u       %8u      %8u      %8u"
+                "   %10llu   %10llu  %3u%%\n",
                 i,s.shared_tc,s.total_tc,
-                tsg_array[i]->exec_page_alloc,
+                s.alloc_pages,
                 s.shared_pages,
-                tsg_array[i]->exec_page_total);
+                s.total_pages,
+                s.evictions,s.recompiles,tsg_hit_rate(&s));
       }
    }
 
@@ -779,6 +984,389 @@ void tc_free_patches(cpu_tc_t *tc)
    tc->patch_table = NULL;
 }
 
+/* Record the position of a host absolute address in translated code */
+int tc_record_reloc(cpu_tc_t *tc,u_char *ptr)
+{
+   u_char **table;
+   u_int max;
+
+   if (tc->reloc_count == tc->reloc_max) {
+      max = tc->reloc_max ? (tc->reloc_max * 2) : 32;
+
+      if (!(table = realloc(tc->reloc_table,max * sizeof(u_char *))))
+         return(-1);
+
+      tc->reloc_table = table;
+      tc->reloc_max = max;
+   }
+
+   tc->reloc_table[tc->reloc_count++] = ptr;
+   return(0);
+}
+
+/* Free the relocation table */
+void tc_free_relocs(cpu_tc_t *tc)
+{
+   free(tc->reloc_table);
+   tc->reloc_table = NULL;
+   tc->reloc_count = tc->reloc_max = 0;
+}
+
+/* Background compilation thread */
+static void *tc_job_thread(void *arg)
+{
+   struct tc_job *job;
+
+   for(;;) {
+      TC_JOB_LOCK();
+
+      while(!tc_job_queue)
+         pthread_cond_wait(&tc_job_cond,&tc_job_mutex);
+
+      job = tc_job_queue;
+
+      if (!(tc_job_queue = job->next))
+         tc_job_queue_tail = &tc_job_queue;
+
+      job->cpu->tc_job_running++;
+      TC_JOB_UNLOCK();
+
+      job->tc = job->translate(job->state,&job->tb);
+
+      /* Give the result back to the CPU */
+      TC_JOB_LOCK();
+      job->next = job->cpu->tc_job_done;
+      job->cpu->tc_job_done = job;
+      job->cpu->tc_job_running--;
+      pthread_cond_broadcast(&tc_job_done_cond);
+      TC_JOB_UNLOCK();
+   }
+
+   return NULL;
+}
+
+/* Start the background compilation threads (lock must be held) */
+static int tc_job_start_threads(void)
+{
+   pthread_t thread;
+
+   while(tc_job_threads < tc_job_workers) {
+      if (pthread_create(&thread,NULL,tc_job_thread,NULL) != 0) {
+         fprintf(stderr,"tc_job_start_threads: unable to create thread.\n");
+         return(tc_job_threads ? 0 : -1);
+      }
+
+      pthread_detach(thread);
+      tc_job_threads++;
+   }
+
+   return(0);
+}
+
+/* Set the number of background compilation threads */
+int tc_job_set_workers(u_int count)
+{
+   if (count > TC_JOB_MAX_WORKERS) {
+      fprintf(stderr,"Invalid number of JIT threads (max: %u).\n",
+              TC_JOB_MAX_WORKERS);
+      return(-1);
+   }
+
+   /* Threads already started are kept */
+   tc_job_workers = count;
+   return(0);
+}
+
+/* Set the number of executions of a page before it gets compiled */
+void tc_job_set_threshold(u_int threshold)
+{
+   tc_job_threshold = threshold ? threshold : 1;
+}
+
+/* Submit a page for background compilation */
+int tc_job_submit(cpu_gen_t *cpu,cpu_tb_t *tb,tc_translate_fn translate)
+{
+   struct tc_job *job;
+
+   if (!tc_job_workers || !(job = malloc(sizeof(*job))))
+      return(-1);
+
+   /* 
+    * The thread works on a copy of the page, so it is not affected by
+    * writes from the virtual CPU. Check that the copy matches the TB.
+    */
+   memcpy(job->page,tb->target_code,VM_PAGE_SIZE);
+
+   if (tsg_checksum_page(job->page,VM_PAGE_SIZE) != tb->checksum) {
+      free(job);
+      return(-1);
+   }
+
+   /* 
+    * The CPU keeps running while the page is translated: the translator
+    * uses a copy of its state, which doesn't change under its feet.
+    */
+   if (!(job->state = malloc(sizeof(*job->state)))) {
+      free(job);
+      return(-1);
+   }
+
+   memcpy(job->state,cpu,sizeof(*job->state));
+
+   if (cpu->type == CPU_TYPE_MIPS64)
+      CPU_MIPS64(job->state)->gen = job->state;
+   else
+      CPU_PPC32(job->state)->gen = job->state;
+
+   memset(&job->tb,0,sizeof(job->tb));
+   job->tb.vaddr       = tb->vaddr;
+   job->tb.exec_state  = tb->exec_state;
+   job->tb.phys_page   = tb->phys_page;
+   job->tb.phys_hash   = tb->phys_hash;
+   job->tb.virt_hash   = tb->virt_hash;
+   job->tb.checksum    = tb->checksum;
+   job->tb.target_code = job->page;
+
+   job->next = NULL;
+   job->cpu = cpu;
+   job->translate = translate;
+   job->tc = NULL;
+
+   TC_JOB_LOCK();
+
+   if (tc_job_start_threads() == -1) {
+      TC_JOB_UNLOCK();
+      free(job->state);
+      free(job);
+      return(-1);
+   }
+
+   *tc_job_queue_tail = job;
+   tc_job_queue_tail = &job->next;
+   pthread_cond_signal(&tc_job_cond);
+   TC_JOB_UNLOCK();
+
+   tb->flags |= TB_FLAG_JOB;
+   return(0);
+}
+
+/* Get the list of jobs completed for a CPU */
+struct tc_job *tc_job_get_done(cpu_gen_t *cpu)
+{
+   struct tc_job *list;
+
+   TC_JOB_LOCK();
+   list = cpu->tc_job_done;
+   cpu->tc_job_done = NULL;
+   TC_JOB_UNLOCK();
+   return list;
+}
+
+/* Find the TB waiting for the result of a job */
+cpu_tb_t *tc_job_find_tb(cpu_gen_t *cpu,struct tc_job *job)
+{
+   cpu_tb_t *tb;
+
+   for(tb=cpu->tb_phys_hash[job->tb.phys_hash];tb;tb=tb->phys_next) {
+      if (((tb->flags & (TB_FLAG_PENDING|TB_FLAG_JOB)) ==
+           (TB_FLAG_PENDING|TB_FLAG_JOB)) &&
+          (tb->vaddr == job->tb.vaddr) &&
+          (tb->exec_state == job->tb.exec_state) &&
+          (tb->phys_page == job->tb.phys_page) &&
+          (tb->checksum == job->tb.checksum))
+         return tb;
+   }
+
+   return NULL;
+}
+
+/* Free a job (and its translated code if it has not been used) */
+void tc_job_free(cpu_gen_t *cpu,struct tc_job *job)
+{
+   tsg_t *tsg = tsg_array[cpu->tsg];
+
+   if (job->tc != NULL) {
+      TSG_LOCK(tsg);
+      tsg->async_dropped++;
+      TSG_UNLOCK(tsg);
+
+      tc_free(tsg,job->tc);
+   }
+
+   free(job->state);
+   free(job);
+}
+
+/* Drop a list of jobs, the TBs waiting for them can be submitted again */
+static void tc_job_drop_list(cpu_gen_t *cpu,struct tc_job *list)
+{
+   struct tc_job *job;
+   cpu_tb_t *tb;
+
+   for(job=list;job;job=list) {
+      list = job->next;
+
+      if ((tb = tc_job_find_tb(cpu,job)) != NULL)
+         tb->flags &= ~TB_FLAG_JOB;
+
+      tc_job_free(cpu,job);
+   }
+}
+
+/* Cancel all jobs of a CPU, and wait for the ones being processed */
+void tc_job_cancel(cpu_gen_t *cpu)
+{
+   struct tc_job *job,**jobp,*queued = NULL,*done;
+
+   TC_JOB_LOCK();
+
+   for(jobp=&tc_job_queue;*jobp;) {
+      job = *jobp;
+
+      if (job->cpu == cpu) {
+         *jobp = job->next;
+         job->next = queued;
+         queued = job;
+      } else {
+         jobp = &job->next;
+      }
+   }
+
+   tc_job_queue_tail = jobp;
+
+   while(cpu->tc_job_running)
+      pthread_cond_wait(&tc_job_done_cond,&tc_job_mutex);
+
+   done = cpu->tc_job_done;
+   cpu->tc_job_done = NULL;
+   TC_JOB_UNLOCK();
+
+   tc_job_drop_list(cpu,queued);
+   tc_job_drop_list(cpu,done);
+}
+
+/* Find the TC descriptor containing the specified host code */
+cpu_tc_t *tc_find_by_jit_ptr(cpu_gen_t *cpu,u_char *ptr)
+{
+   tsg_t *tsg = tsg_array[cpu->tsg];
+   size_t index;
+
+   if (ptr < (u_char *)tsg->exec_area)
+      return NULL;
+
+   index = (ptr - (u_char *)tsg->exec_area) / TC_JIT_PAGE_SIZE;
+
+   if (index >= tsg->exec_page_total)
+      return NULL;
+
+   return(tsg->exec_page_owner[index]);
+}
+
+/* Chain a jump located in translated code to a TB */
+int tc_chain_add(cpu_gen_t *cpu,cpu_tb_t *tb,m_uint32_t *jit_insn,
+                 tc_chain_fn set_link,void *opt)
+{
+   tsg_t *tsg = tsg_array[cpu->tsg];
+   struct tc_chain *chain;
+   cpu_tc_t *tc;
+
+   if (!tb->tc || (tb->flags & TB_FLAG_NOTRANS))
+      return(-1);
+
+   TSG_LOCK(tsg);
+
+   /* The jump must be in valid code, and must not be already chained */
+   tc = tc_find_by_jit_ptr(cpu,(u_char *)jit_insn);
+
+   if (!tc || !(tc->flags & TC_FLAG_VALID))
+      goto err;
+
+   for(chain=tc->chain_list;chain;chain=chain->tc_next)
+      if (chain->jit_insn == jit_insn)
+         goto err;
+
+   if (!(chain = malloc(sizeof(*chain))))
+      goto err;
+
+   chain->cpu = cpu;
+   chain->tc  = tc;
+   chain->tb  = tb;
+   chain->jit_insn = jit_insn;
+   chain->jit_insn_data = *jit_insn;
+
+   M_LIST_ADD(chain,tc->chain_list,tc);
+   M_LIST_ADD(chain,tb->chain_list,tb);
+
+   *jit_insn = set_link(cpu,tb,jit_insn,opt);
+   tsg->chain_links++;
+   cpu->tc_chain_count++;
+   TSG_UNLOCK(tsg);
+   return(0);
+
+ err:
+   TSG_UNLOCK(tsg);
+   return(-1);
+}
+
+/* Remove a chained jump (the lock must be held) */
+static void tc_chain_remove(tsg_t *tsg,struct tc_chain *chain)
+{
+   *chain->jit_insn = chain->jit_insn_data;
+
+   M_LIST_REMOVE(chain,tc);
+   M_LIST_REMOVE(chain,tb);
+   chain->cpu->tc_chain_count--;
+   tsg->chain_unlinks++;
+   free(chain);
+}
+
+/* 
+ * Remove the chained jumps to a TB, and the ones set by this CPU in the
+ * code of the TB (which may be kept alive by other CPUs).
+ */
+static void tb_unlink_chains(cpu_gen_t *cpu,cpu_tb_t *tb)
+{
+   tsg_t *tsg = tsg_array[cpu->tsg];
+   struct tc_chain *chain,*next;
+
+   if (!tb->chain_list && (!tb->tc || !tb->tc->chain_list))
+      return;
+
+   TSG_LOCK(tsg);
+
+   for(chain=tb->chain_list;chain;chain=next) {
+      next = chain->tb_next;
+      tc_chain_remove(tsg,chain);
+   }
+
+   if (tb->tc != NULL) {
+      for(chain=tb->tc->chain_list;chain;chain=next) {
+         next = chain->tc_next;
+
+         if (chain->cpu == cpu)
+            tc_chain_remove(tsg,chain);
+      }
+   }
+
+   TSG_UNLOCK(tsg);
+}
+
+/* 
+ * Remove all the jumps chained by a CPU. Chained jumps don't check the
+ * virtual address of the target TB, so they must be removed when the
+ * guest mappings change.
+ */
+void cpu_jit_unlink_chains(cpu_gen_t *cpu)
+{
+   cpu_tb_t *tb;
+
+   if (!cpu->tc_chain_count)
+      return;
+
+   for(tb=cpu->tb_list;tb;tb=tb->tb_next)
+      tb_unlink_chains(cpu,tb);
+}
+
 /* Initialize the JIT structures of a CPU */
 int cpu_jit_init(cpu_gen_t *cpu,size_t virt_hash_size,size_t phys_hash_size)
 {
@@ -812,6 +1400,7 @@ err_tb_virt_hash:
 /* Shutdown the JIT structures of a CPU */
 void cpu_jit_shutdown(cpu_gen_t *cpu)
 {
+   tc_job_cancel(cpu);
    tsg_unbind_cpu(cpu);
    
    /* Free virtual and physical hash tables */
@@ -846,6 +1435,9 @@ void tb_free(cpu_gen_t *cpu,cpu_tb_t *tb)
 {   
    tsg_t *tsg = tsg_array[cpu->tsg];
 
+   /* Restore the jumps chained to this TB or from its code */
+   tb_unlink_chains(cpu,tb);
+
    /* Remove this TB from the TB list bound to a TC descriptor */   
    TSG_LOCK(tsg);
    M_LIST_REMOVE(tb,tb_dl);
@@ -855,6 +1447,10 @@ void tb_free(cpu_gen_t *cpu,cpu_tb_t *tb)
    if (tb->tc != NULL)
       tc_free(tsg,tb->tc);
 
+   /* Move the eviction clock hand if it points to this block */
+   if (cpu->tb_clock_hand == tb)
+      cpu->tb_clock_hand = tb->tb_next;
+
    /* Remove the block from the CPU TCB list */
    M_LIST_REMOVE(tb,tb);
 
@@ -892,6 +1488,21 @@ void cpu_jit_tcb_flush_all(cpu_gen_t *cpu)
    assert(cpu->tb_list == NULL);
 }
 
+/* Flush the TCB whose code is read from a sorted set of host pages */
+void cpu_jit_tcb_flush_hpa(cpu_gen_t *cpu,m_iptr_t *hpa,u_int count)
+{
+   cpu_tb_t *tb,*next;
+   m_iptr_t page;
+
+   for(tb=cpu->tb_list;tb;tb=next) {
+      next = tb->tb_next;
+      page = (m_iptr_t)tb->target_code & VM_PAGE_MASK;
+
+      if (tb->target_code && cpu_hpa_lookup(hpa,count,page))
+         tb_free(cpu,tb);
+   }
+}
+
 /* Mark a TB as containing self-modifying code */
 void tb_mark_smc(cpu_gen_t *cpu,cpu_tb_t *tb)
 {
@@ -899,6 +1510,7 @@ void tb_mark_smc(cpu_gen_t *cpu,cpu_tb_t *tb)
       return; /* already done */
 
    tb->flags |= TB_FLAG_SMC;
+   tb_unlink_chains(cpu,tb);
 
    if (tb->tc != NULL) {
       tc_free(tsg_array[cpu->tsg],tb->tc);
@@ -11,6 +11,9 @@
 #include "utils.h"
 #include "vm.h"
 
+/* Maximum number of translation sharing groups */
+#define TSG_MAX_GROUPS  128
+
 /* Checksum type */
 typedef m_uint64_t tsg_checksum_t;
 
@@ -35,9 +38,12 @@ struct insn_patch_table {
 #define TB_FLAG_RECOMP   0x02  /* Page being recompiled */
 #define TB_FLAG_NOJIT    0x04  /* Page not supported for JIT */
 #define TB_FLAG_VALID    0x08
+#define TB_FLAG_PENDING  0x10  /* Translation pending (page interpreted) */
+#define TB_FLAG_JOB      0x20  /* Page submitted to a background thread */
 
 /* Don't use translated code to execute the page */
-#define TB_FLAG_NOTRANS  (TB_FLAG_SMC|TB_FLAG_RECOMP|TB_FLAG_NOJIT)
+#define TB_FLAG_NOTRANS  \
+   (TB_FLAG_SMC|TB_FLAG_RECOMP|TB_FLAG_NOJIT|TB_FLAG_PENDING)
 
 /* CPU Translation Block */
 struct cpu_tb {
@@ -49,6 +55,9 @@ struct cpu_tb {
    m_uint64_t acc_count;   
    void *target_code;
 
+   /* Value of acc_count when the eviction clock hand last passed */
+   m_uint64_t acc_mark;
+
    cpu_tb_t **tb_pprev,*tb_next;
    
    /* Translated Code (can be shared among multiple CPUs) */
@@ -63,17 +72,25 @@ struct cpu_tb {
    m_uint32_t phys_hash;
    cpu_tb_t **phys_pprev,*phys_next;
 
+   /* Chained jumps from other pages to this TB */
+   struct tc_chain *chain_list;
+
 #if DEBUG_BLOCK_TIMESTAMP
    m_uint64_t tm_first_use,tm_last_use;
 #endif
 };
 
+/* Size of a JIT page */
+#define TC_JIT_PAGE_SIZE  32768
+
 /* Maximum exec pages per TC descriptor */ 
 #define TC_MAX_CHUNKS  32
 
 /* TC descriptor flags */
 #define TC_FLAG_REMOVAL  0x01  /* Descriptor marked for removal */
 #define TC_FLAG_VALID    0x02
+#define TC_FLAG_CACHED   0x04  /* Code loaded from the persistent cache */
+#define TC_FLAG_ASYNC    0x08  /* Translated by a background thread */
 
 /* CPU Translated Code */
 struct cpu_tc {
@@ -96,6 +113,10 @@ struct cpu_tc {
    /* Patch table */
    struct insn_patch_table *patch_table;
 
+   /* Positions of host absolute addresses (used during the translation) */
+   u_char **reloc_table;
+   u_int reloc_count,reloc_max;
+
    /* Translation position in target code */
    u_int trans_pos;
    
@@ -114,8 +135,35 @@ struct cpu_tc {
    
    /* Linked list for single-CPU referencement (ref_count=1) */
    cpu_tc_t **sc_pprev,*sc_next;
+
+   /* Chained jumps from this code to other pages */
+   struct tc_chain *chain_list;
+};
+
+/* Number of executions of a jump to another page before it is chained */
+#define TC_CHAIN_THRESHOLD  64
+
+/* 
+ * Jump from translated code directly to the code of another page.
+ * The link is only valid for the CPU which has set it. The jump is a
+ * 32-bit word patched in place, restored when the link is removed.
+ */
+struct tc_chain {
+   cpu_gen_t *cpu;
+   cpu_tc_t *tc;
+   cpu_tb_t *tb;
+
+   m_uint32_t *jit_insn;
+   m_uint32_t jit_insn_data;
+
+   struct tc_chain **tc_pprev,*tc_next;
+   struct tc_chain **tb_pprev,*tb_next;
 };
 
+/* Backend function preparing a chained jump to a TB */
+typedef m_uint32_t (*tc_chain_fn)(cpu_gen_t *cpu,cpu_tb_t *tb,
+                                  m_uint32_t *jit_insn,void *opt);
+
 #define TC_TARGET_BITMAP_INDEX(x) (((x) >> 7) & 0x1F)
 #define TC_TARGET_BITMAP_POS(x)   (((x) >> 2) & 0x1F)
 
@@ -165,16 +213,53 @@ struct tsg_stats {
    u_int total_tc;
    u_int shared_tc;
    u_int shared_pages;
+   u_int alloc_pages;
+   u_int total_pages;
+
+   /* Code cache management */
+   m_uint64_t compiles,recompiles,cache_loads;
+   m_uint64_t async_compiles,async_dropped;
+   m_uint64_t chain_links,chain_unlinks;
+   m_uint64_t evictions,evicted_pages;
+   m_uint64_t lookups,lookup_misses;
+};
+
+/* Background compilation: default number of threads and threshold */
+#define TC_JOB_DEFAULT_WORKERS    1
+#define TC_JOB_MAX_WORKERS        16
+#define TC_JOB_DEFAULT_THRESHOLD  16
+
+/* Translation function used by background threads */
+typedef cpu_tc_t *(*tc_translate_fn)(cpu_gen_t *cpu,cpu_tb_t *tb);
+
+/* Background compilation job */
+struct tc_job {
+   struct tc_job *next;
+   cpu_gen_t *cpu;
+   tc_translate_fn translate;
+
+   /* Copy of the CPU state taken at submit time (used by the translator) */
+   cpu_gen_t *state;
+
+   /* Private copy of the TB and of the guest page */
+   cpu_tb_t tb;
+   u_char page[VM_PAGE_SIZE];
+
+   /* Result */
+   cpu_tc_t *tc;
 };
 
+/* Number of background threads (0: synchronous compilation) */
+extern u_int tc_job_workers;
+
+/* Number of executions of a page before it gets compiled */
+extern u_int tc_job_threshold;
+
 enum {
    CPU_JIT_DISABLE_CPU = 0,
    CPU_JIT_ENABLE_CPU,
 };
 
-/* Allocate a new TCB descriptor */
-cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state);
-
 /* Bind a CPU to a TSG - If the group isn't specified, create one */
 int tsg_bind_cpu(cpu_gen_t *cpu);
 
@@ -185,7 +270,8 @@ int tsg_unbind_cpu(cpu_gen_t *cpu);
 int tc_alloc_jit_chunk(cpu_gen_t *cpu,cpu_tc_t *tc);
 
 /* Allocate a new TC descriptor */
-cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state);
+cpu_tc_t *tc_alloc(cpu_gen_t *cpu,m_uint64_t vaddr,m_uint32_t exec_state,
+                   u_int flags);
 
 /* Compute a checksum on a page */
 tsg_checksum_t tsg_checksum_page(void *page,ssize_t size);
@@ -205,6 +291,9 @@ void tb_dump(cpu_tb_t *tb);
 /* Dump a TCB descriptor */
 void tc_dump(cpu_tc_t *tc);
 
+/* Get statistics about a translation group */
+int tsg_get_group_stats(int id,struct tsg_stats *s);
+
 /* Show statistics about all translation groups */
 void tsg_show_stats(void);
 
@@ -222,6 +311,12 @@ int tc_apply_patches(cpu_tc_t *tc,void (*set_patch)(u_char *insn,u_char *dst));
 /* Free the patch table */
 void tc_free_patches(cpu_tc_t *tc);
 
+/* Record the position of a host absolute address in translated code */
+int tc_record_reloc(cpu_tc_t *tc,u_char *ptr);
+
+/* Free the relocation table */
+void tc_free_relocs(cpu_tc_t *tc);
+
 /* Initialize the JIT structures of a CPU */
 int cpu_jit_init(cpu_gen_t *cpu,size_t virt_hash_size,size_t phys_hash_size);
 
@@ -240,9 +335,46 @@ void tb_enable(cpu_gen_t *cpu,cpu_tb_t *tb);
 /* Flush all TCB of a virtual CPU */
 void cpu_jit_tcb_flush_all(cpu_gen_t *cpu);
 
+/* Flush the TCB whose code is read from a sorted set of host pages */
+void cpu_jit_tcb_flush_hpa(cpu_gen_t *cpu,m_iptr_t *hpa,u_int count);
+
 /* Mark a TB as containing self-modifying code */
 void tb_mark_smc(cpu_gen_t *cpu,cpu_tb_t *tb);
 
+/* Set the number of background compilation threads */
+int tc_job_set_workers(u_int count);
+
+/* Set the number of executions of a page before it gets compiled */
+void tc_job_set_threshold(u_int threshold);
+
+/* Submit a page for background compilation */
+int tc_job_submit(cpu_gen_t *cpu,cpu_tb_t *tb,tc_translate_fn translate);
+
+/* Get the list of jobs completed for a CPU */
+struct tc_job *tc_job_get_done(cpu_gen_t *cpu);
+
+/* Find the TB waiting for the result of a job */
+cpu_tb_t *tc_job_find_tb(cpu_gen_t *cpu,struct tc_job *job);
+
+/* Free a job (and its translated code if it has not been used) */
+void tc_job_free(cpu_gen_t *cpu,struct tc_job *job);
+
+/* Cancel all jobs of a CPU, and wait for the ones being processed */
+void tc_job_cancel(cpu_gen_t *cpu);
+
+/* Remove all the jumps chained by a CPU (guest mappings have changed) */
+void cpu_jit_unlink_chains(cpu_gen_t *cpu);
+
+/* Find the TC descriptor containing the specified host code */
+cpu_tc_t *tc_find_by_jit_ptr(cpu_gen_t *cpu,u_char *ptr);
+
+/* 
+ * Chain a jump located in translated code to a TB. "set_link" prepares
+ * the link and returns the 32-bit word to store at "jit_insn".
+ */
+int tc_chain_add(cpu_gen_t *cpu,cpu_tb_t *tb,m_uint32_t *jit_insn,
+                 tc_chain_fn set_link,void *opt);
+
 /* Handle write access on an executable page */
 void cpu_jit_write_on_exec_page(cpu_gen_t *cpu,
                                 m_uint32_t wr_phys_page,
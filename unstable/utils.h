@@ -61,6 +61,8 @@ struct fd_pool {
 typedef struct cpu_gen cpu_gen_t;
 typedef struct vm_instance vm_instance_t;
 typedef struct vm_platform vm_platform_t;
+typedef struct vm_ckpt_field vm_ckpt_field_t;
+typedef struct ios_unpack ios_unpack_t;
 typedef struct mips64_jit_tcb mips64_jit_tcb_t;
 typedef struct ppc32_jit_tcb ppc32_jit_tcb_t;
 typedef struct jit_op jit_op_t;
@@ -379,6 +381,26 @@ int memzone_unmap(void *addr, size_t len);
 /* Map a memory zone as an executable area */
 u_char *memzone_map_exec_area(size_t len);
 
+/* Huge page modes */
+#define MEMZONE_HUGE_NONE  0   /* Regular pages */
+#define MEMZONE_HUGE_THP   1   /* Transparent huge pages (madvise) */
+#define MEMZONE_HUGE_TLB   2   /* Reserved huge pages (hugetlbfs) */
+
+#define MEMZONE_HUGE_PAGE_SIZE  (2 * 1048576)
+
+/* Map an anonymous memory zone backed by huge pages */
+u_char *memzone_map_huge(size_t len,int prot,int *mode);
+
+/* Unmap a memory zone created by memzone_map_huge() */
+int memzone_unmap_huge(void *addr,size_t len);
+
+/* Open a file and copy it into a memory zone backed by huge pages */
+int memzone_open_huge_file(char *filename,size_t len,u_char **ptr,
+                           off_t *fsize,int *mode);
+
+/* Get the name of a huge page mode */
+char *memzone_huge_mode_str(int mode);
+
 /* Map a memory zone from a file */
 u_char *memzone_map_file(int fd,size_t len);
 
@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <glob.h>
 
@@ -22,8 +23,12 @@
 #include "cpu.h"
 #include "vm.h"
 #include "tcb.h"
+#include "tc_cache.h"
+#include "mem_merge.h"
+#include "ios_unpack.h"
 #include "mips64_jit.h"
 #include "dev_vtty.h"
+#include "ptask.h"
 
 #include MIPS64_ARCH_INC_FILE
 
@@ -371,6 +376,11 @@ static vm_instance_t *vm_create(char *name,int instance_id,
    vm->rommon_vars.filename = vm_build_filename(vm,"rommon_vars");
    vm->tsg                  = -1;
 
+   pthread_mutex_init(&vm->mem_lock,NULL);
+   pthread_mutex_init(&vm->state_lock,NULL);
+   pthread_mutex_init(&vm->dma_lock,NULL);
+   pthread_cond_init(&vm->dma_cond,NULL);
+
    if (!vm->rommon_vars.filename)
       goto err_rommon;
 
@@ -401,6 +411,10 @@ static vm_instance_t *vm_create(char *name,int instance_id,
  err_lock:
    free(vm->rommon_vars.filename);
  err_rommon:
+   pthread_mutex_destroy(&vm->mem_lock);
+   pthread_mutex_destroy(&vm->state_lock);
+   pthread_mutex_destroy(&vm->dma_lock);
+   pthread_cond_destroy(&vm->dma_cond);
    free(vm->name);
  err_name:
    free(vm);
@@ -425,6 +439,10 @@ int vm_hardware_shutdown(vm_instance_t *vm)
    /* Mark the VM as halted */
    vm->status = VM_STATUS_HALTED;
 
+   /* Stop merging pages of this VM */
+   mem_merge_vm_shutdown(vm);
+   ios_unpack_free(vm);
+
    /* Free the object list */
    vm_object_free_list(vm);
 
@@ -457,6 +475,10 @@ int vm_hardware_shutdown(vm_instance_t *vm)
    vm->cpu_group = NULL;
    vm->boot_cpu = NULL;
 
+   /* Release the persistent cache of translated code */
+   tc_cache_close(vm->tc_cache);
+   vm->tc_cache = NULL;
+
    vm_log(vm,"VM","shutdown procedure completed.\n");
    m_log("VM","VM %s shutdown.\n",vm->name);
    return(0);
@@ -468,6 +490,7 @@ void vm_free(vm_instance_t *vm)
    if (vm != NULL) {
       /* Free hardware resources */
       vm_hardware_shutdown(vm);
+      dev_map_free(vm);
 
       m_log("VM","VM %s destroyed.\n",vm->name);
 
@@ -479,12 +502,19 @@ void vm_free(vm_instance_t *vm)
 
       /* Free all chunks */
       vm_chunk_free_all(vm);
+      free(vm->mem_merge_retired);
+      pthread_mutex_destroy(&vm->mem_lock);
+      pthread_mutex_destroy(&vm->state_lock);
+      pthread_mutex_destroy(&vm->dma_lock);
+      pthread_cond_destroy(&vm->dma_cond);
 
       /* Free various elements */
       free(vm->rommon_vars.filename);
       free(vm->ghost_ram_filename);
       free(vm->sym_filename);
       free(vm->ios_image);
+      free(vm->pcmcia_disk_base[0]);
+      free(vm->pcmcia_disk_base[1]);
       free(vm->ios_startup_config);
       free(vm->ios_private_config);
       free(vm->rom_filename);
@@ -508,16 +538,39 @@ int vm_release(vm_instance_t *vm)
 /* Initialize RAM */
 int vm_ram_init(vm_instance_t *vm,m_uint64_t paddr)
 {
+   char *ghost_file;
    m_uint32_t len;
+   int use_mmap;
 
    len = vm->ram_size * 1048576;
 
+   /* Identical and zero pages can be shared only with sparse memory */
+   if (vm->mem_merge || vm->mem_zero_reclaim) {
+      if (vm->sparse_mem)
+         mem_merge_start();
+      else
+         vm_log(vm,"VM","page merging requires sparse memory.\n");
+   }
+
    if (vm->ghost_status == VM_GHOST_RAM_USE) {
       return(dev_ram_ghost_init(vm,"ram",vm->sparse_mem,vm->ghost_ram_filename,
                                 paddr,len));
    }
 
-   return(dev_ram_init(vm,"ram",vm->ram_mmap,
+   /* IOS image already decompressed by a previous boot */
+   if ((ghost_file = ios_unpack_ram_file(vm)) != NULL)
+      return(dev_ram_ghost_init(vm,"ram",vm->sparse_mem,ghost_file,paddr,len));
+
+   /* 
+    * Huge pages are anonymous memory, so a RAM file is used only to
+    * generate a ghost image.
+    */
+   use_mmap = vm->ram_mmap;
+
+   if (vm->huge_pages && (vm->ghost_status != VM_GHOST_RAM_GENERATE))
+      use_mmap = FALSE;
+
+   return(dev_ram_init(vm,"ram",use_mmap,
                        (vm->ghost_status != VM_GHOST_RAM_GENERATE),
                        vm->ghost_ram_filename,vm->sparse_mem,paddr,len));
 }
@@ -578,6 +631,10 @@ int vm_bind_device(vm_instance_t *vm,struct vdevice *dev)
    if (*cur) (*cur)->pprev = &dev->next;
    dev->pprev = cur;
    *cur = dev;
+
+   /* Update the physical address map */
+   dev_map_update(vm,dev->phys_addr,dev->phys_len);
+   physmem_tlb_flush(vm);
    return(0);
 }
 
@@ -605,6 +662,10 @@ int vm_unbind_device(vm_instance_t *vm,struct vdevice *dev)
    /* Clear device list info */
    dev->next = NULL;
    dev->pprev = NULL;
+
+   /* Update the physical address map */
+   dev_map_update(vm,dev->phys_addr,dev->phys_len);
+   physmem_tlb_flush(vm);
    return(0);
 }
 
@@ -639,32 +700,102 @@ int vm_map_device(vm_instance_t *vm,struct vdevice *dev,m_uint64_t base_addr)
 /* Suspend a VM instance */
 int vm_suspend(vm_instance_t *vm)
 {
+   pthread_mutex_lock(&vm->state_lock);
+
    if (vm->status == VM_STATUS_RUNNING) {
       cpu_group_save_state(vm->cpu_group);
       cpu_group_set_state(vm->cpu_group,CPU_STATE_SUSPENDED);
       vm->status = VM_STATUS_SUSPENDED;
    }
+
+   pthread_mutex_unlock(&vm->state_lock);
    return(0);
 }
 
 /* Resume a VM instance */
 int vm_resume(vm_instance_t *vm)
 {
+   pthread_mutex_lock(&vm->state_lock);
+
    if (vm->status == VM_STATUS_SUSPENDED) {
       cpu_group_restore_state(vm->cpu_group);
       vm->status = VM_STATUS_RUNNING;
    }
+
+   pthread_mutex_unlock(&vm->state_lock);
    return(0);
 }
 
 /* Stop an instance */
 int vm_stop(vm_instance_t *vm)
 {
+   pthread_mutex_lock(&vm->state_lock);
    cpu_group_stop_all_cpu(vm->cpu_group);
    vm->status = VM_STATUS_SHUTDOWN;
+   pthread_mutex_unlock(&vm->state_lock);
    return(0);
 }
 
+/* 
+ * Pause CPU activity of a running or suspended VM, without changing its
+ * status. Running CPUs are parked between two blocks: their state is not
+ * changed, so the translated code is kept. State changes are blocked
+ * until vm_unpause() is called.
+ */
+int vm_pause(vm_instance_t *vm)
+{
+   pthread_mutex_lock(&vm->state_lock);
+
+   if (((vm->status != VM_STATUS_RUNNING) &&
+        (vm->status != VM_STATUS_SUSPENDED)) || !vm->cpu_group)
+      goto err_status;
+
+   if (cpu_group_quiesce(vm->cpu_group) == -1) {
+      vm_error(vm,"unable to sync with system CPUs.\n");
+      cpu_group_unquiesce(vm->cpu_group);
+      goto err_status;
+   }
+
+   return(0);
+
+ err_status:
+   pthread_mutex_unlock(&vm->state_lock);
+   return(-1);
+}
+
+/* Resume CPU activity after vm_pause() */
+void vm_unpause(vm_instance_t *vm)
+{
+   cpu_group_unquiesce(vm->cpu_group);
+   pthread_mutex_unlock(&vm->state_lock);
+}
+
+/* 
+ * Stop the device threads of a VM: the periodic tasks of the VM are
+ * suspended and the NIO are unbound from the devices, so nothing accesses
+ * the devices or the memory of the VM.
+ */
+void vm_suspend_io(vm_instance_t *vm)
+{
+   u_int i;
+
+   ptask_suspend_group(vm);
+
+   for(i=0;i<vm->nr_slots;i++)
+      vm_slot_disable_all_nio(vm,i);
+}
+
+/* Restart the device threads stopped by vm_suspend_io() */
+void vm_resume_io(vm_instance_t *vm)
+{
+   u_int i;
+
+   for(i=0;i<vm->nr_slots;i++)
+      vm_slot_enable_all_nio(vm,i);
+
+   ptask_resume_group(vm);
+}
+
 /* Monitor an instance periodically */
 void vm_monitor(vm_instance_t *vm)
 {
@@ -677,20 +808,32 @@ static vm_chunk_t *vm_chunk_create(vm_instance_t *vm)
 {
    vm_chunk_t *chunk;
    size_t area_len;
+   int mode;
    
    if (!(chunk = malloc(sizeof(*chunk))))
       return NULL;
 
-   area_len = VM_CHUNK_AREA_SIZE * VM_PAGE_SIZE;
+   chunk->page_alloc = 0;
+   chunk->page_total = VM_CHUNK_AREA_SIZE;
+   chunk->huge = FALSE;
+
+   /* With huge pages, a chunk is a single huge page */
+   if (vm->huge_pages) {
+      mode = vm->huge_pages;
+      chunk->page_total = MEMZONE_HUGE_PAGE_SIZE / VM_PAGE_SIZE;
+      chunk->area = memzone_map_huge(MEMZONE_HUGE_PAGE_SIZE,
+                                     PROT_READ|PROT_WRITE,&mode);
+      chunk->huge = TRUE;
+   } else {
+      area_len = VM_CHUNK_AREA_SIZE * VM_PAGE_SIZE;
+      chunk->area = m_memalign(VM_PAGE_SIZE,area_len);
+   }
 
-   if (!(chunk->area = m_memalign(VM_PAGE_SIZE,area_len))) {
+   if (!chunk->area) {
       free(chunk);
       return NULL;
    }
 
-   chunk->page_alloc = 0;
-   chunk->page_total = VM_CHUNK_AREA_SIZE;
-
    chunk->next = vm->chunks;
    vm->chunks = chunk;
    return chunk;
@@ -699,7 +842,11 @@ static vm_chunk_t *vm_chunk_create(vm_instance_t *vm)
 /* Free a chunk */
 static void vm_chunk_free(vm_chunk_t *chunk)
 {
-   free(chunk->area);
+   if (chunk->huge)
+      memzone_unmap_huge(chunk->area,chunk->page_total * VM_PAGE_SIZE);
+   else
+      free(chunk->area);
+
    free(chunk);
 }
 
@@ -714,14 +861,24 @@ static void vm_chunk_free_all(vm_instance_t *vm)
    }
 
    vm->chunks = NULL;
+
+   free(vm->free_pages);
+   vm->free_pages = NULL;
+   vm->free_page_count = vm->free_page_max = 0;
 }
 
-/* Allocate an host page */
+/* 
+ * Allocate an host page (pages from the free list are zeroed).
+ * The memory lock must be held.
+ */
 void *vm_alloc_host_page(vm_instance_t *vm)
 {
    vm_chunk_t *chunk = vm->chunks;
    void *ptr;
 
+   if (vm->free_page_count > 0)
+      return(vm->free_pages[--vm->free_page_count]);
+
    if (!chunk || (chunk->page_alloc == chunk->page_total)) {
       chunk = vm_chunk_create(vm);
       if (!chunk) return NULL;
@@ -732,6 +889,36 @@ void *vm_alloc_host_page(vm_instance_t *vm)
    return(ptr);
 }
 
+/* 
+ * Free an host page: the host memory is returned to the system and the
+ * page is kept in a free list. The memory lock must be held.
+ */
+void vm_free_host_page(vm_instance_t *vm,void *ptr)
+{
+   void **pages;
+   u_int max;
+
+   if (vm->free_page_count == vm->free_page_max) {
+      max = vm->free_page_max ? (vm->free_page_max * 2) : VM_CHUNK_AREA_SIZE;
+
+      if (!(pages = realloc(vm->free_pages,max * sizeof(void *))))
+         return;
+
+      vm->free_pages = pages;
+      vm->free_page_max = max;
+   }
+
+   /* 
+    * Free pages must be zeroed. Pages of huge page chunks are cleared:
+    * releasing them would split a transparent huge page (and is not
+    * possible with hugetlbfs).
+    */
+   if (vm->huge_pages || (madvise(ptr,VM_PAGE_SIZE,MADV_DONTNEED) == -1))
+      memset(ptr,0,VM_PAGE_SIZE);
+
+   vm->free_pages[vm->free_page_count++] = ptr;
+}
+
 /* Free resources used by a ghost image */
 static void vm_ghost_image_free(vm_ghost_image_t *img)
 {
@@ -739,8 +926,12 @@ static void vm_ghost_image_free(vm_ghost_image_t *img)
       if (img->fd != -1) {
          close(img->fd);
 
-         if (img->area_ptr != NULL)
-            memzone_unmap(img->area_ptr,img->file_size);
+         if (img->area_ptr != NULL) {
+            if (img->huge)
+               memzone_unmap_huge(img->area_ptr,img->file_size);
+            else
+               memzone_unmap(img->area_ptr,img->file_size);
+         }
       }
 
       free(img->filename);
@@ -749,21 +940,22 @@ static void vm_ghost_image_free(vm_ghost_image_t *img)
 }
 
 /* Find a specified ghost image in the pool */
-static vm_ghost_image_t *vm_ghost_image_find(char *filename)
+static vm_ghost_image_t *vm_ghost_image_find(char *filename,int huge)
 {
    vm_ghost_image_t *img;
 
    for(img=vm_ghost_pool;img;img=img->next)
-      if (!strcmp(img->filename,filename))
+      if (!strcmp(img->filename,filename) && (img->huge == huge))
          return img;
 
    return NULL;
 }
 
 /* Load a new ghost image */
-static vm_ghost_image_t *vm_ghost_image_load(char *filename)
+static vm_ghost_image_t *vm_ghost_image_load(char *filename,int huge)
 {
    vm_ghost_image_t *img;
+   int mode = huge;
 
    if (!(img = calloc(1,sizeof(*img))))
       return NULL;
@@ -775,7 +967,25 @@ static vm_ghost_image_t *vm_ghost_image_load(char *filename)
       return NULL;
    }
 
-   img->fd = memzone_open_file_ro(img->filename,&img->area_ptr,&img->file_size);
+   /* 
+    * With huge pages, the image is copied in anonymous memory, still
+    * shared by all VMs and read-only.
+    */
+   if (huge) {
+      img->fd = memzone_open_huge_file(img->filename,0,&img->area_ptr,
+                                       &img->file_size,&mode);
+
+      if (img->fd != -1) {
+         img->huge = huge;
+         mprotect(img->area_ptr,img->file_size,PROT_READ);
+
+         m_log("GHOST","ghost image %s copied in huge pages (%s)\n",
+               img->filename,memzone_huge_mode_str(mode));
+      }
+   } else {
+      img->fd = memzone_open_file_ro(img->filename,&img->area_ptr,
+                                     &img->file_size);
+   }
 
    if (img->fd == -1) {
       vm_ghost_image_free(img);
@@ -788,15 +998,15 @@ static vm_ghost_image_t *vm_ghost_image_load(char *filename)
    return img;
 }
 
-/* Get a ghost image */
-int vm_ghost_image_get(char *filename,u_char **ptr,int *fd)
+/* Get a ghost image (huge: huge page mode requested by the VM) */
+int vm_ghost_image_get(char *filename,int huge,u_char **ptr,int *fd)
 {
    vm_ghost_image_t *img;
 
    VM_GLOCK();
 
    /* Do we already have this image in the pool ? */
-   if ((img = vm_ghost_image_find(filename)) != NULL) {
+   if ((img = vm_ghost_image_find(filename,huge)) != NULL) {
       img->ref_count++;
       *ptr = img->area_ptr;
       *fd  = img->fd;
@@ -805,7 +1015,7 @@ int vm_ghost_image_get(char *filename,u_char **ptr,int *fd)
    }
 
    /* Load the ghost file and add it into the pool */
-   if (!(img = vm_ghost_image_load(filename))) {
+   if (!(img = vm_ghost_image_load(filename,huge))) {
       VM_GUNLOCK();
       fprintf(stderr,"Unable to load ghost image %s\n",filename);
       return(-1);
@@ -940,6 +1150,32 @@ int vm_ios_set_image(vm_instance_t *vm,char *ios_image)
    return(0);
 }
 
+/* Set the base image of a PCMCIA disk (NULL: no base image) */
+int vm_set_disk_base(vm_instance_t *vm,u_int disk_id,char *filename)
+{
+   char *str = NULL;
+
+   if (disk_id >= 2)
+      return(-1);
+
+   if (filename && !(str = strdup(filename)))
+      return(-1);
+
+   free(vm->pcmcia_disk_base[disk_id]);
+   vm->pcmcia_disk_base[disk_id] = str;
+   return(0);
+}
+
+/* Set the huge page mode used for RAM and exec areas (MEMZONE_HUGE_*) */
+int vm_set_huge_pages(vm_instance_t *vm,int mode)
+{
+   if ((mode < MEMZONE_HUGE_NONE) || (mode > MEMZONE_HUGE_TLB))
+      return(-1);
+
+   vm->huge_pages = mode;
+   return(0);
+}
+
 /* Unset a Cisco IOS configuration file */
 void vm_ios_unset_config(vm_instance_t *vm)
 {
@@ -1048,6 +1284,9 @@ void vm_save_config(vm_instance_t *vm,FILE *fd)
    fprintf(fd,"vm set_ram %s %u\n",vm->name,vm->ram_size);
    fprintf(fd,"vm set_nvram %s %u\n",vm->name,vm->nvram_size);
    fprintf(fd,"vm set_ram_mmap %s %u\n",vm->name,vm->ram_mmap);
+
+   if (vm->huge_pages)
+      fprintf(fd,"vm set_huge_pages %s %d\n",vm->name,vm->huge_pages);
    fprintf(fd,"vm set_clock_divisor %s %u\n",vm->name,vm->clock_divisor);
    fprintf(fd,"vm set_conf_reg %s 0x%4.4x\n",vm->name,vm->conf_reg_setup);
 
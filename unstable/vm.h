@@ -31,6 +31,7 @@ typedef struct vm_chunk vm_chunk_t;
 struct vm_chunk {
    void *area;
    u_int page_alloc,page_total;
+   int huge;                      /* Area mapped with memzone_map_huge() */
    vm_chunk_t *next;
 };
 
@@ -42,6 +43,7 @@ struct vm_ghost_image {
    int fd;
    off_t file_size;
    u_char *area_ptr;
+   int huge;                      /* Copy in huge pages (MEMZONE_HUGE_*) */
    vm_ghost_image_t *next;
 };
 
@@ -51,6 +53,43 @@ struct vm_ghost_image {
 /* Size of the PCI bus pool */
 #define VM_PCI_POOL_SIZE  32
 
+/* Physical memory translation cache (physmem_* helpers) */
+#define VM_PMEM_TLB_SIZE   64
+#define VM_PMEM_TLB_WRITE  0x01   /* Host page is writable */
+
+typedef struct vm_pmem_tlb_entry vm_pmem_tlb_entry_t;
+struct vm_pmem_tlb_entry {
+   m_uint32_t seq;      /* Update sequence (odd: update in progress) */
+   m_uint32_t flags;
+   m_uint64_t ppage;    /* Physical page address */
+   u_char *hptr;        /* Host page address */
+};
+
+/* 
+ * Counters of the translation cache, spread over slots selected by thread
+ * so that threads don't share a cache line. Each slot fills a cache line.
+ */
+#define VM_PMEM_TLB_STATS_SLOTS  16
+
+typedef struct vm_pmem_tlb_stats vm_pmem_tlb_stats_t;
+struct vm_pmem_tlb_stats {
+   m_uint64_t hits,misses;
+   m_uint64_t pad[6];
+};
+
+/* 
+ * Device threads accessing memory through the physmem functions are
+ * counted in slots selected by thread, so that the accesses can be
+ * stopped while memory pages are remapped. Each slot fills a cache line.
+ */
+#define VM_DMA_SLOTS  16
+
+typedef struct vm_dma_slot vm_dma_slot_t;
+struct vm_dma_slot {
+   m_uint32_t count;
+   m_uint32_t pad[15];
+};
+
 /* VM instance status */
 enum {   
    VM_STATUS_HALTED = 0,      /* VM is halted and no HW resources are used */
@@ -78,12 +117,34 @@ typedef struct vm_obj vm_obj_t;
 /* Shutdown function prototype for an object */
 typedef void *(*vm_shutdown_t)(vm_instance_t *vm,void *data);
 
+/* Function called when the state of an object is restored */
+typedef void (*vm_ckpt_restore_t)(vm_instance_t *vm,void *data);
+
+/* Field saved in VM checkpoints (registers, device state) */
+struct vm_ckpt_field {
+   char *name;
+   long offset;
+   size_t size;
+};
+
+/* A single field, or a range of fields (from first to last, included) */
+#define VM_CKPT_FIELD(st,f)  { #f, OFFSET(st,f), sizeof(((st *)NULL)->f) }
+#define VM_CKPT_RANGE(st,first,last) \
+   { #first, OFFSET(st,first), \
+     OFFSET(st,last) + sizeof(((st *)NULL)->last) - OFFSET(st,first) }
+#define VM_CKPT_FIELD_END    { NULL, 0, 0 }
+
 /* VM object, used to keep track of devices and various things */
 struct vm_obj {
    char *name;
    void *data;
    struct vm_obj *next,**pprev;
    vm_shutdown_t shutdown;
+
+   /* State saved in checkpoints (fields relative to ckpt_data or data) */
+   vm_ckpt_field_t *ckpt_fields;
+   void *ckpt_data;
+   vm_ckpt_restore_t ckpt_restore;
 };
 
 /* VM instance */
@@ -100,6 +161,8 @@ struct vm_instance {
    u_int iomem_size;              /* IOMEM size in Mb */
    u_int nvram_size;              /* NVRAM size in Kb */
    u_int pcmcia_disk_size[2];     /* PCMCIA disk0 and disk1 sizes (in Mb) */
+   char *pcmcia_disk_base[2];     /* PCMCIA disk base images (COW) */
+   u_int pcmcia_disk_mmap;        /* Memory-mapped PCMCIA disks ? */
    u_int conf_reg,conf_reg_setup; /* Config register */
    u_int clock_divisor;           /* Clock Divisor (see cp0.c) */
    u_int ram_mmap;                /* Memory-mapped RAM ? */
@@ -116,13 +179,25 @@ struct vm_instance {
    int debug_level;               /* Debugging Level */
    int jit_use;                   /* CPUs use JIT */
    int sparse_mem;                /* Use sparse virtual memory */
+   int huge_pages;                /* Huge pages for RAM and exec area */
    u_int nm_iomem_size;           /* IO mem size to be passed to Smart Init */
 
    /* ROMMON variables */
    struct rommon_var_list rommon_vars;
 
-   /* Memory chunks */
+   /* Memory chunks and free host pages */
    vm_chunk_t *chunks;
+   void **free_pages;
+   u_int free_page_count,free_page_max;
+   pthread_mutex_t mem_lock;
+
+   /* Lock for CPU state changes (suspend/resume/stop) */
+   pthread_mutex_t state_lock;
+
+   /* Merging of identical pages with other VMs, zero page reclaim */
+   int mem_merge,mem_zero_reclaim;
+   m_iptr_t *mem_merge_retired;
+   u_int mem_merge_retired_count,mem_merge_retired_max;
 
    /* Basic hardware: system CPU, PCI busses and PCI I/O space */
    cpu_group_t *cpu_group;
@@ -135,6 +210,19 @@ struct vm_instance {
    struct vdevice *dev_list;
    struct vdevice *dev_array[VM_DEVICE_MAX];
 
+   /* Physical address map (device id for each page, by chunks) */
+   m_uint8_t **dev_map;
+
+   /* Physical memory translation cache */
+   vm_pmem_tlb_entry_t pmem_tlb[VM_PMEM_TLB_SIZE];
+   vm_pmem_tlb_stats_t pmem_tlb_stats[VM_PMEM_TLB_STATS_SLOTS];
+
+   /* Device accesses to memory (closed while pages are remapped) */
+   vm_dma_slot_t dma_slots[VM_DMA_SLOTS];
+   int dma_closed;
+   pthread_mutex_t dma_lock;
+   pthread_cond_t dma_cond;
+
    /* IRQ routing */
    void (*set_irq)(vm_instance_t *vm,u_int irq);
    void (*clear_irq)(vm_instance_t *vm,u_int irq);
@@ -158,15 +246,20 @@ struct vm_instance {
    /* Translation sharing group */
    int tsg;
 
+   /* Persistent cache of translated code */
+   struct tc_cache *tc_cache;
+
+   /* Cache of the self-decompressed IOS image (armed: watch entry point) */
+   ios_unpack_t *ios_unpack;
+   int ios_unpack_armed;
+
    /* "idling" pointer counter */
    m_uint64_t idle_pc;
+   int idle_pc_auto;
 
    /* JIT block direct jumps */
    int exec_blk_direct_jump;
 
-   /* IRQ idling preemption */
-   u_int irq_idle_preempt[256];
-
    /* Console and AUX port VTTY type and parameters */
    int vtty_con_type,vtty_aux_type;
    int vtty_con_tcp_port,vtty_aux_tcp_port;
@@ -188,6 +281,10 @@ struct vm_instance {
    struct vm_obj *vm_object_list;   
 };
 
+/* Lock for host page allocation and sparse device maps */
+#define VM_MEM_LOCK(vm)    pthread_mutex_lock(&(vm)->mem_lock)
+#define VM_MEM_UNLOCK(vm)  pthread_mutex_unlock(&(vm)->mem_lock)
+
 /* VM Platform definition */
 struct vm_platform {
    char *name;
@@ -221,6 +318,10 @@ static inline void vm_set_irq(vm_instance_t *vm,u_int irq)
 {
    if (vm->set_irq != NULL)
       vm->set_irq(vm,irq);
+
+   /* Wake up the boot CPU if it is idling (or about to idle) */
+   if (cpu_idle_wakeup_needed(vm->boot_cpu))
+      cpu_idle_break_wait(vm->boot_cpu);
 }
 
 /* Clear an IRQ for a VM */
@@ -329,6 +430,18 @@ int vm_resume(vm_instance_t *vm);
 /* Stop an instance */
 int vm_stop(vm_instance_t *vm);
 
+/* Pause CPU activity of a VM, without changing its status */
+int vm_pause(vm_instance_t *vm);
+
+/* Resume CPU activity after vm_pause() */
+void vm_unpause(vm_instance_t *vm);
+
+/* Stop the device threads of a VM (periodic tasks and NIO receive) */
+void vm_suspend_io(vm_instance_t *vm);
+
+/* Restart the device threads stopped by vm_suspend_io() */
+void vm_resume_io(vm_instance_t *vm);
+
 /* Monitor an instance periodically */
 void vm_monitor(vm_instance_t *vm);
 
@@ -338,8 +451,8 @@ void *vm_alloc_host_page(vm_instance_t *vm);
 /* Free an host page */
 void vm_free_host_page(vm_instance_t *vm,void *ptr);
 
-/* Get a ghost image */
-int vm_ghost_image_get(char *filename,u_char **ptr,int *fd);
+/* Get a ghost image (huge: huge page mode requested by the VM) */
+int vm_ghost_image_get(char *filename,int huge,u_char **ptr,int *fd);
 
 /* Release a ghost image */
 int vm_ghost_image_release(int fd);
@@ -360,6 +473,12 @@ int vm_ios_save_config(vm_instance_t *vm);
 /* Set Cisco IOS image to use */
 int vm_ios_set_image(vm_instance_t *vm,char *ios_image);
 
+/* Set the base image of a PCMCIA disk (NULL: no base image) */
+int vm_set_disk_base(vm_instance_t *vm,u_int disk_id,char *filename);
+
+/* Set the huge page mode used for RAM and exec areas (MEMZONE_HUGE_*) */
+int vm_set_huge_pages(vm_instance_t *vm,int mode);
+
 /* Unset a Cisco IOS configuration file */
 void vm_ios_unset_config(vm_instance_t *vm);
 
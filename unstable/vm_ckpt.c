@@ -0,0 +1,1137 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * VM checkpoints: save the state of a running VM to a file and restore it.
+ *
+ * A checkpoint contains the registers of the CPUs, the content of memory
+ * devices (RAM, NVRAM, ...), the base addresses of PCI devices and the
+ * state of the devices which describe their registers with a table of
+ * fields (VM objects and PCI devices). For sparse memory devices, only the
+ * pages which differ from the initial content are saved. Pages filled with
+ * zeroes are never stored, and the other pages may be compressed with zlib.
+ *
+ * A checkpoint is restored into a VM with the same configuration: the VM
+ * is started if needed, its CPUs are paused and its device threads are
+ * stopped, the state is loaded and the MTS caches and translated code
+ * (with the chained jumps) are flushed before resuming the VM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <assert.h>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "cpu.h"
+#include "vm.h"
+#include "device.h"
+#include "pci_dev.h"
+#include "memory.h"
+#include "mips64.h"
+#include "mips64_mem.h"
+#include "ppc32.h"
+#include "ppc32_mem.h"
+#include "ppc32_jit.h"
+#include "mem_merge.h"
+#include "vm_ckpt.h"
+
+/* Maximum length of record and field names */
+#define VM_CKPT_NAME_LEN  128
+
+/* MIPS64 CPU state */
+static vm_ckpt_field_t mips64_ckpt_fields[] = {
+   VM_CKPT_FIELD(cpu_mips_t,pc),
+   VM_CKPT_FIELD(cpu_mips_t,gpr),
+   VM_CKPT_FIELD(cpu_mips_t,lo),
+   VM_CKPT_FIELD(cpu_mips_t,hi),
+   VM_CKPT_FIELD(cpu_mips_t,ret_pc),
+   VM_CKPT_FIELD(cpu_mips_t,bd_slot),
+   VM_CKPT_FIELD(cpu_mips_t,ll_bit),
+   VM_CKPT_FIELD(cpu_mips_t,irq_pending),
+   VM_CKPT_FIELD(cpu_mips_t,irq_cause),
+   VM_CKPT_FIELD(cpu_mips_t,cp0),
+   VM_CKPT_FIELD(cpu_mips_t,fpu),
+   VM_CKPT_FIELD(cpu_mips_t,cp0_virt_cnt_reg),
+   VM_CKPT_FIELD(cpu_mips_t,cp0_virt_cmp_reg),
+   VM_CKPT_FIELD(cpu_mips_t,addr_mode),
+   VM_CKPT_FIELD_END,
+};
+
+/* PowerPC 32-bit CPU state */
+static vm_ckpt_field_t ppc32_ckpt_fields[] = {
+   VM_CKPT_FIELD(cpu_ppc_t,ia),
+   VM_CKPT_FIELD(cpu_ppc_t,gpr),
+   VM_CKPT_FIELD(cpu_ppc_t,xer),
+   VM_CKPT_FIELD(cpu_ppc_t,xer_ca),
+   VM_CKPT_FIELD(cpu_ppc_t,lr),
+   VM_CKPT_FIELD(cpu_ppc_t,ctr),
+   VM_CKPT_FIELD(cpu_ppc_t,reserve),
+   VM_CKPT_FIELD(cpu_ppc_t,cr_fields),
+   VM_CKPT_FIELD(cpu_ppc_t,irq_pending),
+   VM_CKPT_FIELD(cpu_ppc_t,irq_check),
+   VM_CKPT_FIELD(cpu_ppc_t,timer_irq_armed),
+   VM_CKPT_FIELD(cpu_ppc_t,bat),
+   VM_CKPT_FIELD(cpu_ppc_t,sr),
+   VM_CKPT_FIELD(cpu_ppc_t,sdr1),
+   VM_CKPT_FIELD(cpu_ppc_t,msr),
+   VM_CKPT_FIELD(cpu_ppc_t,srr0),
+   VM_CKPT_FIELD(cpu_ppc_t,srr1),
+   VM_CKPT_FIELD(cpu_ppc_t,dsisr),
+   VM_CKPT_FIELD(cpu_ppc_t,dar),
+   VM_CKPT_FIELD(cpu_ppc_t,sprg),
+   VM_CKPT_FIELD(cpu_ppc_t,tb),
+   VM_CKPT_FIELD(cpu_ppc_t,dec),
+   VM_CKPT_FIELD(cpu_ppc_t,hid0),
+   VM_CKPT_FIELD(cpu_ppc_t,hid1),
+   VM_CKPT_FIELD(cpu_ppc_t,ppc405_tlb),
+   VM_CKPT_FIELD(cpu_ppc_t,ppc405_pid),
+   VM_CKPT_FIELD(cpu_ppc_t,mpc860_immr),
+   VM_CKPT_FIELD(cpu_ppc_t,fpu),
+   VM_CKPT_FIELD_END,
+};
+
+/* Checkpoint statistics */
+struct vm_ckpt_stats {
+   u_int pages,zero_pages,zlib_pages;
+   u_int objects,skipped;
+};
+
+/* Get the field table and state of a CPU */
+static vm_ckpt_field_t *vm_ckpt_cpu_fields(cpu_gen_t *cpu,void **base)
+{
+   switch(cpu->type) {
+      case CPU_TYPE_MIPS64:
+         *base = CPU_MIPS64(cpu);
+         return(mips64_ckpt_fields);
+      case CPU_TYPE_PPC32:
+         *base = CPU_PPC32(cpu);
+         return(ppc32_ckpt_fields);
+      default:
+         return NULL;
+   }
+}
+
+/* Returns TRUE if a device is a memory device saved in checkpoints */
+static inline int vm_ckpt_mem_dev(struct vdevice *dev)
+{
+   if (dev->flags & VDEVICE_FLAG_REMAP)
+      return(FALSE);
+
+   return((dev->flags & VDEVICE_FLAG_SPARSE) || dev->host_addr);
+}
+
+/* Returns TRUE if a page is filled with zeroes */
+static int vm_ckpt_zero_page(void *page)
+{
+   m_uint64_t *p = page;
+   u_int i;
+
+   for(i=0;i<VM_PAGE_SIZE/sizeof(m_uint64_t);i++)
+      if (p[i] != 0)
+         return(FALSE);
+
+   return(TRUE);
+}
+
+/* Name of a PCI device in checkpoints */
+static void vm_ckpt_pci_name(struct pci_bus *bus,struct pci_device *dev,
+                             char *name,size_t len)
+{
+   snprintf(name,len,"%s:%d.%d:%s",
+            bus->name,dev->device,dev->function,dev->name);
+}
+
+/* Get the PCI busses of a VM, without duplicates */
+static u_int vm_ckpt_pci_busses(vm_instance_t *vm,struct pci_bus **list)
+{
+   struct pci_bus *bus;
+   u_int i,j,count = 0;
+
+   for(i=0;i<2+VM_PCI_POOL_SIZE;i++) {
+      bus = (i < 2) ? vm->pci_bus[i] : vm->pci_bus_pool[i-2];
+
+      if (!bus)
+         continue;
+
+      for(j=0;j<count;j++)
+         if (list[j] == bus)
+            break;
+
+      if (j == count)
+         list[count++] = bus;
+   }
+
+   return(count);
+}
+
+/* ======================================================================== */
+/* Checkpoint creation                                                      */
+/* ======================================================================== */
+
+/* Write a record header (the record size is set by vm_ckpt_rec_end) */
+static int vm_ckpt_rec_start(FILE *fd,u_int type,char *name,off_t *pos)
+{
+   struct vm_ckpt_rec rec;
+
+   memset(&rec,0,sizeof(rec));
+   rec.type = type;
+   rec.name_len = strlen(name);
+
+   if ((*pos = ftello(fd)) == -1)
+      return(-1);
+
+   if ((fwrite(&rec,sizeof(rec),1,fd) != 1) ||
+       (rec.name_len && (fwrite(name,rec.name_len,1,fd) != 1)))
+      return(-1);
+
+   return(0);
+}
+
+/* Complete a record by updating its size */
+static int vm_ckpt_rec_end(FILE *fd,char *name,off_t pos)
+{
+   m_uint64_t size;
+   off_t cur;
+
+   if ((cur = ftello(fd)) == -1)
+      return(-1);
+
+   size = cur - (pos + sizeof(struct vm_ckpt_rec) + strlen(name));
+
+   if ((fseeko(fd,pos+OFFSET(struct vm_ckpt_rec,size),SEEK_SET) != 0) ||
+       (fwrite(&size,sizeof(size),1,fd) != 1) ||
+       (fseeko(fd,cur,SEEK_SET) != 0))
+      return(-1);
+
+   return(0);
+}
+
+/* Write a table of fields */
+static int vm_ckpt_write_fields(FILE *fd,vm_ckpt_field_t *fields,void *base)
+{
+   struct vm_ckpt_field_hdr hdr;
+   vm_ckpt_field_t *f;
+
+   for(f=fields;f->name;f++) {
+      hdr.name_len = strlen(f->name);
+      hdr.size = f->size;
+
+      if ((fwrite(&hdr,sizeof(hdr),1,fd) != 1) ||
+          (fwrite(f->name,hdr.name_len,1,fd) != 1) ||
+          (fwrite((char *)base + f->offset,f->size,1,fd) != 1))
+         return(-1);
+   }
+
+   return(0);
+}
+
+/* Write a record made of fields */
+static int vm_ckpt_save_fields(FILE *fd,u_int type,char *name,
+                               vm_ckpt_field_t *fields,void *base,
+                               void *prefix,size_t prefix_len)
+{
+   off_t pos;
+
+   if ((vm_ckpt_rec_start(fd,type,name,&pos) == -1) ||
+       (prefix_len && (fwrite(prefix,prefix_len,1,fd) != 1)) ||
+       (fields && (vm_ckpt_write_fields(fd,fields,base) == -1)) ||
+       (vm_ckpt_rec_end(fd,name,pos) == -1))
+      return(-1);
+
+   return(0);
+}
+
+/* Save a memory page */
+static int vm_ckpt_save_page(FILE *fd,u_int index,void *page,int compress,
+                             u_char *buffer,struct vm_ckpt_stats *stats)
+{
+   struct vm_ckpt_page hdr;
+   void *data = page;
+
+   memset(&hdr,0,sizeof(hdr));
+   hdr.index = index;
+   hdr.type  = VM_CKPT_PAGE_RAW;
+   hdr.size  = VM_PAGE_SIZE;
+
+   if (vm_ckpt_zero_page(page)) {
+      hdr.type = VM_CKPT_PAGE_ZERO;
+      hdr.size = 0;
+      stats->zero_pages++;
+   }
+#ifdef USE_ZLIB
+   else if (compress) {
+      uLongf len = VM_PAGE_SIZE;
+
+      if ((compress2(buffer,&len,page,VM_PAGE_SIZE,Z_BEST_SPEED) == Z_OK) &&
+          (len < VM_PAGE_SIZE))
+      {
+         hdr.type = VM_CKPT_PAGE_ZLIB;
+         hdr.size = len;
+         data = buffer;
+         stats->zlib_pages++;
+      }
+   }
+#endif
+
+   if ((fwrite(&hdr,sizeof(hdr),1,fd) != 1) ||
+       (hdr.size && (fwrite(data,hdr.size,1,fd) != 1)))
+      return(-1);
+
+   stats->pages++;
+   return(0);
+}
+
+/*
+ * Save a memory device. For sparse devices, pages which were never written
+ * are skipped (they keep their initial content, zeroes or ghost image).
+ * For other devices, all pages are saved except the zero pages.
+ */
+static int vm_ckpt_save_mem(FILE *fd,struct vdevice *dev,int compress,
+                            u_char *buffer,struct vm_ckpt_stats *stats)
+{
+   struct vm_ckpt_mem mem;
+   struct vm_ckpt_page end;
+   u_int i,nr_pages;
+   m_iptr_t ptr;
+   off_t pos;
+
+   memset(&mem,0,sizeof(mem));
+   mem.phys_len = dev->phys_len;
+
+   if (dev->flags & VDEVICE_FLAG_SPARSE)
+      mem.flags |= VM_CKPT_MEM_PRISTINE;
+
+   if (dev->flags & VDEVICE_FLAG_GHOST)
+      mem.flags |= VM_CKPT_MEM_GHOST;
+
+   if ((vm_ckpt_rec_start(fd,VM_CKPT_REC_MEM,dev->name,&pos) == -1) ||
+       (fwrite(&mem,sizeof(mem),1,fd) != 1))
+      return(-1);
+
+   nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+   for(i=0;i<nr_pages;i++) {
+      if (dev->flags & VDEVICE_FLAG_SPARSE) {
+         ptr = dev->sparse_map[i];
+
+         if (!(ptr & (VDEVICE_PTE_DIRTY|VDEVICE_PTE_SHARED)))
+            continue;
+
+         ptr &= VM_PAGE_MASK;
+      } else {
+         ptr = dev->host_addr + ((m_iptr_t)i << VM_PAGE_SHIFT);
+
+         if (vm_ckpt_zero_page((void *)ptr))
+            continue;
+      }
+
+      if (vm_ckpt_save_page(fd,i,(void *)ptr,compress,buffer,stats) == -1)
+         return(-1);
+   }
+
+   memset(&end,0,sizeof(end));
+   end.type = VM_CKPT_PAGE_END;
+
+   if ((fwrite(&end,sizeof(end),1,fd) != 1) ||
+       (vm_ckpt_rec_end(fd,dev->name,pos) == -1))
+      return(-1);
+
+   return(0);
+}
+
+/* Save the base addresses and the state of the PCI devices */
+static int vm_ckpt_save_pci(vm_instance_t *vm,FILE *fd,
+                            struct vm_ckpt_stats *stats)
+{
+   struct pci_bus *bus_list[2+VM_PCI_POOL_SIZE];
+   char name[VM_CKPT_NAME_LEN];
+   struct pci_device *dev;
+   struct vm_ckpt_pci pci;
+   u_int i,j,count;
+
+   count = vm_ckpt_pci_busses(vm,bus_list);
+
+   for(i=0;i<count;i++) {
+      for(dev=bus_list[i]->dev_list;dev;dev=dev->next) {
+         memset(&pci,0,sizeof(pci));
+
+         if (dev->read_register != NULL) {
+            for(j=0;j<VM_CKPT_PCI_BARS;j++)
+               pci.bar[j] = dev->read_register(vm->boot_cpu,dev,
+                                               PCI_REG_BAR0 + (j << 2));
+         }
+
+         vm_ckpt_pci_name(bus_list[i],dev,name,sizeof(name));
+
+         if (vm_ckpt_save_fields(fd,VM_CKPT_REC_PCI,name,
+                                 dev->priv_data ? dev->ckpt_fields : NULL,
+                                 dev->priv_data,&pci,sizeof(pci)) == -1)
+            return(-1);
+
+         if (dev->ckpt_fields)
+            stats->objects++;
+      }
+   }
+
+   return(0);
+}
+
+/* Count the CPUs of a VM */
+static u_int vm_ckpt_cpu_count(vm_instance_t *vm)
+{
+   cpu_gen_t *cpu;
+   u_int count = 0;
+
+   for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+      count++;
+
+   return(count);
+}
+
+/* Write the file header */
+static int vm_ckpt_write_header(vm_instance_t *vm,FILE *fd)
+{
+   struct vm_ckpt_header hdr;
+
+   memset(&hdr,0,sizeof(hdr));
+   hdr.magic = VM_CKPT_MAGIC;
+   hdr.version = VM_CKPT_VERSION;
+   hdr.ram_size = vm->ram_size;
+   hdr.cpu_count = vm_ckpt_cpu_count(vm);
+   strncpy(hdr.platform,vm->platform->name,sizeof(hdr.platform)-1);
+
+   if (fwrite(&hdr,sizeof(hdr),1,fd) != 1)
+      return(-1);
+
+   return(0);
+}
+
+/* Write the final record */
+static int vm_ckpt_write_end(FILE *fd)
+{
+   struct vm_ckpt_rec end;
+
+   memset(&end,0,sizeof(end));
+   end.type = VM_CKPT_REC_END;
+
+   if (fwrite(&end,sizeof(end),1,fd) != 1)
+      return(-1);
+
+   return(0);
+}
+
+/* Save the registers of all CPUs */
+static int vm_ckpt_save_cpu_regs(vm_instance_t *vm,FILE *fd)
+{
+   char name[VM_CKPT_NAME_LEN];
+   vm_ckpt_field_t *fields;
+   cpu_gen_t *cpu;
+   void *base;
+
+   for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next) {
+      if (!(fields = vm_ckpt_cpu_fields(cpu,&base)))
+         continue;
+
+      snprintf(name,sizeof(name),"cpu%u",cpu->id);
+
+      if (vm_ckpt_save_fields(fd,VM_CKPT_REC_CPU,name,fields,base,
+                              &cpu->type,sizeof(cpu->type)) == -1)
+         return(-1);
+   }
+
+   return(0);
+}
+
+/* Save the state of a VM (CPUs paused) */
+static int vm_ckpt_save_state(vm_instance_t *vm,FILE *fd,int compress,
+                              struct vm_ckpt_stats *stats)
+{
+   struct vdevice *dev;
+   u_char *buffer;
+   vm_obj_t *obj;
+   void *base;
+   int res = -1;
+
+   if (!(buffer = malloc(VM_PAGE_SIZE)))
+      return(-1);
+
+   if (vm_ckpt_write_header(vm,fd) == -1)
+      goto done;
+
+   /* Memory devices */
+   for(dev=vm->dev_list;dev;dev=dev->next) {
+      if (vm_ckpt_mem_dev(dev) &&
+          (vm_ckpt_save_mem(fd,dev,compress,buffer,stats) == -1))
+         goto done;
+   }
+
+   /* PCI devices */
+   if (vm_ckpt_save_pci(vm,fd,stats) == -1)
+      goto done;
+
+   /* VM objects */
+   for(obj=vm->vm_object_list;obj;obj=obj->next) {
+      if (!obj->ckpt_fields) {
+         stats->skipped++;
+         continue;
+      }
+
+      base = obj->ckpt_data ? obj->ckpt_data : obj->data;
+
+      if (vm_ckpt_save_fields(fd,VM_CKPT_REC_OBJ,obj->name,
+                              obj->ckpt_fields,base,NULL,0) == -1)
+         goto done;
+
+      stats->objects++;
+   }
+
+   /* CPUs */
+   if ((vm_ckpt_save_cpu_regs(vm,fd) == 0) && (vm_ckpt_write_end(fd) == 0))
+      res = 0;
+
+ done:
+   free(buffer);
+   return(res);
+}
+
+/* Save the state of a VM into a checkpoint file */
+int vm_ckpt_save(vm_instance_t *vm,char *filename,int compress)
+{
+   struct vm_ckpt_stats stats;
+   m_tmcnt_t start;
+   FILE *fd;
+   int res;
+
+#ifndef USE_ZLIB
+   if (compress) {
+      vm_error(vm,"checkpoint: compression is not supported (no zlib).\n");
+      return(-1);
+   }
+#endif
+
+   if (!(fd = fopen(filename,"w"))) {
+      vm_error(vm,"checkpoint: unable to create file '%s'\n",filename);
+      return(-1);
+   }
+
+   if (vm_pause(vm) == -1) {
+      vm_error(vm,"checkpoint: the VM is not running.\n");
+      fclose(fd);
+      unlink(filename);
+      return(-1);
+   }
+
+   start = m_gettime_usec();
+   memset(&stats,0,sizeof(stats));
+
+   VM_MEM_LOCK(vm);
+   res = vm_ckpt_save_state(vm,fd,compress,&stats);
+   VM_MEM_UNLOCK(vm);
+
+   vm_unpause(vm);
+
+   if ((fclose(fd) != 0) || (res == -1)) {
+      vm_error(vm,"checkpoint: unable to write file '%s'\n",filename);
+      unlink(filename);
+      return(-1);
+   }
+
+   vm_log(vm,"CHECKPOINT","saved to '%s' in %llu ms: %u pages "
+          "(%u zero, %u compressed), %u devices (%u objects without state)\n",
+          filename,(m_tmcnt_t)(m_gettime_usec() - start) / 1000,
+          stats.pages,stats.zero_pages,stats.zlib_pages,
+          stats.objects,stats.skipped);
+   return(0);
+}
+
+/* Save only the CPU registers (CPUs not running or called by themselves) */
+int vm_ckpt_save_cpus(vm_instance_t *vm,char *filename)
+{
+   FILE *fd;
+   int res;
+
+   if (!(fd = fopen(filename,"w")))
+      return(-1);
+
+   res = -1;
+
+   if ((vm_ckpt_write_header(vm,fd) == 0) &&
+       (vm_ckpt_save_cpu_regs(vm,fd) == 0) &&
+       (vm_ckpt_write_end(fd) == 0))
+      res = 0;
+
+   if ((fclose(fd) != 0) || (res == -1)) {
+      unlink(filename);
+      return(-1);
+   }
+
+   return(0);
+}
+
+/* ======================================================================== */
+/* Checkpoint restore                                                       */
+/* ======================================================================== */
+
+/* Read a record or field name */
+static int vm_ckpt_read_name(FILE *fd,u_int len,char *name)
+{
+   if ((len >= VM_CKPT_NAME_LEN) || (len && (fread(name,len,1,fd) != 1)))
+      return(-1);
+
+   name[len] = 0;
+   return(0);
+}
+
+/* Read a table of fields, unknown fields are skipped */
+static int vm_ckpt_read_fields(vm_instance_t *vm,FILE *fd,char *rec_name,
+                               m_uint64_t size,vm_ckpt_field_t *fields,
+                               void *base)
+{
+   char name[VM_CKPT_NAME_LEN];
+   struct vm_ckpt_field_hdr hdr;
+   vm_ckpt_field_t *f;
+   m_uint64_t len;
+
+   while(size > 0) {
+      if ((size < sizeof(hdr)) || (fread(&hdr,sizeof(hdr),1,fd) != 1) ||
+          (vm_ckpt_read_name(fd,hdr.name_len,name) == -1))
+         return(-1);
+
+      len = sizeof(hdr) + hdr.name_len + hdr.size;
+
+      if (len > size)
+         return(-1);
+
+      size -= len;
+
+      for(f=fields;f && f->name;f++)
+         if (!strcmp(f->name,name) && (f->size == hdr.size))
+            break;
+
+      if (!f || !f->name) {
+         vm_log(vm,"CHECKPOINT","%s: ignoring unknown field '%s'\n",
+                rec_name,name);
+
+         if (fseeko(fd,hdr.size,SEEK_CUR) != 0)
+            return(-1);
+         continue;
+      }
+
+      if (fread((char *)base + f->offset,f->size,1,fd) != 1)
+         return(-1);
+   }
+
+   return(0);
+}
+
+/* Get a private page of a sparse device, to be overwritten */
+static void *vm_ckpt_sparse_page(vm_instance_t *vm,struct vdevice *dev,
+                                 u_int index)
+{
+   m_iptr_t ptr = dev->sparse_map[index];
+   void *page;
+
+   if (ptr & VDEVICE_PTE_DIRTY)
+      return((void *)(ptr & VM_PAGE_MASK));
+
+   page = vm_alloc_host_page(vm);
+   assert(page);
+
+   if (ptr & VDEVICE_PTE_SHARED)
+      mem_merge_put_page((void *)(ptr & VM_PAGE_MASK));
+
+   dev->sparse_map[index] = (m_iptr_t)page | VDEVICE_PTE_DIRTY;
+   return(page);
+}
+
+/*
+ * Give its initial content to a page of a sparse device. Private pages
+ * are kept, device threads may still be accessing them.
+ */
+static void vm_ckpt_sparse_reset(struct vdevice *dev,u_int index)
+{
+   m_iptr_t ptr = dev->sparse_map[index];
+   m_iptr_t orig = 0;
+
+   if (dev->host_addr)
+      orig = dev->host_addr + ((m_iptr_t)index << VM_PAGE_SHIFT);
+
+   if (ptr & VDEVICE_PTE_DIRTY) {
+      if (orig)
+         memcpy((void *)(ptr & VM_PAGE_MASK),(void *)orig,VM_PAGE_SIZE);
+      else
+         memset((void *)(ptr & VM_PAGE_MASK),0,VM_PAGE_SIZE);
+   } else if (ptr & VDEVICE_PTE_SHARED) {
+      mem_merge_put_page((void *)(ptr & VM_PAGE_MASK));
+      dev->sparse_map[index] = orig;
+   }
+}
+
+/* Restore a page filled with zeroes */
+static void vm_ckpt_zero_fill(vm_instance_t *vm,struct vdevice *dev,
+                              u_int index)
+{
+   if (!(dev->flags & VDEVICE_FLAG_SPARSE)) {
+      memset((void *)(dev->host_addr + ((m_iptr_t)index << VM_PAGE_SHIFT)),
+             0,VM_PAGE_SIZE);
+      return;
+   }
+
+   /* Without ghost image, an unmapped page is a zero page */
+   if (!dev->host_addr && !(dev->sparse_map[index] & VDEVICE_PTE_DIRTY)) {
+      vm_ckpt_sparse_reset(dev,index);
+      return;
+   }
+
+   memset(vm_ckpt_sparse_page(vm,dev,index),0,VM_PAGE_SIZE);
+}
+
+/* Load the content of a page */
+static int vm_ckpt_load_page(vm_instance_t *vm,FILE *fd,struct vdevice *dev,
+                             struct vm_ckpt_page *hdr,u_char *buffer)
+{
+   void *page;
+
+   if (hdr->type == VM_CKPT_PAGE_ZERO) {
+      vm_ckpt_zero_fill(vm,dev,hdr->index);
+      return(0);
+   }
+
+   if (dev->flags & VDEVICE_FLAG_SPARSE)
+      page = vm_ckpt_sparse_page(vm,dev,hdr->index);
+   else
+      page = (void *)(dev->host_addr +
+                      ((m_iptr_t)hdr->index << VM_PAGE_SHIFT));
+
+   switch(hdr->type) {
+      case VM_CKPT_PAGE_RAW:
+         if ((hdr->size != VM_PAGE_SIZE) ||
+             (fread(page,VM_PAGE_SIZE,1,fd) != 1))
+            return(-1);
+         return(0);
+
+#ifdef USE_ZLIB
+      case VM_CKPT_PAGE_ZLIB: {
+         uLongf len = VM_PAGE_SIZE;
+
+         if ((hdr->size > VM_PAGE_SIZE) ||
+             (fread(buffer,hdr->size,1,fd) != 1) ||
+             (uncompress(page,&len,buffer,hdr->size) != Z_OK) ||
+             (len != VM_PAGE_SIZE))
+            return(-1);
+         return(0);
+      }
+#endif
+
+      default:
+         vm_error(vm,"checkpoint: unsupported page type %u for device %s\n",
+                  hdr->type,dev->name);
+         return(-1);
+   }
+}
+
+/* Restore a memory device */
+static int vm_ckpt_load_mem(vm_instance_t *vm,FILE *fd,char *name,
+                            u_char *buffer,struct vm_ckpt_stats *stats)
+{
+   struct vm_ckpt_page hdr;
+   struct vm_ckpt_mem mem;
+   struct vdevice *dev;
+   u_int i,nr_pages;
+   u_char *loaded;
+   int sparse,res = -1;
+
+   if (fread(&mem,sizeof(mem),1,fd) != 1)
+      return(-1);
+
+   if (!(dev = dev_get_by_name(vm,name)) || !vm_ckpt_mem_dev(dev) ||
+       (dev->phys_len != mem.phys_len))
+   {
+      vm_error(vm,"checkpoint: memory device '%s' does not match.\n",name);
+      return(-1);
+   }
+
+   sparse = (dev->flags & VDEVICE_FLAG_SPARSE) ? TRUE : FALSE;
+
+   /* The initial content of pages must be the same */
+   if ((mem.flags & VM_CKPT_MEM_PRISTINE) &&
+       (!(mem.flags & VM_CKPT_MEM_GHOST) != !(dev->flags & VDEVICE_FLAG_GHOST) ||
+        (!sparse && (dev->flags & VDEVICE_FLAG_GHOST))))
+   {
+      vm_error(vm,"checkpoint: ghost/sparse configuration of device '%s' "
+               "does not match.\n",name);
+      return(-1);
+   }
+
+   nr_pages = normalize_size(dev->phys_len,VM_PAGE_SIZE,VM_PAGE_SHIFT);
+
+   if (!(loaded = calloc(nr_pages,sizeof(u_char))))
+      return(-1);
+
+   for(;;) {
+      if (fread(&hdr,sizeof(hdr),1,fd) != 1)
+         goto done;
+
+      if (hdr.type == VM_CKPT_PAGE_END)
+         break;
+
+      if (hdr.index >= nr_pages)
+         goto done;
+
+      if (vm_ckpt_load_page(vm,fd,dev,&hdr,buffer) == -1)
+         goto done;
+
+      loaded[hdr.index] = TRUE;
+      stats->pages++;
+   }
+
+   /* Pages which were not saved: initial content or zeroes */
+   for(i=0;i<nr_pages;i++) {
+      if (loaded[i])
+         continue;
+
+      if (sparse && (mem.flags & VM_CKPT_MEM_PRISTINE))
+         vm_ckpt_sparse_reset(dev,i);
+      else
+         vm_ckpt_zero_fill(vm,dev,i);
+   }
+
+   /* Page checksums of the memory scanner are not valid anymore */
+   if (dev->sparse_hash != NULL)
+      memset(dev->sparse_hash,0,nr_pages * sizeof(m_uint64_t));
+
+   res = 0;
+ done:
+   free(loaded);
+   return(res);
+}
+
+/* Restore a PCI device */
+static int vm_ckpt_load_pci(vm_instance_t *vm,FILE *fd,char *name,
+                            m_uint64_t size,struct vm_ckpt_stats *stats)
+{
+   struct pci_bus *bus_list[2+VM_PCI_POOL_SIZE];
+   char dev_name[VM_CKPT_NAME_LEN];
+   struct pci_device *dev = NULL;
+   struct vm_ckpt_pci pci;
+   u_int i,count;
+   m_uint32_t bar;
+   int reg;
+
+   if ((size < sizeof(pci)) || (fread(&pci,sizeof(pci),1,fd) != 1))
+      return(-1);
+
+   count = vm_ckpt_pci_busses(vm,bus_list);
+
+   for(i=0;(i<count) && !dev;i++) {
+      for(dev=bus_list[i]->dev_list;dev;dev=dev->next) {
+         vm_ckpt_pci_name(bus_list[i],dev,dev_name,sizeof(dev_name));
+         if (!strcmp(dev_name,name))
+            break;
+      }
+   }
+
+   if (!dev) {
+      vm_error(vm,"checkpoint: unknown PCI device '%s'.\n",name);
+      return(-1);
+   }
+
+   /* Program the base addresses which have changed (including cleared ones) */
+   if (dev->read_register && dev->write_register) {
+      for(i=0;i<VM_CKPT_PCI_BARS;i++) {
+         reg = PCI_REG_BAR0 + (i << 2);
+         bar = dev->read_register(vm->boot_cpu,dev,reg);
+
+         if (pci.bar[i] != bar)
+            dev->write_register(vm->boot_cpu,dev,reg,pci.bar[i]);
+      }
+   }
+
+   if (dev->ckpt_fields)
+      stats->objects++;
+
+   return(vm_ckpt_read_fields(vm,fd,name,size - sizeof(pci),
+                              dev->priv_data ? dev->ckpt_fields : NULL,
+                              dev->priv_data));
+}
+
+/* Restore the state of a VM object */
+static int vm_ckpt_load_obj(vm_instance_t *vm,FILE *fd,char *name,
+                            m_uint64_t size,struct vm_ckpt_stats *stats)
+{
+   vm_obj_t *obj;
+   void *base;
+
+   if (!(obj = vm_object_find(vm,name)) || !obj->ckpt_fields) {
+      vm_error(vm,"checkpoint: unknown object '%s'.\n",name);
+      return(-1);
+   }
+
+   base = obj->ckpt_data ? obj->ckpt_data : obj->data;
+
+   if (vm_ckpt_read_fields(vm,fd,name,size,obj->ckpt_fields,base) == -1)
+      return(-1);
+
+   if (obj->ckpt_restore != NULL)
+      obj->ckpt_restore(vm,obj->data);
+
+   stats->objects++;
+   return(0);
+}
+
+/* Restore the registers of a CPU */
+static int vm_ckpt_load_cpu(vm_instance_t *vm,FILE *fd,char *name,
+                            m_uint64_t size)
+{
+   vm_ckpt_field_t *fields;
+   cpu_mips_t *mcpu;
+   cpu_ppc_t *pcpu;
+   u_int id,type,addr_mode,swap_mode;
+   cpu_gen_t *cpu;
+   void *base;
+
+   if ((sscanf(name,"cpu%u",&id) != 1) || (size < sizeof(type)) ||
+       (fread(&type,sizeof(type),1,fd) != 1))
+      return(-1);
+
+   if (!(cpu = cpu_group_find_id(vm->cpu_group,id)) || (cpu->type != type) ||
+       !(fields = vm_ckpt_cpu_fields(cpu,&base)))
+   {
+      vm_error(vm,"checkpoint: CPU %u does not match.\n",id);
+      return(-1);
+   }
+
+   switch(cpu->type) {
+      case CPU_TYPE_MIPS64:
+         mcpu = CPU_MIPS64(cpu);
+         addr_mode = mcpu->addr_mode;
+
+         if (vm_ckpt_read_fields(vm,fd,name,size - sizeof(type),
+                                 fields,base) == -1)
+            return(-1);
+
+         /* Switch the MTS to the saved addressing mode */
+         swap_mode = mcpu->addr_mode;
+         mcpu->addr_mode = addr_mode;
+         mips64_set_addr_mode(mcpu,swap_mode);
+         break;
+
+      case CPU_TYPE_PPC32:
+         pcpu = CPU_PPC32(cpu);
+
+         if (vm_ckpt_read_fields(vm,fd,name,size - sizeof(type),
+                                 fields,base) == -1)
+            return(-1);
+
+         if (pcpu->sdr1)
+            ppc32_set_sdr1(pcpu,pcpu->sdr1);
+         break;
+   }
+
+   return(0);
+}
+
+/* Drop the translated code of the CPUs, memory has changed (CPUs paused) */
+static void vm_ckpt_flush_code(vm_instance_t *vm)
+{
+   cpu_gen_t *cpu;
+
+   for(cpu=vm->cpu_group->cpu_list;cpu;cpu=cpu->next)
+      cpu_flush_code(cpu);
+}
+
+/* Restore the state of a VM (CPUs paused) */
+static int vm_ckpt_load_state(vm_instance_t *vm,FILE *fd,
+                              struct vm_ckpt_stats *stats)
+{
+   char name[VM_CKPT_NAME_LEN];
+   struct vm_ckpt_rec rec;
+   u_char *buffer;
+   int res = -1;
+
+   if (!(buffer = malloc(VM_PAGE_SIZE)))
+      return(-1);
+
+   for(;;) {
+      if ((fread(&rec,sizeof(rec),1,fd) != 1) ||
+          (vm_ckpt_read_name(fd,rec.name_len,name) == -1))
+         break;
+
+      switch(rec.type) {
+         case VM_CKPT_REC_END:
+            res = 0;
+            goto done;
+
+         case VM_CKPT_REC_MEM:
+            VM_MEM_LOCK(vm);
+            res = vm_ckpt_load_mem(vm,fd,name,buffer,stats);
+            VM_MEM_UNLOCK(vm);
+            break;
+
+         case VM_CKPT_REC_PCI:
+            res = vm_ckpt_load_pci(vm,fd,name,rec.size,stats);
+            break;
+
+         case VM_CKPT_REC_OBJ:
+            res = vm_ckpt_load_obj(vm,fd,name,rec.size,stats);
+            break;
+
+         case VM_CKPT_REC_CPU:
+            res = vm_ckpt_load_cpu(vm,fd,name,rec.size);
+            break;
+
+         default:
+            vm_log(vm,"CHECKPOINT","ignoring record '%s' (type %u)\n",
+                   name,rec.type);
+            res = (fseeko(fd,rec.size,SEEK_CUR) == 0) ? 0 : -1;
+      }
+
+      if (res == -1) {
+         vm_error(vm,"checkpoint: unable to restore '%s'.\n",name);
+         goto done;
+      }
+
+      res = -1;
+   }
+
+ done:
+   free(buffer);
+   return(res);
+}
+
+/* Check that a checkpoint can be restored into a VM */
+static int vm_ckpt_check_header(vm_instance_t *vm,struct vm_ckpt_header *hdr)
+{
+   if ((hdr->magic != VM_CKPT_MAGIC) || (hdr->version != VM_CKPT_VERSION)) {
+      vm_error(vm,"checkpoint: invalid file or unsupported version.\n");
+      return(-1);
+   }
+
+   hdr->platform[sizeof(hdr->platform)-1] = 0;
+
+   if (strcmp(hdr->platform,vm->platform->name) ||
+       (hdr->ram_size != vm->ram_size))
+   {
+      vm_error(vm,"checkpoint: saved from a %s with %u Mb of RAM.\n",
+               hdr->platform,hdr->ram_size);
+      return(-1);
+   }
+
+   return(0);
+}
+
+/* Check that the VM has as many CPUs as the checkpoint (VM initialized) */
+static int vm_ckpt_check_cpus(vm_instance_t *vm,struct vm_ckpt_header *hdr)
+{
+   if (hdr->cpu_count != vm_ckpt_cpu_count(vm)) {
+      vm_error(vm,"checkpoint: saved from a VM with %u CPU(s).\n",
+               hdr->cpu_count);
+      return(-1);
+   }
+
+   return(0);
+}
+
+/* Load a checkpoint file into a VM whose CPUs are not running */
+int vm_ckpt_load(vm_instance_t *vm,char *filename)
+{
+   struct vm_ckpt_header hdr;
+   struct vm_ckpt_stats stats;
+   FILE *fd;
+   int res = -1;
+
+   if (!(fd = fopen(filename,"r"))) {
+      vm_error(vm,"checkpoint: unable to open file '%s'\n",filename);
+      return(-1);
+   }
+
+   memset(&stats,0,sizeof(stats));
+
+   if ((fread(&hdr,sizeof(hdr),1,fd) == 1) &&
+       (vm_ckpt_check_header(vm,&hdr) == 0) &&
+       (vm_ckpt_check_cpus(vm,&hdr) == 0) &&
+       ((res = vm_ckpt_load_state(vm,fd,&stats)) == 0))
+      vm_ckpt_flush_code(vm);
+
+   fclose(fd);
+   return(res);
+}
+
+/* Restore the state of a VM from a checkpoint file (the VM is started) */
+int vm_ckpt_restore(vm_instance_t *vm,char *filename)
+{
+   struct vm_ckpt_header hdr;
+   struct vm_ckpt_stats stats;
+   m_tmcnt_t start;
+   FILE *fd;
+   int res,started;
+
+   if (!(fd = fopen(filename,"r"))) {
+      vm_error(vm,"checkpoint: unable to open file '%s'\n",filename);
+      return(-1);
+   }
+
+   if ((fread(&hdr,sizeof(hdr),1,fd) != 1) ||
+       (vm_ckpt_check_header(vm,&hdr) == -1))
+      goto err_file;
+
+   start = m_gettime_usec();
+
+   if ((started = (vm->status == VM_STATUS_HALTED)) &&
+       (vm_init_instance(vm) == -1))
+   {
+      vm_error(vm,"checkpoint: unable to start the VM.\n");
+      goto err_file;
+   }
+
+   /* The CPUs are only known once the VM is initialized */
+   if (vm_ckpt_check_cpus(vm,&hdr) == -1) {
+      if (started)
+         vm_stop_instance(vm);
+      goto err_file;
+   }
+
+   if (vm_pause(vm) == -1) {
+      vm_error(vm,"checkpoint: the VM is not running.\n");
+      goto err_file;
+   }
+
+   /* Device threads keep running while the CPUs are paused */
+   vm_suspend_io(vm);
+
+   memset(&stats,0,sizeof(stats));
+   res = vm_ckpt_load_state(vm,fd,&stats);
+
+   /* Drop all virtual mappings, translated code and cached host pages */
+   cpu_group_rebuild_mts(vm->cpu_group);
+   vm_ckpt_flush_code(vm);
+   physmem_tlb_flush(vm);
+
+   vm_resume_io(vm);
+   vm_unpause(vm);
+   fclose(fd);
+
+   /* Don't let the VM run with a partially restored state */
+   if (res == -1) {
+      vm_error(vm,"checkpoint: restore from '%s' failed, stopping VM.\n",
+               filename);
+      vm_stop_instance(vm);
+      return(-1);
+   }
+
+   vm_log(vm,"CHECKPOINT","restored from '%s' in %llu ms: %u pages, "
+          "%u devices\n",filename,
+          (m_tmcnt_t)(m_gettime_usec() - start) / 1000,
+          stats.pages,stats.objects);
+   return(0);
+
+ err_file:
+   fclose(fd);
+   return(-1);
+}
@@ -0,0 +1,95 @@
+/*
+ * Cisco router simulation platform.
+ * Copyright (c) 2008 Christophe Fillot (cf@utc.fr)
+ *
+ * VM checkpoints: save the state of a running VM to a file and restore it.
+ */
+
+#ifndef __VM_CKPT_H__
+#define __VM_CKPT_H__
+
+#include "utils.h"
+#include "vm.h"
+
+/* Checkpoint file identification */
+#define VM_CKPT_MAGIC    0x44594e41434b5054ULL  /* "DYNACKPT" */
+#define VM_CKPT_VERSION  1
+
+/* Record types */
+enum {
+   VM_CKPT_REC_END = 0,
+   VM_CKPT_REC_CPU,       /* CPU registers */
+   VM_CKPT_REC_MEM,       /* Content of a memory device */
+   VM_CKPT_REC_PCI,       /* PCI device (BARs and device state) */
+   VM_CKPT_REC_OBJ,       /* State of a VM object */
+};
+
+/* Page types in a memory record */
+enum {
+   VM_CKPT_PAGE_END = 0,
+   VM_CKPT_PAGE_RAW,      /* Page content */
+   VM_CKPT_PAGE_ZERO,     /* Page filled with zeroes */
+   VM_CKPT_PAGE_ZLIB,     /* Page content compressed with zlib */
+};
+
+/* Checkpoint file header */
+struct vm_ckpt_header {
+   m_uint64_t magic;
+   m_uint32_t version;
+   m_uint32_t cpu_count;
+   char platform[32];
+   m_uint32_t ram_size;
+   m_uint32_t pad;
+};
+
+/* Record header, followed by the record name and "size" bytes of data */
+struct vm_ckpt_rec {
+   m_uint32_t type;
+   m_uint32_t name_len;
+   m_uint64_t size;
+};
+
+/* Field header in CPU, PCI and object records (followed by name and data) */
+struct vm_ckpt_field_hdr {
+   m_uint32_t name_len;
+   m_uint32_t size;
+};
+
+/* Memory record: device length and pages (followed by page data) */
+struct vm_ckpt_mem {
+   m_uint32_t phys_len;
+   m_uint32_t flags;
+};
+
+/* Pages not saved have their initial content (otherwise zeroes) */
+#define VM_CKPT_MEM_PRISTINE  0x01
+/* Initial content is a ghost image */
+#define VM_CKPT_MEM_GHOST     0x02
+
+struct vm_ckpt_page {
+   m_uint32_t type;
+   m_uint32_t index;
+   m_uint32_t size;
+   m_uint32_t pad;
+};
+
+/* PCI record: base address registers (followed by fields) */
+#define VM_CKPT_PCI_BARS  6
+
+struct vm_ckpt_pci {
+   m_uint32_t bar[VM_CKPT_PCI_BARS];
+};
+
+/* Save the state of a VM into a checkpoint file */
+int vm_ckpt_save(vm_instance_t *vm,char *filename,int compress);
+
+/* Restore the state of a VM from a checkpoint file (the VM is started) */
+int vm_ckpt_restore(vm_instance_t *vm,char *filename);
+
+/* Save only the CPU registers (CPUs not running or called by themselves) */
+int vm_ckpt_save_cpus(vm_instance_t *vm,char *filename);
+
+/* Load a checkpoint file into a VM whose CPUs are not running */
+int vm_ckpt_load(vm_instance_t *vm,char *filename);
+
+#endif